@@ -176,4 +176,41 @@ macro(list_hlsl_shaders HLSL_FILES HEADER_FILES SHADER_FILES)
             list(APPEND SHADER_FILES ${OUTPUT_PATH_SPIRV})
         endif()
     endforeach()
-endmacro()
\ No newline at end of file
+endmacro()
+
+# Compiles a permutation of a DXC-only shader, "DEFINES" is a list of "-DNAME=VALUE" (must define the entry point if the shader is a library)
+macro(add_hlsl_permutation FILE_NAME OUTPUT_NAME DEFINES HEADER_FILES SHADER_FILES)
+    set(DXC_PROFILE "")
+    set(FXC_PROFILE "")
+    set(ENTRY_POINT "")
+    set(OUTPUT_PATH_DXIL "${SHADER_OUTPUT_PATH}/${OUTPUT_NAME}.dxil")
+    set(OUTPUT_PATH_SPIRV "${SHADER_OUTPUT_PATH}/${OUTPUT_NAME}.spirv")
+    get_shader_profile_from_name(${FILE_NAME} DXC_PROFILE FXC_PROFILE ENTRY_POINT)
+    # add DXC compilation step (DXIL)
+    if (NOT "${DXC_PROFILE}" STREQUAL "" AND NOT "${DXC_PATH}" STREQUAL "")
+        add_custom_command(
+                OUTPUT ${OUTPUT_PATH_DXIL}
+                COMMAND ${DXC_PATH} ${ENTRY_POINT} -DCOMPILER_DXC=1 ${DEFINES} -T ${DXC_PROFILE}
+                    -I "${EXTERNAL_INCLUDE_PATH}" -I "${SHADER_INCLUDE_PATH}" -I "${MATHLIB_INCLUDE_PATH}" /I "Include"
+                    ${FILE_NAME} -Fo ${OUTPUT_PATH_DXIL} -WX -O3
+                DEPENDS ${FILE_NAME} ${HEADER_FILES}
+                WORKING_DIRECTORY "${CMAKE_CURRENT_SOURCE_DIR}/Source/Shaders"
+                VERBATIM
+        )
+        list(APPEND SHADER_FILES ${OUTPUT_PATH_DXIL})
+    endif()
+    # add one more DXC compilation step (SPIR-V)
+    if (NOT "${DXC_PROFILE}" STREQUAL "" AND NOT "${DXC_SPIRV_PATH}" STREQUAL "")
+        add_custom_command(
+                OUTPUT ${OUTPUT_PATH_SPIRV}
+                COMMAND ${DXC_SPIRV_PATH} ${ENTRY_POINT} -DCOMPILER_DXC=1 -DVULKAN=1 ${DEFINES} -T ${DXC_PROFILE}
+                    -fspv-target-env=vulkan1.2 -fspv-extension=SPV_EXT_descriptor_indexing -fspv-extension=SPV_KHR_ray_tracing -spirv
+                    -I "${EXTERNAL_INCLUDE_PATH}" -I "${SHADER_INCLUDE_PATH}" -I "${MATHLIB_INCLUDE_PATH}" /I "Include"
+                    ${FILE_NAME} -Fo ${OUTPUT_PATH_SPIRV} ${DXC_VK_SHIFTS} -WX -O3
+                DEPENDS ${FILE_NAME} ${HEADER_FILES}
+                WORKING_DIRECTORY "${CMAKE_CURRENT_SOURCE_DIR}/Source/Shaders"
+                VERBATIM
+        )
+        list(APPEND SHADER_FILES ${OUTPUT_PATH_SPIRV})
+    endif()
+endmacro()
@@ -16,8 +16,8 @@
 
 #define DLSS_INTEGRATION 1
 #define DLSS_INTEGRATION_MAJOR 1
-#define DLSS_INTEGRATION_MINOR 0
-#define DLSS_INTEGRATION_DATE "28 July 2021"
+#define DLSS_INTEGRATION_MINOR 1
+#define DLSS_INTEGRATION_DATE "14 October 2026"
 
 enum class DlssQuality
 {
@@ -25,7 +25,9 @@ enum class DlssQuality
     PERFORMANCE,
     BALANCED,
     QUALITY,
-    ULTRA_QUALITY
+    ULTRA_QUALITY,
+
+    MAX_NUM
 };
 
 // This is retrieved from DLSS
@@ -67,6 +69,7 @@ struct DlssDispatchDesc
     NVSDK_NGX_Dimensions renderOrScaledResolution = {};
     float jitter[2] = {0.0f, 0.0f};
     float motionVectorScale[2] = {1.0f, 1.0f};
+    nri::DescriptorPool* descriptorPool = nullptr; // (optional) rebound after evaluation, DLSS binds its own descriptor heaps
     uint32_t physicalDeviceIndex = 0;
     bool reset = false;
 };
@@ -83,10 +86,18 @@ public:
     inline bool IsInitialized() const
     { return m_Initialized; }
 
+    inline DlssQuality GetQuality() const
+    { return m_Quality; }
+
+    inline bool IsFeatureCreated(DlssQuality quality) const
+    { return m_Features[(uint32_t)quality] != nullptr; }
+
     bool InitializeLibrary(nri::Device& device, const char* appDataPath, uint64_t applicationId = 231313132);
     bool GetOptimalSettings(const NVSDK_NGX_Dimensions& outputResolution, DlssQuality quality, DlssSettings& outSettings) const;
-    bool Initialize(nri::CommandQueue* commandQueue, const DlssInitDesc& desc);
-    void Evaluate(nri::CommandBuffer* commandBuffer, const DlssDispatchDesc& desc); // currently bound nri::DescriptorPool will be lost
+    bool Initialize(nri::CommandQueue* commandQueue, const DlssInitDesc& desc); // creates the feature for "desc.quality" (if not cached) and makes it current
+    bool SetQuality(DlssQuality quality); // switches to a cached feature, no GPU work
+    void Evaluate(nri::CommandBuffer* commandBuffer, const DlssDispatchDesc& desc); // currently bound nri::DescriptorPool will be lost, unless "desc.descriptorPool" is provided
+    void ReleaseFeatures(); // the GPU must be idle
     void Shutdown();
 
     static inline void SetupDeviceExtensions(nri::DeviceCreationDesc& desc)
@@ -104,6 +115,7 @@ public:
 
 private:
 
+    void ReleaseFeature(NVSDK_NGX_Handle* feature);
     inline NVSDK_NGX_Resource_VK SetupVulkanTexture(nri::Texture* texture, nri::Descriptor* descriptor, uint32_t physicalDeviceIndex, bool isStorage);
 
 private:
@@ -117,8 +129,10 @@ private:
 
     NRIInterface NRI = {};
     nri::Device* m_Device = nullptr;
-    NVSDK_NGX_Handle* m_DLSS = nullptr;
     NVSDK_NGX_Parameter* m_NgxParameters = nullptr;
+    NVSDK_NGX_Handle* m_Features[(uint32_t)DlssQuality::MAX_NUM] = {}; // cached per quality, all for "m_OutputResolution"
+    NVSDK_NGX_Dimensions m_OutputResolution = {};
     uint64_t m_ApplicationId = 0;
+    DlssQuality m_Quality = DlssQuality::QUALITY;
     bool m_Initialized = false;
 };
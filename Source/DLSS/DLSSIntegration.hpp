@@ -144,6 +144,20 @@ bool DlssIntegration::Initialize(nri::CommandQueue* commandQueue, const DlssInit
 {
     assert(m_Initialized);
 
+    // Cached features are valid for one output resolution (and the same flags)
+    if (desc.outputResolution.Width != m_OutputResolution.Width || desc.outputResolution.Height != m_OutputResolution.Height)
+    {
+        ReleaseFeatures();
+        m_OutputResolution = desc.outputResolution;
+    }
+
+    NVSDK_NGX_Handle*& feature = m_Features[(uint32_t)desc.quality];
+    if (feature)
+    {
+        m_Quality = desc.quality;
+        return true;
+    }
+
     nri::CommandAllocator* commandAllocator;
     NRI.CreateCommandAllocator(*commandQueue, 0, commandAllocator);
 
@@ -181,17 +195,17 @@ bool DlssIntegration::Initialize(nri::CommandQueue* commandQueue, const DlssInit
         if (deviceDesc.graphicsAPI == nri::GraphicsAPI::D3D12)
         {
             ID3D12GraphicsCommandList* d3d12CommandList = NRI.GetCommandBufferD3D12(*commandBuffer);
-            result = NGX_D3D12_CREATE_DLSS_EXT(d3d12CommandList, creationNodeMask, visibilityNodeMask, &m_DLSS, m_NgxParameters, &dlssCreateParams);
+            result = NGX_D3D12_CREATE_DLSS_EXT(d3d12CommandList, creationNodeMask, visibilityNodeMask, &feature, m_NgxParameters, &dlssCreateParams);
         }
         else if (deviceDesc.graphicsAPI == nri::GraphicsAPI::VULKAN)
         {
             VkCommandBuffer vkCommandBuffer = (VkCommandBuffer)NRI.GetCommandBufferVK(*commandBuffer);
-            result = NGX_VULKAN_CREATE_DLSS_EXT(vkCommandBuffer, creationNodeMask, visibilityNodeMask, &m_DLSS, m_NgxParameters, &dlssCreateParams);
+            result = NGX_VULKAN_CREATE_DLSS_EXT(vkCommandBuffer, creationNodeMask, visibilityNodeMask, &feature, m_NgxParameters, &dlssCreateParams);
         }
         else if (deviceDesc.graphicsAPI == nri::GraphicsAPI::D3D11)
         {
             ID3D11DeviceContext* d3d11DeviceContext = NRI.GetCommandBufferD3D11(*commandBuffer);
-            result = NGX_D3D11_CREATE_DLSS_EXT(d3d11DeviceContext, &m_DLSS, m_NgxParameters, &dlssCreateParams);
+            result = NGX_D3D11_CREATE_DLSS_EXT(d3d11DeviceContext, &feature, m_NgxParameters, &dlssCreateParams);
         }
     }
     NRI.EndCommandBuffer(*commandBuffer);
@@ -207,13 +221,36 @@ bool DlssIntegration::Initialize(nri::CommandQueue* commandQueue, const DlssInit
     NRI.DestroyCommandAllocator(*commandAllocator);
     NRI.DestroyDeviceSemaphore(*semaphore);
 
-    return NVSDK_NGX_SUCCEED(result);
+    if (!NVSDK_NGX_SUCCEED(result))
+    {
+        ReleaseFeature(feature);
+        feature = nullptr;
+
+        return false;
+    }
+
+    m_Quality = desc.quality;
+
+    return true;
+}
+
+bool DlssIntegration::SetQuality(DlssQuality quality)
+{
+    if (!m_Features[(uint32_t)quality])
+        return false;
+
+    m_Quality = quality;
+
+    return true;
 }
 
 void DlssIntegration::Evaluate(nri::CommandBuffer* commandBuffer, const DlssDispatchDesc& desc)
 {
     assert(m_Initialized);
 
+    NVSDK_NGX_Handle* feature = m_Features[(uint32_t)m_Quality];
+    assert(feature);
+
     const nri::DeviceDesc& deviceDesc = NRI.GetDeviceDesc(*m_Device);
 
     NVSDK_NGX_Result result = NVSDK_NGX_Result_Fail;
@@ -239,7 +276,7 @@ void DlssIntegration::Evaluate(nri::CommandBuffer* commandBuffer, const DlssDisp
         d3d12DlssEvalParams.InMVScaleY = desc.motionVectorScale[1];
 
         ID3D12GraphicsCommandList* d3dCommandList = NRI.GetCommandBufferD3D12(*commandBuffer);
-        result = NGX_D3D12_EVALUATE_DLSS_EXT(d3dCommandList, m_DLSS, m_NgxParameters, &d3d12DlssEvalParams);
+        result = NGX_D3D12_EVALUATE_DLSS_EXT(d3dCommandList, feature, m_NgxParameters, &d3d12DlssEvalParams);
     }
     else if (deviceDesc.graphicsAPI == nri::GraphicsAPI::VULKAN)
     {
@@ -267,7 +304,7 @@ void DlssIntegration::Evaluate(nri::CommandBuffer* commandBuffer, const DlssDisp
         }
 
         VkCommandBuffer vkCommandbuffer = (VkCommandBuffer)NRI.GetCommandBufferVK(*commandBuffer);
-        result = NGX_VULKAN_EVALUATE_DLSS_EXT(vkCommandbuffer, m_DLSS, m_NgxParameters, &vkDlssEvalParams);
+        result = NGX_VULKAN_EVALUATE_DLSS_EXT(vkCommandbuffer, feature, m_NgxParameters, &vkDlssEvalParams);
     }
     else if (deviceDesc.graphicsAPI == nri::GraphicsAPI::D3D11)
     {
@@ -291,10 +328,38 @@ void DlssIntegration::Evaluate(nri::CommandBuffer* commandBuffer, const DlssDisp
         d3d11DlssEvalParams.InMVScaleY = desc.motionVectorScale[1];
 
         ID3D11DeviceContext* d3d11DeviceContext = NRI.GetCommandBufferD3D11(*commandBuffer);
-        result = NGX_D3D11_EVALUATE_DLSS_EXT(d3d11DeviceContext, m_DLSS, m_NgxParameters, &d3d11DlssEvalParams);
+        result = NGX_D3D11_EVALUATE_DLSS_EXT(d3d11DeviceContext, feature, m_NgxParameters, &d3d11DlssEvalParams);
     }
 
     assert( NVSDK_NGX_SUCCEED(result) );
+
+    if (desc.descriptorPool)
+        NRI.CmdSetDescriptorPool(*commandBuffer, *desc.descriptorPool);
+}
+
+void DlssIntegration::ReleaseFeature(NVSDK_NGX_Handle* feature)
+{
+    if (!feature)
+        return;
+
+    const nri::DeviceDesc& deviceDesc = NRI.GetDeviceDesc(*m_Device);
+    if (deviceDesc.graphicsAPI == nri::GraphicsAPI::D3D12)
+        NVSDK_NGX_D3D12_ReleaseFeature(feature);
+    else if (deviceDesc.graphicsAPI == nri::GraphicsAPI::VULKAN)
+        NVSDK_NGX_VULKAN_ReleaseFeature(feature);
+    else if (deviceDesc.graphicsAPI == nri::GraphicsAPI::D3D11)
+        NVSDK_NGX_D3D11_ReleaseFeature(feature);
+}
+
+void DlssIntegration::ReleaseFeatures()
+{
+    for (NVSDK_NGX_Handle*& feature : m_Features)
+    {
+        ReleaseFeature(feature);
+        feature = nullptr;
+    }
+
+    m_OutputResolution = {};
 }
 
 void DlssIntegration::Shutdown()
@@ -302,15 +367,14 @@ void DlssIntegration::Shutdown()
     if (!m_Device || !m_Initialized)
         return;
 
+    ReleaseFeatures();
+
     const nri::DeviceDesc& deviceDesc = NRI.GetDeviceDesc(*m_Device);
     if (deviceDesc.graphicsAPI == nri::GraphicsAPI::D3D12)
     {
         if (m_NgxParameters)
             NVSDK_NGX_D3D12_DestroyParameters(m_NgxParameters);
 
-        if (m_DLSS)
-            NVSDK_NGX_D3D12_ReleaseFeature(m_DLSS);
-
         NVSDK_NGX_D3D12_Shutdown();
     }
     else if (deviceDesc.graphicsAPI == nri::GraphicsAPI::VULKAN)
@@ -318,9 +382,6 @@ void DlssIntegration::Shutdown()
         if (m_NgxParameters)
             NVSDK_NGX_VULKAN_DestroyParameters(m_NgxParameters);
 
-        if (m_DLSS)
-            NVSDK_NGX_VULKAN_ReleaseFeature(m_DLSS);
-
         NVSDK_NGX_VULKAN_Shutdown();
     }
     else if (deviceDesc.graphicsAPI == nri::GraphicsAPI::D3D11)
@@ -328,14 +389,10 @@ void DlssIntegration::Shutdown()
         if (m_NgxParameters)
             NVSDK_NGX_D3D11_DestroyParameters(m_NgxParameters);
 
-        if (m_DLSS)
-            NVSDK_NGX_D3D11_ReleaseFeature(m_DLSS);
-
         NVSDK_NGX_D3D11_Shutdown();
     }
 
     m_NgxParameters = nullptr;
-    m_DLSS = nullptr;
     m_Device = nullptr;
     m_Initialized = false;
 }
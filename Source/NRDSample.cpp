@@ -19,16 +19,70 @@ license agreement from NVIDIA CORPORATION is strictly prohibited.
 #include "Extensions/NRIWrapperVK.h"
 #include "DLSS/DLSSIntegration.hpp"
 
-#define NRD_COMBINED 1
-#define NRD_OCCLUSION_ONLY 0
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+// CPU profiler zones on the hot paths ("-DDISABLE_CPU_ZONES=ON" compiles them out)
+#ifndef CPU_ZONES
+    #define CPU_ZONES 1
+#endif
 
 constexpr auto BUILD_FLAGS = nri::AccelerationStructureBuildBits::PREFER_FAST_TRACE;
+constexpr auto TLAS_BUILD_FLAGS = BUILD_FLAGS | nri::AccelerationStructureBuildBits::ALLOW_UPDATE;
+constexpr uint32_t TLAS_REBUILD_PERIOD = 16; // frames refitted in a row before a full rebuild
+constexpr uint32_t INSTANCE_BLOCK_SIZE = 128; // instances per job, transforms of a block are processed in SoA form
 constexpr uint32_t TEXTURES_PER_MATERIAL = 4;
+constexpr uint32_t FRAMES_IN_FLIGHT_MIN_NUM = 2;
+constexpr uint32_t FRAMES_IN_FLIGHT_MAX_NUM = 4; // "--framesInFlight" range
 constexpr uint32_t FG_TEX_SIZE = 256;
 constexpr float NEAR_Z = 0.001f; // m
 constexpr bool CAMERA_RELATIVE = true;
 constexpr bool CAMERA_LEFT_HANDED = true;
 constexpr uint32_t ANIMATED_INSTANCE_MAX_NUM = 512;
+constexpr uint64_t TEXTURE_STREAMING_BUDGET = 8 * 1024 * 1024; // bytes per frame
+constexpr uint32_t TEXTURE_STREAMING_MIP_MAX_NUM = 256; // per frame
+constexpr uint32_t TEXTURE_STREAMING_INITIAL_MIP_SIZE = 64; // mips up to this size get uploaded before the first frame
+constexpr uint32_t TEXTURE_RESIDENCY_MIP_SIZE_MIN = 256; // "--textureResidency": material textures are never allocated smaller than this
+constexpr uint32_t TEXTURE_RESIDENCY_UPDATE_PERIOD = 32; // frames of feedback gathered before reallocating
+constexpr uint32_t TEXTURE_RESIDENCY_EVICTION_FRAMES = 300; // textures not sampled for this long shrink to "TEXTURE_RESIDENCY_MIP_SIZE_MIN"
+constexpr uint8_t TEXTURE_RESIDENCY_NOT_REQUESTED = 0xFF;
+constexpr uint64_t BLAS_SCRATCH_POOL_SIZE = 64 * 1024 * 1024;
+constexpr uint32_t BLAS_SCRATCH_ALIGNMENT = 256;
+constexpr uint32_t UPLOAD_RING_ALIGNMENT = 256; // covers constant buffer views and TLAS instance descs
+constexpr uint32_t BLAS_GEOMETRY_ALIGNMENT = 256;
+constexpr uint32_t SCENE_CACHE_MAGIC = 0x4344524E; // "NRDC"
+constexpr uint32_t SCENE_CACHE_VERSION = 2; // bump if "PrimitiveData" packing or the layout of "utils::Scene" changes
+constexpr uint64_t MEMORY_HEAP_SIZE = 256 * 1024 * 1024; // resources are placed into heaps of this size (bigger ones get a heap of their own)
+constexpr uint32_t REBLUR_METHOD_SET_NUM = 4; // radiance / occlusion-only x combined / separate
+constexpr uint32_t RELAX_METHOD_SET_NUM = 2; // combined / separate
+constexpr uint32_t RAYGEN_PERMUTATION_NUM = 3 * 2 * 2 * 2; // rpp (0.5, 1, 2+) x 2nd bounce specular x emission x transparency, see "Raytracing.rgen.hlsl"
+constexpr uint32_t MULTI_GPU_MAX_NUM = 4; // "--multiGpu": GPUs of the device group sharing ray tracing, each one traces a horizontal band
+constexpr uint32_t CAPTURE_PENDING_FILE_MAX_NUM = 64; // "--capture": files queued for the writer threads before the renderer stalls
+constexpr uint32_t CPU_ZONE_MAX_NUM = 4096; // per frame, zones beyond are dropped
+constexpr float CAPTURE_FRAME_TIME = 1000.0f / 60.0f; // ms, "--capture": animation advances by a fixed step, i.e. sequences don't depend on throughput
+constexpr uint32_t RAYGEN_SORTED_PERMUTATION_NUM = 2 * 2; // per ray sorting stage: emission x transparency (primary rays), 2nd bounce specular x emission (secondary rays)
+constexpr uint32_t RAY_BIN_NUM = 128 + 1; // see "Shared.hlsli"
+constexpr uint32_t RAY_SORT_GROUP_SIZE = 256;
+constexpr uint32_t SAMPLE_BUDGET_TILE_SIZE = 16; // see "Shared.hlsli"
+#ifdef _DEBUG
+constexpr nri::AccessBits SAMPLE_SUM_ACCESS = nri::AccessBits::COPY_SOURCE; // "Buffer::SampleSum" between frames, debug builds read it back to validate the budget
+#else
+constexpr nri::AccessBits SAMPLE_SUM_ACCESS = nri::AccessBits::SHADER_RESOURCE_STORAGE;
+#endif
+constexpr float MIP_FEEDBACK_MIP_SCALE = 16.0f; // see "Shared.hlsli"
+constexpr float MAX_MIP_LEVEL = 11.0f; // see "Shared.hlsli"
+constexpr uint32_t QUALITY_TILE_SIZE = 16; // see "Shared.hlsli"
+constexpr uint32_t QUALITY_REFERENCE_MAGIC = 0x4652524E; // "NRRF"
+constexpr int32_t QUALITY_REFERENCE_RPP = 8; // "--quality": rays per pixel of the accumulated reference (the UI maximum)
 
 #define UI_YELLOW ImVec4(1.0f, 0.9f, 0.0f, 1.0f)
 
@@ -50,6 +104,7 @@ constexpr uint32_t ANIMATED_INSTANCE_MAX_NUM = 512;
 #define FLAG_TRANSPARENT                0x02
 #define FLAG_EMISSION                   0x04
 #define FLAG_FORCED_EMISSION            0x08
+#define MATERIAL_INDEX_BITS             24
 
 enum Denoiser : int32_t
 {
@@ -61,28 +116,33 @@ enum Denoiser : int32_t
 
 enum ShaderGroup : uint32_t
 {
-    Raytracing00_rgen,
-    Raytracing01_rgen,
-    Raytracing10_rgen,
-    Raytracing11_rgen,
-    Main_rmiss,
+    Raytracing_rgen, // RAYGEN_PERMUTATION_NUM permutations
+    RaytracingPrimary_rgen = Raytracing_rgen + RAYGEN_PERMUTATION_NUM, // RAYGEN_SORTED_PERMUTATION_NUM permutations
+    RaytracingSecondary_rgen = RaytracingPrimary_rgen + RAYGEN_SORTED_PERMUTATION_NUM, // RAYGEN_SORTED_PERMUTATION_NUM permutations
+    Main_rmiss = RaytracingSecondary_rgen + RAYGEN_SORTED_PERMUTATION_NUM,
     Main_rhit
 };
 
 enum class Buffer : uint32_t
 {
-    GlobalConstants,
-    InstanceDataStaging,
-    WorldTlasDataStaging,
-    LightTlasDataStaging,
+    UploadRing,
+    LightDataStaging,
+    TextureStreamingStaging,
 
     ShaderTable,
+    LightData,
     PrimitiveData,
+    Indices,
+    VertexData,
     InstanceData,
     WorldScratch,
-    LightScratch,
+    RayRecords,
+    SampleSum,
+    MipFeedback,
+    QualityReference,
+    QualityMetrics,
 
-    UploadHeapBufferNum = 4
+    UploadHeapBufferNum = 3
 };
 
 enum class Texture : uint32_t
@@ -104,6 +164,9 @@ enum class Texture : uint32_t
     Unfiltered_Spec,
     Unfiltered_Shadow_Translucency,
     ComposedLighting_ViewZ,
+    TileNoise,
+    DilatedNoise,
+    SampleNum,
     TaaHistory,
     TaaHistoryPrev,
     Final,
@@ -118,16 +181,31 @@ enum class Pipeline : uint32_t
     Temporal,
     Upsample,
     PreDlss,
-    AfterDlss
+    AfterDlss,
+    SortRays,
+    CompositionTemporal,
+    SampleBudget,
+    SampleNum,
+    QualityReference,
+    QualityMetrics,
+
+    MAX_NUM
 };
 
 enum class Descriptor : uint32_t
 {
     World_AccelerationStructure,
-    Light_AccelerationStructure,
 
+    LightData_Buffer,
     PrimitiveData_Buffer,
+    Indices_Buffer,
+    VertexData_Buffer,
     InstanceData_Buffer,
+    RayRecords_StorageBuffer,
+    SampleSum_StorageBuffer,
+    MipFeedback_StorageBuffer,
+    QualityReference_StorageBuffer,
+    QualityMetrics_StorageBuffer,
 
     IntegrateBRDF_Texture,
     IntegrateBRDF_StorageTexture,
@@ -163,6 +241,12 @@ enum class Descriptor : uint32_t
     Unfiltered_Shadow_Translucency_StorageTexture,
     ComposedLighting_ViewZ_Texture,
     ComposedLighting_ViewZ_StorageTexture,
+    TileNoise_Texture,
+    TileNoise_StorageTexture,
+    DilatedNoise_Texture,
+    DilatedNoise_StorageTexture,
+    SampleNum_Texture,
+    SampleNum_StorageTexture,
     TaaHistory_Texture,
     TaaHistory_StorageTexture,
     TaaHistoryPrev_Texture,
@@ -175,17 +259,159 @@ enum class Descriptor : uint32_t
 enum class DescriptorSet : uint32_t
 {
     IntegrateBRDF0,
-    Raytracing2,
-    Raytracing1,
-    Composition1,
     Temporal1a,
     Temporal1b,
     Upsample1a,
     Upsample1b,
+    AfterDlss1,
+    SortRays1,
+    SampleNum1,
+    QualityReference1a, // "finalResult": Final, TaaHistory, TaaHistoryPrev
+    QualityReference1b,
+    QualityReference1c,
+    QualityMetrics1a,
+    QualityMetrics1b,
+    QualityMetrics1c,
+
+    // Reference data textures, sets for the other data format are kept in "m_DataDescriptorSetTwins"
+    Raytracing1,
+    Composition1,
     PreDlss1,
-    AfterDlss1
+    CompositionTemporal1a,
+    CompositionTemporal1b,
+    SampleBudget1,
+
+    MAX_NUM
+};
+
+// Every pass gets a pair of timestamps (begin / end) per buffered frame
+enum class GpuPass : uint32_t
+{
+    Frame,
+    IntegrateBRDF,
+    Tlas,
+    Raytracing,
+    Reblur,
+    Relax,
+    Sigma,
+    SampleBudget,
+    Composition,
+    PreDlss,
+    Dlss,
+    AfterDlss,
+    Temporal,
+    CompositionTemporal,
+    Upsample,
+    UI,
+
+    MAX_NUM
+};
+
+// Placed resources are accounted per category
+enum class MemoryCategory : uint32_t
+{
+    RenderTargets,
+    TransientRenderTargets,
+    MaterialTextures,
+    Buffers,
+    UploadBuffers,
+    AccelerationStructures,
+
+    MAX_NUM
+};
+
+static const char* MEMORY_CATEGORY_NAMES[(uint32_t)MemoryCategory::MAX_NUM] =
+{
+    "render targets",
+    "transient render targets",
+    "material textures",
+    "buffers",
+    "upload buffers",
+    "acceleration structures",
+};
+
+static const char* GPU_PASS_NAMES[(uint32_t)GpuPass::MAX_NUM] =
+{
+    "Frame",
+    "IntegrateBRDF",
+    "TLAS",
+    "Raytracing",
+    "REBLUR",
+    "RELAX",
+    "SIGMA (async)",
+    "Sample budget",
+    "Composition",
+    "PreDlss",
+    "DLSS",
+    "AfterDlss",
+    "Temporal",
+    "Composition + Temporal",
+    "Upsample",
+    "UI",
+};
+
+constexpr uint32_t GPU_PASS_QUERY_NUM = (uint32_t)GpuPass::MAX_NUM * 2;
+
+// "--capture": targets which can be read back
+enum class CaptureTarget : uint32_t
+{
+    Final,
+    Unfiltered_Diff,
+    Unfiltered_Spec,
+    Diff,
+    Spec,
+    ViewZ,
+    Normal_Roughness,
+    ObjectMotion,
+
+    MAX_NUM
 };
 
+// Names used by "--captureTargets" and in file names
+static const char* CAPTURE_TARGET_NAMES[(uint32_t)CaptureTarget::MAX_NUM] =
+{
+    "final",
+    "unfilteredDiff",
+    "unfilteredSpec",
+    "diff",
+    "spec",
+    "viewZ",
+    "normalRoughness",
+    "motion",
+};
+
+// "Final" is replaced by the texture actually holding the final image
+static const Texture CAPTURE_TARGET_TEXTURES[(uint32_t)CaptureTarget::MAX_NUM] =
+{
+    Texture::Final,
+    Texture::Unfiltered_Diff,
+    Texture::Unfiltered_Spec,
+    Texture::Diff,
+    Texture::Spec,
+    Texture::ViewZ,
+    Texture::Normal_Roughness,
+    Texture::ObjectMotion,
+};
+
+// Formats of capture targets only
+inline uint32_t GetCaptureTexelSize(nri::Format format)
+{
+    switch (format)
+    {
+        case nri::Format::R16_SFLOAT:
+            return 2;
+
+        case nri::Format::RGBA16_UNORM:
+        case nri::Format::RGBA16_SFLOAT:
+            return 8;
+
+        case nri::Format::RGBA32_SFLOAT:
+            return 16;
+    }
+
+    return 4; // RGBA8, R32 and packed formats
+}
+
 struct NRIInterface
     : public nri::CoreInterface
     , public nri::SwapChainInterface
@@ -196,10 +422,16 @@ struct NRIInterface
 struct Frame
 {
     nri::DeviceSemaphore* deviceSemaphore;
-    nri::CommandAllocator* commandAllocator;
+    std::array<nri::CommandAllocator*, 3> commandAllocators; // one per command buffer, they are recorded in parallel
     std::array<nri::CommandBuffer*, 3> commandBuffers;
+    nri::CommandAllocator* computeCommandAllocator; // async compute only
+    nri::CommandBuffer* computeCommandBuffer;
+    std::array<nri::CommandAllocator*, MULTI_GPU_MAX_NUM> peerCommandAllocators; // "--multiGpu" only, [0] is unused (GPU 0 records into "commandBuffers")
+    std::array<nri::CommandBuffer*, MULTI_GPU_MAX_NUM> peerCommandBuffers;
+    std::array<nri::Descriptor*, MULTI_GPU_MAX_NUM> peerConstantBufferDescriptors; // per GPU constants differ in "gBandOrigin" only
     nri::Descriptor* globalConstantBufferDescriptor;
     nri::DescriptorSet* globalConstantBufferDescriptorSet;
+    nri::DescriptorSet* raytracing2DescriptorSet; // per frame, "--textureResidency" replaces material views while other frames are in flight
     uint64_t globalConstantBufferOffset;
 };
 
@@ -253,6 +485,11 @@ struct GlobalConstantBufferData
     uint32_t gBlueNoise;
     uint32_t gSampleNum;
     uint32_t gOcclusionOnly;
+    uint32_t gInstanceDataOffset;
+    uint32_t gAdaptiveSampling;
+    uint32_t gMipFeedback;
+    uint32_t gCompactPrimitiveData;
+    uint32_t gBandOrigin;
 };
 
 struct NrdSettings
@@ -352,6 +589,115 @@ struct TextureState
     nri::TextureLayout nextLayout;
 };
 
+// "--textureResidency": a material texture is allocated from "mipOffset", mips are always resident from the coarsest up to "m_TextureResidentMips"
+struct ResidentTexture
+{
+    nri::Memory* memory; // dedicated, "nullptr" if not managed
+    uint64_t memorySize;
+    uint32_t lastRequestFrame;
+    uint8_t mipOffset;
+    uint8_t mipOffsetMax;
+    uint8_t requestedMip; // the finest since the last update
+    bool isManaged;
+};
+
+// "--textureResidency": the old allocation of a reallocated texture, destroyed when frames in flight are done with it
+struct RetiredTexture
+{
+    nri::Texture* texture;
+    nri::Memory* memory;
+    nri::Descriptor* descriptor;
+    uint32_t frameIndex; // the frame copying from it
+};
+
+struct MemoryHeap
+{
+    nri::Memory* memory;
+    nri::MemoryType type;
+    uint64_t size;
+    uint64_t offset;
+};
+
+// Persistently mapped "Buffer::UploadRing", split into a segment per frame in flight. A segment gets rewound only after waiting for the frame which used it
+struct UploadRing
+{
+    uint8_t* data;
+    uint64_t segmentSize;
+    uint64_t head;
+    uint64_t end;
+};
+
+// Textures placed into shared memory, only one of the overlapping ones holds valid contents
+struct TransientTexture
+{
+    Texture texture;
+    nri::Memory* memory;
+    uint64_t offset;
+    uint64_t size;
+    bool isResident;
+};
+
+// Data textures are R16 in occlusion-only mode and RGBA16 otherwise. The other format lives in a twin placed into the same memory, switching the mode swaps them
+struct DataTextureTwin
+{
+    Texture texture;
+    Descriptor descriptor; // followed by the storage view
+    nri::Texture* resource;
+    nri::Format format;
+    nri::TextureTransitionBarrierDesc state;
+    nri::Descriptor* textureView;
+    nri::Descriptor* storageView;
+};
+
+// NRD allocates its pools internally, "memorySize" is an estimate (see "EstimateNrdMemorySize")
+struct NrdInstance
+{
+    std::unique_ptr<NrdIntegration> integration;
+    uint64_t memorySize;
+};
+
+struct FramePassDesc
+{
+    const char* name;
+    const TextureState* textures;
+    const nri::BufferTransitionBarrierDesc* buffers;
+    const nri::TextureTransitionBarrierDesc* untrackedTextures; // not in "m_Textures" (back buffer)
+    uint32_t textureNum;
+    uint32_t bufferNum;
+    uint32_t untrackedTextureNum;
+    uint32_t commandBufferIndex; // ignored for async compute passes
+    nri::BarrierDependency stage;
+    bool isExternal; // transitions are done by the pass itself (NRD), only lifetimes are tracked
+    bool isAsyncCompute; // recorded into "Frame::computeCommandBuffer"
+};
+
+struct FramePass
+{
+    std::function<void(nri::CommandBuffer&)> execute;
+    const char* name;
+    uint32_t textureOffset;
+    uint32_t textureNum;
+    uint32_t bufferOffset;
+    uint32_t bufferNum;
+    uint32_t untrackedTextureOffset;
+    uint32_t untrackedTextureNum;
+    uint32_t commandBufferIndex;
+    nri::BarrierDependency stage;
+    bool isExternal;
+    bool isAsyncCompute;
+};
+
+// A texture transition scheduled right after the previous use of the texture, i.e. before pass "batchIndex"
+struct FrameBarrier
+{
+    nri::TextureTransitionBarrierDesc transition;
+    Texture texture;
+    uint32_t batchIndex;
+    nri::BarrierDependency srcStage;
+    nri::BarrierDependency dstStage;
+    bool isAliasing;
+};
+
 struct AnimationParameters
 {
     float3 rotationAxis;
@@ -418,6 +764,44 @@ struct PrimitiveData
     uint32_t b2S_unused;
 };
 
+// "--compactPrimitiveData": per triangle only the face normal and "worldToUvUnits" (2 triangles per "uint4"), vertex attributes are stored once and fetched via "Buffer::Indices"
+struct CompactPrimitiveData
+{
+    uint32_t fn; // octahedral, unorm16 x 2
+    float worldToUvUnits;
+};
+
+struct CompactVertexData
+{
+    uint32_t uv;
+    uint32_t n; // octahedral, unorm16 x 2
+    uint32_t t; // octahedral, unorm16 x 2
+    float bitangentSign;
+};
+
+// Matches "STL::Packing::DecodeUnitVector( p, false )"
+inline uint32_t EncodeUnitVector(float3 v)
+{
+    float sum = Abs(v.x) + Abs(v.y) + Abs(v.z);
+    if (sum < 1e-15f)
+        return 0x7FFF7FFF; // degenerate tangents, the shader normalizes anyway
+
+    v /= sum;
+
+    float x = v.x;
+    float y = v.y;
+    if (v.z < 0.0f)
+    {
+        x = (1.0f - Abs(v.y)) * (v.x >= 0.0f ? 1.0f : -1.0f);
+        y = (1.0f - Abs(v.x)) * (v.y >= 0.0f ? 1.0f : -1.0f);
+    }
+
+    uint32_t ux = uint32_t(Saturate(x * 0.5f + 0.5f) * 65535.0f + 0.5f);
+    uint32_t uy = uint32_t(Saturate(y * 0.5f + 0.5f) * 65535.0f + 0.5f);
+
+    return ux | (uy << 16);
+}
+
 struct InstanceData
 {
     float4 mObjectToWorld0_basePrimitiveId;
@@ -429,2108 +813,6038 @@ struct InstanceData
     float4 mWorldToWorldPrev2;
 };
 
-class Sample : public SampleBase
+// "utils::Scene" arrays (see "WriteCacheArray") and texture names follow, packed "PrimitiveData" goes last (can be empty)
+struct SceneCacheHeader
 {
-public:
-    Sample() :
-        m_Reblur(BUFFERED_FRAME_MAX_NUM),
-        m_Relax(BUFFERED_FRAME_MAX_NUM)
-    {}
-
-    ~Sample();
-
-    bool Initialize(nri::GraphicsAPI graphicsAPI);
-    void PrepareFrame(uint32_t frameIndex);
-    void RenderFrame(uint32_t frameIndex);
-
-    inline nri::Texture*& Get(Texture index)
-    { return m_Textures[(uint32_t)index]; }
+    uint32_t magic;
+    uint32_t version;
+    uint64_t sourceHash; // sizes and modification times of the source files
+    uint32_t defaultInstancesOffset;
+    uint32_t textureNum;
+};
 
-    inline nri::TextureTransitionBarrierDesc& GetState(Texture index)
-    { return m_TextureStates[(uint32_t)index]; }
+// "--quality": a cached reference image, "width * height" half4 pixels follow
+struct QualityReferenceHeader
+{
+    uint32_t magic;
+    uint32_t frameNum; // accumulated
+    uint32_t width;
+    uint32_t height;
+    uint64_t sourceHash; // the scene and its tests
+};
 
-    inline nri::Format GetFormat(Texture index)
-    { return m_TextureFormats[(uint32_t)index]; }
+// GPU work of "BuildTopLevelAccelerationStructure" and "UpdateLightData", replayed on peer GPUs ("--multiGpu")
+struct WorldTlasBuild
+{
+    uint64_t tlasDataOffset;
+    uint64_t instanceDataOffset; // in "Buffer::UploadRing"
+    uint64_t instanceDataCopyOffset; // in "Buffer::InstanceData"
+    uint64_t instanceDataCopySize;
+    uint64_t lightDataOffset; // in "Buffer::LightDataStaging"
+    uint64_t lightDataCopySize;
+    uint32_t instanceNum;
+    bool isUpdate;
+};
 
-    inline nri::Buffer*& Get(Buffer index)
-    { return m_Buffers[(uint32_t)index]; }
+// "--capture": where a target lives in a slice of the readback ring (sized for the largest possible format and the full resolution)
+struct CaptureLayout
+{
+    uint64_t offset;
+    uint32_t rowPitch;
+};
 
-    inline nri::Pipeline*& Get(Pipeline index)
-    { return m_Pipelines[(uint32_t)index]; }
+// "--capture": what a slice of the readback ring holds
+struct CaptureSlot
+{
+    std::array<nri::Format, (uint32_t)CaptureTarget::MAX_NUM> formats;
+    std::array<uint2, (uint32_t)CaptureTarget::MAX_NUM> sizes;
+    uint32_t frameIndex; // + 1, 0 - nothing copied
+    uint32_t test;
+    uint32_t testFrame; // captured frames of the test before this one
+};
 
-    inline nri::PipelineLayout*& GetPipelineLayout(Pipeline index)
-    { return m_PipelineLayouts[(uint32_t)index]; }
+// "--quality": what got copied into the readback buffer by a buffered frame
+struct QualitySlot
+{
+    uint32_t run; // + 1, 0 - no metrics copied
+    uint32_t referenceTest; // + 1, 0 - no reference copied
+};
 
-    inline nri::Descriptor*& Get(Descriptor index)
-    { return m_Descriptors[(uint32_t)index]; }
+struct InstanceRef
+{
+    uint32_t instanceIndex;
+    uint32_t flags;
+    uint32_t worldIndex;
+};
 
-    inline nri::DescriptorSet*& Get(DescriptorSet index)
-    { return m_DescriptorSets[(uint32_t)index]; }
+struct LightInstance
+{
+    uint32_t instanceIndex;
+    uint32_t instanceIdAndFlags;
+    uint32_t triangleOffset;
+};
 
-private:
-    void CreateCommandBuffers();
-    void CreateSwapChain(nri::Format& swapChainFormat);
-    void CreateResources(nri::Format swapChainFormat);
-    void CreatePipelines();
-    void CreateDescriptorSets();
-    void CreateBottomLevelAccelerationStructures();
-    void CreateTopLevelAccelerationStructure();
-    void UpdateShaderTable();
-    void UpdateConstantBuffer(uint32_t frameIndex);
-    void UploadStaticData();
-    void LoadScene();
-    void SetupAnimatedObjects();
-    void CreateUploadBuffer(uint64_t size, nri::Buffer*& buffer, nri::Memory*& memory);
-    void CreateScratchBuffer(nri::AccelerationStructure& accelerationStructure, nri::Buffer*& buffer, nri::Memory*& memory);
-    void BuildBottomLevelAccelerationStructure(nri::AccelerationStructure& accelerationStructure, const nri::GeometryObject* objects, const uint32_t objectNum);
-    void BuildTopLevelAccelerationStructure(nri::CommandBuffer& commandBuffer, uint32_t bufferedFrameIndex);
-    void CreateTexture(std::vector<DescriptorDesc>& descriptorDescs, const char* debugName, nri::Format format, uint16_t width, uint16_t height, uint16_t mipNum, uint16_t arraySize, nri::TextureUsageBits usage, nri::AccessBits state);
-    void CreateBuffer(std::vector<DescriptorDesc>& descriptorDescs, const char* debugName, uint64_t elements, uint32_t stride, nri::BufferUsageBits usage, nri::Format format = nri::Format::UNKNOWN);
-    void CreateDescriptors(const std::vector<DescriptorDesc>& descriptorDescs);
-    uint32_t BuildOptimizedTransitions(const TextureState* states, uint32_t stateNum, nri::TextureTransitionBarrierDesc* transitions, uint32_t transitionMaxNum);
+// What the cached triangles of a light instance slot were transformed with
+struct LightInstanceCache
+{
+    float4x4 mObjectToWorld;
+    uint32_t instanceIndex;
+    uint32_t instanceIdAndFlags;
+    uint32_t triangleOffset;
+};
 
-    inline float3 GetSunDirection() const
+// Persistent worker threads for data parallel CPU work. The calling thread participates
+class WorkerPool
+{
+public:
+    ~WorkerPool()
     {
-        float3 sunDirection;
-        sunDirection.x = Cos( DegToRad(m_Settings.sunAzimuth) ) * Cos( DegToRad(m_Settings.sunElevation) );
-        sunDirection.y = Sin( DegToRad(m_Settings.sunAzimuth) ) * Cos( DegToRad(m_Settings.sunElevation) );
-        sunDirection.z = Sin( DegToRad(m_Settings.sunElevation) );
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_IsStopping = true;
+        }
+        m_WakeUp.notify_all();
 
-        return sunDirection;
+        for (std::thread& thread : m_Threads)
+            thread.join();
     }
 
-    inline float3 GetTrimmingParams() const
+    void Initialize(uint32_t threadNum)
     {
-        // See NRDSettings.h - it's a good start
-        return m_Settings.specularLobeTrimming ? float3(0.85f, 0.04f, 0.11f) : float3(1.0f, 0.0f, 0.0001f);
+        for (uint32_t i = 0; i < threadNum; i++)
+            m_Threads.emplace_back(&WorkerPool::WorkerLoop, this);
     }
 
-    inline void GetAntilagSettings(nrd::AntilagIntensitySettings& antilagIntensitySettings, nrd::AntilagHitDistanceSettings& antilagHitDistanceSettings) const
+    inline uint32_t GetThreadNum() const
+    { return helper::GetCountOf(m_Threads) + 1; }
+
+    // Runs "job(jobIndex)" for all jobs and returns when all of them are done
+    void Execute(uint32_t jobNum, const std::function<void(uint32_t)>& job)
     {
-        float f = Saturate(m_Settings.nrdSettings.residualNoiseLevel / 5.0f);
-        float scale = 1.0f / (1.0f + float(m_Settings.rpp) * 0.5f);
+        if (m_Threads.empty() || jobNum <= 1)
+        {
+            for (uint32_t i = 0; i < jobNum; i++)
+                job(i);
 
-        antilagIntensitySettings.thresholdMin = Lerp(0.03f, 0.04f, f) * scale;
-        antilagIntensitySettings.thresholdMax = Lerp(0.15f, 0.20f, f) * scale;
-        antilagIntensitySettings.sigmaScale = 1.0f;
-        antilagIntensitySettings.enable = m_Settings.nrdSettings.antilagIntensity;
+            return;
+        }
 
-        antilagHitDistanceSettings.thresholdMin = Lerp(0.01f, 0.02f, f) * scale;
-        antilagHitDistanceSettings.thresholdMax = Lerp(0.06f, 0.10f, f) * scale;
-        antilagHitDistanceSettings.sigmaScale = 1.0f;
-        antilagHitDistanceSettings.enable = m_Settings.nrdSettings.antilagHitDistance;
+        {
+            // A late worker from the previous call must not see the counters reset under its feet
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            m_Done.wait(lock, [this]() { return m_ActiveWorkerNum == 0; });
+
+            m_Job = &job;
+            m_JobNum = jobNum;
+            m_FinishedJobNum = 0;
+            m_NextJob = 0;
+            m_Generation++;
+        }
+        m_WakeUp.notify_all();
 
-        antilagIntensitySettings.thresholdMin *= 0.25f;
-        antilagHitDistanceSettings.thresholdMin *= 0.25f;
+        RunJobs();
+
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        m_Done.wait(lock, [this]() { return m_FinishedJobNum == m_JobNum; });
     }
 
 private:
-    NrdIntegration m_Reblur;
-    NrdIntegration m_Relax;
+    void WorkerLoop()
+    {
+        uint32_t generation = 0;
 
-    DlssIntegration m_DLSS;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_Mutex);
+                m_WakeUp.wait(lock, [&]() { return m_IsStopping || m_Generation != generation; });
 
-    NRIInterface NRI = {};
-    nri::Device* m_Device = nullptr;
-    nri::SwapChain* m_SwapChain = nullptr;
-    nri::CommandQueue* m_CommandQueue = nullptr;
-    nri::QueueSemaphore* m_BackBufferAcquireSemaphore = nullptr;
-    nri::QueueSemaphore* m_BackBufferReleaseSemaphore = nullptr;
-    nri::AccelerationStructure* m_WorldTlas = nullptr;
-    nri::AccelerationStructure* m_LightTlas = nullptr;
-    nri::DescriptorPool* m_DescriptorPool = nullptr;
-    std::array<Frame, BUFFERED_FRAME_MAX_NUM> m_Frames = {};
-    std::vector<nri::Texture*> m_Textures;
-    std::vector<nri::TextureTransitionBarrierDesc> m_TextureStates;
-    std::vector<nri::Format> m_TextureFormats;
-    std::vector<nri::Buffer*> m_Buffers;
-    std::vector<nri::Memory*> m_MemoryAllocations;
-    std::vector<nri::Descriptor*> m_Descriptors;
-    std::vector<nri::DescriptorSet*> m_DescriptorSets;
-    std::vector<nri::PipelineLayout*> m_PipelineLayouts;
-    std::vector<nri::Pipeline*> m_Pipelines;
-    std::vector<nri::AccelerationStructure*> m_BLASs;
-    std::vector<uint64_t> m_ShaderEntries;
-    std::vector<BackBuffer> m_SwapChainBuffers;
-    std::vector<AnimatedInstance> m_AnimatedInstances;
-    std::array<float, 256> m_FrameTimes = {};
-    Timer m_Timer;
-    float3 m_PrevLocalPos = {};
-    float2 m_RectSizePrev = {};
-    uint2 m_OutputResolution = {};
-    uint2 m_ScreenResolution = {};
-    utils::Scene m_Scene;
-    nrd::RelaxDiffuseSpecularSettings m_RelaxSettings = {}; // TODO: after code stabilization move to Settings and adjust unit tests
-    Settings m_Settings = {};
-    Settings m_PrevSettings = {};
-    Settings m_DefaultSettings = {};
-    const nri::DeviceDesc* m_DeviceDesc = nullptr;
-    uint64_t m_ConstantBufferSize = 0;
-    uint32_t m_DefaultInstancesOffset = 0;
-    uint32_t m_LastSelectedTest = uint32_t(-1);
-    uint32_t m_TestNum = uint32_t(-1);
-    float m_ResolutionScale = 1.0f;
-    float m_MinResolutionScale = 50.0f;
-    float m_MinFps = 0.0f;
-    bool m_HasTransparentObjects = false;
-    bool m_ShowUi = true;
-    bool m_AmbientInComposition = true; // TODO: only to WAR unsupported AO / SO in non-REBLUR
-    bool m_ForceHistoryReset = false;
-};
+                if (m_IsStopping)
+                    return;
 
-Sample::~Sample()
-{
-    NRI.WaitForIdle(*m_CommandQueue);
+                generation = m_Generation;
+                m_ActiveWorkerNum++;
+            }
 
-    m_DLSS.Shutdown();
+            RunJobs();
 
-    m_Reblur.Destroy();
-    m_Relax.Destroy();
+            {
+                std::lock_guard<std::mutex> lock(m_Mutex);
+                m_ActiveWorkerNum--;
+            }
+            m_Done.notify_all();
+        }
+    }
 
-    for (Frame& frame : m_Frames)
+    void RunJobs()
     {
-        for (nri::CommandBuffer*& commandBuffer : frame.commandBuffers)
-            NRI.DestroyCommandBuffer(*commandBuffer);
-        NRI.DestroyDeviceSemaphore(*frame.deviceSemaphore);
-        NRI.DestroyCommandAllocator(*frame.commandAllocator);
-        NRI.DestroyDescriptor(*frame.globalConstantBufferDescriptor);
+        uint32_t finishedJobNum = 0;
+        for (uint32_t i = m_NextJob++; i < m_JobNum; i = m_NextJob++)
+        {
+            (*m_Job)(i);
+            finishedJobNum++;
+        }
+
+        if (finishedJobNum)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_Mutex);
+                m_FinishedJobNum += finishedJobNum;
+            }
+            m_Done.notify_all();
+        }
     }
 
-    for (BackBuffer& backBuffer : m_SwapChainBuffers)
+private:
+    std::vector<std::thread> m_Threads;
+    std::mutex m_Mutex;
+    std::condition_variable m_WakeUp;
+    std::condition_variable m_Done;
+    const std::function<void(uint32_t)>* m_Job = nullptr;
+    std::atomic<uint32_t> m_NextJob = {0};
+    uint32_t m_JobNum = 0;
+    uint32_t m_FinishedJobNum = 0;
+    uint32_t m_ActiveWorkerNum = 0;
+    uint32_t m_Generation = 0;
+    bool m_IsStopping = false;
+};
+
+// Background threads for file output. "Push" returns right away unless too many jobs are pending, then the caller waits for the disk
+class FileWriterPool
+{
+public:
+    ~FileWriterPool()
     {
-        NRI.DestroyDescriptor(*backBuffer.colorAttachment);
-        NRI.DestroyFrameBuffer(*backBuffer.frameBufferUI);
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_IsStopping = true;
+        }
+        m_WakeUp.notify_all();
+
+        // Pending jobs get finished
+        for (std::thread& thread : m_Threads)
+            thread.join();
     }
 
-    for (uint32_t i = 0; i < m_Textures.size(); i++)
-        NRI.DestroyTexture(*m_Textures[i]);
+    void Initialize(uint32_t threadNum, uint32_t pendingJobMaxNum)
+    {
+        m_PendingJobMaxNum = pendingJobMaxNum;
 
-    for (uint32_t i = 0; i < m_Buffers.size(); i++)
-        NRI.DestroyBuffer(*m_Buffers[i]);
+        for (uint32_t i = 0; i < threadNum; i++)
+            m_Threads.emplace_back(&FileWriterPool::WorkerLoop, this);
+    }
 
-    for (uint32_t i = 0; i < m_Descriptors.size(); i++)
-        NRI.DestroyDescriptor(*m_Descriptors[i]);
+    void Push(std::function<void()>&& job)
+    {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        m_Done.wait(lock, [this]() { return m_Jobs.size() < m_PendingJobMaxNum; });
 
-    for (uint32_t i = 0; i < m_Pipelines.size(); i++)
-        NRI.DestroyPipeline(*m_Pipelines[i]);
+        m_Jobs.push_back(std::move(job));
+        lock.unlock();
 
-    for (uint32_t i = 0; i < m_PipelineLayouts.size(); i++)
-        NRI.DestroyPipelineLayout(*m_PipelineLayouts[i]);
+        m_WakeUp.notify_one();
+    }
 
-    for (uint32_t i = 0; i < m_BLASs.size(); i++)
-        NRI.DestroyAccelerationStructure(*m_BLASs[i]);
+    void WaitIdle()
+    {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        m_Done.wait(lock, [this]() { return m_Jobs.empty() && m_ActiveJobNum == 0; });
+    }
 
-    NRI.DestroyDescriptorPool(*m_DescriptorPool);
-    NRI.DestroyAccelerationStructure(*m_WorldTlas);
-    NRI.DestroyAccelerationStructure(*m_LightTlas);
-    NRI.DestroyQueueSemaphore(*m_BackBufferAcquireSemaphore);
-    NRI.DestroyQueueSemaphore(*m_BackBufferReleaseSemaphore);
-    NRI.DestroySwapChain(*m_SwapChain);
+private:
+    void WorkerLoop()
+    {
+        while (true)
+        {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(m_Mutex);
+                m_WakeUp.wait(lock, [this]() { return m_IsStopping || !m_Jobs.empty(); });
 
-    for (size_t i = 0; i < m_MemoryAllocations.size(); i++)
-        NRI.FreeMemory(*m_MemoryAllocations[i]);
+                if (m_Jobs.empty())
+                    return;
 
-    DestroyUserInterface();
+                job = std::move(m_Jobs.front());
+                m_Jobs.pop_front();
+                m_ActiveJobNum++;
+            }
+            m_Done.notify_all();
 
-    nri::DestroyDevice(*m_Device);
-}
+            job();
 
-bool Sample::Initialize(nri::GraphicsAPI graphicsAPI)
+            {
+                std::lock_guard<std::mutex> lock(m_Mutex);
+                m_ActiveJobNum--;
+            }
+            m_Done.notify_all();
+        }
+    }
+
+private:
+    std::vector<std::thread> m_Threads;
+    std::deque<std::function<void()>> m_Jobs;
+    std::mutex m_Mutex;
+    std::condition_variable m_WakeUp;
+    std::condition_variable m_Done;
+    uint32_t m_PendingJobMaxNum = 1;
+    uint32_t m_ActiveJobNum = 0;
+    bool m_IsStopping = false;
+};
+
+// A finished CPU zone or a GPU pass placed on the CPU timeline
+struct CpuZoneEvent
 {
-    nri::PhysicalDeviceGroup physicalDeviceGroup = {};
-    if (!helper::FindPhysicalDeviceGroup(physicalDeviceGroup))
-        return false;
+    const char* name; // must outlive the profiler (literals, pass names)
+    uint64_t begin; // ns since the profiler start
+    uint64_t end;
+    uint32_t frameIndex;
+    uint32_t threadIndex; // 0 - main thread, "CPU_ZONE_GPU_THREAD" - GPU
+    uint32_t depth;
+};
 
-    nri::DeviceCreationDesc deviceCreationDesc = {};
-    deviceCreationDesc.graphicsAPI = graphicsAPI;
-    deviceCreationDesc.enableAPIValidation = m_DebugAPI;
-    deviceCreationDesc.enableNRIValidation = m_DebugNRI;
-    deviceCreationDesc.spirvBindingOffsets = SPIRV_BINDING_OFFSETS;
-    deviceCreationDesc.physicalDeviceGroup = &physicalDeviceGroup;
-    DlssIntegration::SetupDeviceExtensions(deviceCreationDesc);
-    NRI_ABORT_ON_FAILURE( nri::CreateDevice(deviceCreationDesc, m_Device) );
+constexpr uint32_t CPU_ZONE_GPU_THREAD = uint32_t(-1);
 
-    NRI_ABORT_ON_FAILURE( nri::GetInterface(*m_Device, NRI_INTERFACE(nri::CoreInterface), (nri::CoreInterface*)&NRI) );
-    NRI_ABORT_ON_FAILURE( nri::GetInterface(*m_Device, NRI_INTERFACE(nri::SwapChainInterface), (nri::SwapChainInterface*)&NRI) );
-    NRI_ABORT_ON_FAILURE( nri::GetInterface(*m_Device, NRI_INTERFACE(nri::RayTracingInterface), (nri::RayTracingInterface*)&NRI) );
-    NRI_ABORT_ON_FAILURE( nri::GetInterface(*m_Device, NRI_INTERFACE(nri::HelperInterface), (nri::HelperInterface*)&NRI) );
+// Zones get appended lock-free from any thread. "BeginFrame" (main thread, no zones open elsewhere) keeps the finished frame for the flame view and the trace
+class CpuProfiler
+{
+public:
+    CpuProfiler() :
+        m_Events(CPU_ZONE_MAX_NUM),
+        m_StartTime(std::chrono::steady_clock::now())
+    { }
 
-    NRI_ABORT_ON_FAILURE( NRI.GetCommandQueue(*m_Device, nri::CommandQueueType::GRAPHICS, m_CommandQueue));
-    NRI_ABORT_ON_FAILURE( NRI.CreateQueueSemaphore(*m_Device, m_BackBufferAcquireSemaphore));
-    NRI_ABORT_ON_FAILURE( NRI.CreateQueueSemaphore(*m_Device, m_BackBufferReleaseSemaphore));
+    inline uint64_t Now() const
+    { return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_StartTime).count(); }
 
-    m_DeviceDesc = &NRI.GetDeviceDesc(*m_Device);
-    m_ConstantBufferSize = helper::GetAlignedSize(sizeof(GlobalConstantBufferData), m_DeviceDesc->constantBufferOffsetAlignment);
-    m_OutputResolution = uint2(GetWindowWidth(), GetWindowHeight());
-    m_ScreenResolution = m_OutputResolution;
+    inline uint32_t BeginZone()
+    { return GetDepth()++; }
 
-    if (m_DlssQuality != uint32_t(-1))
+    inline void EndZone(const char* name, uint64_t begin, uint32_t depth)
     {
-        if (m_DLSS.InitializeLibrary(*m_Device, ""))
-        {
-            DlssSettings dlssSettings = {};
-            if (m_DLSS.GetOptimalSettings({m_OutputResolution.x, m_OutputResolution.y}, (DlssQuality)m_DlssQuality, dlssSettings))
-            {
-                DlssInitDesc dlssInitDesc = {};
-                dlssInitDesc.outputResolution = {m_OutputResolution.x, m_OutputResolution.y};
-                dlssInitDesc.quality = (DlssQuality)m_DlssQuality;
-                dlssInitDesc.isContentHDR = true;
-
-                m_DLSS.Initialize(m_CommandQueue, dlssInitDesc);
+        GetDepth()--;
 
-                float sx = float(dlssSettings.minRenderResolution.Width) / float(dlssSettings.renderResolution.Width);
-                float sy = float(dlssSettings.minRenderResolution.Height) / float(dlssSettings.renderResolution.Height);
-                float minResolutionScale = sy > sx ? sy : sx;
+        const uint32_t index = m_EventNum.fetch_add(1, std::memory_order_relaxed);
+        if (index < CPU_ZONE_MAX_NUM)
+            m_Events[index] = {name, begin, Now(), m_FrameIndex, GetThreadIndex(), depth};
+    }
 
-                m_ScreenResolution = {dlssSettings.renderResolution.Width, dlssSettings.renderResolution.Height};
-                m_MinResolutionScale = Floor(minResolutionScale * 100.0f + 0.99f);
+    void BeginFrame(uint32_t frameIndex)
+    {
+        GetThreadIndex(); // the main thread gets index 0
 
-                printf("DLSS: render resolution (%u, %u)\n", m_ScreenResolution.x, m_ScreenResolution.y);
-            }
-            else
-            {
-                m_DLSS.Shutdown();
+        const uint32_t eventNum = Min(m_EventNum.exchange(0), CPU_ZONE_MAX_NUM);
+        m_LastFrameEvents.assign(m_Events.begin(), m_Events.begin() + eventNum);
 
-                printf("DLSS: unsupported mode!\n");
-            }
+        if (m_TraceFrameNum)
+        {
+            m_TraceEvents.insert(m_TraceEvents.end(), m_LastFrameEvents.begin(), m_LastFrameEvents.end());
+            m_TraceFrameNum--;
+            m_IsTraceReady = m_TraceFrameNum == 0;
         }
-    }
 
-    nri::Format swapChainFormat = nri::Format::UNKNOWN;
-    LoadScene();
-    CreateCommandBuffers();
-    CreateSwapChain(swapChainFormat);
-    CreatePipelines();
-    CreateBottomLevelAccelerationStructures();
-    CreateTopLevelAccelerationStructure();
-    CreateResources(swapChainFormat);
-    CreateDescriptorSets();
-    UpdateShaderTable();
-    UploadStaticData();
-    SetupAnimatedObjects();
+        m_FrameIndex = frameIndex;
+    }
 
-    // REBLUR
+    // GPU passes arrive frames later, while the trace is still recording they get added as they are
+    inline void AddGpuPass(const char* name, uint64_t begin, uint64_t end, uint32_t frameIndex)
     {
-        const nrd::MethodDesc methodDescs[] =
-        {
-            #if( NRD_OCCLUSION_ONLY == 1 )
-                #if( NRD_COMBINED == 1 )
-                    { nrd::Method::REBLUR_DIFFUSE_SPECULAR_OCCLUSION, (uint16_t)m_ScreenResolution.x, (uint16_t)m_ScreenResolution.y },
-                #else
-                    { nrd::Method::REBLUR_DIFFUSE_OCCLUSION, (uint16_t)m_ScreenResolution.x, (uint16_t)m_ScreenResolution.y },
-                    { nrd::Method::REBLUR_SPECULAR_OCCLUSION, (uint16_t)m_ScreenResolution.x, (uint16_t)m_ScreenResolution.y },
-                #endif
-            #else
-                #if( NRD_COMBINED == 1 )
-                    { nrd::Method::REBLUR_DIFFUSE_SPECULAR, (uint16_t)m_ScreenResolution.x, (uint16_t)m_ScreenResolution.y },
-                    { nrd::Method::SIGMA_SHADOW_TRANSLUCENCY, (uint16_t)m_ScreenResolution.x, (uint16_t)m_ScreenResolution.y },
-                #else
-                    { nrd::Method::REBLUR_DIFFUSE, (uint16_t)m_ScreenResolution.x, (uint16_t)m_ScreenResolution.y },
-                    { nrd::Method::REBLUR_SPECULAR, (uint16_t)m_ScreenResolution.x, (uint16_t)m_ScreenResolution.y },
-                    { nrd::Method::SIGMA_SHADOW_TRANSLUCENCY, (uint16_t)m_ScreenResolution.x, (uint16_t)m_ScreenResolution.y },
-                #endif
-            #endif
-        };
+        if (m_TraceFrameNum)
+            m_TraceEvents.push_back({name, begin, end, frameIndex, CPU_ZONE_GPU_THREAD, 0});
+    }
 
-        nrd::DenoiserCreationDesc denoiserCreationDesc = {};
-        denoiserCreationDesc.requestedMethods = methodDescs;
-        denoiserCreationDesc.requestedMethodNum = helper::GetCountOf(methodDescs);
-        NRI_ABORT_ON_FALSE( m_Reblur.Initialize(*m_Device, NRI, NRI, denoiserCreationDesc) );
+    inline void StartTrace(uint32_t frameNum)
+    {
+        m_TraceEvents.clear();
+        m_TraceFrameNum = frameNum;
+        m_IsTraceReady = false;
     }
 
-    // RELAX
+    inline bool IsTracing() const
+    { return m_TraceFrameNum != 0; }
+
+    inline bool IsTraceReady() const
+    { return m_IsTraceReady; }
+
+    inline const std::vector<CpuZoneEvent>& GetLastFrameEvents() const
+    { return m_LastFrameEvents; }
+
+    // Chrome trace event format ("chrome://tracing", "ui.perfetto.dev")
+    bool WriteTrace(const char* path)
     {
-        const nrd::MethodDesc methodDescs[] =
+        m_IsTraceReady = false;
+
+        FILE* fp = fopen(path, "w");
+        if (!fp)
+            return false;
+
+        uint32_t threadNum = 0;
+        for (const CpuZoneEvent& event : m_TraceEvents)
         {
-            #if( NRD_COMBINED == 1 )
-                { nrd::Method::RELAX_DIFFUSE_SPECULAR, (uint16_t)m_ScreenResolution.x, (uint16_t)m_ScreenResolution.y },
-                { nrd::Method::SIGMA_SHADOW_TRANSLUCENCY, (uint16_t)m_ScreenResolution.x, (uint16_t)m_ScreenResolution.y },
-            #else
-                { nrd::Method::RELAX_DIFFUSE, (uint16_t)m_ScreenResolution.x, (uint16_t)m_ScreenResolution.y },
-                { nrd::Method::RELAX_SPECULAR, (uint16_t)m_ScreenResolution.x, (uint16_t)m_ScreenResolution.y },
-                { nrd::Method::SIGMA_SHADOW_TRANSLUCENCY, (uint16_t)m_ScreenResolution.x, (uint16_t)m_ScreenResolution.y },
-            #endif
-        };
+            if (event.threadIndex != CPU_ZONE_GPU_THREAD)
+                threadNum = Max(threadNum, event.threadIndex + 1);
+        }
 
-        nrd::DenoiserCreationDesc denoiserCreationDesc = {};
-        denoiserCreationDesc.requestedMethods = methodDescs;
-        denoiserCreationDesc.requestedMethodNum = helper::GetCountOf(methodDescs);
+        fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+        fprintf(fp, "  {\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 0, \"args\": {\"name\": \"CPU\"}},\n");
+        fprintf(fp, "  {\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"GPU (aligned to submission)\"}},\n");
+        for (uint32_t i = 0; i < threadNum; i++)
+            fprintf(fp, "  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": %u, \"args\": {\"name\": \"%s %u\"}},\n", i, i ? "Worker" : "Main", i);
+
+        for (const CpuZoneEvent& event : m_TraceEvents)
+        {
+            const bool isGpu = event.threadIndex == CPU_ZONE_GPU_THREAD;
+            fprintf(fp, "  {\"name\": \"%s\", \"ph\": \"X\", \"pid\": %u, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"frame\": %u}},\n",
+                event.name, isGpu ? 1 : 0, isGpu ? 0 : event.threadIndex, event.begin * 0.001, (event.end - event.begin) * 0.001, event.frameIndex);
+        }
+
+        fprintf(fp, "  {}\n]}\n"); // the empty object avoids tracking the last comma
+        fclose(fp);
 
-        NRI_ABORT_ON_FALSE(m_Relax.Initialize(*m_Device, NRI, NRI, denoiserCreationDesc));
+        m_TraceEvents.clear();
+
+        return true;
     }
 
-    m_Camera.Initialize(m_Scene.aabb.GetCenter(), m_Scene.aabb.vMin, CAMERA_RELATIVE);
-    m_Scene.UnloadResources();
+private:
+    inline uint32_t& GetDepth()
+    {
+        static thread_local uint32_t depth = 0;
+        return depth;
+    }
 
-    m_DefaultSettings = m_Settings;
+    inline uint32_t GetThreadIndex()
+    {
+        static thread_local uint32_t threadIndex = m_ThreadNum++;
+        return threadIndex;
+    }
 
-    return CreateUserInterface(*m_Device, NRI, NRI, m_OutputResolution.x, m_OutputResolution.y, swapChainFormat);
-}
+private:
+    std::vector<CpuZoneEvent> m_Events;
+    std::vector<CpuZoneEvent> m_LastFrameEvents;
+    std::vector<CpuZoneEvent> m_TraceEvents;
+    std::chrono::steady_clock::time_point m_StartTime;
+    std::atomic<uint32_t> m_EventNum = {0};
+    std::atomic<uint32_t> m_ThreadNum = {0};
+    uint32_t m_FrameIndex = 0;
+    uint32_t m_TraceFrameNum = 0;
+    bool m_IsTraceReady = false;
+};
 
-void Sample::SetupAnimatedObjects()
+class CpuZone
 {
-    const float3 maxSize = Abs(m_Scene.aabb.vMax) + Abs(m_Scene.aabb.vMin);
+public:
+    inline CpuZone(CpuProfiler& profiler, const char* name) :
+        m_Profiler(profiler),
+        m_Name(name),
+        m_Begin(profiler.Now()),
+        m_Depth(profiler.BeginZone())
+    { }
 
-    Rand::Seed(106937, &m_FastRandState);
+    inline ~CpuZone()
+    { m_Profiler.EndZone(m_Name, m_Begin, m_Depth); }
 
-    for (uint32_t i = 0; i < ANIMATED_INSTANCE_MAX_NUM; i++)
-    {
-        uint32_t instanceIndex = i % m_DefaultInstancesOffset;
-        float3 tmpPosition = Rand::uf3(&m_FastRandState) * maxSize - Abs(m_Scene.aabb.vMin);
+private:
+    CpuProfiler& m_Profiler;
+    const char* m_Name;
+    uint64_t m_Begin;
+    uint32_t m_Depth;
+};
 
-        AnimatedInstance tmpAnimatedInstance = {};
-        tmpAnimatedInstance.instanceID = helper::GetCountOf(m_Scene.instances);
-        tmpAnimatedInstance.position = ToDouble( tmpPosition );
-        tmpAnimatedInstance.basePosition = tmpAnimatedInstance.position;
-        tmpAnimatedInstance.animation.durationSec = Rand::uf1(&m_FastRandState) * 10.0f + 5.0f;
-        tmpAnimatedInstance.animation.progressedSec = tmpAnimatedInstance.animation.durationSec * Rand::uf1(&m_FastRandState);
-        tmpAnimatedInstance.animation.rotationAxis = Normalize( Rand::sf3(&m_FastRandState) + 1e-6f );
-        tmpAnimatedInstance.animation.elipseAxis = Rand::sf3(&m_FastRandState) * 5.0f;
-        tmpAnimatedInstance.animation.inverseDirection = Sign( Rand::sf1(&m_FastRandState) );
-        tmpAnimatedInstance.animation.inverseRotation = Sign( Rand::sf1(&m_FastRandState) );
-        m_AnimatedInstances.push_back(tmpAnimatedInstance);
+#if CPU_ZONES
+    #define CPU_ZONE_CONCAT_(a, b) a##b
+    #define CPU_ZONE_CONCAT(a, b) CPU_ZONE_CONCAT_(a, b)
+    #define CPU_ZONE(name) CpuZone CPU_ZONE_CONCAT(cpuZone, __LINE__)(m_CpuProfiler, name)
+#else
+    #define CPU_ZONE(name)
+#endif
 
-        const utils::Instance& tmpInstance = m_Scene.instances[instanceIndex];
-        m_Scene.instances.push_back(tmpInstance);
-    }
-}
+struct BenchmarkRun
+{
+    std::array<std::vector<float>, (uint32_t)GpuPass::MAX_NUM> gpuPassTimes;
+    std::vector<float> cpuFrameTimes;
+    uint32_t test;
+    int32_t denoiser;
+    int32_t rpp; // "--quality" only
+    float resolutionScale;
+    float psnr; // dB, 0 - not measured
+    float ssim;
+};
 
-void Sample::PrepareFrame(uint32_t frameIndex)
+struct TimingStats
 {
-    const float sceneRadius = m_Scene.aabb.GetRadius() / m_Settings.meterToUnitsMultiplier;
+    float mean;
+    float p50;
+    float p95;
+    float p99;
+};
 
-    m_PrevSettings = m_Settings;
-    m_Camera.SavePreviousState();
+inline TimingStats GetTimingStats(std::vector<float> samples)
+{
+    TimingStats stats = {};
+    if (samples.empty())
+        return stats;
 
-    PrepareUserInterface();
+    std::sort(samples.begin(), samples.end());
 
-    if (IsKeyToggled(Key::Space))
-        m_Settings.pauseAnimation = !m_Settings.pauseAnimation;
-    if (IsKeyToggled(Key::F1))
-        m_ShowUi = !m_ShowUi;
-    if (IsKeyToggled(Key::F2))
-        m_Settings.denoiser = (m_Settings.denoiser + 1) % DENOISER_MAX_NUM;
-    if (IsKeyToggled(Key::F3))
-        m_Settings.debug = Step(0.5f, 1.0f - m_Settings.debug);
+    double sum = 0.0;
+    for (float sample : samples)
+        sum += sample;
 
-    float avgFrameTime = m_Timer.GetVerySmoothedElapsedTime();
+    // Nearest-rank percentiles
+    const size_t n = samples.size();
+    stats.mean = float(sum / double(n));
+    stats.p50 = samples[std::min(n - 1, (n * 50 + 99) / 100 - 1)];
+    stats.p95 = samples[std::min(n - 1, (n * 95 + 99) / 100 - 1)];
+    stats.p99 = samples[std::min(n - 1, (n * 99 + 99) / 100 - 1)];
+
+    return stats;
+}
+
+// "_Data" lives in the source directory, while the executable is in "_Build/<config>". Look up from the executable, not from the working directory
+static std::filesystem::path GetShaderDataPath()
+{
+    std::error_code error;
+
+#ifdef _WIN32
+    char* executablePath = nullptr;
+    _get_pgmptr(&executablePath);
+    std::filesystem::path path = executablePath ? std::filesystem::path(executablePath) : std::filesystem::path();
+#else
+    std::filesystem::path path = std::filesystem::read_symlink("/proc/self/exe", error);
+#endif
 
-    if (m_Settings.limitFps && m_MinFps > 0.0f && m_SwapInterval == 0) // TODO: GPU time is needed to get it working with VSYNC
+    for (path = path.parent_path(); !path.empty(); path = path.parent_path())
     {
-        float msLimit = 1000.0f / m_MinFps;
-        float frameTime = m_Timer.GetElapsedTime();
-        float ratio = Sqrt(msLimit / frameTime);
-        float scale = m_ResolutionScale * ratio;
-        float f = 1000.0f / avgFrameTime;
-        m_ResolutionScale = Lerp(m_ResolutionScale, scale, 1.0f / (1.0f + f));
-        m_ResolutionScale = Clamp(m_ResolutionScale, 0.5f, 1.0f);
+        const std::filesystem::path shaders = path / "_Data" / "Shaders";
+        if (std::filesystem::is_directory(shaders, error))
+            return shaders;
+
+        if (path == path.root_path())
+            break;
     }
 
-    m_ResolutionScale *= 100.0f;
+    return std::filesystem::absolute("_Data/Shaders", error);
+}
 
-    if (!IsKeyPressed(Key::LAlt) && m_ShowUi)
+// NRI has no pipeline cache objects, but drivers keep their own ones on disk. Pointing them next to the shaders makes them survive wiped user profiles
+// (test machines) and keeps them in sync with the shader blobs. Must be called before device creation, explicitly set variables are respected.
+// Only VULKAN drivers read these variables: D3D11 and D3D12 get no caching from it (D3D12 would need "ID3D12PipelineLibrary", which NRI doesn't expose)
+static void SetupDriverShaderCache()
+{
+    const std::filesystem::path cachePath = GetShaderDataPath() / "DriverCache";
+
+    std::error_code error;
+    std::filesystem::create_directories(cachePath, error);
+    if (error)
     {
-        ImGui::SetNextWindowPos(ImVec2(5.0f, 5.0f), ImGuiCond_Once);
-        ImGui::SetNextWindowSize(ImVec2(0.0f, 0.0f));
-        ImGui::Begin("Settings (F1 - hide)", nullptr, ImGuiWindowFlags_NoSavedSettings | ImGuiWindowFlags_NoResize);
-        {
-            char avg[64];
-            snprintf(avg, sizeof(avg), "%.1f FPS (%.2f ms)", 1000.0f / avgFrameTime, avgFrameTime);
+        printf("Driver shader cache: can't create '%s'!\n", cachePath.string().c_str());
+        return;
+    }
 
-            ImVec4 colorFps = ImVec4(0.0f, 1.0f, 0.0f, 1.0f);
-            if (avgFrameTime > 1000.0f / 60.0f)
-                colorFps = ImVec4(1.0f, 1.0f, 0.0f, 1.0f);
-            if (avgFrameTime > 1000.0f / 30.0f)
-                colorFps = ImVec4(1.0f, 0.0f, 0.0f, 1.0f);
+    const std::string path = cachePath.string();
+    const std::pair<const char*, const char*> variables[] =
+    {
+        { "__GL_SHADER_DISK_CACHE", "1" }, // NVIDIA (VULKAN too)
+        { "__GL_SHADER_DISK_CACHE_PATH", path.c_str() },
+        { "__GL_SHADER_DISK_CACHE_SKIP_CLEANUP", "1" },
+        { "MESA_SHADER_CACHE_DIR", path.c_str() }, // RADV, ANV
+    };
 
-            float lo = avgFrameTime * 0.5f;
-            float hi = avgFrameTime * 1.5f;
+    for (const auto& variable : variables)
+    {
+        if (getenv(variable.first))
+            continue;
 
-            const uint32_t N = helper::GetCountOf(m_FrameTimes);
-            uint32_t head = frameIndex % N;
-            m_FrameTimes[head] = m_Timer.GetElapsedTime();
-            ImGui::PushStyleColor(ImGuiCol_Text, colorFps);
-            ImGui::PlotLines("Performance", m_FrameTimes.data(), N, head, avg, lo, hi, ImVec2(0, 80.0f));
-            ImGui::PopStyleColor();
+    #ifdef _WIN32
+        _putenv_s(variable.first, variable.second);
+    #else
+        setenv(variable.first, variable.second, 0);
+    #endif
+    }
+}
 
-            if (IsButtonPressed(Button::Right))
-            {
-                ImGui::Text("Move - W/S/A/D");
-                ImGui::Text("Accelerate - MOUSE SCROLL");
-            }
-            else
-            {
-                ImGui::PushID("CAMERA");
-                {
-                    #if( NRD_OCCLUSION_ONLY == 1 )
-                        static const char* onScreenModes[] =
-                        {
-                            "Ambient occlusion",
-                            "Specular occlusion",
-                        };
-                    #else
-                        static const char* onScreenModes[] =
-                        {
-                            "Final",
-                            "Ambient occlusion",
-                            "Specular occlusion",
-                            "Denoised diffuse",
-                            "Denoised specular",
-                            "Shadow",
-                            "Base color",
-                            "Normal",
-                            "Roughness",
-                            "Metalness",
-                            "World units",
-                            "Barycentrics",
-                            "Mesh",
-                            "Mip level (primary)",
-                            "Mip level (specular)",
-                        };
-                    #endif
+class Sample : public SampleBase
+{
+public:
+    Sample() :
+        m_Sigma(FRAMES_IN_FLIGHT_MAX_NUM)
+    {}
+
+    ~Sample();
+
+    void InitCmdLine(cmdline::parser& cmdLine) override;
+    void ReadCmdLine(cmdline::parser& cmdLine) override;
+    bool Initialize(nri::GraphicsAPI graphicsAPI);
+    void PrepareFrame(uint32_t frameIndex);
+    void RenderFrame(uint32_t frameIndex);
+
+    inline nri::Texture*& Get(Texture index)
+    { return m_Textures[(uint32_t)index]; }
+
+    inline nri::TextureTransitionBarrierDesc& GetState(Texture index)
+    { return m_TextureStates[(uint32_t)index]; }
+
+    inline nri::Format GetFormat(Texture index)
+    { return m_TextureFormats[(uint32_t)index]; }
+
+    inline nri::Buffer*& Get(Buffer index)
+    { return m_Buffers[(uint32_t)index]; }
+
+    inline nri::Pipeline*& Get(Pipeline index)
+    { return m_Pipelines[(uint32_t)index]; }
+
+    inline nri::PipelineLayout*& GetPipelineLayout(Pipeline index)
+    { return m_PipelineLayouts[(uint32_t)index]; }
+
+    inline nri::Descriptor*& Get(Descriptor index)
+    { return m_Descriptors[(uint32_t)index]; }
+
+    inline nri::DescriptorSet*& Get(DescriptorSet index)
+    { return m_DescriptorSets[(uint32_t)index]; }
+
+    // Quality sets come in triples, one per possible "finalResult"
+    inline nri::DescriptorSet* GetQualityDescriptorSet(DescriptorSet first, Texture finalResult)
+    { return m_DescriptorSets[(uint32_t)first + (finalResult == Texture::Final ? 0 : (finalResult == Texture::TaaHistory ? 1 : 2))]; }
+
+private:
+    void CreateCommandBuffers();
+    void CreateSwapChain(nri::Format& swapChainFormat);
+    void CreateResources(nri::Format swapChainFormat);
+    void CreatePipelines();
+    void CreateDescriptorSets();
+    void CreateDataDescriptorSets();
+    void SwapDataTextureTwins();
+    void SwitchNrdMode(bool isOcclusionOnly, bool isCombined);
+    NrdIntegration& GetDenoiser();
+    void DestroyDenoiser(int32_t denoiser);
+    uint64_t EstimateNrdMemorySize(const nrd::DenoiserCreationDesc& denoiserCreationDesc) const;
+    void CreateBottomLevelAccelerationStructures();
+    void CreateTopLevelAccelerationStructure();
+    void UpdateShaderTable();
+    void UpdateConstantBuffer(uint32_t frameIndex);
+    void UploadStaticData();
+    void CreateLightGeometry();
+    void LoadScene();
+    bool LoadSceneCache();
+    bool LoadPrimitiveDataCache(std::vector<PrimitiveData>& primitiveData);
+    void SaveSceneCache(const std::vector<PrimitiveData>& primitiveData) const;
+    bool LoadQualityReference(uint32_t test);
+    void SaveQualityReference(uint32_t test, const void* data) const;
+    void SetupAnimatedObjects();
+    void CreateUploadBuffer(uint64_t size, nri::Buffer*& buffer, nri::Memory*& memory);
+    void CreateScratchBuffer(uint64_t size, nri::Buffer*& buffer, nri::Memory*& memory);
+    void CreateReadbackBuffer(uint64_t size, nri::Buffer*& buffer, nri::Memory*& memory);
+    uint64_t AllocateAndBindAccelerationStructureMemory(const std::vector<nri::AccelerationStructure*>& accelerationStructures, nri::Memory*& memory);
+    void SubmitAndWait(nri::CommandBuffer& commandBuffer, uint32_t physicalDeviceIndex = 0);
+    void ReplicateStaticData();
+    uint32_t GetInstanceFlags(size_t instanceIndex);
+    uint32_t GatherInstances(size_t instanceBegin, size_t instanceEnd, uint32_t worldIndex, bool& hasTransparentObjects);
+    void PackInstances(const InstanceRef* instanceRefs, uint32_t instanceNum, bool isStatic, InstanceData* instanceData, nri::GeometryObjectInstance* tlasData);
+    void PackInstancesParallel(bool isStatic, InstanceData* instanceData, nri::GeometryObjectInstance* tlasData);
+    void UpdateLightData(nri::CommandBuffer& commandBuffer, uint32_t bufferedFrameIndex);
+    void BuildTopLevelAccelerationStructure(nri::CommandBuffer& commandBuffer, uint32_t bufferedFrameIndex);
+    void ReplayWorldTlasBuild(nri::CommandBuffer& commandBuffer, uint32_t physicalDeviceIndex);
+    void CreateTexture(std::vector<DescriptorDesc>& descriptorDescs, const char* debugName, nri::Format format, uint16_t width, uint16_t height, uint16_t mipNum, uint16_t arraySize, nri::TextureUsageBits usage, nri::AccessBits state);
+    void CreateBuffer(std::vector<DescriptorDesc>& descriptorDescs, const char* debugName, uint64_t elements, uint32_t stride, nri::BufferUsageBits usage, nri::Format format = nri::Format::UNKNOWN);
+    void CreateDescriptors(const std::vector<DescriptorDesc>& descriptorDescs);
+    void AddFramePass(const FramePassDesc& framePassDesc, std::function<void(nri::CommandBuffer&)>&& execute);
+    void CompileFrameGraph();
+    void RecordFramePass(uint32_t passIndex, nri::CommandBuffer& commandBuffer, std::vector<nri::TextureTransitionBarrierDesc>& transitions);
+    void ExecuteFrameGraph(const Frame& frame);
+    nri::Memory* AllocateFromHeap(const nri::MemoryDesc& memoryDesc, MemoryCategory category, uint64_t& offset, uint64_t heapSize = MEMORY_HEAP_SIZE);
+    void PlaceResources();
+    uint8_t* AllocateFromUploadRing(uint64_t size, uint64_t& offset);
+    void CreateQueryPools();
+    void ReadGpuPassTimes(uint32_t bufferedFrameIndex);
+    void ReadMipFeedback(uint32_t bufferedFrameIndex);
+#ifdef _DEBUG
+    void ReadSampleSum(uint32_t bufferedFrameIndex);
+#endif
+    void UpdateTextureResidency(nri::CommandBuffer& commandBuffer, uint32_t frameIndex);
+    void ReallocateResidentTextures(nri::CommandBuffer& commandBuffer, uint32_t frameIndex);
+    void ResizeResidentTexture(nri::CommandBuffer& commandBuffer, uint32_t textureIndex, uint32_t mipOffset, uint32_t frameIndex);
+    void WaitForFrame(uint32_t frameIndex);
+    void SetGpuTimingsDump(bool enable);
+    void UpdateDynamicResolution();
+    void SetDlssQuality(uint32_t quality);
+    bool LoadTest(const std::string& path, uint32_t test);
+    void UpdateBenchmark(uint32_t frameIndex);
+    void WriteBenchmarkReport() const;
+    void UpdateCapture(uint32_t frameIndex);
+    void ReadCapture(uint32_t bufferedFrameIndex);
+    void CmdReadbackCaptureTarget(nri::CommandBuffer& commandBuffer, uint32_t bufferedFrameIndex, CaptureTarget target, Texture texture);
+    void UpdateQuality(uint32_t frameIndex);
+    void ReadQuality(uint32_t bufferedFrameIndex);
+    bool StreamTextures(nri::CommandBuffer& commandBuffer, uint32_t bufferedFrameIndex, uint32_t mipSizeMax);
+
+    inline void BeginGpuPass(nri::CommandBuffer& commandBuffer, uint32_t bufferedFrameIndex, GpuPass pass)
+    {
+        m_TimestampMasks[bufferedFrameIndex].fetch_or(1 << (uint32_t)pass, std::memory_order_relaxed);
+        NRI.CmdEndQuery(commandBuffer, *m_TimestampQueryPool, bufferedFrameIndex * GPU_PASS_QUERY_NUM + (uint32_t)pass * 2);
+    }
+
+    inline void EndGpuPass(nri::CommandBuffer& commandBuffer, uint32_t bufferedFrameIndex, GpuPass pass)
+    {
+        NRI.CmdEndQuery(commandBuffer, *m_TimestampQueryPool, bufferedFrameIndex * GPU_PASS_QUERY_NUM + (uint32_t)pass * 2 + 1);
+    }
+
+    inline float GetGpuPassTime(GpuPass pass) const
+    { return m_SmoothedGpuPassTimes[(uint32_t)pass]; }
+
+    // All layers of a mip in the layout expected by "CmdUploadBufferToTexture"
+    inline uint64_t GetStagedMipSize(const utils::Texture& texture, uint32_t mip) const
+    {
+        nri::TextureSubresourceUploadDesc subresource = {};
+        texture.GetSubresource(subresource, mip, 0);
+
+        const uint32_t rowNum = subresource.slicePitch / subresource.rowPitch;
+        const uint64_t rowPitch = helper::GetAlignedSize((uint64_t)subresource.rowPitch, m_DeviceDesc->uploadBufferTextureRowAlignment);
+        const uint64_t slicePitch = helper::GetAlignedSize(rowPitch * rowNum, m_DeviceDesc->uploadBufferTextureSliceAlignment);
+
+        return slicePitch * texture.GetArraySize();
+    }
+
+    // Bytes of all mips starting from "mipOffset", an estimation of the memory needed for a resident texture
+    inline uint64_t GetResidentTextureSize(const utils::Texture& texture, uint32_t mipOffset) const
+    {
+        uint64_t size = 0;
+        for (uint32_t mip = mipOffset; mip < texture.GetMipNum(); mip++)
+            size += GetStagedMipSize(texture, mip);
+
+        return size;
+    }
+
+    // Finest resident mip relative to the allocated mips, which shaders see
+    inline uint32_t GetTextureMinMip(uint32_t textureIndex) const
+    { return m_TextureResidentMips[textureIndex] - m_ResidentTextures[textureIndex].mipOffset; }
+
+    // Streamed mips are uploaded coarse to fine, so a material is safe to sample from the finest mip resident in all its textures
+    inline uint32_t GetMaterialMinMip(const utils::Material& material) const
+    {
+        uint32_t minMip = Max(GetTextureMinMip(material.diffuseMapIndex), GetTextureMinMip(material.specularMapIndex));
+        minMip = Max(minMip, GetTextureMinMip(material.normalMapIndex));
+        minMip = Max(minMip, GetTextureMinMip(material.emissiveMapIndex));
+
+        return minMip;
+    }
+
+    inline void GetMaterialTextureDescriptors(std::vector<nri::Descriptor*>& textures)
+    {
+        textures.resize(m_Scene.materials.size() * TEXTURES_PER_MATERIAL);
+        for (size_t i = 0; i < m_Scene.materials.size(); i++)
+        {
+            const uint32_t index = uint32_t(i) * TEXTURES_PER_MATERIAL;
+            const utils::Material& material = m_Scene.materials[i];
+
+            textures[index] = Get( Descriptor((uint32_t)Descriptor::MaterialTextures + material.diffuseMapIndex) );
+            textures[index + 1] = Get( Descriptor((uint32_t)Descriptor::MaterialTextures + material.specularMapIndex) );
+            textures[index + 2] = Get( Descriptor((uint32_t)Descriptor::MaterialTextures + material.normalMapIndex) );
+            textures[index + 3] = Get( Descriptor((uint32_t)Descriptor::MaterialTextures + material.emissiveMapIndex) );
+        }
+    }
+
+    inline std::string GetTestPath() const
+    {
+        std::string sceneName = std::string( utils::GetFileName(m_SceneFile) );
+        size_t dotPos = sceneName.find_last_of(".");
+        if (dotPos != std::string::npos)
+            sceneName.replace(dotPos, 4, ".bin");
+
+        return utils::GetFullPath(sceneName, utils::DataFolder::TESTS);
+    }
+
+    inline uint32_t GetTestByteSize() const
+    { return sizeof(m_Settings) + Camera::GetStateSize(); }
+
+    inline std::string GetSceneCachePath() const
+    { return utils::GetFullPath(m_SceneFile, utils::DataFolder::SCENES) + ".cache"; }
+
+    // "--quality": a half4 per output pixel
+    inline uint64_t GetQualityReferenceSize() const
+    { return uint64_t(m_OutputResolution.x) * m_OutputResolution.y * 4 * sizeof(uint16_t); }
+
+    // "--quality": next to the tests, a reference per test and output resolution
+    inline std::string GetQualityReferencePath(uint32_t test) const
+    {
+        std::string path = GetTestPath();
+        path.resize(path.size() - 4); // ".bin"
+
+        return path + "_" + std::to_string(test + 1) + "_" + std::to_string(m_OutputResolution.x) + "x" + std::to_string(m_OutputResolution.y) + ".ref";
+    }
+
+    // DLSS qualities share textures sized for the largest render resolution, the current one is a rectangle inside
+    inline uint2 GetRenderResolution() const
+    { return m_DLSS.IsInitialized() ? m_DlssRenderResolutions[m_DlssQuality] : m_ScreenResolution; }
+
+    inline uint2 GetRectSize() const
+    {
+        const uint2 renderResolution = GetRenderResolution();
+        return uint2( uint32_t(renderResolution.x * m_ResolutionScale + 0.5f), uint32_t(renderResolution.y * m_ResolutionScale + 0.5f) );
+    }
+
+    // "--multiGpu": rows traced by a GPU (origin, height)
+    inline uint2 GetRaytracingBand(uint32_t physicalDeviceIndex) const
+    {
+        const uint32_t rectH = GetRectSize().y;
+        const uint32_t origin = rectH * physicalDeviceIndex / m_PhysicalDeviceNum;
+
+        return uint2( origin, rectH * (physicalDeviceIndex + 1) / m_PhysicalDeviceNum - origin );
+    }
+
+    // The scale actually applied after rounding the rectangle to whole pixels
+    inline float2 GetEffectiveResolutionScale() const
+    {
+        const uint2 rectSize = GetRectSize();
+        return float2( float(rectSize.x) / float(m_ScreenResolution.x), float(rectSize.y) / float(m_ScreenResolution.y) );
+    }
+
+    inline float3 GetSunDirection() const
+    {
+        float3 sunDirection;
+        sunDirection.x = Cos( DegToRad(m_Settings.sunAzimuth) ) * Cos( DegToRad(m_Settings.sunElevation) );
+        sunDirection.y = Sin( DegToRad(m_Settings.sunAzimuth) ) * Cos( DegToRad(m_Settings.sunElevation) );
+        sunDirection.z = Sin( DegToRad(m_Settings.sunElevation) );
+
+        return sunDirection;
+    }
+
+    inline float3 GetTrimmingParams() const
+    {
+        // See NRDSettings.h - it's a good start
+        return m_Settings.specularLobeTrimming ? float3(0.85f, 0.04f, 0.11f) : float3(1.0f, 0.0f, 0.0001f);
+    }
+
+    inline void GetAntilagSettings(nrd::AntilagIntensitySettings& antilagIntensitySettings, nrd::AntilagHitDistanceSettings& antilagHitDistanceSettings) const
+    {
+        float f = Saturate(m_Settings.nrdSettings.residualNoiseLevel / 5.0f);
+        float scale = 1.0f / (1.0f + float(m_Settings.rpp) * 0.5f);
+
+        antilagIntensitySettings.thresholdMin = Lerp(0.03f, 0.04f, f) * scale;
+        antilagIntensitySettings.thresholdMax = Lerp(0.15f, 0.20f, f) * scale;
+        antilagIntensitySettings.sigmaScale = 1.0f;
+        antilagIntensitySettings.enable = m_Settings.nrdSettings.antilagIntensity;
+
+        antilagHitDistanceSettings.thresholdMin = Lerp(0.01f, 0.02f, f) * scale;
+        antilagHitDistanceSettings.thresholdMax = Lerp(0.06f, 0.10f, f) * scale;
+        antilagHitDistanceSettings.sigmaScale = 1.0f;
+        antilagHitDistanceSettings.enable = m_Settings.nrdSettings.antilagHitDistance;
+
+        antilagIntensitySettings.thresholdMin *= 0.25f;
+        antilagHitDistanceSettings.thresholdMin *= 0.25f;
+    }
+
+private:
+    // Created on first use of a method set and kept, switching modes back and forth doesn't recreate anything
+    // Only one denoiser is resident, instances of the other one get destroyed on a switch
+    std::array<NrdInstance, REBLUR_METHOD_SET_NUM> m_Reblur = {};
+    std::array<NrdInstance, RELAX_METHOD_SET_NUM> m_Relax = {};
+    NrdIntegration m_Sigma; // async compute only
+
+    DlssIntegration m_DLSS;
+
+    NRIInterface NRI = {};
+    nri::Device* m_Device = nullptr;
+    nri::SwapChain* m_SwapChain = nullptr;
+    nri::CommandQueue* m_CommandQueue = nullptr;
+    nri::QueueSemaphore* m_BackBufferAcquireSemaphore = nullptr;
+    nri::QueueSemaphore* m_BackBufferReleaseSemaphore = nullptr;
+    nri::CommandQueue* m_ComputeQueue = nullptr;
+    nri::QueueSemaphore* m_RaytracingSemaphore = nullptr;
+    nri::QueueSemaphore* m_ShadowDenoisingSemaphore = nullptr;
+    std::array<nri::QueueSemaphore*, MULTI_GPU_MAX_NUM> m_PeerRaytracingSemaphores = {}; // peer GPU -> GPU 0: the band is traced
+    std::array<nri::QueueSemaphore*, MULTI_GPU_MAX_NUM> m_PeerHistorySemaphores = {}; // GPU 0 -> peer GPU: "ComposedLighting_ViewZ" is copied
+    std::vector<const nri::Texture*> m_PeerInitializedTextures; // raytracing outputs already moved out of the initial state on peer GPUs
+    nri::AccelerationStructure* m_WorldTlas = nullptr;
+    nri::DescriptorPool* m_DescriptorPool = nullptr;
+    nri::QueryPool* m_TimestampQueryPool = nullptr;
+    nri::Buffer* m_TimestampBuffer = nullptr;
+    nri::Buffer* m_MipFeedbackBuffer = nullptr;
+    nri::Buffer* m_SampleSumBuffer = nullptr;
+    nri::Buffer* m_CaptureBuffer = nullptr;
+    nri::Buffer* m_QualityReadbackBuffer = nullptr; // metrics slices per buffered frame, then the reference
+    nri::Buffer* m_QualityUploadBuffer = nullptr; // a cached reference
+    FILE* m_GpuTimingsFile = nullptr;
+    std::vector<Frame> m_Frames; // "m_FrameInFlightNum" entries
+    std::array<std::atomic<uint32_t>, FRAMES_IN_FLIGHT_MAX_NUM> m_TimestampMasks = {};
+    std::array<uint32_t, FRAMES_IN_FLIGHT_MAX_NUM> m_TimestampFrameIndices = {};
+    std::array<float, FRAMES_IN_FLIGHT_MAX_NUM> m_TimestampPixelRatios = {};
+    std::array<uint32_t, FRAMES_IN_FLIGHT_MAX_NUM> m_MipFeedbackFrameIndices = {}; // frame index + 1, 0 - nothing copied
+#ifdef _DEBUG
+    std::array<uint32_t, FRAMES_IN_FLIGHT_MAX_NUM> m_SampleSumBudgets = {}; // expected number of distributed samples, 0 - nothing copied
+#endif
+    std::array<uint64_t, FRAMES_IN_FLIGHT_MAX_NUM> m_CpuSubmitTimes = {}; // ns, CPU profiler time
+    std::array<CaptureSlot, FRAMES_IN_FLIGHT_MAX_NUM> m_CaptureSlots = {};
+    std::array<CaptureLayout, (uint32_t)CaptureTarget::MAX_NUM> m_CaptureLayouts = {};
+    std::array<QualitySlot, FRAMES_IN_FLIGHT_MAX_NUM> m_QualitySlots = {};
+    std::array<uint2, (uint32_t)DlssQuality::MAX_NUM> m_DlssRenderResolutions = {}; // 0 - unsupported
+    std::array<float, (uint32_t)DlssQuality::MAX_NUM> m_DlssMinResolutionScales = {}; // %
+    std::array<float, (uint32_t)GpuPass::MAX_NUM> m_GpuPassTimes = {};
+    std::array<float, (uint32_t)GpuPass::MAX_NUM> m_SmoothedGpuPassTimes = {};
+    std::vector<nri::Texture*> m_Textures;
+    std::vector<nri::TextureTransitionBarrierDesc> m_TextureStates;
+    std::vector<nri::Format> m_TextureFormats;
+    std::vector<nri::Buffer*> m_Buffers;
+    std::vector<nri::Memory*> m_MemoryAllocations;
+    std::vector<MemoryHeap> m_MemoryHeaps;
+    UploadRing m_UploadRing = {};
+    WorldTlasBuild m_WorldTlasBuild = {};
+    InstanceData* m_InstanceData = nullptr; // mapped "Buffer::InstanceData" if host visible
+    std::vector<TransientTexture> m_TransientTextures;
+    std::array<DataTextureTwin, 4> m_DataTextureTwins = {};
+    std::array<nri::DescriptorSet*, (uint32_t)DescriptorSet::MAX_NUM - (uint32_t)DescriptorSet::Raytracing1> m_DataDescriptorSetTwins = {};
+    std::vector<FramePass> m_FramePasses;
+    std::vector<TextureState> m_FramePassTextures;
+    std::vector<nri::BufferTransitionBarrierDesc> m_FramePassBuffers;
+    std::vector<nri::TextureTransitionBarrierDesc> m_FramePassUntrackedTextures;
+    std::vector<nri::TextureTransitionBarrierDesc> m_FramePassTextureStates; // states before external passes
+    std::vector<nri::TextureTransitionBarrierDesc> m_FrameTextureStates;
+    std::vector<FrameBarrier> m_FrameBarriers;
+    std::array<uint64_t, (uint32_t)MemoryCategory::MAX_NUM> m_MemoryCategorySizes = {};
+    std::vector<nri::Descriptor*> m_Descriptors;
+    std::vector<nri::DescriptorSet*> m_DescriptorSets;
+    std::vector<nri::PipelineLayout*> m_PipelineLayouts;
+    std::vector<nri::Pipeline*> m_Pipelines;
+    std::vector<nri::AccelerationStructure*> m_BLASs;
+    std::vector<uint64_t> m_ShaderEntries;
+    std::vector<BackBuffer> m_SwapChainBuffers;
+    std::vector<AnimatedInstance> m_AnimatedInstances;
+    std::vector<BenchmarkRun> m_BenchmarkRuns;
+    std::vector<int32_t> m_QualityRpps; // "--quality" configurations: denoiser x rpp x resolution scale
+    std::vector<float> m_QualityScales;
+    std::vector<nri::GeometryObjectInstance> m_StaticTlasInstances;
+    std::vector<InstanceData> m_StaticInstanceData;
+    std::vector<uint32_t> m_StaticTlasInstanceIndices;
+    std::vector<InstanceRef> m_InstanceRefs;
+    std::vector<uint32_t> m_StaticLightInstances;
+    std::vector<LightInstance> m_LightInstances;
+    std::vector<LightInstanceCache> m_LightInstanceCaches;
+    std::vector<float4> m_LightTriangles; // camera relative, 3 per triangle, as in "LightData"
+    std::vector<float3> m_LightMeshVertices; // object space, 3 per triangle
+    std::vector<uint32_t> m_LightMeshVertexOffsets; // per mesh, "uint32_t(-1)" if the mesh can't emit
+    std::vector<PrimitiveData> m_CachedPrimitiveData; // read with the scene, consumed by "UploadStaticData"
+    std::vector<float> m_LightTrianglePowers;
+    std::vector<float4> m_LightAliasTable;
+    std::vector<uint32_t> m_StreamedTextures;
+    std::vector<uint8_t> m_TextureResidentMips;
+    std::vector<ResidentTexture> m_ResidentTextures;
+    std::vector<RetiredTexture> m_RetiredTextures;
+    std::array<float, 256> m_FrameTimes = {};
+    Timer m_Timer;
+    CpuProfiler m_CpuProfiler;
+    WorkerPool m_WorkerPool;
+    std::chrono::steady_clock::time_point m_CaptureStartTime = {};
+    std::string m_CaptureDirectory;
+    std::atomic<uint64_t> m_CaptureWrittenBytes = {0};
+    std::atomic<uint32_t> m_CaptureWrittenFileNum = {0};
+    std::atomic<uint32_t> m_CaptureFailedFileNum = {0};
+    FileWriterPool m_CaptureWriter; // after everything its jobs touch, i.e. destroyed first
+    float3 m_PrevLocalPos = {};
+    float2 m_RectSizePrev = {};
+    uint2 m_OutputResolution = {};
+    uint2 m_ScreenResolution = {};
+    utils::Scene m_Scene;
+    nrd::RelaxDiffuseSpecularSettings m_RelaxSettings = {}; // TODO: after code stabilization move to Settings and adjust unit tests
+    Settings m_Settings = {};
+    Settings m_PrevSettings = {};
+    Settings m_DefaultSettings = {};
+    const nri::DeviceDesc* m_DeviceDesc = nullptr;
+    uint64_t m_ConstantBufferSize = 0;
+    uint64_t m_TextureStreamingStagingSize = 0;
+    uint64_t m_StreamedTextureBytes = 0;
+    uint64_t m_CaptureSliceSize = 0;
+    uint64_t m_QualityMetricsSize = 0; // bytes per buffered frame
+    uint64_t m_QualitySourceHash = 0;
+    uint64_t m_SceneHash = 0;
+    uint64_t m_LightSetHash = 0;
+    uint64_t m_AliasedMemorySize = 0;
+    uint32_t m_DefaultInstancesOffset = 0;
+    uint32_t m_TextureStreamingMipSize = 1;
+    uint32_t m_TextureBudget = 0; // MB, 0 - unlimited
+    uint32_t m_TextureResidencyUpdateFrame = 0;
+    uint32_t m_MaterialViewsDirtyMask = 0; // buffered frames with outdated material views in "raytracing2DescriptorSet"
+    uint32_t m_WorldTlasInstanceNum = 0;
+    uint32_t m_WorldTlasUpdateNum = 0;
+    uint32_t m_LightTriangleMaxNum = 0;
+    uint32_t m_LastSelectedTest = uint32_t(-1);
+    uint32_t m_TestNum = uint32_t(-1);
+    uint32_t m_TimestampQuerySize = 0;
+    uint32_t m_GpuPassMask = 0;
+    uint32_t m_BenchmarkWarmupFrameNum = 120;
+    uint32_t m_BenchmarkMeasureFrameNum = 240;
+    uint32_t m_BenchmarkTestNum = 0;
+    uint32_t m_BenchmarkRunFrame = 0;
+    uint32_t m_FrameInFlightNum = FRAMES_IN_FLIGHT_MIN_NUM;
+    int32_t m_PinnedDenoiser = DENOISER_MAX_NUM; // none
+    uint32_t m_StaticInstanceDataMask = 0; // frames with up-to-date static instances in "Buffer::InstanceData", if host visible
+    uint32_t m_InstanceDataFrameCapacity = 0;
+    uint32_t m_BenchmarkMeasureStart = 0;
+    uint32_t m_SampleBudgetFrameNum = 0; // consecutive frames with the sample budget passes
+    uint32_t m_PhysicalDeviceNum = 1; // GPUs sharing ray tracing, > 1 only with "--multiGpu"
+    uint32_t m_DlssQualityRequest = uint32_t(-1); // set by the UI, applied after it
+    uint32_t m_CpuTraceFrameNum = 0; // "--cpuTrace"
+    uint32_t m_CaptureTargetMask = 0; // "1 << CaptureTarget"
+    uint32_t m_CaptureFrameNum = 16; // per test
+    uint32_t m_CaptureTest = uint32_t(-1); // none yet
+    uint32_t m_CaptureRunFrame = 0;
+    uint32_t m_CaptureRenderedFrameNum = 0;
+    uint32_t m_CapturedFrameNum = 0; // read back
+    uint32_t m_QualityReferenceFrameNum = 1024;
+    uint32_t m_QualityTest = uint32_t(-1); // none yet
+    uint32_t m_QualityConfig = 0; // uint32_t(-1) - the reference
+    uint32_t m_QualityRunFrame = 0;
+    uint32_t m_QualityRunFrameNum = 0;
+    float m_ResolutionScale = 1.0f;
+    float m_MinResolutionScale = 50.0f;
+    float m_GpuBudget = 16.6f; // ms
+    float m_GpuPassPixelRatio = 1.0f;
+    float m_DrsFullResolutionCost = 0.0f; // ms
+    float m_DrsFixedCost = 0.0f; // ms
+    bool m_HasTransparentObjects = false;
+    bool m_ShowUi = true;
+    bool m_AmbientInComposition = true; // TODO: only to WAR unsupported AO / SO in non-REBLUR
+    bool m_ForceHistoryReset = false;
+    bool m_IsDlssHistoryReset = false; // cached DLSS features keep stale history
+    bool m_ShowGpuProfiler = false;
+    bool m_ShowCpuProfiler = false;
+    bool m_DynamicResolution = false;
+    bool m_IsGpuPassTimesUpdated = false;
+    bool m_Benchmark = false;
+    bool m_IsAsyncCompute = false;
+    bool m_IsLowLatency = false;
+    bool m_IsInstanceDataHostVisible = false;
+    bool m_IsCompactResources = false;
+    bool m_IsRaySorting = false;
+    bool m_IsCompositionFused = false;
+    bool m_IsAdaptiveSampling = false;
+    bool m_IsTextureResidency = false;
+    bool m_IsCompactPrimitiveData = false;
+    bool m_IsSceneCached = false;
+    bool m_IsMultiGpu = false;
+    bool m_IsCapture = false;
+    bool m_IsCaptureFrame = false;
+    bool m_IsCaptureFinished = false;
+    bool m_IsQuality = false;
+    bool m_IsQualityReferenceUpload = false; // the cached reference gets copied in this frame
+    bool m_IsQualityReferenceFrame = false; // the reference gets stored and read back in this frame
+    bool m_IsQualityMetricsFrame = false;
+    bool m_IsOcclusionOnly = false;
+    bool m_IsNrdCombined = true;
+    bool m_IsStaticInstancesDirty = true;
+    bool m_StaticInstancesEmission = false;
+    bool m_HasStaticTransparentObjects = false;
+};
+
+Sample::~Sample()
+{
+    NRI.WaitForIdle(*m_CommandQueue);
+    if (m_IsAsyncCompute)
+        NRI.WaitForIdle(*m_ComputeQueue);
+
+    if (m_CaptureBuffer)
+    {
+        // Frames in flight are done, their slices can be read back right away
+        for (uint32_t i = 0; i < m_FrameInFlightNum; i++)
+            ReadCapture(i);
+
+        m_CaptureWriter.WaitIdle();
+
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_CaptureStartTime).count();
+        printf("Capture: %u frames (%u rendered), %u files, %.1f MB in %.2f s, %.2f frames/s\n", m_CapturedFrameNum, m_CaptureRenderedFrameNum, m_CaptureWrittenFileNum.load(),
+            m_CaptureWrittenBytes.load() / (1024.0 * 1024.0), seconds, seconds > 0.0 ? m_CapturedFrameNum / seconds : 0.0);
+
+        if (m_CaptureFailedFileNum)
+            printf("Capture: %u files can't be written to '%s'!\n", m_CaptureFailedFileNum.load(), m_CaptureDirectory.c_str());
+    }
+
+    m_DLSS.Shutdown();
+
+    for (NrdInstance& reblur : m_Reblur)
+    {
+        if (reblur.integration)
+            reblur.integration->Destroy();
+    }
+
+    for (NrdInstance& relax : m_Relax)
+    {
+        if (relax.integration)
+            relax.integration->Destroy();
+    }
+
+    if (m_IsAsyncCompute)
+        m_Sigma.Destroy();
+
+    for (Frame& frame : m_Frames)
+    {
+        if (m_IsAsyncCompute)
+        {
+            NRI.DestroyCommandBuffer(*frame.computeCommandBuffer);
+            NRI.DestroyCommandAllocator(*frame.computeCommandAllocator);
+        }
+
+        for (uint32_t i = 1; i < m_PhysicalDeviceNum; i++)
+        {
+            NRI.DestroyCommandBuffer(*frame.peerCommandBuffers[i]);
+            NRI.DestroyCommandAllocator(*frame.peerCommandAllocators[i]);
+            NRI.DestroyDescriptor(*frame.peerConstantBufferDescriptors[i]);
+        }
+
+        for (nri::CommandBuffer*& commandBuffer : frame.commandBuffers)
+            NRI.DestroyCommandBuffer(*commandBuffer);
+        NRI.DestroyDeviceSemaphore(*frame.deviceSemaphore);
+        for (nri::CommandAllocator*& commandAllocator : frame.commandAllocators)
+            NRI.DestroyCommandAllocator(*commandAllocator);
+        NRI.DestroyDescriptor(*frame.globalConstantBufferDescriptor);
+    }
+
+    for (BackBuffer& backBuffer : m_SwapChainBuffers)
+    {
+        NRI.DestroyDescriptor(*backBuffer.colorAttachment);
+        NRI.DestroyFrameBuffer(*backBuffer.frameBufferUI);
+    }
+
+    for (uint32_t i = 0; i < m_Textures.size(); i++)
+        NRI.DestroyTexture(*m_Textures[i]);
+
+    for (DataTextureTwin& twin : m_DataTextureTwins)
+    {
+        NRI.DestroyDescriptor(*twin.textureView);
+        NRI.DestroyDescriptor(*twin.storageView);
+        NRI.DestroyTexture(*twin.resource);
+    }
+
+    if (m_UploadRing.data)
+        NRI.UnmapBuffer(*Get(Buffer::UploadRing));
+    if (m_InstanceData)
+        NRI.UnmapBuffer(*Get(Buffer::InstanceData));
+
+    for (uint32_t i = 0; i < m_Buffers.size(); i++)
+        NRI.DestroyBuffer(*m_Buffers[i]);
+
+    for (uint32_t i = 0; i < m_Descriptors.size(); i++)
+        NRI.DestroyDescriptor(*m_Descriptors[i]);
+
+    for (uint32_t i = 0; i < m_Pipelines.size(); i++)
+        NRI.DestroyPipeline(*m_Pipelines[i]);
+
+    for (uint32_t i = 0; i < m_PipelineLayouts.size(); i++)
+        NRI.DestroyPipelineLayout(*m_PipelineLayouts[i]);
+
+    for (uint32_t i = 0; i < m_BLASs.size(); i++)
+        NRI.DestroyAccelerationStructure(*m_BLASs[i]);
+
+    SetGpuTimingsDump(false);
+
+    NRI.DestroyQueryPool(*m_TimestampQueryPool);
+    NRI.DestroyBuffer(*m_TimestampBuffer);
+    if (m_MipFeedbackBuffer)
+        NRI.DestroyBuffer(*m_MipFeedbackBuffer);
+    if (m_SampleSumBuffer)
+        NRI.DestroyBuffer(*m_SampleSumBuffer);
+    if (m_CaptureBuffer)
+        NRI.DestroyBuffer(*m_CaptureBuffer);
+    if (m_QualityReadbackBuffer)
+        NRI.DestroyBuffer(*m_QualityReadbackBuffer);
+    if (m_QualityUploadBuffer)
+        NRI.DestroyBuffer(*m_QualityUploadBuffer);
+    NRI.DestroyDescriptorPool(*m_DescriptorPool);
+    NRI.DestroyAccelerationStructure(*m_WorldTlas);
+    NRI.DestroyQueueSemaphore(*m_BackBufferAcquireSemaphore);
+    NRI.DestroyQueueSemaphore(*m_BackBufferReleaseSemaphore);
+
+    if (m_IsAsyncCompute)
+    {
+        NRI.DestroyQueueSemaphore(*m_RaytracingSemaphore);
+        NRI.DestroyQueueSemaphore(*m_ShadowDenoisingSemaphore);
+    }
+
+    for (uint32_t i = 1; i < m_PhysicalDeviceNum; i++)
+    {
+        NRI.DestroyQueueSemaphore(*m_PeerRaytracingSemaphores[i]);
+        NRI.DestroyQueueSemaphore(*m_PeerHistorySemaphores[i]);
+    }
+    NRI.DestroySwapChain(*m_SwapChain);
+
+    for (size_t i = 0; i < m_MemoryAllocations.size(); i++)
+        NRI.FreeMemory(*m_MemoryAllocations[i]);
+
+    for (const ResidentTexture& residentTexture : m_ResidentTextures)
+    {
+        if (residentTexture.memory)
+            NRI.FreeMemory(*residentTexture.memory);
+    }
+
+    for (const RetiredTexture& retiredTexture : m_RetiredTextures)
+    {
+        NRI.DestroyDescriptor(*retiredTexture.descriptor);
+        NRI.DestroyTexture(*retiredTexture.texture);
+        NRI.FreeMemory(*retiredTexture.memory);
+    }
+
+    DestroyUserInterface();
+
+    nri::DestroyDevice(*m_Device);
+}
+
+bool Sample::Initialize(nri::GraphicsAPI graphicsAPI)
+{
+    SetupDriverShaderCache();
+
+    nri::PhysicalDeviceGroup physicalDeviceGroup = {};
+    if (!helper::FindPhysicalDeviceGroup(physicalDeviceGroup))
+        return false;
+
+    nri::DeviceCreationDesc deviceCreationDesc = {};
+    deviceCreationDesc.graphicsAPI = graphicsAPI;
+    deviceCreationDesc.enableAPIValidation = m_DebugAPI;
+    deviceCreationDesc.enableNRIValidation = m_DebugNRI;
+    deviceCreationDesc.spirvBindingOffsets = SPIRV_BINDING_OFFSETS;
+    deviceCreationDesc.physicalDeviceGroup = &physicalDeviceGroup;
+    DlssIntegration::SetupDeviceExtensions(deviceCreationDesc);
+    NRI_ABORT_ON_FAILURE( nri::CreateDevice(deviceCreationDesc, m_Device) );
+
+    NRI_ABORT_ON_FAILURE( nri::GetInterface(*m_Device, NRI_INTERFACE(nri::CoreInterface), (nri::CoreInterface*)&NRI) );
+    NRI_ABORT_ON_FAILURE( nri::GetInterface(*m_Device, NRI_INTERFACE(nri::SwapChainInterface), (nri::SwapChainInterface*)&NRI) );
+    NRI_ABORT_ON_FAILURE( nri::GetInterface(*m_Device, NRI_INTERFACE(nri::RayTracingInterface), (nri::RayTracingInterface*)&NRI) );
+    NRI_ABORT_ON_FAILURE( nri::GetInterface(*m_Device, NRI_INTERFACE(nri::HelperInterface), (nri::HelperInterface*)&NRI) );
+
+    NRI_ABORT_ON_FAILURE( NRI.GetCommandQueue(*m_Device, nri::CommandQueueType::GRAPHICS, m_CommandQueue));
+    NRI_ABORT_ON_FAILURE( NRI.CreateQueueSemaphore(*m_Device, m_BackBufferAcquireSemaphore));
+    NRI_ABORT_ON_FAILURE( NRI.CreateQueueSemaphore(*m_Device, m_BackBufferReleaseSemaphore));
+
+    if (m_IsMultiGpu)
+    {
+        // Peer GPUs only trace their bands, features with per frame GPU state beyond ray tracing outputs stay on a single GPU
+        m_PhysicalDeviceNum = Min(NRI.GetDeviceDesc(*m_Device).physicalDeviceNum, MULTI_GPU_MAX_NUM);
+        if (m_PhysicalDeviceNum > 1)
+        {
+            for (uint32_t i = 1; i < m_PhysicalDeviceNum; i++)
+            {
+                NRI_ABORT_ON_FAILURE( NRI.CreateQueueSemaphore(*m_Device, m_PeerRaytracingSemaphores[i]));
+                NRI_ABORT_ON_FAILURE( NRI.CreateQueueSemaphore(*m_Device, m_PeerHistorySemaphores[i]));
+            }
+
+            if (m_IsAsyncCompute || m_IsRaySorting || m_IsAdaptiveSampling || m_IsTextureResidency)
+                printf("Multi-GPU: async compute, ray sorting, adaptive sampling and texture residency are not supported, disabled!\n");
+
+            m_IsAsyncCompute = false;
+            m_IsRaySorting = false;
+            m_IsAdaptiveSampling = false;
+            m_IsTextureResidency = false;
+
+            printf("Multi-GPU: ray tracing is split across %u GPUs\n", m_PhysicalDeviceNum);
+        }
+        else
+        {
+            m_IsMultiGpu = false;
+            m_PhysicalDeviceNum = 1;
+            printf("Multi-GPU: the device group has a single GPU, disabled!\n");
+        }
+    }
+
+    if (m_IsAsyncCompute)
+    {
+        // D3D11 has no compute queue
+        if (NRI.GetCommandQueue(*m_Device, nri::CommandQueueType::COMPUTE, m_ComputeQueue) == nri::Result::SUCCESS && m_ComputeQueue != m_CommandQueue)
+        {
+            NRI_ABORT_ON_FAILURE( NRI.CreateQueueSemaphore(*m_Device, m_RaytracingSemaphore));
+            NRI_ABORT_ON_FAILURE( NRI.CreateQueueSemaphore(*m_Device, m_ShadowDenoisingSemaphore));
+        }
+        else
+        {
+            m_IsAsyncCompute = false;
+            printf("Async compute: compute queue is not available, disabled!\n");
+        }
+    }
+
+    m_DeviceDesc = &NRI.GetDeviceDesc(*m_Device);
+    m_ConstantBufferSize = helper::GetAlignedSize(sizeof(GlobalConstantBufferData), m_DeviceDesc->constantBufferOffsetAlignment);
+    m_OutputResolution = uint2(GetWindowWidth(), GetWindowHeight());
+    m_ScreenResolution = m_OutputResolution;
+    m_Frames.resize(m_FrameInFlightNum);
+
+    // Scene import and texture decoding don't touch the device, overlap them with DLSS, NRD and swap chain creation. Everything depending on the scene waits for "join"
+    std::thread sceneLoader(&Sample::LoadScene, this);
+
+    // Per instance CPU work (animation, transform inversion and packing) goes wide, the main thread takes one share
+    m_WorkerPool.Initialize(Max(std::thread::hardware_concurrency(), 1u) - 1);
+
+    // The reference is a plain accumulation at the output resolution, DLSS would be measured against itself
+    if (m_IsQuality && m_DlssQuality != uint32_t(-1))
+    {
+        printf("Quality: DLSS is not supported, disabled!\n");
+        m_DlssQuality = uint32_t(-1);
+    }
+
+    if (m_DlssQuality != uint32_t(-1))
+    {
+        if (m_DLSS.InitializeLibrary(*m_Device, ""))
+        {
+            // Features of all supported qualities get created (and cached) upfront, textures and NRD instances get the largest render resolution. Switching the quality is free then
+            DlssInitDesc dlssInitDesc = {};
+            dlssInitDesc.outputResolution = {m_OutputResolution.x, m_OutputResolution.y};
+            dlssInitDesc.isContentHDR = true;
+
+            uint2 renderResolutionMax = {};
+            for (uint32_t i = 0; i < (uint32_t)DlssQuality::MAX_NUM; i++)
+            {
+                DlssSettings dlssSettings = {};
+                dlssInitDesc.quality = (DlssQuality)i;
+                if (!m_DLSS.GetOptimalSettings(dlssInitDesc.outputResolution, dlssInitDesc.quality, dlssSettings) || !m_DLSS.Initialize(m_CommandQueue, dlssInitDesc))
+                    continue;
+
+                float sx = float(dlssSettings.minRenderResolution.Width) / float(dlssSettings.renderResolution.Width);
+                float sy = float(dlssSettings.minRenderResolution.Height) / float(dlssSettings.renderResolution.Height);
+                float minResolutionScale = sy > sx ? sy : sx;
+
+                m_DlssRenderResolutions[i] = {dlssSettings.renderResolution.Width, dlssSettings.renderResolution.Height};
+                m_DlssMinResolutionScales[i] = Floor(minResolutionScale * 100.0f + 0.99f);
+                renderResolutionMax = uint2(Max(renderResolutionMax.x, m_DlssRenderResolutions[i].x), Max(renderResolutionMax.y, m_DlssRenderResolutions[i].y));
+            }
+
+            if (m_DlssQuality < (uint32_t)DlssQuality::MAX_NUM && m_DLSS.SetQuality((DlssQuality)m_DlssQuality))
+            {
+                m_ScreenResolution = renderResolutionMax;
+                m_MinResolutionScale = m_DlssMinResolutionScales[m_DlssQuality];
+                m_DlssQualityRequest = m_DlssQuality;
+
+                printf("DLSS: render resolution (%u, %u), textures (%u, %u)\n", m_DlssRenderResolutions[m_DlssQuality].x, m_DlssRenderResolutions[m_DlssQuality].y, m_ScreenResolution.x, m_ScreenResolution.y);
+            }
+            else
+            {
+                m_DLSS.Shutdown();
+
+                printf("DLSS: unsupported mode!\n");
+            }
+        }
+    }
+
+    nri::Format swapChainFormat = nri::Format::UNKNOWN;
+    CreateCommandBuffers();
+    CreateQueryPools();
+    CreateSwapChain(swapChainFormat);
+
+    // SIGMA (async compute)
+    if (m_IsAsyncCompute)
+    {
+        const nrd::MethodDesc methodDescs[] =
+        {
+            { nrd::Method::SIGMA_SHADOW_TRANSLUCENCY, (uint16_t)m_ScreenResolution.x, (uint16_t)m_ScreenResolution.y },
+        };
+
+        nrd::DenoiserCreationDesc denoiserCreationDesc = {};
+        denoiserCreationDesc.requestedMethods = methodDescs;
+        denoiserCreationDesc.requestedMethodNum = helper::GetCountOf(methodDescs);
+
+        NRI_ABORT_ON_FALSE(m_Sigma.Initialize(*m_Device, NRI, NRI, denoiserCreationDesc));
+    }
+
+    // The pinned denoiser is created right away, otherwise the first frame creates the one in use
+    if (m_PinnedDenoiser != DENOISER_MAX_NUM)
+    {
+        m_Settings.denoiser = m_PinnedDenoiser;
+        GetDenoiser();
+    }
+
+    sceneLoader.join();
+
+    CreatePipelines();
+    CreateBottomLevelAccelerationStructures();
+    CreateTopLevelAccelerationStructure();
+    CreateResources(swapChainFormat);
+    CreateDescriptorSets();
+    UpdateShaderTable();
+    UploadStaticData();
+    CreateLightGeometry();
+    if (m_PhysicalDeviceNum > 1)
+        ReplicateStaticData();
+    SetupAnimatedObjects();
+
+    m_Camera.Initialize(m_Scene.aabb.GetCenter(), m_Scene.aabb.vMin, CAMERA_RELATIVE);
+
+    // Texture data stays alive until all streamed mips are uploaded (forever with texture residency, finer mips can be requested any time)
+    if (m_StreamedTextures.empty() && !m_IsTextureResidency)
+        m_Scene.UnloadResources();
+
+    m_DefaultSettings = m_Settings;
+
+    // The benchmark and capture replay the same tests
+    if (m_Benchmark || m_IsCapture)
+    {
+        FILE* fp = fopen(GetTestPath().c_str(), "rb");
+        if (fp)
+        {
+            fseek(fp, 0, SEEK_END);
+            m_BenchmarkTestNum = ftell(fp) / GetTestByteSize();
+            fclose(fp);
+        }
+
+        if (!m_BenchmarkTestNum)
+            printf("%s: no tests found in '%s'!\n", m_IsCapture ? "Capture" : "Benchmark", GetTestPath().c_str());
+
+        m_ShowUi = false;
+    }
+
+    if (m_IsCapture)
+    {
+        std::error_code error;
+        std::filesystem::create_directories(m_CaptureDirectory, error);
+
+        // Writing is IO bound, leave cores for recording
+        m_CaptureWriter.Initialize(Max(std::thread::hardware_concurrency() / 2, 1u), CAPTURE_PENDING_FILE_MAX_NUM);
+    }
+
+    return CreateUserInterface(*m_Device, NRI, NRI, m_OutputResolution.x, m_OutputResolution.y, swapChainFormat);
+}
+
+NrdIntegration& Sample::GetDenoiser()
+{
+    // Must be called on the main thread, creation of a new method set costs a frame
+    NrdInstance& denoiser = m_Settings.denoiser == REBLUR ? m_Reblur[(m_IsOcclusionOnly ? 2 : 0) + (m_IsNrdCombined ? 0 : 1)] : m_Relax[m_IsNrdCombined ? 0 : 1];
+    if (denoiser.integration)
+        return *denoiser.integration;
+
+    // History of the other denoiser is useless after a switch, don't hold both
+    DestroyDenoiser(m_Settings.denoiser == REBLUR ? RELAX : REBLUR);
+
+    const uint16_t w = (uint16_t)m_ScreenResolution.x;
+    const uint16_t h = (uint16_t)m_ScreenResolution.y;
+
+    std::vector<nrd::MethodDesc> methodDescs;
+    if (m_Settings.denoiser == REBLUR)
+    {
+        if (m_IsOcclusionOnly && m_IsNrdCombined)
+            methodDescs.push_back( {nrd::Method::REBLUR_DIFFUSE_SPECULAR_OCCLUSION, w, h} );
+        else if (m_IsOcclusionOnly)
+        {
+            methodDescs.push_back( {nrd::Method::REBLUR_DIFFUSE_OCCLUSION, w, h} );
+            methodDescs.push_back( {nrd::Method::REBLUR_SPECULAR_OCCLUSION, w, h} );
+        }
+        else if (m_IsNrdCombined)
+            methodDescs.push_back( {nrd::Method::REBLUR_DIFFUSE_SPECULAR, w, h} );
+        else
+        {
+            methodDescs.push_back( {nrd::Method::REBLUR_DIFFUSE, w, h} );
+            methodDescs.push_back( {nrd::Method::REBLUR_SPECULAR, w, h} );
+        }
+    }
+    else
+    {
+        if (m_IsNrdCombined)
+            methodDescs.push_back( {nrd::Method::RELAX_DIFFUSE_SPECULAR, w, h} );
+        else
+        {
+            methodDescs.push_back( {nrd::Method::RELAX_DIFFUSE, w, h} );
+            methodDescs.push_back( {nrd::Method::RELAX_SPECULAR, w, h} );
+        }
+    }
+
+    // SIGMA goes last, with async compute it's a separate instance (there is no SIGMA in REBLUR occlusion-only mode)
+    if (!m_IsAsyncCompute && !(m_Settings.denoiser == REBLUR && m_IsOcclusionOnly))
+        methodDescs.push_back( {nrd::Method::SIGMA_SHADOW_TRANSLUCENCY, w, h} );
+
+    nrd::DenoiserCreationDesc denoiserCreationDesc = {};
+    denoiserCreationDesc.requestedMethods = methodDescs.data();
+    denoiserCreationDesc.requestedMethodNum = helper::GetCountOf(methodDescs);
+
+    denoiser.integration = std::make_unique<NrdIntegration>(FRAMES_IN_FLIGHT_MAX_NUM);
+    NRI_ABORT_ON_FALSE( denoiser.integration->Initialize(*m_Device, NRI, NRI, denoiserCreationDesc) );
+    denoiser.memorySize = EstimateNrdMemorySize(denoiserCreationDesc);
+
+    printf("NRD: %s (%s, %s) created, ~%.1f MB\n", m_Settings.denoiser == REBLUR ? "REBLUR" : "RELAX", m_IsOcclusionOnly && m_Settings.denoiser == REBLUR ? "occlusion only" : "radiance",
+        m_IsNrdCombined ? "combined" : "separate", denoiser.memorySize / (1024.0 * 1024.0));
+
+    return *denoiser.integration;
+}
+
+void Sample::DestroyDenoiser(int32_t denoiser)
+{
+    NrdInstance* instances = denoiser == REBLUR ? m_Reblur.data() : m_Relax.data();
+    const uint32_t instanceNum = denoiser == REBLUR ? (uint32_t)m_Reblur.size() : (uint32_t)m_Relax.size();
+
+    uint64_t freedSize = 0;
+    bool isIdle = false;
+    for (uint32_t i = 0; i < instanceNum; i++)
+    {
+        NrdInstance& instance = instances[i];
+        if (!instance.integration)
+            continue;
+
+        // Frames in flight may still use the instance
+        if (!isIdle)
+        {
+            NRI.WaitForIdle(*m_CommandQueue);
+            isIdle = true;
+        }
+
+        instance.integration->Destroy();
+        instance.integration.reset();
+
+        freedSize += instance.memorySize;
+        instance.memorySize = 0;
+    }
+
+    if (isIdle)
+        printf("NRD: %s destroyed, ~%.1f MB freed\n", denoiser == REBLUR ? "REBLUR" : "RELAX", freedSize / (1024.0 * 1024.0));
+}
+
+inline uint32_t GetNrdFormatBytes(nrd::Format format)
+{
+    switch (format)
+    {
+        case nrd::Format::R8_UNORM:
+        case nrd::Format::R8_SNORM:
+        case nrd::Format::R8_UINT:
+        case nrd::Format::R8_SINT:
+            return 1;
+
+        case nrd::Format::RG8_UNORM:
+        case nrd::Format::RG8_SNORM:
+        case nrd::Format::RG8_UINT:
+        case nrd::Format::RG8_SINT:
+        case nrd::Format::R16_UNORM:
+        case nrd::Format::R16_SNORM:
+        case nrd::Format::R16_UINT:
+        case nrd::Format::R16_SINT:
+        case nrd::Format::R16_SFLOAT:
+            return 2;
+
+        case nrd::Format::RGBA16_UNORM:
+        case nrd::Format::RGBA16_SNORM:
+        case nrd::Format::RGBA16_UINT:
+        case nrd::Format::RGBA16_SINT:
+        case nrd::Format::RGBA16_SFLOAT:
+        case nrd::Format::RG32_UINT:
+        case nrd::Format::RG32_SINT:
+        case nrd::Format::RG32_SFLOAT:
+            return 8;
+
+        case nrd::Format::RGB32_UINT:
+        case nrd::Format::RGB32_SINT:
+        case nrd::Format::RGB32_SFLOAT:
+            return 12;
+
+        case nrd::Format::RGBA32_UINT:
+        case nrd::Format::RGBA32_SINT:
+        case nrd::Format::RGBA32_SFLOAT:
+            return 16;
+    }
+
+    return 4; // RGBA8, RG16, R32 and packed formats
+}
+
+uint64_t Sample::EstimateNrdMemorySize(const nrd::DenoiserCreationDesc& denoiserCreationDesc) const
+{
+    // A CPU-only denoiser object is enough to get pool descs. Alignment and padding are not taken into account
+    nrd::Denoiser* denoiser = nullptr;
+    if (nrd::CreateDenoiser(denoiserCreationDesc, denoiser) != nrd::Result::SUCCESS)
+        return 0;
+
+    const nrd::DenoiserDesc& denoiserDesc = nrd::GetDenoiserDesc(*denoiser);
+
+    uint64_t size = 0;
+    for (uint32_t pool = 0; pool < 2; pool++)
+    {
+        const nrd::TextureDesc* textureDescs = pool == 0 ? denoiserDesc.permanentPool : denoiserDesc.transientPool;
+        const uint32_t textureNum = pool == 0 ? denoiserDesc.permanentPoolSize : denoiserDesc.transientPoolSize;
+
+        for (uint32_t i = 0; i < textureNum; i++)
+        {
+            const nrd::TextureDesc& textureDesc = textureDescs[i];
+            const uint32_t w = (uint32_t)m_ScreenResolution.x / textureDesc.downsampleFactor;
+            const uint32_t h = (uint32_t)m_ScreenResolution.y / textureDesc.downsampleFactor;
+
+            for (uint32_t mip = 0; mip < textureDesc.mipNum; mip++)
+                size += uint64_t(Max(w >> mip, 1u)) * Max(h >> mip, 1u) * GetNrdFormatBytes(textureDesc.format);
+        }
+    }
+
+    nrd::DestroyDenoiser(*denoiser);
+
+    return size;
+}
+
+void Sample::SwitchNrdMode(bool isOcclusionOnly, bool isCombined)
+{
+    // Only the data format depends on the mode, both formats are always resident, so it's a matter of swapping pointers. Instances of the new method set get created by "GetDenoiser"
+    if (isOcclusionOnly != m_IsOcclusionOnly)
+    {
+        SwapDataTextureTwins();
+
+        // "onScreen" is an index into a shorter list in occlusion-only mode
+        m_Settings.onScreen = isOcclusionOnly ? Clamp(m_Settings.onScreen - 1, 0, 1) : m_Settings.onScreen + 1;
+    }
+
+    m_IsOcclusionOnly = isOcclusionOnly;
+    m_IsNrdCombined = isCombined;
+    m_ForceHistoryReset = true;
+}
+
+void Sample::InitCmdLine(cmdline::parser& cmdLine)
+{
+    cmdLine.add("benchmark", 0, "replay all tests of the scene with each denoiser, write a report and exit");
+    cmdLine.add<uint32_t>("warmupFrames", 0, "benchmark, capture, CPU trace: frames to let history converge before measuring, capturing or tracing", false, 120);
+    cmdLine.add<uint32_t>("measureFrames", 0, "benchmark: frames to measure per test and denoiser", false, 240, cmdline::range(1u, 100000u));
+    cmdLine.add("asyncCompute", 0, "denoise shadows (SIGMA) on a compute queue in parallel with REBLUR / RELAX");
+    cmdLine.add<uint32_t>("framesInFlight", 0, "frames the CPU can run ahead of the GPU", false, FRAMES_IN_FLIGHT_MIN_NUM, cmdline::range(FRAMES_IN_FLIGHT_MIN_NUM, FRAMES_IN_FLIGHT_MAX_NUM));
+    cmdLine.add("lowLatency", 0, "wait for the GPU before sampling input, not before recording");
+    cmdLine.add("compactResources", 0, "don't allocate and write direction / PDF denoiser inputs (REBLUR pre-pass is limited to \"simple\"), R11G11B10 DLSS output");
+    cmdLine.add("occlusionOnly", 0, "start with REBLUR in occlusion-only mode (can be toggled in the UI)");
+    cmdLine.add<std::string>("pinDenoiser", 0, "create only this denoiser (REBLUR or RELAX) at startup and disable switching", false, "");
+    cmdLine.add("separateMethods", 0, "start with separate diffuse and specular NRD methods instead of combined ones (can be toggled in the UI)");
+    cmdLine.add("sortRays", 0, "rpp 2+: trace secondary rays in a separate pass, sorted by direction and material");
+    cmdLine.add("adaptiveSampling", 0, "rpp 2+: distribute rays by noise of the previous frame, rpp is the average (can be toggled in the UI)");
+    cmdLine.add("fuseComposition", 0, "start with composition and TAA fused into one pass (can be toggled in the UI)");
+    cmdLine.add("textureResidency", 0, "keep only mips of material textures requested by ray tracing (GPU feedback) resident");
+    cmdLine.add<uint32_t>("textureBudget", 0, "texture residency: memory budget for material textures in MB, 0 - unlimited", false, 0);
+    cmdLine.add("multiGpu", 0, "split ray tracing into horizontal bands across GPUs of the device group, GPU 0 denoises and presents");
+    cmdLine.add("compactPrimitiveData", 0, "store quantized vertex attributes once and fetch them via an index buffer (~2x smaller primitive data)");
+    cmdLine.add("capture", 0, "render all tests of the scene offline (no presentation), read back targets, write them to files and exit");
+    cmdLine.add<uint32_t>("captureFrames", 0, "capture: frames written per test", false, 16, cmdline::range(1u, 100000u));
+    cmdLine.add<std::string>("captureTargets", 0, "capture: comma separated list of final, unfilteredDiff, unfilteredSpec, diff, spec, viewZ, normalRoughness, motion", false, "final,unfilteredDiff,unfilteredSpec,diff,spec,viewZ,normalRoughness,motion");
+    cmdLine.add<std::string>("captureDir", 0, "capture: output directory", false, "Capture");
+    cmdLine.add("quality", 0, "benchmark per test against an accumulated (cached) reference: GPU time, PSNR and SSIM of each denoiser x rpp x resolution scale");
+    cmdLine.add<std::string>("qualityRpp", 0, "quality: comma separated list of rays per pixel (0 - 0.5 rpp)", false, "0,1,2");
+    cmdLine.add<std::string>("qualityScales", 0, "quality: comma separated list of resolution scales in %", false, "100,75,50");
+    cmdLine.add<uint32_t>("qualityReferenceFrames", 0, "quality: frames accumulated into the reference", false, 1024, cmdline::range(1u, 100000u));
+    cmdLine.add<uint32_t>("cpuTrace", 0, "record CPU zones and GPU passes of N frames into 'CpuTrace.json' (Chrome trace format)", false, 0, cmdline::range(0u, 10000u));
+}
+
+void Sample::ReadCmdLine(cmdline::parser& cmdLine)
+{
+    m_Benchmark = cmdLine.exist("benchmark");
+    m_BenchmarkWarmupFrameNum = cmdLine.get<uint32_t>("warmupFrames");
+    m_BenchmarkMeasureFrameNum = cmdLine.get<uint32_t>("measureFrames");
+    m_IsAsyncCompute = cmdLine.exist("asyncCompute");
+    m_FrameInFlightNum = cmdLine.get<uint32_t>("framesInFlight");
+    m_IsLowLatency = cmdLine.exist("lowLatency");
+    m_IsCompactResources = cmdLine.exist("compactResources");
+    m_IsOcclusionOnly = cmdLine.exist("occlusionOnly");
+    m_IsNrdCombined = !cmdLine.exist("separateMethods");
+    m_IsRaySorting = cmdLine.exist("sortRays");
+    m_IsCompositionFused = cmdLine.exist("fuseComposition");
+    m_IsAdaptiveSampling = cmdLine.exist("adaptiveSampling");
+    m_IsTextureResidency = cmdLine.exist("textureResidency");
+    m_TextureBudget = cmdLine.get<uint32_t>("textureBudget");
+    m_IsCompactPrimitiveData = cmdLine.exist("compactPrimitiveData");
+    m_IsMultiGpu = cmdLine.exist("multiGpu");
+    m_IsCapture = cmdLine.exist("capture");
+    m_CaptureFrameNum = cmdLine.get<uint32_t>("captureFrames");
+    m_CaptureDirectory = cmdLine.get<std::string>("captureDir");
+
+    const std::string captureTargets = cmdLine.get<std::string>("captureTargets");
+    for (size_t begin = 0; begin < captureTargets.size();)
+    {
+        size_t end = captureTargets.find(',', begin);
+        if (end == std::string::npos)
+            end = captureTargets.size();
+
+        const std::string name = captureTargets.substr(begin, end - begin);
+        uint32_t target = 0;
+        while (target < (uint32_t)CaptureTarget::MAX_NUM && name != CAPTURE_TARGET_NAMES[target])
+            target++;
+
+        if (target < (uint32_t)CaptureTarget::MAX_NUM)
+            m_CaptureTargetMask |= 1 << target;
+        else if (!name.empty())
+            printf("Capture: unknown target '%s', skipped!\n", name.c_str());
+
+        begin = end + 1;
+    }
+
+    m_IsQuality = cmdLine.exist("quality");
+    m_QualityReferenceFrameNum = cmdLine.get<uint32_t>("qualityReferenceFrames");
+    if (m_IsQuality)
+        m_Benchmark = true;
+
+    for (uint32_t list = 0; list < 2; list++)
+    {
+        const std::string values = cmdLine.get<std::string>(list == 0 ? "qualityRpp" : "qualityScales");
+        for (size_t begin = 0; begin < values.size();)
+        {
+            size_t end = values.find(',', begin);
+            if (end == std::string::npos)
+                end = values.size();
+
+            const std::string value = values.substr(begin, end - begin);
+            if (!value.empty())
+            {
+                if (list == 0)
+                    m_QualityRpps.push_back(Clamp(atoi(value.c_str()), 0, QUALITY_REFERENCE_RPP));
+                else
+                    m_QualityScales.push_back(Clamp((float)atof(value.c_str()), 10.0f, 100.0f) * 0.01f);
+            }
+
+            begin = end + 1;
+        }
+    }
+
+    if (m_IsQuality && (m_QualityRpps.empty() || m_QualityScales.empty()))
+    {
+        printf("Quality: no configurations, disabled!\n");
+        m_IsQuality = false;
+        m_Benchmark = false;
+    }
+
+    m_CpuTraceFrameNum = cmdLine.get<uint32_t>("cpuTrace");
+#if !CPU_ZONES
+    if (m_CpuTraceFrameNum)
+        printf("CPU profiler: zones are compiled out, the trace has GPU passes only!\n");
+#endif
+
+    if (m_IsCapture && m_Benchmark)
+    {
+        printf("Capture: the benchmark is not supported, disabled!\n");
+        m_Benchmark = false;
+        m_IsQuality = false;
+    }
+
+    const std::string pinnedDenoiser = cmdLine.get<std::string>("pinDenoiser");
+    if (pinnedDenoiser == "REBLUR")
+        m_PinnedDenoiser = REBLUR;
+    else if (pinnedDenoiser == "RELAX")
+        m_PinnedDenoiser = RELAX;
+    else if (!pinnedDenoiser.empty())
+        printf("Unknown denoiser '%s', nothing is pinned!\n", pinnedDenoiser.c_str());
+}
+
+bool Sample::LoadTest(const std::string& path, uint32_t test)
+{
+    FILE* fp = fopen(path.c_str(), "rb");
+    bool isLoaded = false;
+
+    if (fp && fseek(fp, test * GetTestByteSize(), SEEK_SET) == 0)
+    {
+        fread(&m_Settings, sizeof(m_Settings), 1, fp);
+        fread(m_Camera.GetState(), Camera::GetStateSize(), 1, fp);
+
+        // Reset some settings to defaults to avoid a potential confusion
+        m_Settings.debug = 0.0f;
+        m_Settings.denoiser = REBLUR;
+        m_AmbientInComposition = true;
+        m_ForceHistoryReset = true;
+
+        isLoaded = true;
+    }
+
+    if (fp)
+        fclose(fp);
+
+    return isLoaded;
+}
+
+void Sample::UpdateBenchmark(uint32_t frameIndex)
+{
+    // Each run is "warmup + measure" frames. Then the GPU timings needing "m_FrameInFlightNum" frames to come back get drained
+    const uint32_t runFrameNum = m_BenchmarkWarmupFrameNum + m_BenchmarkMeasureFrameNum + m_FrameInFlightNum;
+
+    // Streamed textures change both the cost and the image, start measuring only when all mips are resident
+    if (m_BenchmarkRuns.empty() && !m_StreamedTextures.empty())
+        return;
+
+    if (m_BenchmarkRuns.empty() || m_BenchmarkRunFrame == runFrameNum)
+    {
+        const uint32_t runIndex = helper::GetCountOf(m_BenchmarkRuns);
+        const uint32_t denoiserNum = m_PinnedDenoiser == DENOISER_MAX_NUM ? DENOISER_MAX_NUM : 1;
+        const uint32_t test = runIndex / denoiserNum;
+
+        if (test >= m_BenchmarkTestNum || !LoadTest(GetTestPath(), test))
+        {
+            WriteBenchmarkReport();
+
+            m_Benchmark = false;
+            m_FrameNum = frameIndex + 1;
+
+            return;
+        }
+
+        m_Settings.denoiser = m_PinnedDenoiser == DENOISER_MAX_NUM ? runIndex % DENOISER_MAX_NUM : m_PinnedDenoiser;
+        m_Settings.limitFps = false;
+
+        m_BenchmarkRuns.emplace_back();
+        BenchmarkRun& run = m_BenchmarkRuns.back();
+        run.test = test;
+        run.denoiser = m_Settings.denoiser;
+        run.cpuFrameTimes.reserve(m_BenchmarkMeasureFrameNum);
+
+        m_BenchmarkRunFrame = 0;
+        m_BenchmarkMeasureStart = frameIndex + m_BenchmarkWarmupFrameNum;
+
+        printf("Benchmark: test %u / %u, %s\n", test + 1, m_BenchmarkTestNum, m_Settings.denoiser == REBLUR ? "REBLUR" : "RELAX");
+    }
+
+    // Elapsed time belongs to the previous frame
+    if (frameIndex > m_BenchmarkMeasureStart && frameIndex <= m_BenchmarkMeasureStart + m_BenchmarkMeasureFrameNum)
+        m_BenchmarkRuns.back().cpuFrameTimes.push_back(m_Timer.GetElapsedTime());
+
+    m_BenchmarkRunFrame++;
+}
+
+void Sample::UpdateQuality(uint32_t frameIndex)
+{
+    // Per test: the reference ("m_QualityReferenceFrameNum" frames, unless cached), then a benchmark run per configuration. Metrics are taken on the first frame
+    // after the measured ones and need "m_FrameInFlightNum" frames to come back, + 1 to be read before the next run starts (or the report gets written)
+    m_IsQualityReferenceUpload = false;
+    m_IsQualityReferenceFrame = false;
+    m_IsQualityMetricsFrame = false;
+
+    // Streamed textures change both the cost and the image, start only when all mips are resident
+    if (m_QualityTest == uint32_t(-1) && !m_StreamedTextures.empty())
+        return;
+
+    const uint32_t denoiserNum = m_PinnedDenoiser == DENOISER_MAX_NUM ? DENOISER_MAX_NUM : 1;
+    const uint32_t rppNum = helper::GetCountOf(m_QualityRpps);
+    const uint32_t scaleNum = helper::GetCountOf(m_QualityScales);
+    const uint32_t configNum = denoiserNum * rppNum * scaleNum;
+
+    if (m_QualityTest == uint32_t(-1) || m_QualityRunFrame == m_QualityRunFrameNum)
+    {
+        if (m_QualityTest == uint32_t(-1) || m_QualityConfig + 1 == configNum)
+        {
+            m_QualityTest++;
+            m_QualityConfig = uint32_t(-1);
+        }
+        else
+            m_QualityConfig++;
+
+        if (m_QualityTest >= m_BenchmarkTestNum || !LoadTest(GetTestPath(), m_QualityTest))
+        {
+            WriteBenchmarkReport();
+
+            m_Benchmark = false;
+            m_FrameNum = frameIndex + 1;
+
+            return;
+        }
+
+        // The reference and the configurations must see the same image
+        m_Settings.limitFps = false;
+        m_Settings.pauseAnimation = true;
+        m_Settings.motionStartTime = 0.0;
+        m_Settings.separator = 0.0f;
+        m_DynamicResolution = false;
+
+        if (m_QualityConfig == uint32_t(-1) && LoadQualityReference(m_QualityTest))
+        {
+            m_IsQualityReferenceUpload = true;
+            m_QualityConfig = 0;
+        }
+
+        if (m_QualityConfig == uint32_t(-1))
+        {
+            m_Settings.denoiser = REBLUR;
+            m_Settings.nrdSettings.referenceAccumulation = true;
+            m_Settings.specularLobeTrimming = false;
+            m_Settings.TAA = false;
+            m_Settings.rpp = QUALITY_REFERENCE_RPP;
+            m_ResolutionScale = 1.0f;
+
+            m_QualityRunFrameNum = m_QualityReferenceFrameNum;
+
+            printf("Quality: test %u / %u, accumulating the reference (%u frames)\n", m_QualityTest + 1, m_BenchmarkTestNum, m_QualityReferenceFrameNum);
+        }
+        else
+        {
+            m_Settings.denoiser = m_PinnedDenoiser == DENOISER_MAX_NUM ? int32_t(m_QualityConfig / (rppNum * scaleNum)) : m_PinnedDenoiser;
+            m_Settings.nrdSettings.referenceAccumulation = false;
+            m_Settings.rpp = m_QualityRpps[(m_QualityConfig / scaleNum) % rppNum];
+            m_ResolutionScale = m_QualityScales[m_QualityConfig % scaleNum];
+
+            m_BenchmarkRuns.emplace_back();
+            BenchmarkRun& run = m_BenchmarkRuns.back();
+            run.test = m_QualityTest;
+            run.denoiser = m_Settings.denoiser;
+            run.rpp = m_Settings.rpp;
+            run.resolutionScale = m_ResolutionScale;
+            run.cpuFrameTimes.reserve(m_BenchmarkMeasureFrameNum);
+
+            m_BenchmarkMeasureStart = frameIndex + m_BenchmarkWarmupFrameNum;
+            m_QualityRunFrameNum = m_BenchmarkWarmupFrameNum + m_BenchmarkMeasureFrameNum + m_FrameInFlightNum + 1;
+
+            printf("Quality: test %u / %u, %s, %.1f rpp, %.0f%% resolution\n", m_QualityTest + 1, m_BenchmarkTestNum, m_Settings.denoiser == REBLUR ? "REBLUR" : "RELAX",
+                m_Settings.rpp == 0 ? 0.5f : float(m_Settings.rpp), m_ResolutionScale * 100.0f);
+        }
+
+        m_QualityRunFrame = 0;
+    }
+
+    if (m_QualityConfig == uint32_t(-1))
+        m_IsQualityReferenceFrame = m_QualityRunFrame + 1 == m_QualityRunFrameNum;
+    else
+    {
+        m_IsQualityMetricsFrame = frameIndex == m_BenchmarkMeasureStart + m_BenchmarkMeasureFrameNum;
+
+        // Elapsed time belongs to the previous frame
+        if (frameIndex > m_BenchmarkMeasureStart && frameIndex <= m_BenchmarkMeasureStart + m_BenchmarkMeasureFrameNum)
+            m_BenchmarkRuns.back().cpuFrameTimes.push_back(m_Timer.GetElapsedTime());
+    }
+
+    m_QualityRunFrame++;
+}
+
+void Sample::ReadQuality(uint32_t bufferedFrameIndex)
+{
+    // Called after waiting for the frame which used this slot
+    QualitySlot& slot = m_QualitySlots[bufferedFrameIndex];
+
+    if (slot.referenceTest)
+    {
+        const void* data = NRI.MapBuffer(*m_QualityReadbackBuffer, m_QualityMetricsSize * m_FrameInFlightNum, GetQualityReferenceSize());
+        SaveQualityReference(slot.referenceTest - 1, data);
+        NRI.UnmapBuffer(*m_QualityReadbackBuffer);
+    }
+
+    if (slot.run)
+    {
+        const uint32_t* metrics = (const uint32_t*)NRI.MapBuffer(*m_QualityReadbackBuffer, bufferedFrameIndex * m_QualityMetricsSize, m_QualityMetricsSize);
+
+        // Tile sums: squared error, SSIM (floats), pixel and block counts
+        double errorSum = 0.0;
+        double ssimSum = 0.0;
+        uint64_t pixelNum = 0;
+        uint64_t blockNum = 0;
+
+        const uint64_t tileNum = m_QualityMetricsSize / (4 * sizeof(uint32_t));
+        for (uint64_t i = 0; i < tileNum; i++)
+        {
+            const uint32_t* tile = metrics + i * 4;
+            errorSum += *(const float*)(tile + 0);
+            ssimSum += *(const float*)(tile + 1);
+            pixelNum += tile[2];
+            blockNum += tile[3];
+        }
+
+        NRI.UnmapBuffer(*m_QualityReadbackBuffer);
+
+        // PSNR of identical images is infinite, capped
+        const double mse = pixelNum ? errorSum / double(pixelNum) : 0.0;
+
+        BenchmarkRun& run = m_BenchmarkRuns[slot.run - 1];
+        run.psnr = mse > 1e-10 ? float( 10.0 * log10(1.0 / mse) ) : 100.0f;
+        run.ssim = blockNum ? float( ssimSum / double(blockNum) ) : 0.0f;
+
+        printf("Quality: PSNR %.2f dB, SSIM %.4f\n", run.psnr, run.ssim);
+    }
+
+    slot = {};
+}
+
+void Sample::WriteBenchmarkReport() const
+{
+    const std::string sceneName = std::string( utils::GetFileName(m_SceneFile) );
+    std::string reportName = sceneName;
+    size_t dotPos = reportName.find_last_of(".");
+    if (dotPos != std::string::npos)
+        reportName.resize(dotPos);
+    reportName = (m_IsQuality ? "Quality_" : "Benchmark_") + reportName;
+
+    const std::string jsonPath = reportName + ".json";
+    const std::string csvPath = reportName + ".csv";
+
+    FILE* json = fopen(jsonPath.c_str(), "w");
+    FILE* csv = fopen(csvPath.c_str(), "w");
+    if (!json || !csv)
+    {
+        printf("Benchmark: can't write the report!\n");
+
+        if (json)
+            fclose(json);
+        if (csv)
+            fclose(csv);
+
+        return;
+    }
+
+    fprintf(json, "{\n");
+    fprintf(json, "  \"scene\": \"%s\",\n", sceneName.c_str());
+    fprintf(json, "  \"outputResolution\": [%u, %u],\n", m_OutputResolution.x, m_OutputResolution.y);
+    fprintf(json, "  \"renderResolution\": [%u, %u],\n", GetRectSize().x, GetRectSize().y);
+    fprintf(json, "  \"warmupFrames\": %u,\n", m_BenchmarkWarmupFrameNum);
+    fprintf(json, "  \"measureFrames\": %u,\n", m_BenchmarkMeasureFrameNum);
+    if (m_IsQuality)
+        fprintf(json, "  \"referenceFrames\": %u,\n", m_QualityReferenceFrameNum);
+    fprintf(json, "  \"runs\": [\n");
+
+    // Quality: configuration and image metrics are repeated in every row of the run
+    fprintf(csv, "Test,Denoiser,%sMetric,Mean (ms),P50 (ms),P95 (ms),P99 (ms)\n", m_IsQuality ? "Rpp,Resolution scale (%),PSNR (dB),SSIM," : "");
+
+    for (size_t r = 0; r < m_BenchmarkRuns.size(); r++)
+    {
+        const BenchmarkRun& run = m_BenchmarkRuns[r];
+        const char* denoiser = run.denoiser == REBLUR ? "REBLUR" : "RELAX";
+
+        fprintf(json, "    {\n");
+        fprintf(json, "      \"test\": %u,\n", run.test + 1);
+        fprintf(json, "      \"denoiser\": \"%s\",\n", denoiser);
+
+        char config[128] = {};
+        if (m_IsQuality)
+        {
+            const float rpp = run.rpp == 0 ? 0.5f : float(run.rpp);
+
+            fprintf(json, "      \"rpp\": %.1f,\n", rpp);
+            fprintf(json, "      \"resolutionScale\": %.2f,\n", run.resolutionScale);
+            fprintf(json, "      \"psnr\": %.4f,\n", run.psnr);
+            fprintf(json, "      \"ssim\": %.4f,\n", run.ssim);
+
+            snprintf(config, sizeof(config), "%.1f,%.0f,%.4f,%.4f,", rpp, run.resolutionScale * 100.0f, run.psnr, run.ssim);
+        }
+
+        TimingStats stats = GetTimingStats(run.cpuFrameTimes);
+        fprintf(json, "      \"cpuFrame\": { \"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f },\n", stats.mean, stats.p50, stats.p95, stats.p99);
+        fprintf(csv, "%u,%s,%sCPU frame,%.4f,%.4f,%.4f,%.4f\n", run.test + 1, denoiser, config, stats.mean, stats.p50, stats.p95, stats.p99);
+
+        fprintf(json, "      \"gpu\": {");
+        bool isFirst = true;
+        for (uint32_t i = 0; i < (uint32_t)GpuPass::MAX_NUM; i++)
+        {
+            if (run.gpuPassTimes[i].empty())
+                continue;
+
+            stats = GetTimingStats(run.gpuPassTimes[i]);
+            fprintf(json, "%s\n        \"%s\": { \"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f }", isFirst ? "" : ",", GPU_PASS_NAMES[i], stats.mean, stats.p50, stats.p95, stats.p99);
+            fprintf(csv, "%u,%s,%sGPU %s,%.4f,%.4f,%.4f,%.4f\n", run.test + 1, denoiser, config, GPU_PASS_NAMES[i], stats.mean, stats.p50, stats.p95, stats.p99);
+            isFirst = false;
+        }
+        fprintf(json, "\n      }\n");
+        fprintf(json, "    }%s\n", r + 1 == m_BenchmarkRuns.size() ? "" : ",");
+    }
+
+    fprintf(json, "  ]\n");
+    fprintf(json, "}\n");
+
+    fclose(json);
+    fclose(csv);
+
+    printf("Benchmark: report saved to '%s' and '%s'\n", jsonPath.c_str(), csvPath.c_str());
+}
+
+void Sample::UpdateCapture(uint32_t frameIndex)
+{
+    // Each test is "warmup + capture" frames
+    m_IsCaptureFrame = false;
+
+    // Streamed textures change the image, start capturing only when all mips are resident
+    if (m_IsCaptureFinished || (m_CaptureTest == uint32_t(-1) && !m_StreamedTextures.empty()))
+        return;
+
+    if (m_CaptureTest == uint32_t(-1) || m_CaptureRunFrame == m_BenchmarkWarmupFrameNum + m_CaptureFrameNum)
+    {
+        if (m_CaptureTest == uint32_t(-1))
+            m_CaptureStartTime = std::chrono::steady_clock::now();
+
+        m_CaptureTest++;
+        if (m_CaptureTest >= m_BenchmarkTestNum || !LoadTest(GetTestPath(), m_CaptureTest))
+        {
+            // Frames in flight get read back on exit
+            m_IsCaptureFinished = true;
+            m_FrameNum = frameIndex + 1;
+
+            return;
+        }
+
+        m_Settings.limitFps = false;
+        m_CaptureRunFrame = 0;
+
+        printf("Capture: test %u / %u\n", m_CaptureTest + 1, m_BenchmarkTestNum);
+    }
+
+    m_IsCaptureFrame = m_CaptureRunFrame >= m_BenchmarkWarmupFrameNum && m_CaptureBuffer;
+    m_CaptureRunFrame++;
+    m_CaptureRenderedFrameNum++;
+}
+
+void Sample::SetupAnimatedObjects()
+{
+    const float3 maxSize = Abs(m_Scene.aabb.vMax) + Abs(m_Scene.aabb.vMin);
+
+    Rand::Seed(106937, &m_FastRandState);
+
+    for (uint32_t i = 0; i < ANIMATED_INSTANCE_MAX_NUM; i++)
+    {
+        uint32_t instanceIndex = i % m_DefaultInstancesOffset;
+        float3 tmpPosition = Rand::uf3(&m_FastRandState) * maxSize - Abs(m_Scene.aabb.vMin);
+
+        AnimatedInstance tmpAnimatedInstance = {};
+        tmpAnimatedInstance.instanceID = helper::GetCountOf(m_Scene.instances);
+        tmpAnimatedInstance.position = ToDouble( tmpPosition );
+        tmpAnimatedInstance.basePosition = tmpAnimatedInstance.position;
+        tmpAnimatedInstance.animation.durationSec = Rand::uf1(&m_FastRandState) * 10.0f + 5.0f;
+        tmpAnimatedInstance.animation.progressedSec = tmpAnimatedInstance.animation.durationSec * Rand::uf1(&m_FastRandState);
+        tmpAnimatedInstance.animation.rotationAxis = Normalize( Rand::sf3(&m_FastRandState) + 1e-6f );
+        tmpAnimatedInstance.animation.elipseAxis = Rand::sf3(&m_FastRandState) * 5.0f;
+        tmpAnimatedInstance.animation.inverseDirection = Sign( Rand::sf1(&m_FastRandState) );
+        tmpAnimatedInstance.animation.inverseRotation = Sign( Rand::sf1(&m_FastRandState) );
+        m_AnimatedInstances.push_back(tmpAnimatedInstance);
+
+        const utils::Instance& tmpInstance = m_Scene.instances[instanceIndex];
+        m_Scene.instances.push_back(tmpInstance);
+    }
+}
+
+void Sample::PrepareFrame(uint32_t frameIndex)
+{
+    // The previous frame is complete here (zones of recording jobs included)
+    m_CpuProfiler.BeginFrame(frameIndex);
+    if (m_CpuProfiler.IsTraceReady())
+    {
+        const char* fileName = "CpuTrace.json";
+        if (m_CpuProfiler.WriteTrace(fileName))
+            printf("CPU profiler: trace saved to '%s'\n", fileName);
+        else
+            printf("CPU profiler: can't open '%s'!\n", fileName);
+    }
+    if (m_CpuTraceFrameNum && frameIndex == m_BenchmarkWarmupFrameNum)
+        m_CpuProfiler.StartTrace(m_CpuTraceFrameNum);
+
+    CPU_ZONE("PrepareFrame");
+
+    // Low latency: the CPU can't run ahead while the slot is busy, stall before the input gets sampled rather than after
+    if (m_IsLowLatency)
+        WaitForFrame(frameIndex);
+
+    const float sceneRadius = m_Scene.aabb.GetRadius() / m_Settings.meterToUnitsMultiplier;
+
+    m_PrevSettings = m_Settings;
+    m_Camera.SavePreviousState();
+
+    // Offline capture never presents, i.e. there is no UI to build
+    if (!m_IsCapture)
+        PrepareUserInterface();
+
+    if (IsKeyToggled(Key::Space))
+        m_Settings.pauseAnimation = !m_Settings.pauseAnimation;
+    if (IsKeyToggled(Key::F1))
+        m_ShowUi = !m_ShowUi;
+    if (IsKeyToggled(Key::F2) && m_PinnedDenoiser == DENOISER_MAX_NUM)
+        m_Settings.denoiser = (m_Settings.denoiser + 1) % DENOISER_MAX_NUM;
+    if (IsKeyToggled(Key::F3))
+        m_Settings.debug = Step(0.5f, 1.0f - m_Settings.debug);
+
+    float avgFrameTime = m_Timer.GetVerySmoothedElapsedTime();
+
+    if (m_Benchmark && m_IsQuality)
+        UpdateQuality(frameIndex);
+    else if (m_Benchmark)
+        UpdateBenchmark(frameIndex);
+
+    if (m_IsCapture)
+        UpdateCapture(frameIndex);
+
+    if (m_DynamicResolution)
+        UpdateDynamicResolution();
+
+    m_ResolutionScale *= 100.0f;
+
+    if (!IsKeyPressed(Key::LAlt) && m_ShowUi)
+    {
+        CPU_ZONE("ImGui");
+
+        ImGui::SetNextWindowPos(ImVec2(5.0f, 5.0f), ImGuiCond_Once);
+        ImGui::SetNextWindowSize(ImVec2(0.0f, 0.0f));
+        ImGui::Begin("Settings (F1 - hide)", nullptr, ImGuiWindowFlags_NoSavedSettings | ImGuiWindowFlags_NoResize);
+        {
+            char avg[64];
+            snprintf(avg, sizeof(avg), "%.1f FPS (%.2f ms)", 1000.0f / avgFrameTime, avgFrameTime);
+
+            ImVec4 colorFps = ImVec4(0.0f, 1.0f, 0.0f, 1.0f);
+            if (avgFrameTime > 1000.0f / 60.0f)
+                colorFps = ImVec4(1.0f, 1.0f, 0.0f, 1.0f);
+            if (avgFrameTime > 1000.0f / 30.0f)
+                colorFps = ImVec4(1.0f, 0.0f, 0.0f, 1.0f);
+
+            float lo = avgFrameTime * 0.5f;
+            float hi = avgFrameTime * 1.5f;
+
+            const uint32_t N = helper::GetCountOf(m_FrameTimes);
+            uint32_t head = frameIndex % N;
+            m_FrameTimes[head] = m_Timer.GetElapsedTime();
+            ImGui::PushStyleColor(ImGuiCol_Text, colorFps);
+            ImGui::PlotLines("Performance", m_FrameTimes.data(), N, head, avg, lo, hi, ImVec2(0, 80.0f));
+            ImGui::PopStyleColor();
+
+            ImGui::PushID("GPU PROFILER");
+            {
+                ImGui::Checkbox("GPU profiler", &m_ShowGpuProfiler);
+                ImGui::SameLine();
+                ImGui::Text("(GPU frame %.2f ms)", GetGpuPassTime(GpuPass::Frame));
+
+                if (m_ShowGpuProfiler)
+                {
+                    const float frameTime = Max(GetGpuPassTime(GpuPass::Frame), 0.0001f);
+
+                    ImGui::Separator();
+                    for (uint32_t i = (uint32_t)GpuPass::Frame + 1; i < (uint32_t)GpuPass::MAX_NUM; i++)
+                    {
+                        if (m_GpuPassMask & (1 << i))
+                            ImGui::Text("%-14s %7.3f ms  %5.1f %%", GPU_PASS_NAMES[i], m_SmoothedGpuPassTimes[i], 100.0f * m_SmoothedGpuPassTimes[i] / frameTime);
+                    }
+
+                    bool isDumpEnabled = m_GpuTimingsFile != nullptr;
+                    if (ImGui::Checkbox("Dump to CSV", &isDumpEnabled))
+                        SetGpuTimingsDump(isDumpEnabled);
+                    ImGui::Separator();
+                }
+            }
+            ImGui::PopID();
+
+#if CPU_ZONES
+            ImGui::PushID("CPU PROFILER");
+            {
+                ImGui::Checkbox("CPU profiler", &m_ShowCpuProfiler);
+
+                if (m_ShowCpuProfiler)
+                {
+                    // Flame view of the previous frame: a row per thread and nesting level
+                    const std::vector<CpuZoneEvent>& events = m_CpuProfiler.GetLastFrameEvents();
+
+                    uint64_t frameBegin = uint64_t(-1);
+                    uint64_t frameEnd = 0;
+                    std::array<uint32_t, 64> threadDepths = {}; // levels per thread
+                    for (const CpuZoneEvent& event : events)
+                    {
+                        frameBegin = Min(frameBegin, event.begin);
+                        frameEnd = Max(frameEnd, event.end);
+                        if (event.threadIndex < threadDepths.size())
+                            threadDepths[event.threadIndex] = Max(threadDepths[event.threadIndex], event.depth + 1);
+                    }
+
+                    std::array<uint32_t, 64> threadRows = {};
+                    uint32_t rowNum = 0;
+                    for (uint32_t i = 0; i < threadDepths.size(); i++)
+                    {
+                        threadRows[i] = rowNum;
+                        rowNum += threadDepths[i];
+                    }
+
+                    const float rowHeight = ImGui::GetTextLineHeight() + 2.0f;
+                    const float width = 400.0f;
+                    const double frameTime = Max(double(frameEnd - frameBegin), 1.0);
+                    ImGui::Text("CPU frame %.2f ms", events.empty() ? 0.0 : frameTime * 0.000001);
+
+                    const ImVec2 origin = ImGui::GetCursorScreenPos();
+                    ImGui::Dummy(ImVec2(width, rowHeight * rowNum));
+
+                    ImDrawList* drawList = ImGui::GetWindowDrawList();
+                    drawList->PushClipRect(origin, ImVec2(origin.x + width, origin.y + rowHeight * rowNum), true);
+                    for (const CpuZoneEvent& event : events)
+                    {
+                        if (event.threadIndex >= threadDepths.size())
+                            continue;
+
+                        const float x0 = origin.x + float( double(event.begin - frameBegin) / frameTime * width );
+                        const float x1 = Max(origin.x + float( double(event.end - frameBegin) / frameTime * width ), x0 + 1.0f);
+                        const float y0 = origin.y + rowHeight * (threadRows[event.threadIndex] + event.depth);
+                        const ImVec2 a = ImVec2(x0, y0);
+                        const ImVec2 b = ImVec2(x1, y0 + rowHeight - 1.0f);
+
+                        // Same name, same color
+                        uint32_t hash = 2166136261u;
+                        for (const char* c = event.name; *c; c++)
+                            hash = (hash ^ uint8_t(*c)) * 16777619u;
+
+                        drawList->AddRectFilled(a, b, IM_COL32(80 + (hash & 0x7F), 80 + ((hash >> 8) & 0x7F), 80 + ((hash >> 16) & 0x7F), 255));
+
+                        drawList->PushClipRect(a, b, true);
+                        drawList->AddText(ImVec2(x0 + 2.0f, y0 + 1.0f), IM_COL32(255, 255, 255, 255), event.name);
+                        drawList->PopClipRect();
+
+                        if (ImGui::IsMouseHoveringRect(a, b))
+                            ImGui::SetTooltip("%s (thread %u): %.3f ms", event.name, event.threadIndex, (event.end - event.begin) * 0.000001);
+                    }
+                    drawList->PopClipRect();
+
+                    if (m_CpuProfiler.IsTracing())
+                        ImGui::Text("Recording trace...");
+                    else if (ImGui::Button("Record trace (120 frames)"))
+                        m_CpuProfiler.StartTrace(120);
+                    ImGui::Separator();
+                }
+            }
+            ImGui::PopID();
+#endif
+
+            if (IsButtonPressed(Button::Right))
+            {
+                ImGui::Text("Move - W/S/A/D");
+                ImGui::Text("Accelerate - MOUSE SCROLL");
+            }
+            else
+            {
+                ImGui::PushID("CAMERA");
+                {
+                    static const char* onScreenModes[] =
+                    {
+                        "Final",
+                        "Ambient occlusion",
+                        "Specular occlusion",
+                        "Denoised diffuse",
+                        "Denoised specular",
+                        "Shadow",
+                        "Base color",
+                        "Normal",
+                        "Roughness",
+                        "Metalness",
+                        "World units",
+                        "Barycentrics",
+                        "Mesh",
+                        "Mip level (primary)",
+                        "Mip level (specular)",
+                    };
+
+                    // Occlusion-only: only AO / SO are available
+                    const int32_t onScreenModeOffset = m_IsOcclusionOnly ? 1 : 0;
+                    const int32_t onScreenModeNum = m_IsOcclusionOnly ? 2 : int32_t(helper::GetCountOf(onScreenModes));
 
                     static const char* motionMode[] =
                     {
-                        "Left / Right",
-                        "Up / Down",
-                        "Forward / Backward",
-                        "Mixed"
-                    };
+                        "Left / Right",
+                        "Up / Down",
+                        "Forward / Backward",
+                        "Mixed"
+                    };
+
+                    ImGui::Text("CAMERA (press RIGHT MOUSE BOTTON for free-fly mode)");
+                    ImGui::Separator();
+                    ImGui::SliderFloat("Field of view (deg)", &m_Settings.camFov, 5.0f, 160.0f);
+                    ImGui::SliderFloat("Exposure", &m_Settings.exposure, 0.0001f, 1.0f, "%.7f", ImGuiSliderFlags_Logarithmic);
+                    if (m_DynamicResolution)
+                    {
+                        ImGui::SliderFloat("GPU budget (ms)", &m_GpuBudget, 4.0f, 50.0f, "%.1f");
+                        ImGui::Text("Resolution scale: %.1f %%", m_ResolutionScale);
+                    }
+                    else
+                        ImGui::SliderFloat("Resolution scale (%)", &m_ResolutionScale, m_MinResolutionScale, 100.0f, "%.1f");
+                    if (m_DLSS.IsInitialized())
+                    {
+                        static const char* dlssQualities[] = {"Ultra performance", "Performance", "Balanced", "Quality", "Ultra quality"};
+                        ImGui::Combo("DLSS quality", (int32_t*)&m_DlssQualityRequest, dlssQualities, helper::GetCountOf(dlssQualities));
+                    }
+                    ImGui::Combo("On screen", &m_Settings.onScreen, onScreenModes + onScreenModeOffset, onScreenModeNum);
+                    if (!m_DLSS.IsInitialized())
+                    {
+                        ImGui::PushStyleColor(ImGuiCol_Text, (m_Settings.nrdSettings.referenceAccumulation && m_Settings.TAA) ? UI_YELLOW : ImGui::GetStyleColorVec4(ImGuiCol_Text));
+                            ImGui::Checkbox("TAA", &m_Settings.TAA);
+                        ImGui::PopStyleColor();
+                        ImGui::SameLine();
+                        ImGui::Checkbox("Fused", &m_IsCompositionFused);
+                        ImGui::SameLine();
+                    }
+                    ImGui::Checkbox("3D MVs", &m_Settings.isMotionVectorInWorldSpace);
+                    ImGui::SameLine();
+                    ImGui::Checkbox("Ortho", &m_Settings.ortho);
+                    ImGui::SameLine();
+                    ImGui::Checkbox("FPS cap", &m_Settings.limitFps);
+                    ImGui::SameLine();
+                    ImGui::Checkbox("Dynamic res", &m_DynamicResolution);
+                    ImGui::SameLine();
+                    ImGui::PushStyleColor(ImGuiCol_Text, m_Settings.motionStartTime > 0.0 ? UI_YELLOW : ImGui::GetStyleColorVec4(ImGuiCol_Text));
+                    bool isPressed = ImGui::Button("Emulate motion");
+                    ImGui::PopStyleColor();
+                    if (isPressed)
+                        m_Settings.motionStartTime = m_Settings.motionStartTime > 0.0 ? 0.0 : -1.0;
+                    if (m_Settings.motionStartTime > 0.0)
+                    {
+                        ImGui::SliderFloat("Slower / Faster", &m_Settings.emulateMotionSpeed, -10.0f, 10.0f);
+                        ImGui::SetNextItemWidth(160.0f);
+                        ImGui::Combo("Mode", &m_Settings.motionMode, motionMode, helper::GetCountOf(motionMode));
+                        ImGui::SameLine();
+                        ImGui::Checkbox("Linear", &m_Settings.linearMotion);
+                    }
+                    if (m_Settings.limitFps)
+                        ImGui::SliderFloat("Max FPS", &m_Settings.maxFps, 24.0f, 150.0f, "%.0f");
+                }
+                ImGui::PopID();
+                ImGui::NewLine();
+                ImGui::PushID("MATERIALS");
+                {
+                    static const char* forcedMaterial[] =
+                    {
+                        "None",
+                        "Gypsum",
+                        "Cobalt",
+                    };
+
+                    ImGui::Text("MATERIALS");
+                    ImGui::Separator();
+                    ImGui::SliderFloat2("Roughness / Metalness", &m_Settings.roughnessOverride, 0.0f, 1.0f, "%.3f");
+                    ImGui::SetNextItemWidth(90.0f);
+                    ImGui::Combo("Material", &m_Settings.forcedMaterial, forcedMaterial, helper::GetCountOf(forcedMaterial));
+                    ImGui::SameLine();
+                    ImGui::Checkbox("Full BRDF", &m_Settings.primaryFullBrdf);
+                    ImGui::SameLine();
+                    ImGui::Checkbox("Emission", &m_Settings.emission);
+                    if (m_Settings.emission)
+                        ImGui::SliderFloat("Emission intensity", &m_Settings.emissionIntensity, 1.0f, 100000.0f, "%.3f", ImGuiSliderFlags_Logarithmic);
+                }
+                ImGui::PopID();
+
+                if (m_Settings.onScreen == 10)
+                    ImGui::SliderFloat("Units in 1 meter", &m_Settings.meterToUnitsMultiplier, 0.001f, 100.0f, "%.4f", ImGuiSliderFlags_Logarithmic);
+                else
+                {
+                    ImGui::NewLine();
+                    ImGui::PushID("WORLD");
+                    {
+                        ImGui::Text("WORLD");
+                        ImGui::Separator();
+                        ImGui::SliderFloat2("Sun position (deg)", &m_Settings.sunAzimuth, -180.0f, 180.0f);
+                        ImGui::SliderFloat("Sun angular size (deg)", &m_Settings.sunAngularDiameter, 0.0f, 3.0f);
+                        ImGui::Checkbox("Animate sun", &m_Settings.animateSun);
+                        ImGui::SameLine();
+                        ImGui::Checkbox("Animate objects", &m_Settings.animatedObjects);
+                        if (!m_Scene.animations.empty() && m_Scene.animations[m_Settings.activeAnimation].cameraNode.animationNodeID != -1)
+                        {
+                            ImGui::SameLine();
+                            ImGui::Checkbox("Animate camera", &m_Settings.animateCamera);
+                        }
+
+                        if (m_Settings.animatedObjects)
+                        {
+                            if (!m_Settings.nineBrothers)
+                                ImGui::SliderInt("Object number", &m_Settings.animatedObjectNum, 1, (int32_t)ANIMATED_INSTANCE_MAX_NUM);
+                            ImGui::SliderFloat("Object scale", &m_Settings.animatedObjectScale, 0.1f, 2.0f);
+                            ImGui::Checkbox("\"9 brothers\"", &m_Settings.nineBrothers);
+                            ImGui::SameLine();
+                            ImGui::Checkbox("Blink", &m_Settings.blink);
+                            ImGui::SameLine();
+                            ImGui::Checkbox("Emissive", &m_Settings.emissiveObjects);
+                        }
+
+                        if (m_Settings.animateSun || m_Settings.animatedObjects || !m_Scene.animations.empty())
+                        {
+                            if (m_Settings.animatedObjects)
+                                ImGui::SameLine();
+                            ImGui::Checkbox("Pause (SPACE)", &m_Settings.pauseAnimation);
+                            ImGui::SliderFloat("Slower / Faster", &m_Settings.animationSpeed, -10.0f, 10.0f);
+                        }
+
+                        if (!m_Scene.animations.empty())
+                        {
+                            if (m_Scene.animations[m_Settings.activeAnimation].durationMs != 0.0f)
+                            {
+                                char animationLabel[128];
+                                snprintf(animationLabel, sizeof(animationLabel), "Animation %.1f sec (%%)", 0.001f * m_Scene.animations[m_Settings.activeAnimation].durationMs / (m_Settings.animationSpeed < 0.0f ? 1.0f / (1.0f + Abs(m_Settings.animationSpeed)) : (1.0f + m_Settings.animationSpeed)));
+                                ImGui::SliderFloat(animationLabel, &m_Settings.animationProgress, 0.0f, 99.999f);
+
+                                if (m_Scene.animations.size() > 1)
+                                {
+                                    char items[1024] = {'\0'};
+                                    size_t offset = 0;
+                                    char* iterator = items;
+                                    for (auto animation : m_Scene.animations)
+                                    {
+                                        const size_t size = std::min(sizeof(items), animation.animationName.length() + 1);
+                                        memcpy(iterator + offset, animation.animationName.c_str(), size);
+                                        offset += animation.animationName.length() + 1;
+                                    }
+                                    ImGui::Combo("Animated scene", &m_Settings.activeAnimation, items, helper::GetCountOf(m_Scene.animations));
+                                }
+                            }
+                        }
+
+                        m_Settings.sunElevation = Clamp(m_Settings.sunElevation, -90.0f, 90.0f);
+                    }
+                    ImGui::PopID();
+                    ImGui::NewLine();
+                    ImGui::PushID("INDIRECT RAYS");
+                    {
+                        char s[128];
+                        snprintf(s, sizeof(s), m_Settings.rpp == 0 ? "INDIRECT RAYS - 0.5 rpp (checkerboard)" : "INDIRECT RAYS - %u rpp", m_Settings.rpp);
+
+                        ImGui::Text(s);
+                        ImGui::Separator();
+                        ImGui::SliderInt("Rays per pixel", &m_Settings.rpp, 0, 8);
+                        if (m_Settings.rpp > 1)
+                        {
+                            ImGui::SameLine();
+                            ImGui::Checkbox("Adaptive", &m_IsAdaptiveSampling);
+                        }
+                        ImGui::SliderFloat("Sky ambient (%)", &m_Settings.skyAmbient, 0.0f, 20.0f, "%.3f", ImGuiSliderFlags_Logarithmic);
+                        ImGui::SliderFloat2("AO / SO range (m)", &m_Settings.diffHitDistScale, 0.0f, sceneRadius);
+                        ImGui::Checkbox("Full BRDF", &m_Settings.indirectFullBrdf);
+                        ImGui::SameLine();
+                        ImGui::SameLine();
+                        ImGui::Checkbox("Spec 2nd", &m_Settings.specSecondBounce);
+                        ImGui::SameLine();
+                        ImGui::Checkbox("Diff 2nd", &m_Settings.diffSecondBounce);
+                    }
+                    ImGui::PopID();
+                    ImGui::NewLine();
+                    ImGui::PushID("SWITCHES");
+                    {
+                        ImGui::Text("SWITCHES");
+                        ImGui::Separator();
+                        ImGui::Checkbox("Specular", &m_Settings.indirectSpecular);
+                        ImGui::SameLine();
+                        ImGui::Checkbox("Normal map", &m_Settings.normalMap);
+                        ImGui::SameLine();
+                        ImGui::PushStyleColor(ImGuiCol_Text, (m_Settings.nrdSettings.referenceAccumulation && m_Settings.specularLobeTrimming) ? UI_YELLOW : ImGui::GetStyleColorVec4(ImGuiCol_Text));
+                            ImGui::Checkbox("Trimming", &m_Settings.specularLobeTrimming);
+                        ImGui::PopStyleColor();
+                        ImGui::SameLine();
+                        ImGui::Checkbox("Mip", &m_Settings.mip);
+                        if (m_Settings.rpp < 2)
+                        {
+                            ImGui::SameLine();
+                            ImGui::Checkbox("Blue noise", &m_Settings.blueNoise);
+                        }
+                        ImGui::Checkbox("Diffuse", &m_Settings.indirectDiffuse);
+                        ImGui::SameLine();
+
+                        const float3& sunDirection = GetSunDirection();
+                        bool cmp = sunDirection.z < 0.0f && m_Settings.importanceSampling;
+                        if (cmp)
+                            ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(1.0f, 0.0f, 0.0f, 1.0f));
+                        ImGui::Checkbox("Importance sampling", &m_Settings.importanceSampling);
+                        if (cmp)
+                            ImGui::PopStyleColor();
+
+                        if (m_Settings.metalnessOverride != 0.0f)
+                        {
+                            ImGui::SameLine();
+                            ImGui::Checkbox("Metal ambient", &m_Settings.metalAmbient);
+                        }
+                    }
+                    ImGui::PopID();
+                    ImGui::NewLine();
+                    ImGui::PushID("DENOISER");
+                    {
+                        const nrd::LibraryDesc& nrdLibraryDesc = nrd::GetLibraryDesc();
+
+                        ImGui::Text("NRD v%u.%u.%u - %s / SIGMA (%s)", nrdLibraryDesc.versionMajor, nrdLibraryDesc.versionMinor, nrdLibraryDesc.versionBuild, m_Settings.denoiser == REBLUR ? "REBLUR" : "RELAX",
+                            m_PinnedDenoiser == DENOISER_MAX_NUM ? "F2 - change" : "pinned");
+                        ImGui::Separator();
+                        ImGui::SliderFloat("Disocclusion (%)", &m_Settings.nrdSettings.disocclusionThreshold, 0.25f, 5.0f, "%.3f", ImGuiSliderFlags_Logarithmic);
+
+                        float rppNormalized = Saturate(m_Settings.rpp / 8.0f);
+                        float f = rppNormalized + rppNormalized * rppNormalized * (1.0f - rppNormalized);
+                        int32_t recommendedMaxFastAccumulatedFrameNum = int32_t( Lerp(8.0f, 3.0f, f) - 1.0f + 0.5f ); // It's an estimate, just to provide some insights
+                        int32_t recommendedMaxAccumulatedFrameNum = int32_t( Lerp(32.0f, 8.0f, f) - 1.0f + 0.5f ); // It's an estimate, just to provide some insights
+                        bool cmp = recommendedMaxAccumulatedFrameNum != m_Settings.nrdSettings.maxAccumulatedFrameNum || (recommendedMaxFastAccumulatedFrameNum != m_Settings.nrdSettings.maxFastAccumulatedFrameNum && m_Settings.denoiser != REBLUR);
+                        if (cmp)
+                            ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(1.0f, 1.0f, 0.0f, 1.0f));
+                        if (m_Settings.denoiser == REBLUR)
+                            ImGui::Text("Recommended values: %d", recommendedMaxAccumulatedFrameNum);
+                        else
+                            ImGui::Text("Recommended values: %d (main) / %d (fast)", recommendedMaxAccumulatedFrameNum, recommendedMaxFastAccumulatedFrameNum);
+                        if (cmp)
+                            ImGui::PopStyleColor();
+                        if (m_Settings.denoiser == REBLUR)
+                            ImGui::SliderInt("History length (frames)", &m_Settings.nrdSettings.maxAccumulatedFrameNum, 0, nrd::REBLUR_MAX_HISTORY_FRAME_NUM);
+                        else
+                            ImGui::SliderInt2("History length (frames)", &m_Settings.nrdSettings.maxAccumulatedFrameNum, 0, nrd::REBLUR_MAX_HISTORY_FRAME_NUM);
+
+                        static const char* prePassMode[] =
+                        {
+                            "Off",
+                            "Simple",
+                            "Advanced",
+                        };
+
+                        // Compact resources: no inputs for "advanced"
+                        const int32_t prePassModeNum = int32_t(helper::GetCountOf(prePassMode)) - (m_IsCompactResources ? 1 : 0);
+                        m_Settings.nrdSettings.prePassMode = Min(m_Settings.nrdSettings.prePassMode, prePassModeNum - 1);
+
+                        ImGui::SetNextItemWidth(90.0f);
+                        ImGui::Combo("Pre-pass mode", &m_Settings.nrdSettings.prePassMode, prePassMode, prePassModeNum);
+                        ImGui::SameLine();
+                        ImGui::Checkbox("Anti-firefly", &m_Settings.nrdSettings.enableAntiFirefly);
+
+                        if (m_Settings.denoiser == REBLUR)
+                        {
+                            ImGui::Text("SPATIAL FILTERING (DIFFUSE / SPECULAR):");
+                            ImGui::PushID("SPATIAL FILTERING (DIFFUSE / SPECULAR)");
+                            {
+                                ImGui::SliderFloat("Blur radius (px)", &m_Settings.nrdSettings.blurRadius, 0.0f, 60.0f, "%.1f");
+                                ImGui::SliderFloat("Adaptive radius scale", &m_Settings.nrdSettings.adaptiveRadiusScale, 0.0f, 10.0f, "%.1f");
+                                ImGui::SliderFloat("Normal weight strictness", &m_Settings.nrdSettings.normalWeightStrictness, 0.0f, 1.0f, "%.2f");
+                                ImGui::SliderFloat("Stabilization strength", &m_Settings.nrdSettings.stabilizationStrength, 0.0f, 1.0f, "%.2f");
+                                ImGui::SliderFloat("Residual noise level", &m_Settings.nrdSettings.residualNoiseLevel, 1.0f, 10.0f, "%.2f");
+                                ImGui::Checkbox("Reference", &m_Settings.nrdSettings.referenceAccumulation);
+                            }
+                            ImGui::PopID();
+                            ImGui::Text("ANTI-LAG (%%):");
+                            ImGui::PushID("ANTI-LAG");
+                            {
+                                char s[128];
+
+                                nrd::AntilagIntensitySettings antilagIntensitySettings = {};
+                                nrd::AntilagHitDistanceSettings antilagHitDistanceSettings = {};
+                                GetAntilagSettings(antilagIntensitySettings, antilagHitDistanceSettings);
+
+                                snprintf(s, sizeof(s), "[%.1f; %.1f]", antilagIntensitySettings.thresholdMin * 100.0f, antilagIntensitySettings.thresholdMax * 100.0f);
+                                ImGui::Checkbox("Intensity", &m_Settings.nrdSettings.antilagIntensity);
+                                ImGui::SameLine();
+                                ImGui::Text(s);
+
+                                snprintf(s, sizeof(s), "[%.1f; %.1f]", antilagHitDistanceSettings.thresholdMin * 100.0f, antilagHitDistanceSettings.thresholdMax * 100.0f);
+                                ImGui::SameLine();
+                                ImGui::Checkbox("Hit distance", &m_Settings.nrdSettings.antilagHitDistance);
+                                ImGui::SameLine();
+                                ImGui::Text(s);
+                            }
+                            ImGui::PopID();
+                        }
+                        else if (m_Settings.denoiser == RELAX)
+                        {
+                            ImGui::Text("REPROJECTION:");
+                            ImGui::SliderFloat("Spec variance boost", &m_RelaxSettings.specularVarianceBoost, 0.0f, 8.0f, "%.2f");
+                            ImGui::SliderFloat("Clamping sigma scale", &m_RelaxSettings.historyClampingColorBoxSigmaScale, 0.0f, 10.0f, "%.1f");
+
+                            ImGui::Text("SPATIAL FILTERING:");
+                            ImGui::SliderInt("A-trous iterations", (int32_t*)&m_RelaxSettings.atrousIterationNum, 2, 8);
+                            ImGui::SliderFloat("Normal relaxation", &m_RelaxSettings.normalEdgeStoppingRelaxation, 0.0f, 1.0f, "%.2f");
+                            ImGui::SliderFloat("Luminance relaxation", &m_RelaxSettings.luminanceEdgeStoppingRelaxation, 0.0f, 1.0f, "%.2f");
+                            ImGui::SliderFloat("Depth weight", &m_RelaxSettings.phiDepth, 0.0f, 1.0f, "%.3f");
+                            ImGui::SliderFloat("Normal weight", &m_RelaxSettings.phiNormal, 1.0f, 256.0f, "%.0f");
+                            ImGui::SliderFloat("Diff luminance weight", &m_RelaxSettings.diffusePhiLuminance, 0.0f, 10.0f, "%.1f");
+                            ImGui::SliderFloat("Spec luminance weight", &m_RelaxSettings.specularPhiLuminance, 0.0f, 10.0f, "%.1f");
+                            ImGui::SliderFloat("Roughness relaxation", &m_RelaxSettings.roughnessEdgeStoppingRelaxation, 0.0f, 1.0f, "%.2f");
+
+                            ImGui::Text("DISOCCLUSION FIX:");
+                            ImGui::SliderFloat("Edge-stop normal power", &m_RelaxSettings.disocclusionFixEdgeStoppingNormalPower, 0.0f, 128.0f, "%.1f");
+                            ImGui::SliderFloat("Max kernel radius", &m_RelaxSettings.disocclusionFixMaxRadius, 0.0f, 100.0f, "%.1f");
+                            ImGui::SliderInt("Frames to fix", (int32_t*)&m_RelaxSettings.disocclusionFixNumFramesToFix, 0, 10);
+
+                            ImGui::Text("SPATIAL VARIANCE ESTIMATION:");
+                            ImGui::SliderInt("History threshold", (int32_t*)&m_RelaxSettings.spatialVarianceEstimationHistoryThreshold, 0, 10);
+                        }
+
+                        m_ForceHistoryReset = ImGui::Button("Reset history");
+
+                        if (m_PinnedDenoiser == DENOISER_MAX_NUM)
+                        {
+                            ImGui::SameLine();
+                            if (ImGui::Button("Change denoiser"))
+                                m_Settings.denoiser = (m_Settings.denoiser + 1) % DENOISER_MAX_NUM;
+                        }
+
+                        // Costs a frame: instances and data formats of all modes are kept
+                        bool isOcclusionOnly = m_IsOcclusionOnly;
+                        bool isNrdCombined = m_IsNrdCombined;
+                        ImGui::Checkbox("Occlusion only", &isOcclusionOnly);
+                        ImGui::SameLine();
+                        ImGui::Checkbox("Combined methods", &isNrdCombined);
+                        if (isOcclusionOnly != m_IsOcclusionOnly || isNrdCombined != m_IsNrdCombined)
+                            SwitchNrdMode(isOcclusionOnly, isNrdCombined);
+                    }
+                    ImGui::PopID();
+                    ImGui::NewLine();
+                    ImGui::Separator();
+                    ImGui::SliderFloat("Debug (F3 - toggle)", &m_Settings.debug, 0.0f, 1.0f);
+                    ImGui::SliderFloat("Input / Denoised", &m_Settings.separator, 0.0f, 1.0f, "%.2f");
+
+                    if (ImGui::Button("Reload shaders"))
+                    {
+                        CreatePipelines();
+                        printf("Ready!\n");
+                    }
+
+                    ImGui::SameLine();
+                    if (ImGui::Button("Default settings"))
+                    {
+                        m_Camera.Initialize(m_Scene.aabb.GetCenter(), m_Scene.aabb.vMin, CAMERA_RELATIVE);
+                        m_Settings = m_DefaultSettings;
+                        m_AmbientInComposition = true;
+                    }
+
+                    // Tests
+                    if (m_TestMode)
+                    {
+                        ImGui::NewLine();
+                        ImGui::Text("TESTS (F4 - next)");
+                        ImGui::Separator();
+
+                        char s[64];
+                        const std::string path = GetTestPath();
+                        const uint32_t testByteSize = GetTestByteSize();
+
+                        // Get number of tests
+                        if (m_TestNum == uint32_t(-1))
+                        {
+                            FILE* fp = fopen(path.c_str(), "rb");
+                            if (fp)
+                            {
+                                // Use this code to convert tests to reflect new Settings and Camera layouts
+                                #if 0
+                                    typedef Settings SettingsOld; // adjust if needed
+                                    typedef Camera CameraOld; // adjust if needed
+
+                                    const uint32_t oldItemSize = sizeof(SettingsOld) + CameraOld::GetStateSize();
+
+                                    fseek(fp, 0, SEEK_END);
+                                    m_TestNum = ftell(fp) / oldItemSize;
+                                    fseek(fp, 0, SEEK_SET);
+
+                                    FILE* fpNew;
+                                    fopen_s(&fpNew, (path + ".new").c_str(), "wb");
+
+                                    for (uint32_t i = 0; i < m_TestNum && fpNew; i++)
+                                    {
+                                        SettingsOld settingsOld;
+                                        fread_s(&settingsOld, sizeof(SettingsOld), 1, sizeof(SettingsOld), fp);
+
+                                        CameraOld cameraOld;
+                                        fread_s(cameraOld.GetState(), CameraOld::GetStateSize(), 1, CameraOld::GetStateSize(), fp);
+
+                                        // Convert Old to New here
+                                        m_Settings = settingsOld;
+                                        m_Camera.state = cameraOld.state;
+
+                                        // ...
+
+                                        fwrite(&m_Settings, 1, sizeof(m_Settings), fpNew);
+                                        fwrite(m_Camera.GetState(), 1, Camera::GetStateSize(), fpNew);
+                                    }
+
+                                    fclose(fp);
+                                    fclose(fpNew);
+
+                                    __debugbreak();
+                                #endif
+
+                                fseek(fp, 0, SEEK_END);
+                                m_TestNum = ftell(fp) / testByteSize;
+                                fclose(fp);
+                            }
+                            else
+                                m_TestNum = 0;
+                        }
+
+                        // Adjust current test index
+                        bool isTestChanged = false;
+                        if (IsKeyToggled(Key::F4) && m_TestNum)
+                        {
+                            m_LastSelectedTest++;
+                            isTestChanged = true;
+                        }
+
+                        if (m_LastSelectedTest == uint32_t(-1) || !m_TestNum)
+                            m_LastSelectedTest = uint32_t(-1);
+                        else
+                            m_LastSelectedTest %= m_TestNum;
+
+                        // Main buttons
+                        uint32_t i = 0;
+                        for (; i < m_TestNum; i++)
+                        {
+                            snprintf(s, sizeof(s), "%u", i + 1);
+
+                            if (i % 14 != 0)
+                                ImGui::SameLine();
+
+                            if (ImGui::Button(s, ImVec2(25.0f, 0.0f)) || isTestChanged)
+                            {
+                                uint32_t test = isTestChanged ? m_LastSelectedTest : i;
+                                if (LoadTest(path, test))
+                                    m_LastSelectedTest = test;
+
+                                isTestChanged = false;
+                            }
+                        }
+
+                        if (i % 14 != 0)
+                            ImGui::SameLine();
+
+                        // "Add" button
+                        if (ImGui::Button("Add"))
+                        {
+                            FILE* fp = fopen(path.c_str(), "ab");
+
+                            if (fp)
+                            {
+                                m_Settings.motionStartTime = m_Settings.motionStartTime > 0.0 ? -1.0 : 0.0;
+
+                                fwrite(&m_Settings, sizeof(m_Settings), 1, fp);
+                                fwrite(m_Camera.GetState(), Camera::GetStateSize(), 1, fp);
+                                fclose(fp);
+
+                                m_TestNum = uint32_t(-1);
+                            }
+                        }
+
+                        if ((i + 1) % 14 != 0)
+                            ImGui::SameLine();
+
+                        // "Del" button
+                        snprintf(s, sizeof(s), "Del %u", m_LastSelectedTest + 1);
+                        if (m_TestNum != uint32_t(-1) && m_LastSelectedTest != uint32_t(-1) && ImGui::Button(s))
+                        {
+                            std::vector<uint8_t> data;
+                            utils::LoadFile(path, data);
+
+                            FILE* fp = fopen(path.c_str(), "wb");
+
+                            if (fp)
+                            {
+                                for (i = 0; i < m_TestNum; i++)
+                                {
+                                    if (i != m_LastSelectedTest)
+                                        fwrite(&data[i * testByteSize], 1, testByteSize, fp);
+                                }
+
+                                fclose(fp);
+
+                                m_TestNum = uint32_t(-1);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        ImGui::End();
+    }
+
+    CPU_ZONE("Camera, animation, settings");
+
+    // Update camera
+    cBoxf cameraLimits = m_Scene.aabb;
+    cameraLimits.Scale(2.0f);
+
+    CameraDesc desc = {};
+    desc.limits = cameraLimits;
+    desc.aspectRatio = float( GetWindowWidth() ) / float( GetWindowHeight() );
+    desc.horizontalFov = RadToDeg( Atan( Tan( DegToRad( m_Settings.camFov ) * 0.5f ) *  desc.aspectRatio * 9.0f / 16.0f ) * 2.0f ); // recalculate to ultra-wide if needed
+    desc.nearZ = NEAR_Z * m_Settings.meterToUnitsMultiplier;
+    desc.farZ = 10000.0f * m_Settings.meterToUnitsMultiplier;
+    desc.isCustomMatrixSet = m_Settings.animateCamera;
+    desc.isLeftHanded = CAMERA_LEFT_HANDED;
+    desc.orthoRange = m_Settings.ortho ? Tan( DegToRad( m_Settings.camFov ) * 0.5f ) * 3.0f * m_Settings.meterToUnitsMultiplier : 0.0f;
+    GetCameraDescFromInputDevices(desc);
+
+    const float animationSpeed = m_Settings.pauseAnimation ? 0.0f : (m_Settings.animationSpeed < 0.0f ? 1.0f / (1.0f + Abs(m_Settings.animationSpeed)) : (1.0f + m_Settings.animationSpeed));
+    const float scale = m_Settings.animatedObjectScale * m_Settings.meterToUnitsMultiplier / 2.0f;
+    const float elapsedTime = m_IsCapture ? CAPTURE_FRAME_TIME : m_Timer.GetElapsedTime();
+    const float objectAnimationDelta = animationSpeed * elapsedTime * 0.001f;
+
+    if (m_Settings.motionStartTime > 0.0)
+    {
+        float time = float(m_Timer.GetTimeStamp() - m_Settings.motionStartTime);
+        float amplitude = 40.0f * m_Camera.state.motionScale;
+        float period = 0.0003f * time * (m_Settings.emulateMotionSpeed < 0.0f ? 1.0f / (1.0f + Abs(m_Settings.emulateMotionSpeed)) : (1.0f + m_Settings.emulateMotionSpeed));
+
+        float3 localPos = m_Camera.state.mWorldToView.GetRow0().To3d();
+        if (m_Settings.motionMode == 1)
+            localPos = m_Camera.state.mWorldToView.GetRow1().To3d();
+        else if (m_Settings.motionMode == 2)
+            localPos = m_Camera.state.mWorldToView.GetRow2().To3d();
+        else if (m_Settings.motionMode == 3)
+        {
+            float3 rows[3] = { m_Camera.state.mWorldToView.GetRow0().To3d(), m_Camera.state.mWorldToView.GetRow1().To3d(), m_Camera.state.mWorldToView.GetRow2().To3d() };
+            float f = Sin( Pi(period * 3.0f) );
+            localPos = Normalize( f < 0.0f ? Lerp( rows[1], rows[0], float3( Abs(f) ) ) : Lerp( rows[1], rows[2], float3(f) ) );
+        }
+        localPos *= amplitude * (m_Settings.linearMotion ? WaveTriangle(period) - 0.5f : Sin( Pi(period) ) * 0.5f);
+
+        desc.dUser = localPos - m_PrevLocalPos;
+        m_PrevLocalPos = localPos;
+    }
+    else if (m_Settings.motionStartTime == -1.0)
+    {
+        m_Settings.motionStartTime = m_Timer.GetTimeStamp();
+        m_PrevLocalPos = float3::Zero();
+    }
+
+    m_Scene.Animate(animationSpeed, elapsedTime, m_Settings.animationProgress, m_Settings.activeAnimation, m_Settings.animateCamera ? &desc.customMatrix : nullptr);
+    m_Camera.Update(desc, frameIndex);
+
+    if (m_Settings.nineBrothers)
+    {
+        m_Settings.animatedObjectNum = 9;
+
+        const float3& vRight = m_Camera.state.mViewToWorld.GetCol0().xmm;
+        const float3& vTop = m_Camera.state.mViewToWorld.GetCol1().xmm;
+        const float3& vForward = m_Camera.state.mViewToWorld.GetCol2().xmm;
+
+        float3 basePos = ToFloat(m_Camera.state.globalPosition);
+
+        for (int32_t i = -1; i <= 1; i++ )
+        {
+            for (int32_t j = -1; j <= 1; j++ )
+            {
+                const uint32_t index = (i + 1) * 3 + (j + 1);
+
+                float x = float(i) * scale * 4.0f;
+                float y = float(j) * scale * 4.0f;
+                float z = 10.0f * scale * (CAMERA_LEFT_HANDED ? 1.0f : -1.0f);
+
+                float3 pos = basePos + vRight * x + vTop * y + vForward * z;
+
+                utils::Instance& instance = m_Scene.instances[ m_AnimatedInstances[index].instanceID ];
+                instance.position = ToDouble( pos );
+                instance.rotation = m_Camera.state.mViewToWorld;
+                instance.rotation.SetTranslation( float3::Zero() );
+                instance.rotation.AddScale(scale);
+            }
+        }
+    }
+    else if (m_Settings.animatedObjects)
+    {
+        // Instances animate independently, so blocks can go wide
+        const uint32_t animatedObjectNum = (uint32_t)m_Settings.animatedObjectNum;
+        const uint32_t blockNum = (animatedObjectNum + INSTANCE_BLOCK_SIZE - 1) / INSTANCE_BLOCK_SIZE;
+
+        m_WorkerPool.Execute(blockNum, [&](uint32_t blockIndex)
+        {
+            const uint32_t first = blockIndex * INSTANCE_BLOCK_SIZE;
+            const uint32_t last = std::min(first + INSTANCE_BLOCK_SIZE, animatedObjectNum);
+
+            for (uint32_t i = first; i < last; i++)
+            {
+                float4x4 transform = m_AnimatedInstances[i].Animate(objectAnimationDelta, scale);
+
+                utils::Instance& instance = m_Scene.instances[ m_AnimatedInstances[i].instanceID ];
+                instance.rotation = transform;
+                instance.position = m_AnimatedInstances[i].position;
+            }
+        });
+    }
+
+    m_ResolutionScale *= 0.01f;
+
+    if (m_DLSS.IsInitialized() && m_DlssQualityRequest != m_DlssQuality)
+        SetDlssQuality(m_DlssQualityRequest);
+
+    // A pinned denoiser is the only one ever created (loaded tests reset the denoiser to REBLUR)
+    if (m_PinnedDenoiser != DENOISER_MAX_NUM)
+        m_Settings.denoiser = m_PinnedDenoiser;
+
+    // TODO: modify some settings to WAR unsupported and not working stuff in non-REBLUR
+    if (m_Settings.denoiser == RELAX)
+        m_AmbientInComposition = false;
+}
+
+void Sample::CreateSwapChain(nri::Format& swapChainFormat)
+{
+    nri::SwapChainDesc swapChainDesc = {};
+    swapChainDesc.windowSystemType = GetWindowSystemType();
+    swapChainDesc.window = GetWindow();
+    swapChainDesc.commandQueue = m_CommandQueue;
+    swapChainDesc.format = nri::SwapChainFormat::BT709_G22_8BIT;
+    swapChainDesc.verticalSyncInterval = m_SwapInterval;
+    swapChainDesc.width = (uint16_t)m_OutputResolution.x;
+    swapChainDesc.height = (uint16_t)m_OutputResolution.y;
+    swapChainDesc.textureNum = Max(SWAP_CHAIN_TEXTURE_NUM, m_FrameInFlightNum);
+
+    NRI_ABORT_ON_FAILURE(NRI.CreateSwapChain(*m_Device, swapChainDesc, m_SwapChain));
+
+    uint32_t swapChainTextureNum = 0;
+    nri::Texture* const* swapChainTextures = NRI.GetSwapChainTextures(*m_SwapChain, swapChainTextureNum, swapChainFormat);
+
+    nri::ClearValueDesc clearColor = {};
+    nri::FrameBufferDesc frameBufferDesc = {};
+    frameBufferDesc.colorAttachmentNum = 1;
+    frameBufferDesc.colorClearValues = &clearColor;
+
+    for (uint32_t i = 0; i < swapChainTextureNum; i++)
+    {
+        m_SwapChainBuffers.emplace_back();
+        BackBuffer& backBuffer = m_SwapChainBuffers.back();
+
+        backBuffer = {};
+        backBuffer.texture = swapChainTextures[i];
+
+        nri::Texture2DViewDesc textureViewDesc = {backBuffer.texture, nri::Texture2DViewType::COLOR_ATTACHMENT, swapChainFormat};
+        NRI_ABORT_ON_FAILURE(NRI.CreateTexture2DView(textureViewDesc, backBuffer.colorAttachment));
+
+        frameBufferDesc.colorAttachments = &backBuffer.colorAttachment;
+        NRI_ABORT_ON_FAILURE(NRI.CreateFrameBuffer(*m_Device, frameBufferDesc, backBuffer.frameBufferUI));
+    }
+}
+
+void Sample::CreateCommandBuffers()
+{
+    for (Frame& frame : m_Frames)
+    {
+        NRI_ABORT_ON_FAILURE(NRI.CreateDeviceSemaphore(*m_Device, true, frame.deviceSemaphore));
+        for (size_t i = 0; i < frame.commandBuffers.size(); i++)
+        {
+            NRI_ABORT_ON_FAILURE(NRI.CreateCommandAllocator(*m_CommandQueue, nri::WHOLE_DEVICE_GROUP, frame.commandAllocators[i]));
+            NRI_ABORT_ON_FAILURE(NRI.CreateCommandBuffer(*frame.commandAllocators[i], frame.commandBuffers[i]));
+        }
+
+        if (m_IsAsyncCompute)
+        {
+            NRI_ABORT_ON_FAILURE(NRI.CreateCommandAllocator(*m_ComputeQueue, nri::WHOLE_DEVICE_GROUP, frame.computeCommandAllocator));
+            NRI_ABORT_ON_FAILURE(NRI.CreateCommandBuffer(*frame.computeCommandAllocator, frame.computeCommandBuffer));
+        }
+
+        for (uint32_t i = 1; i < m_PhysicalDeviceNum; i++)
+        {
+            NRI_ABORT_ON_FAILURE(NRI.CreateCommandAllocator(*m_CommandQueue, nri::WHOLE_DEVICE_GROUP, frame.peerCommandAllocators[i]));
+            NRI_ABORT_ON_FAILURE(NRI.CreateCommandBuffer(*frame.peerCommandAllocators[i], frame.peerCommandBuffers[i]));
+        }
+    }
+}
+
+void Sample::CreateQueryPools()
+{
+    nri::QueryPoolDesc queryPoolDesc = {};
+    queryPoolDesc.queryType = nri::QueryType::TIMESTAMP;
+    queryPoolDesc.capacity = GPU_PASS_QUERY_NUM * m_FrameInFlightNum;
+    queryPoolDesc.physicalDeviceMask = nri::WHOLE_DEVICE_GROUP;
+    NRI_ABORT_ON_FAILURE( NRI.CreateQueryPool(*m_Device, queryPoolDesc, m_TimestampQueryPool) );
+
+    m_TimestampQuerySize = NRI.GetQuerySize(*m_TimestampQueryPool);
+
+    // Results are copied into a readback ring, one slice per buffered frame, so reading never waits for the GPU
+    nri::BufferDesc bufferDesc = {};
+    bufferDesc.size = uint64_t(queryPoolDesc.capacity) * m_TimestampQuerySize;
+    bufferDesc.usageMask = nri::BufferUsageBits::NONE;
+    NRI_ABORT_ON_FAILURE( NRI.CreateBuffer(*m_Device, bufferDesc, m_TimestampBuffer) );
+    NRI.SetBufferDebugName(*m_TimestampBuffer, "Buffer::TimestampReadback");
+
+    nri::ResourceGroupDesc resourceGroupDesc = {};
+    resourceGroupDesc.memoryLocation = nri::MemoryLocation::HOST_READBACK;
+    resourceGroupDesc.bufferNum = 1;
+    resourceGroupDesc.buffers = &m_TimestampBuffer;
+
+    const size_t baseAllocation = m_MemoryAllocations.size();
+    m_MemoryAllocations.resize(baseAllocation + NRI.CalculateAllocationNumber(*m_Device, resourceGroupDesc), nullptr);
+    NRI_ABORT_ON_FAILURE( NRI.AllocateAndBindMemory(*m_Device, resourceGroupDesc, m_MemoryAllocations.data() + baseAllocation));
+}
+
+void Sample::WaitForFrame(uint32_t frameIndex)
+{
+    // Must be called once per frame: the semaphore gets reset by the wait (VULKAN)
+    const uint32_t bufferedFrameIndex = frameIndex % m_FrameInFlightNum;
+    const Frame& frame = m_Frames[bufferedFrameIndex];
+
+    CPU_ZONE("WaitForFrame");
+    {
+        CPU_ZONE("WaitForSemaphore");
+        NRI.WaitForSemaphore(*m_CommandQueue, *frame.deviceSemaphore);
+    }
+    for (nri::CommandAllocator* commandAllocator : frame.commandAllocators)
+        NRI.ResetCommandAllocator(*commandAllocator);
+    if (m_IsAsyncCompute)
+        NRI.ResetCommandAllocator(*frame.computeCommandAllocator); // the graphics queue waits for it before "deviceSemaphore" gets signaled
+    for (uint32_t i = 1; i < m_PhysicalDeviceNum; i++)
+        NRI.ResetCommandAllocator(*frame.peerCommandAllocators[i]); // GPU 0 waits for peers before "deviceSemaphore" gets signaled
+
+    ReadGpuPassTimes(bufferedFrameIndex);
+    ReadMipFeedback(bufferedFrameIndex);
+#ifdef _DEBUG
+    ReadSampleSum(bufferedFrameIndex);
+#endif
+    if (m_CaptureBuffer)
+        ReadCapture(bufferedFrameIndex);
+    if (m_QualityReadbackBuffer)
+        ReadQuality(bufferedFrameIndex);
+
+    m_UploadRing.head = bufferedFrameIndex * m_UploadRing.segmentSize;
+    m_UploadRing.end = m_UploadRing.head + m_UploadRing.segmentSize;
+}
+
+void Sample::ReadGpuPassTimes(uint32_t bufferedFrameIndex)
+{
+    // Called after waiting for the frame which used this slot, i.e. the data is "m_FrameInFlightNum" frames old
+    const uint32_t mask = m_TimestampMasks[bufferedFrameIndex].exchange(0);
+
+    if (!mask)
+        return;
+
+    const uint64_t size = uint64_t(GPU_PASS_QUERY_NUM) * m_TimestampQuerySize;
+    const uint8_t* data = (uint8_t*)NRI.MapBuffer(*m_TimestampBuffer, bufferedFrameIndex * size, size);
+    const double ticksToMs = 1000.0 / double(m_DeviceDesc->timestampFrequencyHz);
+
+    // Trace: passes are placed relative to the submission of the frame (the GPU may start later)
+    const bool isTraced = m_CpuProfiler.IsTracing() && (mask & (1 << (uint32_t)GpuPass::Frame));
+    const uint64_t frameBegin = *(const uint64_t*)data;
+    const uint64_t submitTime = m_CpuSubmitTimes[bufferedFrameIndex];
+
+    for (uint32_t i = 0; i < (uint32_t)GpuPass::MAX_NUM; i++)
+    {
+        if (!(mask & (1 << i)))
+        {
+            m_GpuPassTimes[i] = 0.0f;
+            m_SmoothedGpuPassTimes[i] = 0.0f;
+            continue;
+        }
+
+        const uint64_t begin = *(const uint64_t*)(data + (i * 2 + 0) * m_TimestampQuerySize);
+        const uint64_t end = *(const uint64_t*)(data + (i * 2 + 1) * m_TimestampQuerySize);
+        const float ms = end > begin ? float( double(end - begin) * ticksToMs ) : 0.0f;
+
+        m_GpuPassTimes[i] = ms;
+        m_SmoothedGpuPassTimes[i] = m_SmoothedGpuPassTimes[i] == 0.0f ? ms : Lerp(m_SmoothedGpuPassTimes[i], ms, 0.05f);
+
+        if (isTraced && end > begin && begin >= frameBegin)
+        {
+            const uint64_t gpuBegin = submitTime + uint64_t( double(begin - frameBegin) * ticksToMs * 1000000.0 );
+            const uint64_t gpuEnd = submitTime + uint64_t( double(end - frameBegin) * ticksToMs * 1000000.0 );
+            m_CpuProfiler.AddGpuPass(GPU_PASS_NAMES[i], gpuBegin, gpuEnd, m_TimestampFrameIndices[bufferedFrameIndex]);
+        }
+    }
+
+    NRI.UnmapBuffer(*m_TimestampBuffer);
+
+    m_GpuPassMask = mask;
+    m_GpuPassPixelRatio = m_TimestampPixelRatios[bufferedFrameIndex];
+    m_IsGpuPassTimesUpdated = true;
+
+    if (m_Benchmark && !m_BenchmarkRuns.empty())
+    {
+        const uint32_t measuredFrameIndex = m_TimestampFrameIndices[bufferedFrameIndex];
+        if (measuredFrameIndex >= m_BenchmarkMeasureStart && measuredFrameIndex < m_BenchmarkMeasureStart + m_BenchmarkMeasureFrameNum)
+        {
+            BenchmarkRun& run = m_BenchmarkRuns.back();
+            for (uint32_t i = 0; i < (uint32_t)GpuPass::MAX_NUM; i++)
+            {
+                if (mask & (1 << i))
+                    run.gpuPassTimes[i].push_back(m_GpuPassTimes[i]);
+            }
+        }
+    }
+
+    if (m_GpuTimingsFile)
+    {
+        fprintf(m_GpuTimingsFile, "%u", m_TimestampFrameIndices[bufferedFrameIndex]);
+        for (uint32_t i = 0; i < (uint32_t)GpuPass::MAX_NUM; i++)
+        {
+            if (mask & (1 << i))
+                fprintf(m_GpuTimingsFile, ",%.4f", m_GpuPassTimes[i]);
+            else
+                fprintf(m_GpuTimingsFile, ",");
+        }
+        fprintf(m_GpuTimingsFile, "\n");
+    }
+}
+
+void Sample::ReadMipFeedback(uint32_t bufferedFrameIndex)
+{
+    // Called after waiting for the frame which used this slot. Materials hit in that frame have its index in the upper bits, the rest is older
+    const uint32_t copiedFrameIndex = m_MipFeedbackFrameIndices[bufferedFrameIndex];
+    if (!copiedFrameIndex)
+        return;
+
+    m_MipFeedbackFrameIndices[bufferedFrameIndex] = 0;
+
+    const uint32_t frameIndex = copiedFrameIndex - 1;
+    const uint64_t size = m_Scene.materials.size() * sizeof(uint32_t);
+    const uint32_t* feedback = (const uint32_t*)NRI.MapBuffer(*m_MipFeedbackBuffer, bufferedFrameIndex * size, size);
+
+    for (size_t i = 0; i < m_Scene.materials.size(); i++)
+    {
+        if ((feedback[i] >> 8) != (frameIndex & 0xFFFFFF))
+            continue;
+
+        const utils::Material& material = m_Scene.materials[i];
+        const uint32_t textureIndices[] = { material.diffuseMapIndex, material.specularMapIndex, material.normalMapIndex, material.emissiveMapIndex };
+        const float mip = float(255 - (feedback[i] & 0xFF)) / MIP_FEEDBACK_MIP_SCALE;
+
+        for (uint32_t textureIndex : textureIndices)
+        {
+            // See "GetRealMip"
+            const utils::Texture* texture = m_Scene.textures[textureIndex];
+            const float realMip = mip + log2f(float(texture->GetWidth())) - MAX_MIP_LEVEL;
+            const uint32_t requestedMip = (uint32_t)Clamp(realMip, 0.0f, float(texture->GetMipNum() - 1));
+
+            ResidentTexture& residentTexture = m_ResidentTextures[textureIndex];
+            residentTexture.requestedMip = (uint8_t)Min((uint32_t)residentTexture.requestedMip, requestedMip);
+            residentTexture.lastRequestFrame = frameIndex;
+        }
+    }
+
+    NRI.UnmapBuffer(*m_MipFeedbackBuffer);
+}
+
+#ifdef _DEBUG
+void Sample::ReadSampleSum(uint32_t bufferedFrameIndex)
+{
+    // "SampleNum.cs" must distribute exactly the budget, a mismatch gets reported (GPU data, not asserted)
+    const uint32_t budget = m_SampleSumBudgets[bufferedFrameIndex];
+    if (!budget)
+        return;
+
+    m_SampleSumBudgets[bufferedFrameIndex] = 0;
+
+    const uint32_t* sampleSum = (const uint32_t*)NRI.MapBuffer(*m_SampleSumBuffer, bufferedFrameIndex * sizeof(uint32_t), sizeof(uint32_t));
+    if (*sampleSum != budget)
+        printf("Adaptive sampling: %u samples distributed instead of %u!\n", *sampleSum, budget);
+    NRI.UnmapBuffer(*m_SampleSumBuffer);
+}
+#endif
+
+// Uncompressed scanline OpenEXR (little-endian hosts), "channels" names interleaved HALF or FLOAT channels. The file stores them sorted by name
+static bool WriteExr(const std::string& path, const uint8_t* pixels, uint32_t width, uint32_t height, const char* channels, uint32_t channelSize)
+{
+    const uint32_t channelNum = (uint32_t)strlen(channels);
+    const int32_t pixelType = channelSize == 2 ? 1 : 2; // HALF : FLOAT
+
+    std::array<uint32_t, 4> order = {0, 1, 2, 3};
+    std::sort(order.begin(), order.begin() + channelNum, [&](uint32_t a, uint32_t b) { return channels[a] < channels[b]; });
+
+    std::vector<uint8_t> header;
+    auto Put = [&](const void* data, size_t size)
+    { header.insert(header.end(), (const uint8_t*)data, (const uint8_t*)data + size); };
+
+    auto PutInt = [&](int32_t value)
+    { Put(&value, sizeof(value)); };
+
+    auto PutAttribute = [&](const char* name, const char* type, int32_t size)
+    {
+        Put(name, strlen(name) + 1);
+        Put(type, strlen(type) + 1);
+        PutInt(size);
+    };
+
+    PutInt(20000630); // magic
+    PutInt(2); // version, scanline
+
+    PutAttribute("channels", "chlist", channelNum * 18 + 1);
+    for (uint32_t i = 0; i < channelNum; i++)
+    {
+        const char name[2] = {channels[order[i]], 0};
+        Put(name, sizeof(name));
+        PutInt(pixelType);
+        PutInt(0); // pLinear, reserved
+        PutInt(1); // x sampling
+        PutInt(1); // y sampling
+    }
+    header.push_back(0);
+
+    const int32_t window[4] = {0, 0, int32_t(width) - 1, int32_t(height) - 1};
+    const float one = 1.0f;
+    const float center[2] = {};
+
+    PutAttribute("compression", "compression", 1);
+    header.push_back(0); // none
+    PutAttribute("dataWindow", "box2i", sizeof(window));
+    Put(window, sizeof(window));
+    PutAttribute("displayWindow", "box2i", sizeof(window));
+    Put(window, sizeof(window));
+    PutAttribute("lineOrder", "lineOrder", 1);
+    header.push_back(0); // increasing Y
+    PutAttribute("pixelAspectRatio", "float", sizeof(one));
+    Put(&one, sizeof(one));
+    PutAttribute("screenWindowCenter", "v2f", sizeof(center));
+    Put(center, sizeof(center));
+    PutAttribute("screenWindowWidth", "float", sizeof(one));
+    Put(&one, sizeof(one));
+    header.push_back(0);
+
+    // Scanline offsets, then scanlines: "y, size" and channels one after another
+    const uint32_t pixelSize = channelNum * channelSize;
+    const uint32_t lineSize = width * pixelSize;
+
+    uint64_t offset = header.size() + height * sizeof(uint64_t);
+    for (uint32_t y = 0; y < height; y++)
+    {
+        Put(&offset, sizeof(offset));
+        offset += 2 * sizeof(int32_t) + lineSize;
+    }
+
+    FILE* fp = fopen(path.c_str(), "wb");
+    if (!fp)
+        return false;
+
+    bool isWritten = fwrite(header.data(), 1, header.size(), fp) == header.size();
+
+    std::vector<uint8_t> line(2 * sizeof(int32_t) + lineSize);
+    for (uint32_t y = 0; y < height && isWritten; y++)
+    {
+        const int32_t lineHeader[2] = {int32_t(y), int32_t(lineSize)};
+        memcpy(line.data(), lineHeader, sizeof(lineHeader));
+
+        const uint8_t* src = pixels + uint64_t(y) * lineSize;
+        uint8_t* dst = line.data() + sizeof(lineHeader);
+        for (uint32_t i = 0; i < channelNum; i++)
+        {
+            for (uint32_t x = 0; x < width; x++, dst += channelSize)
+                memcpy(dst, src + x * pixelSize + order[i] * channelSize, channelSize);
+        }
+
+        isWritten = fwrite(line.data(), 1, line.size(), fp) == line.size();
+    }
+
+    fclose(fp);
+
+    return isWritten;
+}
+
+void Sample::ReadCapture(uint32_t bufferedFrameIndex)
+{
+    // Called after waiting for the frame which used this slice. Rows get packed tightly here (the slice gets reused by the next frame), files get written by the writer threads
+    CaptureSlot& slot = m_CaptureSlots[bufferedFrameIndex];
+    if (!slot.frameIndex)
+        return;
+
+    slot.frameIndex = 0;
+    m_CapturedFrameNum++;
+
+    std::array<uint32_t, (uint32_t)CaptureTarget::MAX_NUM> targets = {};
+    uint32_t targetNum = 0;
+    for (uint32_t i = 0; i < (uint32_t)CaptureTarget::MAX_NUM; i++)
+    {
+        if (m_CaptureTargetMask & (1 << i))
+            targets[targetNum++] = i;
+    }
+
+    std::array<std::shared_ptr<std::vector<uint8_t>>, (uint32_t)CaptureTarget::MAX_NUM> images;
+    const uint8_t* data = (const uint8_t*)NRI.MapBuffer(*m_CaptureBuffer, bufferedFrameIndex * m_CaptureSliceSize, m_CaptureSliceSize);
+
+    m_WorkerPool.Execute(targetNum, [&](uint32_t jobIndex)
+    {
+        const uint32_t target = targets[jobIndex];
+        const uint2 size = slot.sizes[target];
+        const CaptureLayout& layout = m_CaptureLayouts[target];
+        const uint32_t rowSize = size.x * GetCaptureTexelSize(slot.formats[target]);
+
+        images[jobIndex] = std::make_shared<std::vector<uint8_t>>(uint64_t(rowSize) * size.y);
+        uint8_t* dst = images[jobIndex]->data();
+        for (uint32_t y = 0; y < size.y; y++)
+            memcpy(dst + uint64_t(y) * rowSize, data + layout.offset + uint64_t(y) * layout.rowPitch, rowSize);
+    });
+
+    NRI.UnmapBuffer(*m_CaptureBuffer);
+
+    for (uint32_t i = 0; i < targetNum; i++)
+    {
+        const uint32_t target = targets[i];
+        const uint2 size = slot.sizes[target];
+        const nri::Format format = slot.formats[target];
+
+        // Float formats go to EXR, the rest is written as raw texels of the format
+        const char* channels = nullptr;
+        uint32_t channelSize = 0;
+        if (format == nri::Format::RGBA16_SFLOAT || format == nri::Format::RGBA32_SFLOAT)
+            channels = "RGBA";
+        else if (format == nri::Format::R16_SFLOAT || format == nri::Format::R32_SFLOAT)
+            channels = target == (uint32_t)CaptureTarget::ViewZ ? "Z" : "Y";
+        if (channels)
+            channelSize = GetCaptureTexelSize(format) / (uint32_t)strlen(channels);
+
+        char name[128];
+        if (channels)
+            snprintf(name, sizeof(name), "/t%03u_f%05u_%s.exr", slot.test, slot.testFrame, CAPTURE_TARGET_NAMES[target]);
+        else
+            snprintf(name, sizeof(name), "/t%03u_f%05u_%s_%ux%u_%u.raw", slot.test, slot.testFrame, CAPTURE_TARGET_NAMES[target], size.x, size.y, (uint32_t)format);
+
+        const std::string path = m_CaptureDirectory + name;
+        std::shared_ptr<std::vector<uint8_t>> image = images[i];
+
+        m_CaptureWriter.Push([this, path, image, size, channels, channelSize]()
+        {
+            bool isWritten = false;
+            if (channels)
+                isWritten = WriteExr(path, image->data(), size.x, size.y, channels, channelSize);
+            else
+            {
+                FILE* fp = fopen(path.c_str(), "wb");
+                if (fp)
+                {
+                    isWritten = fwrite(image->data(), 1, image->size(), fp) == image->size();
+                    fclose(fp);
+                }
+            }
+
+            if (isWritten)
+            {
+                m_CaptureWrittenFileNum++;
+                m_CaptureWrittenBytes += image->size();
+            }
+            else
+                m_CaptureFailedFileNum++;
+        });
+    }
+}
+
+void Sample::CmdReadbackCaptureTarget(nri::CommandBuffer& commandBuffer, uint32_t bufferedFrameIndex, CaptureTarget target, Texture texture)
+{
+    const uint2 size = m_CaptureSlots[bufferedFrameIndex].sizes[(uint32_t)target];
+    const CaptureLayout& layout = m_CaptureLayouts[(uint32_t)target];
+
+    nri::TextureRegionDesc srcRegion = {};
+    srcRegion.size[0] = (uint16_t)size.x;
+    srcRegion.size[1] = (uint16_t)size.y;
+    srcRegion.size[2] = 1;
+
+    nri::TextureDataLayoutDesc dstLayout = {};
+    dstLayout.offset = bufferedFrameIndex * m_CaptureSliceSize + layout.offset;
+    dstLayout.rowPitch = layout.rowPitch;
+    dstLayout.slicePitch = layout.rowPitch * size.y;
+
+    NRI.CmdReadbackTextureToBuffer(commandBuffer, *m_CaptureBuffer, dstLayout, *Get(texture), srcRegion);
+}
+
+void Sample::SetGpuTimingsDump(bool enable)
+{
+    if (!enable)
+    {
+        if (m_GpuTimingsFile)
+            fclose(m_GpuTimingsFile);
+        m_GpuTimingsFile = nullptr;
+
+        return;
+    }
+
+    if (m_GpuTimingsFile)
+        return;
+
+    const char* fileName = "GpuTimings.csv";
+    m_GpuTimingsFile = fopen(fileName, "w");
+    if (!m_GpuTimingsFile)
+    {
+        printf("GPU profiler: can't open '%s'!\n", fileName);
+        return;
+    }
+
+    fprintf(m_GpuTimingsFile, "FrameIndex");
+    for (uint32_t i = 0; i < (uint32_t)GpuPass::MAX_NUM; i++)
+        fprintf(m_GpuTimingsFile, ",%s (ms)", GPU_PASS_NAMES[i]);
+    fprintf(m_GpuTimingsFile, "\n");
+
+    printf("GPU profiler: writing per-frame timings to '%s'\n", fileName);
+}
+
+void Sample::UpdateDynamicResolution()
+{
+    // GPU timings are not affected by VSYNC or the FPS cap, but they are "m_FrameInFlightNum" frames old. That's why
+    // the pixel ratio the measured frame was rendered with is stored along with the timestamps
+    if (!m_IsGpuPassTimesUpdated || m_GpuPassTimes[(uint32_t)GpuPass::Frame] == 0.0f)
+        return;
+
+    m_IsGpuPassTimesUpdated = false;
+
+    // Split the frame into a part scaling with the number of traced pixels and a fixed part (TLAS, DLSS, upsampling, UI...)
+    float scaledCost = 0.0f;
+    const GpuPass scaledPasses[] = { GpuPass::Raytracing, GpuPass::Reblur, GpuPass::Relax, GpuPass::SampleBudget, GpuPass::Composition, GpuPass::PreDlss, GpuPass::Temporal, GpuPass::CompositionTemporal };
+    for (GpuPass pass : scaledPasses)
+        scaledCost += m_GpuPassTimes[(uint32_t)pass];
+
+    const float frameCost = m_GpuPassTimes[(uint32_t)GpuPass::Frame];
+    const float fixedCost = Max(frameCost - scaledCost, 0.0f);
+    const float fullResolutionCost = scaledCost / Max(m_GpuPassPixelRatio, 0.01f);
+
+    // Filter the model, not the scale, to remain responsive to sudden changes (history reset, camera cuts)
+    const float k = 0.2f;
+    m_DrsFullResolutionCost = m_DrsFullResolutionCost == 0.0f ? fullResolutionCost : Lerp(m_DrsFullResolutionCost, fullResolutionCost, k);
+    m_DrsFixedCost = m_DrsFixedCost == 0.0f ? fixedCost : Lerp(m_DrsFixedCost, fixedCost, k);
+
+    // Predict the scale which fits the budget, keeping some headroom for spikes
+    const float headroom = 0.95f;
+    const float scaledBudget = Max(m_GpuBudget * headroom - m_DrsFixedCost, m_GpuBudget * 0.05f);
+    const float minScale = m_MinResolutionScale * 0.01f;
+    const float targetScale = Clamp(Sqrt(scaledBudget / Max(m_DrsFullResolutionCost, 0.001f)), minScale, 1.0f);
+
+    // Hysteresis: ignore small fluctuations, go down quickly if over budget, go up slowly to avoid oscillations
+    const float delta = targetScale - m_ResolutionScale;
+    const bool isOverBudget = frameCost > m_GpuBudget;
+    if (Abs(delta) < 0.02f && !isOverBudget)
+        return;
+
+    const float maxStep = delta > 0.0f ? 0.02f : 0.1f;
+    m_ResolutionScale = Clamp(m_ResolutionScale + Clamp(delta, -maxStep, maxStep), minScale, 1.0f);
+}
+
+void Sample::SetDlssQuality(uint32_t quality)
+{
+    // The feature is cached and textures fit the largest render resolution, i.e. nothing gets recreated
+    if (!m_DLSS.SetQuality((DlssQuality)quality))
+    {
+        m_DlssQualityRequest = m_DlssQuality;
+        printf("DLSS: unsupported mode!\n");
+
+        return;
+    }
+
+    const uint2 prevRenderResolution = GetRenderResolution();
+    m_DlssQuality = quality;
+
+    const uint2 renderResolution = GetRenderResolution();
+    m_MinResolutionScale = m_DlssMinResolutionScales[quality];
+    m_ResolutionScale = Max(m_ResolutionScale, m_MinResolutionScale * 0.01f);
+    m_DrsFullResolutionCost *= float(renderResolution.x * renderResolution.y) / float(prevRenderResolution.x * prevRenderResolution.y);
+    m_IsDlssHistoryReset = true;
+
+    printf("DLSS: render resolution (%u, %u)\n", renderResolution.x, renderResolution.y);
+}
+
+void Sample::CreateTexture(std::vector<DescriptorDesc>& descriptorDescs, const char* debugName, nri::Format format, uint16_t width, uint16_t height, uint16_t mipNum, uint16_t arraySize, nri::TextureUsageBits usage, nri::AccessBits state)
+{
+    nri::Texture* texture = nullptr;
+    const nri::CTextureDesc textureDesc = nri::CTextureDesc::Texture2D(format, width, height, mipNum, arraySize, usage);
+    NRI_ABORT_ON_FAILURE(NRI.CreateTexture(*m_Device, textureDesc, texture));
+    m_Textures.push_back(texture);
+
+    if (state != nri::AccessBits::UNKNOWN)
+    {
+        nri::TextureTransitionBarrierDesc transition = nri::TextureTransition(texture, state, state == nri::AccessBits::SHADER_RESOURCE ? nri::TextureLayout::SHADER_RESOURCE : nri::TextureLayout::GENERAL);
+        m_TextureStates.push_back(transition);
+        m_TextureFormats.push_back(format);
+    }
+
+    descriptorDescs.push_back( {debugName, texture, format, usage, nri::BufferUsageBits::NONE, arraySize > 1} );
+}
+
+void Sample::CreateBuffer(std::vector<DescriptorDesc>& descriptorDescs, const char* debugName, uint64_t elements, uint32_t stride, nri::BufferUsageBits usage, nri::Format format)
+{
+    nri::BufferDesc bufferDesc = {};
+    bufferDesc.size = elements * stride;
+    bufferDesc.structureStride = (format == nri::Format::UNKNOWN && stride != 1) ? stride : 0;
+    bufferDesc.usageMask = usage;
+
+    nri::Buffer* buffer = nullptr;
+    NRI_ABORT_ON_FAILURE( NRI.CreateBuffer(*m_Device, bufferDesc, buffer) );
+    m_Buffers.push_back(buffer);
+
+    descriptorDescs.push_back( {debugName, buffer, format, nri::TextureUsageBits::NONE, usage} );
+}
+
+nri::Memory* Sample::AllocateFromHeap(const nri::MemoryDesc& memoryDesc, MemoryCategory category, uint64_t& offset, uint64_t heapSize)
+{
+    m_MemoryCategorySizes[(uint32_t)category] += memoryDesc.size;
+
+    // Linear placement, resources live until shutdown
+    for (MemoryHeap& heap : m_MemoryHeaps)
+    {
+        if (heap.type != memoryDesc.type)
+            continue;
+
+        const uint64_t alignedOffset = helper::GetAlignedSize(heap.offset, memoryDesc.alignment);
+        if (alignedOffset + memoryDesc.size <= heap.size)
+        {
+            heap.offset = alignedOffset + memoryDesc.size;
+            offset = alignedOffset;
+
+            return heap.memory;
+        }
+    }
+
+    MemoryHeap heap = {};
+    heap.type = memoryDesc.type;
+    heap.size = Max(heapSize, memoryDesc.size);
+    heap.offset = memoryDesc.size;
+    NRI_ABORT_ON_FAILURE(NRI.AllocateMemory(*m_Device, nri::WHOLE_DEVICE_GROUP, heap.type, heap.size, heap.memory));
+
+    m_MemoryHeaps.push_back(heap);
+    m_MemoryAllocations.push_back(heap.memory);
+    offset = 0;
+
+    return heap.memory;
+}
+
+uint8_t* Sample::AllocateFromUploadRing(uint64_t size, uint64_t& offset)
+{
+    // Linear within the segment of the current frame, the segment is sized for the worst case
+    offset = m_UploadRing.head;
+    m_UploadRing.head = helper::GetAlignedSize(m_UploadRing.head + size, UPLOAD_RING_ALIGNMENT);
+    assert( m_UploadRing.head <= m_UploadRing.end );
+
+    return m_UploadRing.data + offset;
+}
+
+void Sample::PlaceResources()
+{
+    constexpr uint32_t offset = uint32_t(Buffer::UploadHeapBufferNum);
+
+    // Buffers
+    std::vector<nri::BufferMemoryBindingDesc> bufferBindings(m_Buffers.size());
+    std::vector<nri::MemoryDesc> bufferMemoryDescs(m_Buffers.size());
+
+    uint64_t uploadHeapSize = 0;
+    for (uint32_t i = 0; i < offset; i++)
+    {
+        NRI.GetBufferMemoryInfo(*m_Buffers[i], nri::MemoryLocation::HOST_UPLOAD, bufferMemoryDescs[i]);
+        uploadHeapSize = helper::GetAlignedSize(uploadHeapSize, bufferMemoryDescs[i].alignment) + bufferMemoryDescs[i].size;
+    }
+
+    for (uint32_t i = offset; i < m_Buffers.size(); i++)
+    {
+        const bool isHostVisible = i == (uint32_t)Buffer::InstanceData && m_IsInstanceDataHostVisible;
+        NRI.GetBufferMemoryInfo(*m_Buffers[i], isHostVisible ? nri::MemoryLocation::DEVICE_UPLOAD : nri::MemoryLocation::DEVICE, bufferMemoryDescs[i]);
+    }
+
+    for (uint32_t i = 0; i < m_Buffers.size(); i++)
+    {
+        nri::BufferMemoryBindingDesc& binding = bufferBindings[i];
+        binding = {};
+        binding.buffer = m_Buffers[i];
+
+        // Upload buffers are mapped every frame, they go into a single heap of the exact size
+        if (i < offset)
+            binding.memory = AllocateFromHeap(bufferMemoryDescs[i], MemoryCategory::UploadBuffers, binding.offset, uploadHeapSize);
+        else if (i == (uint32_t)Buffer::InstanceData && m_IsInstanceDataHostVisible)
+            binding.memory = AllocateFromHeap(bufferMemoryDescs[i], MemoryCategory::UploadBuffers, binding.offset, bufferMemoryDescs[i].size);
+        else
+            binding.memory = AllocateFromHeap(bufferMemoryDescs[i], MemoryCategory::Buffers, binding.offset);
+    }
+
+    NRI_ABORT_ON_FAILURE(NRI.BindBufferMemory(*m_Device, bufferBindings.data(), helper::GetCountOf(bufferBindings)));
+
+    // Transient targets: "Unfiltered_*" (ray tracing -> NRD -> DLSS inputs) and "Final" (after DLSS or upsample -> back buffer) never live at the same time within a frame,
+    // the frame graph issues aliasing barriers when ownership of the shared memory changes
+    const Texture unfilteredTextures[] =
+    {
+        Texture::Unfiltered_ShadowData,
+        Texture::Unfiltered_Diff,
+        Texture::Unfiltered_Spec,
+        Texture::Unfiltered_Shadow_Translucency,
+    };
+
+    std::vector<nri::TextureMemoryBindingDesc> textureBindings;
+    textureBindings.reserve(m_Textures.size() + m_DataTextureTwins.size());
+
+    // Data textures share memory with their twins
+    auto GetPlacedTextureMemoryDesc = [&](uint32_t textureIndex, nri::MemoryDesc& memoryDesc)
+    {
+        NRI.GetTextureMemoryInfo(*m_Textures[textureIndex], nri::MemoryLocation::DEVICE, memoryDesc);
+
+        for (const DataTextureTwin& twin : m_DataTextureTwins)
+        {
+            if ((uint32_t)twin.texture != textureIndex)
+                continue;
+
+            nri::MemoryDesc twinMemoryDesc = {};
+            NRI.GetTextureMemoryInfo(*twin.resource, nri::MemoryLocation::DEVICE, twinMemoryDesc);
+            assert( twinMemoryDesc.type == memoryDesc.type );
+
+            memoryDesc.size = Max(memoryDesc.size, twinMemoryDesc.size);
+            memoryDesc.alignment = Max(memoryDesc.alignment, twinMemoryDesc.alignment);
+        }
+    };
+
+    nri::MemoryDesc finalMemoryDesc = {};
+    NRI.GetTextureMemoryInfo(*Get(Texture::Final), nri::MemoryLocation::DEVICE, finalMemoryDesc);
+
+    m_TransientTextures.clear();
+    m_TransientTextures.push_back( {Texture::Final, nullptr, 0, finalMemoryDesc.size, false} );
+
+    nri::MemoryDesc sharedMemoryDesc = finalMemoryDesc;
+    uint64_t unfilteredSize = 0;
+    for (Texture texture : unfilteredTextures)
+    {
+        nri::MemoryDesc memoryDesc = {};
+        GetPlacedTextureMemoryDesc((uint32_t)texture, memoryDesc);
+        assert( memoryDesc.type == finalMemoryDesc.type );
+
+        const uint64_t textureOffset = helper::GetAlignedSize(unfilteredSize, memoryDesc.alignment);
+        m_TransientTextures.push_back( {texture, nullptr, textureOffset, memoryDesc.size, false} );
+
+        unfilteredSize = textureOffset + memoryDesc.size;
+        sharedMemoryDesc.alignment = Max(sharedMemoryDesc.alignment, memoryDesc.alignment);
+    }
+    sharedMemoryDesc.size = Max(unfilteredSize, finalMemoryDesc.size);
+    m_AliasedMemorySize = unfilteredSize + finalMemoryDesc.size - sharedMemoryDesc.size;
+
+    uint64_t sharedOffset = 0;
+    nri::Memory* sharedMemory = AllocateFromHeap(sharedMemoryDesc, MemoryCategory::TransientRenderTargets, sharedOffset);
+
+    std::vector<bool> isPlaced(m_Textures.size(), false);
+    for (TransientTexture& transientTexture : m_TransientTextures)
+    {
+        transientTexture.memory = sharedMemory;
+        transientTexture.offset += sharedOffset;
+
+        textureBindings.push_back( {sharedMemory, Get(transientTexture.texture), transientTexture.offset} );
+        isPlaced[(uint32_t)transientTexture.texture] = true;
+    }
+
+    // The rest
+    for (uint32_t i = 0; i < m_Textures.size(); i++)
+    {
+        if (isPlaced[i])
+            continue;
+
+        nri::MemoryDesc memoryDesc = {};
+        GetPlacedTextureMemoryDesc(i, memoryDesc);
+
+        nri::TextureMemoryBindingDesc binding = {};
+        binding.texture = m_Textures[i];
+
+        // Resident textures get reallocated, they can't live in linear heaps
+        ResidentTexture* residentTexture = i < (uint32_t)Texture::MaterialTextures ? nullptr : &m_ResidentTextures[i - (uint32_t)Texture::MaterialTextures];
+        if (residentTexture && residentTexture->isManaged)
+        {
+            NRI_ABORT_ON_FAILURE(NRI.AllocateMemory(*m_Device, nri::WHOLE_DEVICE_GROUP, memoryDesc.type, memoryDesc.size, residentTexture->memory));
+            residentTexture->memorySize = memoryDesc.size;
+            m_MemoryCategorySizes[(uint32_t)MemoryCategory::MaterialTextures] += memoryDesc.size;
+
+            binding.memory = residentTexture->memory;
+        }
+        else
+            binding.memory = AllocateFromHeap(memoryDesc, i < (uint32_t)Texture::MaterialTextures ? MemoryCategory::RenderTargets : MemoryCategory::MaterialTextures, binding.offset);
+        textureBindings.push_back(binding);
+
+        // Twins alternate in the same memory, which requires an aliasing barrier after a switch
+        for (const DataTextureTwin& twin : m_DataTextureTwins)
+        {
+            if ((uint32_t)twin.texture == i)
+                m_TransientTextures.push_back( {twin.texture, binding.memory, binding.offset, memoryDesc.size, false} );
+        }
+    }
+
+    const size_t bindingNum = textureBindings.size();
+    for (const DataTextureTwin& twin : m_DataTextureTwins)
+    {
+        for (size_t i = 0; i < bindingNum; i++)
+        {
+            if (textureBindings[i].texture == Get(twin.texture))
+                textureBindings.push_back( {textureBindings[i].memory, twin.resource, textureBindings[i].offset} );
+        }
+    }
+
+    NRI_ABORT_ON_FAILURE(NRI.BindTextureMemory(*m_Device, textureBindings.data(), helper::GetCountOf(textureBindings)));
+
+    // Report
+    uint64_t heapSize = 0;
+    for (const MemoryHeap& heap : m_MemoryHeaps)
+        heapSize += heap.size;
+
+    printf("Memory: %u heaps, %.1f MB (%.1f MB saved by aliasing)\n", helper::GetCountOf(m_MemoryHeaps), heapSize / (1024.0 * 1024.0), m_AliasedMemorySize / (1024.0 * 1024.0));
+    for (uint32_t i = 0; i < (uint32_t)MemoryCategory::MAX_NUM; i++)
+        printf("  %-26s %8.1f MB\n", MEMORY_CATEGORY_NAMES[i], m_MemoryCategorySizes[i] / (1024.0 * 1024.0));
+}
+
+inline nri::Format ConvertFormatToTextureStorageCompatible(nri::Format format)
+{
+    switch (format)
+    {
+        case nri::Format::D16_UNORM:                return nri::Format::R16_UNORM;
+        case nri::Format::D24_UNORM_S8_UINT:        return nri::Format::R24_UNORM_X8;
+        case nri::Format::D32_SFLOAT:               return nri::Format::R32_SFLOAT;
+        case nri::Format::D32_SFLOAT_S8_UINT_X24:   return nri::Format::R32_SFLOAT_X8_X24;
+        case nri::Format::RGBA8_SRGB:               return nri::Format::RGBA8_UNORM;
+        case nri::Format::BGRA8_SRGB:               return nri::Format::BGRA8_UNORM;
+    }
+
+    return format;
+}
+
+void Sample::CreateDescriptors(const std::vector<DescriptorDesc>& descriptorDescs)
+{
+    nri::Descriptor* descriptor = nullptr;
+    for (const DescriptorDesc& desc : descriptorDescs)
+    {
+        if (desc.textureUsage == nri::TextureUsageBits::NONE)
+        {
+            if (desc.bufferUsage & nri::BufferUsageBits::CONSTANT_BUFFER)
+            {
+                for (uint32_t i = 0; i < m_FrameInFlightNum; i++)
+                {
+                    nri::BufferViewDesc bufferDesc = {};
+                    bufferDesc.buffer = Get(Buffer::UploadRing);
+                    bufferDesc.viewType = nri::BufferViewType::CONSTANT;
+                    bufferDesc.offset = i * m_UploadRing.segmentSize;
+                    bufferDesc.size = m_ConstantBufferSize;
+
+                    NRI_ABORT_ON_FAILURE( NRI.CreateBufferView(bufferDesc, m_Frames[i].globalConstantBufferDescriptor) );
+                    m_Frames[i].globalConstantBufferOffset = bufferDesc.offset;
+
+                    // Constants of peer GPUs follow
+                    for (uint32_t j = 1; j < m_PhysicalDeviceNum; j++)
+                    {
+                        bufferDesc.offset += helper::GetAlignedSize(m_ConstantBufferSize, UPLOAD_RING_ALIGNMENT);
+                        NRI_ABORT_ON_FAILURE( NRI.CreateBufferView(bufferDesc, m_Frames[i].peerConstantBufferDescriptors[j]) );
+                    }
+                }
+            }
+            else if (desc.bufferUsage & nri::BufferUsageBits::SHADER_RESOURCE)
+            {
+                const nri::BufferViewDesc viewDesc = {(nri::Buffer*)desc.resource, nri::BufferViewType::SHADER_RESOURCE, desc.format};
+                NRI_ABORT_ON_FAILURE(NRI.CreateBufferView(viewDesc, descriptor));
+                m_Descriptors.push_back(descriptor);
+            }
+            else if ((desc.bufferUsage & nri::BufferUsageBits::SHADER_RESOURCE_STORAGE) && desc.format != nri::Format::UNKNOWN) // scratch buffers don't need views
+            {
+                const nri::BufferViewDesc viewDesc = {(nri::Buffer*)desc.resource, nri::BufferViewType::SHADER_RESOURCE_STORAGE, desc.format};
+                NRI_ABORT_ON_FAILURE(NRI.CreateBufferView(viewDesc, descriptor));
+                m_Descriptors.push_back(descriptor);
+            }
+
+            NRI.SetBufferDebugName(*(nri::Buffer*)desc.resource, desc.debugName);
+        }
+        else
+        {
+            nri::Texture2DViewDesc viewDesc = {(nri::Texture*)desc.resource, desc.isArray ? nri::Texture2DViewType::SHADER_RESOURCE_2D_ARRAY : nri::Texture2DViewType::SHADER_RESOURCE_2D, desc.format};
+            NRI_ABORT_ON_FAILURE(NRI.CreateTexture2DView(viewDesc, descriptor));
+            m_Descriptors.push_back(descriptor);
+
+            if (desc.textureUsage & nri::TextureUsageBits::SHADER_RESOURCE_STORAGE)
+            {
+                viewDesc.format = ConvertFormatToTextureStorageCompatible(desc.format);
+                viewDesc.viewType = desc.isArray ? nri::Texture2DViewType::SHADER_RESOURCE_STORAGE_2D_ARRAY : nri::Texture2DViewType::SHADER_RESOURCE_STORAGE_2D;
+                NRI_ABORT_ON_FAILURE(NRI.CreateTexture2DView(viewDesc, descriptor));
+                m_Descriptors.push_back(descriptor);
+            }
+
+            NRI.SetTextureDebugName(*(nri::Texture*)desc.resource, desc.debugName);
+        }
+    }
+}
+
+void Sample::CreateResources(nri::Format swapChainFormat)
+{
+    std::vector<DescriptorDesc> descriptorDescs;
+
+    const uint16_t w = (uint16_t)m_ScreenResolution.x;
+    const uint16_t h = (uint16_t)m_ScreenResolution.y;
+    const uint64_t instanceDataSize = (m_Scene.instances.size() + ANIMATED_INSTANCE_MAX_NUM) * sizeof(InstanceData);
+    const uint64_t worldScratchBufferSize = Max(NRI.GetAccelerationStructureBuildScratchBufferSize(*m_WorldTlas), NRI.GetAccelerationStructureUpdateScratchBufferSize(*m_WorldTlas));
+
+    // Emissive triangle capacity: instances with emissive materials and all animated objects, which can get "forced emission"
+    uint64_t lightTriangleMaxNum = 0;
+    for (const utils::Instance& instance : m_Scene.instances)
+    {
+        if (m_Scene.materials[instance.materialIndex].IsEmissive())
+            lightTriangleMaxNum += m_Scene.meshes[instance.meshIndex].indexNum / 3;
+    }
+
+    for (uint32_t i = 0; i < ANIMATED_INSTANCE_MAX_NUM; i++)
+        lightTriangleMaxNum += m_Scene.meshes[m_Scene.instances[i % m_DefaultInstancesOffset].meshIndex].indexNum / 3;
+
+    m_LightTriangleMaxNum = (uint32_t)lightTriangleMaxNum;
+    const uint64_t lightDataElements = 1 + 4 * lightTriangleMaxNum;
+
+    // A single mip must fit into the per frame streaming staging area
+    m_TextureStreamingStagingSize = TEXTURE_STREAMING_BUDGET;
+    for (const utils::Texture* textureData : m_Scene.textures)
+        m_TextureStreamingStagingSize = Max(m_TextureStreamingStagingSize, GetStagedMipSize(*textureData, 0));
+    m_TextureStreamingStagingSize = helper::GetAlignedSize(m_TextureStreamingStagingSize, m_DeviceDesc->uploadBufferTextureSliceAlignment);
+
+    // ReBAR: "InstanceData" lives in device memory visible to the CPU, a copy per frame in flight. Shaders read it directly, there is no staging copy
+    m_IsInstanceDataHostVisible = m_DeviceDesc->deviceUploadHeapSize >= instanceDataSize * m_FrameInFlightNum && m_PhysicalDeviceNum == 1; // ReBAR memory is local to GPU 0
+    m_InstanceDataFrameCapacity = uint32_t(m_Scene.instances.size() + ANIMATED_INSTANCE_MAX_NUM);
+    printf("Instance data: %s\n", m_IsInstanceDataHostVisible ? "read by shaders from host visible device memory (ReBAR)" : "copied to device memory");
+
+    // Per frame uploads: constants (must go first, views are created at segment starts), TLAS instance descs and "InstanceData" staging
+    assert( m_DeviceDesc->constantBufferOffsetAlignment <= UPLOAD_RING_ALIGNMENT );
+    m_UploadRing.segmentSize = helper::GetAlignedSize(m_ConstantBufferSize, UPLOAD_RING_ALIGNMENT) * m_PhysicalDeviceNum;
+    m_UploadRing.segmentSize += helper::GetAlignedSize(m_InstanceDataFrameCapacity * sizeof(nri::GeometryObjectInstance), UPLOAD_RING_ALIGNMENT);
+    if (!m_IsInstanceDataHostVisible)
+        m_UploadRing.segmentSize += helper::GetAlignedSize(instanceDataSize, UPLOAD_RING_ALIGNMENT);
+
+    // nri::MemoryLocation::HOST_UPLOAD
+    CreateBuffer(descriptorDescs, "Buffer::UploadRing", m_UploadRing.segmentSize * m_FrameInFlightNum, 1, nri::BufferUsageBits::CONSTANT_BUFFER | nri::BufferUsageBits::RAY_TRACING_BUFFER);
+    CreateBuffer(descriptorDescs, "Buffer::LightDataStaging", lightDataElements * sizeof(float4) * m_FrameInFlightNum, 1, nri::BufferUsageBits::NONE);
+    CreateBuffer(descriptorDescs, "Buffer::TextureStreamingStaging", m_TextureStreamingStagingSize * m_FrameInFlightNum, 1, nri::BufferUsageBits::NONE);
+
+    // nri::MemoryLocation::DEVICE
+    CreateBuffer(descriptorDescs, "Buffer::ShaderTable", m_ShaderEntries.back(), 1, nri::BufferUsageBits::NONE);
+    CreateBuffer(descriptorDescs, "Buffer::LightData", lightDataElements, sizeof(float4), nri::BufferUsageBits::SHADER_RESOURCE, nri::Format::RGBA32_SFLOAT);
+    if (m_IsCompactPrimitiveData)
+    {
+        CreateBuffer(descriptorDescs, "Buffer::PrimitiveData", (m_Scene.primitives.size() + 1) / 2, 2 * sizeof(CompactPrimitiveData), nri::BufferUsageBits::SHADER_RESOURCE, nri::Format::RGBA32_UINT);
+        CreateBuffer(descriptorDescs, "Buffer::Indices", m_Scene.indices.size(), sizeof(uint32_t), nri::BufferUsageBits::SHADER_RESOURCE, nri::Format::R32_UINT);
+        CreateBuffer(descriptorDescs, "Buffer::VertexData", m_Scene.unpackedVertices.size(), sizeof(CompactVertexData), nri::BufferUsageBits::SHADER_RESOURCE, nri::Format::RGBA32_UINT);
+    }
+    else
+    {
+        // Indices and vertex data are not needed, 1 element placeholders to have valid descriptors
+        CreateBuffer(descriptorDescs, "Buffer::PrimitiveData", m_Scene.primitives.size(), sizeof(PrimitiveData), nri::BufferUsageBits::SHADER_RESOURCE, nri::Format::RGBA32_UINT);
+        CreateBuffer(descriptorDescs, "Buffer::Indices", 1, sizeof(uint32_t), nri::BufferUsageBits::SHADER_RESOURCE, nri::Format::R32_UINT);
+        CreateBuffer(descriptorDescs, "Buffer::VertexData", 1, sizeof(CompactVertexData), nri::BufferUsageBits::SHADER_RESOURCE, nri::Format::RGBA32_UINT);
+    }
+    CreateBuffer(descriptorDescs, "Buffer::InstanceData", instanceDataSize * (m_IsInstanceDataHostVisible ? m_FrameInFlightNum : 1) / (4 * sizeof(float)), 4 * sizeof(float), nri::BufferUsageBits::SHADER_RESOURCE, nri::Format::RGBA32_SFLOAT);
+    CreateBuffer(descriptorDescs, "Buffer::WorldScratch", worldScratchBufferSize, 1, nri::BufferUsageBits::RAY_TRACING_BUFFER | nri::BufferUsageBits::SHADER_RESOURCE_STORAGE);
+    CreateBuffer(descriptorDescs, "Buffer::RayRecords", 2 * RAY_BIN_NUM + (m_IsRaySorting ? 2 * uint64_t(w) * h : 0), sizeof(uint32_t), nri::BufferUsageBits::SHADER_RESOURCE_STORAGE, nri::Format::R32_UINT);
+    CreateBuffer(descriptorDescs, "Buffer::SampleSum", 1, sizeof(uint32_t), nri::BufferUsageBits::SHADER_RESOURCE_STORAGE, nri::Format::R32_UINT);
+    CreateBuffer(descriptorDescs, "Buffer::MipFeedback", m_Scene.materials.size(), sizeof(uint32_t), nri::BufferUsageBits::SHADER_RESOURCE_STORAGE, nri::Format::R32_UINT);
+
+    // Quality harness: the reference (half4 per output pixel) and metrics per tile, 1 element placeholders to have valid descriptors otherwise
+    const uint64_t qualityTileNum = uint64_t((m_OutputResolution.x + QUALITY_TILE_SIZE - 1) / QUALITY_TILE_SIZE) * ((m_OutputResolution.y + QUALITY_TILE_SIZE - 1) / QUALITY_TILE_SIZE);
+    CreateBuffer(descriptorDescs, "Buffer::QualityReference", m_IsQuality ? GetQualityReferenceSize() / sizeof(uint32_t) : 1, sizeof(uint32_t), nri::BufferUsageBits::SHADER_RESOURCE_STORAGE, nri::Format::R32_UINT);
+    CreateBuffer(descriptorDescs, "Buffer::QualityMetrics", m_IsQuality ? 4 * qualityTileNum : 4, sizeof(uint32_t), nri::BufferUsageBits::SHADER_RESOURCE_STORAGE, nri::Format::R32_UINT);
+
+    nri::Format dataFormat = m_IsOcclusionOnly ? nri::Format::R16_SFLOAT : nri::Format::RGBA16_SFLOAT;
+
+    // Compact: the DLSS output is read as RGB only ("AfterDlss.cs")
+    nri::Format outputFormat = swapChainFormat;
+    if (m_DLSS.IsInitialized())
+        outputFormat = m_IsCompactResources ? nri::Format::R11_G11_B10_UFLOAT : nri::Format::RGBA16_SFLOAT;
+
+    // Compact: direction / PDF inputs are consumed only by the "advanced" REBLUR pre-pass, keep 1x1 placeholders to have valid descriptors
+    const uint16_t directionPdfW = m_IsCompactResources ? 1 : w;
+    const uint16_t directionPdfH = m_IsCompactResources ? 1 : h;
+
+    // Adaptive sampling: noise and ray count per tile
+    const uint16_t tileW = uint16_t((w + SAMPLE_BUDGET_TILE_SIZE - 1) / SAMPLE_BUDGET_TILE_SIZE);
+    const uint16_t tileH = uint16_t((h + SAMPLE_BUDGET_TILE_SIZE - 1) / SAMPLE_BUDGET_TILE_SIZE);
+
+    CreateTexture(descriptorDescs, "Texture::IntegrateBRDF", nri::Format::RG16_SFLOAT, FG_TEX_SIZE, FG_TEX_SIZE, 1, 1,
+        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE_STORAGE);
+    CreateTexture(descriptorDescs, "Texture::ViewZ", nri::Format::R32_SFLOAT, w, h, 1, 1,
+        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE);
+    CreateTexture(descriptorDescs, "Texture::DirectLighting", nri::Format::R11_G11_B10_UFLOAT, w, h, 1, 1,
+        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE);
+    CreateTexture(descriptorDescs, "Texture::TransparentLighting", nri::Format::RGBA16_SFLOAT, w, h, 1, 1,
+        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE);
+    CreateTexture(descriptorDescs, "Texture::ObjectMotion", nri::Format::RGBA16_SFLOAT, w, h, 1, 1,
+        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE);
+    CreateTexture(descriptorDescs, "Texture::Normal_Roughness", NORMAL_FORMAT, w, h, 1, 1,
+        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE);
+    CreateTexture(descriptorDescs, "Texture::BaseColor_Metalness", nri::Format::RGBA8_SRGB, w, h, 1, 1,
+        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE);
+    CreateTexture(descriptorDescs, "Texture::Shadow", nri::Format::RGBA8_UNORM, w, h, 1, 1,
+        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE);
+    CreateTexture(descriptorDescs, "Texture::Diff", dataFormat, w, h, 1, 1,
+        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE);
+    CreateTexture(descriptorDescs, "Texture::DiffDirectionPdf", nri::Format::RGBA16_SFLOAT, directionPdfW, directionPdfH, 1, 1,
+        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE);
+    CreateTexture(descriptorDescs, "Texture::Spec", dataFormat, w, h, 1, 1,
+        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE);
+    CreateTexture(descriptorDescs, "Texture::SpecDirectionPdf", nri::Format::RGBA16_SFLOAT, directionPdfW, directionPdfH, 1, 1,
+        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE);
+    CreateTexture(descriptorDescs, "Texture::Unfiltered_ShadowData", nri::Format::RG16_SFLOAT, w, h, 1, 1,
+        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE);
+    CreateTexture(descriptorDescs, "Texture::Unfiltered_Diff", dataFormat, w, h, 1, 1,
+        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE);
+    CreateTexture(descriptorDescs, "Texture::Unfiltered_Spec", dataFormat, w, h, 1, 1,
+        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE);
+    CreateTexture(descriptorDescs, "Texture::Unfiltered_Shadow_Translucency", nri::Format::RGBA8_UNORM, w, h, 1, 1,
+        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE);
+    CreateTexture(descriptorDescs, "Texture::ComposedLighting_ViewZ", nri::Format::RGBA16_SFLOAT, w, h, 1, 1,
+        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE_STORAGE);
+    CreateTexture(descriptorDescs, "Texture::TileNoise", nri::Format::R16_SFLOAT, tileW, tileH, 1, 1,
+        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE);
+    CreateTexture(descriptorDescs, "Texture::DilatedNoise", nri::Format::R16_SFLOAT, tileW, tileH, 1, 1,
+        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE_STORAGE);
+    CreateTexture(descriptorDescs, "Texture::SampleNum", nri::Format::R8_UINT, tileW, tileH, 1, 1,
+        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE);
+    CreateTexture(descriptorDescs, "Texture::TaaHistory", outputFormat, m_OutputResolution.x, m_OutputResolution.y, 1, 1,
+        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE);
+    CreateTexture(descriptorDescs, "Texture::TaaHistoryPrev", outputFormat, m_OutputResolution.x, m_OutputResolution.y, 1, 1,
+        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE_STORAGE);
+    CreateTexture(descriptorDescs, "Texture::Final", swapChainFormat, (uint16_t)m_OutputResolution.x, (uint16_t)m_OutputResolution.y, 1, 1,
+        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::COPY_SOURCE);
+
+    // Material textures (with residency, textures used by materials start from the mip not exceeding "TEXTURE_RESIDENCY_MIP_SIZE_MIN", feedback decides the rest)
+    m_ResidentTextures.resize(m_Scene.textures.size(), {});
+    if (m_IsTextureResidency)
+    {
+        for (const utils::Material& material : m_Scene.materials)
+        {
+            m_ResidentTextures[material.diffuseMapIndex].isManaged = true;
+            m_ResidentTextures[material.specularMapIndex].isManaged = true;
+            m_ResidentTextures[material.normalMapIndex].isManaged = true;
+            m_ResidentTextures[material.emissiveMapIndex].isManaged = true;
+        }
+    }
+
+    for (uint32_t i = 0; i < m_Scene.textures.size(); i++)
+    {
+        const utils::Texture* textureData = m_Scene.textures[i];
+        ResidentTexture& residentTexture = m_ResidentTextures[i];
+
+        // Block compressed formats need the top mip to be at least 4x4
+        uint32_t mipOffset = 0;
+        while (residentTexture.isManaged && mipOffset + 1 < textureData->GetMipNum()
+            && uint32_t(Max(textureData->GetWidth(), textureData->GetHeight())) >> mipOffset > TEXTURE_RESIDENCY_MIP_SIZE_MIN
+            && uint32_t(Min(textureData->GetWidth(), textureData->GetHeight())) >> (mipOffset + 1) >= 4)
+            mipOffset++;
+
+        residentTexture.mipOffset = (uint8_t)mipOffset;
+        residentTexture.mipOffsetMax = (uint8_t)mipOffset;
+        residentTexture.requestedMip = TEXTURE_RESIDENCY_NOT_REQUESTED;
+
+        CreateTexture(descriptorDescs, "", textureData->GetFormat(), (uint16_t)Max(textureData->GetWidth() >> mipOffset, 1), (uint16_t)Max(textureData->GetHeight() >> mipOffset, 1),
+            uint16_t(textureData->GetMipNum() - mipOffset), textureData->GetArraySize(), nri::TextureUsageBits::SHADER_RESOURCE, nri::AccessBits::UNKNOWN);
+    }
+
+    // Data texture twins (the other format)
+    m_DataTextureTwins =
+    {{
+        {Texture::Diff, Descriptor::Diff_Texture},
+        {Texture::Spec, Descriptor::Spec_Texture},
+        {Texture::Unfiltered_Diff, Descriptor::Unfiltered_Diff_Texture},
+        {Texture::Unfiltered_Spec, Descriptor::Unfiltered_Spec_Texture},
+    }};
+
+    for (DataTextureTwin& twin : m_DataTextureTwins)
+    {
+        twin.format = m_IsOcclusionOnly ? nri::Format::RGBA16_SFLOAT : nri::Format::R16_SFLOAT;
+
+        const nri::CTextureDesc textureDesc = nri::CTextureDesc::Texture2D(twin.format, w, h, 1, 1, nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE);
+        NRI_ABORT_ON_FAILURE(NRI.CreateTexture(*m_Device, textureDesc, twin.resource));
+
+        twin.state = nri::TextureTransition(twin.resource, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE);
+    }
+
+    PlaceResources();
+
+    // Never unmapped, ray tracing implies D3D12 or VULKAN where buffers can stay mapped while being used by the GPU
+    m_UploadRing.data = (uint8_t*)NRI.MapBuffer(*Get(Buffer::UploadRing), 0, nri::WHOLE_SIZE);
+    if (m_IsInstanceDataHostVisible)
+        m_InstanceData = (InstanceData*)NRI.MapBuffer(*Get(Buffer::InstanceData), 0, nri::WHOLE_SIZE);
+
+    CreateDescriptors(descriptorDescs);
+
+    for (DataTextureTwin& twin : m_DataTextureTwins)
+    {
+        nri::Texture2DViewDesc viewDesc = {twin.resource, nri::Texture2DViewType::SHADER_RESOURCE_2D, twin.format};
+        NRI_ABORT_ON_FAILURE(NRI.CreateTexture2DView(viewDesc, twin.textureView));
+
+        viewDesc.viewType = nri::Texture2DViewType::SHADER_RESOURCE_STORAGE_2D;
+        NRI_ABORT_ON_FAILURE(NRI.CreateTexture2DView(viewDesc, twin.storageView));
+    }
+
+    // Mip feedback gets copied into a readback ring, one slice per buffered frame (like timestamps)
+    if (m_IsTextureResidency)
+    {
+        nri::BufferDesc bufferDesc = {};
+        bufferDesc.size = m_Scene.materials.size() * sizeof(uint32_t) * m_FrameInFlightNum;
+        bufferDesc.usageMask = nri::BufferUsageBits::NONE;
+        NRI_ABORT_ON_FAILURE( NRI.CreateBuffer(*m_Device, bufferDesc, m_MipFeedbackBuffer) );
+        NRI.SetBufferDebugName(*m_MipFeedbackBuffer, "Buffer::MipFeedbackReadback");
+
+        nri::ResourceGroupDesc resourceGroupDesc = {};
+        resourceGroupDesc.memoryLocation = nri::MemoryLocation::HOST_READBACK;
+        resourceGroupDesc.bufferNum = 1;
+        resourceGroupDesc.buffers = &m_MipFeedbackBuffer;
+
+        const size_t baseAllocation = m_MemoryAllocations.size();
+        m_MemoryAllocations.resize(baseAllocation + NRI.CalculateAllocationNumber(*m_Device, resourceGroupDesc), nullptr);
+        NRI_ABORT_ON_FAILURE( NRI.AllocateAndBindMemory(*m_Device, resourceGroupDesc, m_MemoryAllocations.data() + baseAllocation));
+    }
+
+#ifdef _DEBUG
+    // Distributed samples get copied into a readback ring, a uint per buffered frame (like timestamps)
+    if (m_IsAdaptiveSampling)
+    {
+        nri::BufferDesc bufferDesc = {};
+        bufferDesc.size = sizeof(uint32_t) * m_FrameInFlightNum;
+        bufferDesc.usageMask = nri::BufferUsageBits::NONE;
+        NRI_ABORT_ON_FAILURE( NRI.CreateBuffer(*m_Device, bufferDesc, m_SampleSumBuffer) );
+        NRI.SetBufferDebugName(*m_SampleSumBuffer, "Buffer::SampleSumReadback");
+
+        nri::ResourceGroupDesc resourceGroupDesc = {};
+        resourceGroupDesc.memoryLocation = nri::MemoryLocation::HOST_READBACK;
+        resourceGroupDesc.bufferNum = 1;
+        resourceGroupDesc.buffers = &m_SampleSumBuffer;
+
+        const size_t baseAllocation = m_MemoryAllocations.size();
+        m_MemoryAllocations.resize(baseAllocation + NRI.CalculateAllocationNumber(*m_Device, resourceGroupDesc), nullptr);
+        NRI_ABORT_ON_FAILURE( NRI.AllocateAndBindMemory(*m_Device, resourceGroupDesc, m_MemoryAllocations.data() + baseAllocation));
+    }
+#endif
+
+    // Capture targets get copied into a readback ring, one slice per buffered frame (like timestamps). A slice fits the full resolution and
+    // the largest format a target can have: "Final" can be a TAA history, radiance and occlusion-only data textures are swapped
+    if (m_IsCapture && m_CaptureTargetMask)
+    {
+        for (uint32_t i = 0; i < (uint32_t)CaptureTarget::MAX_NUM; i++)
+        {
+            if (!(m_CaptureTargetMask & (1 << i)))
+                continue;
+
+            const Texture texture = CAPTURE_TARGET_TEXTURES[i];
+            uint32_t texelSize = GetCaptureTexelSize(GetFormat(texture));
+            if (texture == Texture::Final)
+                texelSize = Max(texelSize, GetCaptureTexelSize(GetFormat(Texture::TaaHistory)));
+            else if (texture != Texture::ViewZ && texture != Texture::Normal_Roughness && texture != Texture::ObjectMotion)
+                texelSize = Max(texelSize, GetCaptureTexelSize(nri::Format::RGBA16_SFLOAT));
+
+            const uint2 size = texture == Texture::Final ? m_OutputResolution : uint2(w, h);
+
+            CaptureLayout& layout = m_CaptureLayouts[i];
+            layout.offset = m_CaptureSliceSize;
+            layout.rowPitch = (uint32_t)helper::GetAlignedSize(uint64_t(size.x) * texelSize, m_DeviceDesc->uploadBufferTextureRowAlignment);
+
+            m_CaptureSliceSize += helper::GetAlignedSize(uint64_t(layout.rowPitch) * size.y, m_DeviceDesc->uploadBufferTextureSliceAlignment);
+        }
+
+        nri::BufferDesc bufferDesc = {};
+        bufferDesc.size = m_CaptureSliceSize * m_FrameInFlightNum;
+        bufferDesc.usageMask = nri::BufferUsageBits::NONE;
+        NRI_ABORT_ON_FAILURE( NRI.CreateBuffer(*m_Device, bufferDesc, m_CaptureBuffer) );
+        NRI.SetBufferDebugName(*m_CaptureBuffer, "Buffer::CaptureReadback");
+
+        nri::ResourceGroupDesc resourceGroupDesc = {};
+        resourceGroupDesc.memoryLocation = nri::MemoryLocation::HOST_READBACK;
+        resourceGroupDesc.bufferNum = 1;
+        resourceGroupDesc.buffers = &m_CaptureBuffer;
+
+        const size_t baseAllocation = m_MemoryAllocations.size();
+        m_MemoryAllocations.resize(baseAllocation + NRI.CalculateAllocationNumber(*m_Device, resourceGroupDesc), nullptr);
+        NRI_ABORT_ON_FAILURE( NRI.AllocateAndBindMemory(*m_Device, resourceGroupDesc, m_MemoryAllocations.data() + baseAllocation));
+
+        printf("Capture: %.1f MB readback ring\n", bufferDesc.size / (1024.0 * 1024.0));
+    }
+
+    // Quality metrics get copied into a readback ring, one slice per buffered frame (like timestamps), followed by room for the reference of a test.
+    // A cached reference gets uploaded from a staging buffer
+    if (m_IsQuality)
+    {
+        m_QualityMetricsSize = 4 * qualityTileNum * sizeof(uint32_t);
+
+        nri::BufferDesc bufferDesc = {};
+        bufferDesc.size = m_QualityMetricsSize * m_FrameInFlightNum + GetQualityReferenceSize();
+        bufferDesc.usageMask = nri::BufferUsageBits::NONE;
+        NRI_ABORT_ON_FAILURE( NRI.CreateBuffer(*m_Device, bufferDesc, m_QualityReadbackBuffer) );
+        NRI.SetBufferDebugName(*m_QualityReadbackBuffer, "Buffer::QualityReadback");
+
+        bufferDesc.size = GetQualityReferenceSize();
+        NRI_ABORT_ON_FAILURE( NRI.CreateBuffer(*m_Device, bufferDesc, m_QualityUploadBuffer) );
+        NRI.SetBufferDebugName(*m_QualityUploadBuffer, "Buffer::QualityUpload");
+
+        nri::ResourceGroupDesc resourceGroupDesc = {};
+        resourceGroupDesc.memoryLocation = nri::MemoryLocation::HOST_READBACK;
+        resourceGroupDesc.bufferNum = 1;
+        resourceGroupDesc.buffers = &m_QualityReadbackBuffer;
+
+        size_t baseAllocation = m_MemoryAllocations.size();
+        m_MemoryAllocations.resize(baseAllocation + NRI.CalculateAllocationNumber(*m_Device, resourceGroupDesc), nullptr);
+        NRI_ABORT_ON_FAILURE( NRI.AllocateAndBindMemory(*m_Device, resourceGroupDesc, m_MemoryAllocations.data() + baseAllocation));
+
+        resourceGroupDesc.memoryLocation = nri::MemoryLocation::HOST_UPLOAD;
+        resourceGroupDesc.buffers = &m_QualityUploadBuffer;
+
+        baseAllocation = m_MemoryAllocations.size();
+        m_MemoryAllocations.resize(baseAllocation + NRI.CalculateAllocationNumber(*m_Device, resourceGroupDesc), nullptr);
+        NRI_ABORT_ON_FAILURE( NRI.AllocateAndBindMemory(*m_Device, resourceGroupDesc, m_MemoryAllocations.data() + baseAllocation));
+    }
+}
+
+void Sample::CreatePipelines()
+{
+    if (!m_Pipelines.empty())
+    {
+        NRI.WaitForIdle(*m_CommandQueue);
+
+        for (uint32_t i = 0; i < m_Pipelines.size(); i++)
+            NRI.DestroyPipeline(*m_Pipelines[i]);
+        m_Pipelines.clear();
+
+        for (NrdInstance& reblur : m_Reblur)
+        {
+            if (reblur.integration)
+                reblur.integration->CreatePipelines();
+        }
+
+        for (NrdInstance& relax : m_Relax)
+        {
+            if (relax.integration)
+                relax.integration->CreatePipelines();
+        }
+
+        if (m_IsAsyncCompute)
+            m_Sigma.CreatePipelines();
+    }
+
+    const auto timeBegin = std::chrono::steady_clock::now();
+
+    utils::ShaderCodeStorage shaderCodeStorage;
+    std::array<std::string, ShaderGroup::Main_rmiss> raygenEntryPoints; // referenced by shader descs until pipelines are created
+    nri::PipelineLayout* pipelineLayout = nullptr;
+
+    // Pipelines are independent, descs get gathered here (layouts are cheap, "ShaderCodeStorage" is not thread safe), pipelines get compiled in parallel at the end
+    std::vector<std::function<void()>> pipelineJobs;
+    m_Pipelines.resize((size_t)Pipeline::MAX_NUM, nullptr);
+
+    auto AddComputePipeline = [&](Pipeline index, nri::PipelineLayout* computePipelineLayout, const char* shaderName)
+    {
+        nri::ComputePipelineDesc pipelineDesc = {};
+        pipelineDesc.pipelineLayout = computePipelineLayout;
+        pipelineDesc.computeShader = utils::LoadShader(m_DeviceDesc->graphicsAPI, shaderName, shaderCodeStorage);
+
+        pipelineJobs.push_back([this, index, pipelineDesc]()
+        {
+            NRI_ABORT_ON_FAILURE(NRI.CreateComputePipeline(*m_Device, pipelineDesc, Get(index)));
+        });
+    };
+
+    nri::SamplerDesc samplerDescs[3] = {};
+    {
+        samplerDescs[0].addressModes = {nri::AddressMode::REPEAT, nri::AddressMode::REPEAT};
+        samplerDescs[0].minification = nri::Filter::LINEAR;
+        samplerDescs[0].magnification = nri::Filter::LINEAR;
+        samplerDescs[0].mip = nri::Filter::LINEAR;
+        samplerDescs[0].mipMax = 16.0f;
 
-                    ImGui::Text("CAMERA (press RIGHT MOUSE BOTTON for free-fly mode)");
-                    ImGui::Separator();
-                    ImGui::SliderFloat("Field of view (deg)", &m_Settings.camFov, 5.0f, 160.0f);
-                    ImGui::SliderFloat("Exposure", &m_Settings.exposure, 0.0001f, 1.0f, "%.7f", ImGuiSliderFlags_Logarithmic);
-                    ImGui::SliderFloat("Resolution scale (%)", &m_ResolutionScale, m_MinResolutionScale, 100.0f, "%.1f");
-                    ImGui::Combo("On screen", &m_Settings.onScreen, onScreenModes, helper::GetCountOf(onScreenModes));
-                    if (!m_DLSS.IsInitialized())
-                    {
-                        ImGui::PushStyleColor(ImGuiCol_Text, (m_Settings.nrdSettings.referenceAccumulation && m_Settings.TAA) ? UI_YELLOW : ImGui::GetStyleColorVec4(ImGuiCol_Text));
-                            ImGui::Checkbox("TAA", &m_Settings.TAA);
-                        ImGui::PopStyleColor();
-                        ImGui::SameLine();
-                    }
-                    ImGui::Checkbox("3D MVs", &m_Settings.isMotionVectorInWorldSpace);
-                    ImGui::SameLine();
-                    ImGui::Checkbox("Ortho", &m_Settings.ortho);
-                    ImGui::SameLine();
-                    ImGui::Checkbox("FPS cap", &m_Settings.limitFps);
-                    ImGui::SameLine();
-                    ImGui::PushStyleColor(ImGuiCol_Text, m_Settings.motionStartTime > 0.0 ? UI_YELLOW : ImGui::GetStyleColorVec4(ImGuiCol_Text));
-                    bool isPressed = ImGui::Button("Emulate motion");
-                    ImGui::PopStyleColor();
-                    if (isPressed)
-                        m_Settings.motionStartTime = m_Settings.motionStartTime > 0.0 ? 0.0 : -1.0;
-                    if (m_Settings.motionStartTime > 0.0)
-                    {
-                        ImGui::SliderFloat("Slower / Faster", &m_Settings.emulateMotionSpeed, -10.0f, 10.0f);
-                        ImGui::SetNextItemWidth(160.0f);
-                        ImGui::Combo("Mode", &m_Settings.motionMode, motionMode, helper::GetCountOf(motionMode));
-                        ImGui::SameLine();
-                        ImGui::Checkbox("Linear", &m_Settings.linearMotion);
-                    }
-                    if (m_Settings.limitFps)
-                    {
-                        float v[2] = {m_MinFps, m_Settings.maxFps};
-                        ImGui::SliderFloat2("Min / Max FPS", v, 24.0f, 150.0f, "%.0f");
-                        m_MinFps = v[0];
-                        m_Settings.maxFps = v[0] > v[1] ? v[0] * 1.2f : v[1];
-                    }
-                }
-                ImGui::PopID();
-                ImGui::NewLine();
-                ImGui::PushID("MATERIALS");
-                {
-                    static const char* forcedMaterial[] =
-                    {
-                        "None",
-                        "Gypsum",
-                        "Cobalt",
-                    };
+        samplerDescs[1].addressModes = {nri::AddressMode::REPEAT, nri::AddressMode::REPEAT};
+        samplerDescs[1].minification = nri::Filter::NEAREST;
+        samplerDescs[1].magnification = nri::Filter::NEAREST;
+        samplerDescs[1].mip = nri::Filter::NEAREST;
+        samplerDescs[1].mipMax = 16.0f;
 
-                    ImGui::Text("MATERIALS");
-                    ImGui::Separator();
-                    ImGui::SliderFloat2("Roughness / Metalness", &m_Settings.roughnessOverride, 0.0f, 1.0f, "%.3f");
-                    ImGui::SetNextItemWidth(90.0f);
-                    ImGui::Combo("Material", &m_Settings.forcedMaterial, forcedMaterial, helper::GetCountOf(forcedMaterial));
-                    ImGui::SameLine();
-                    ImGui::Checkbox("Full BRDF", &m_Settings.primaryFullBrdf);
-                    ImGui::SameLine();
-                    ImGui::Checkbox("Emission", &m_Settings.emission);
-                    if (m_Settings.emission)
-                        ImGui::SliderFloat("Emission intensity", &m_Settings.emissionIntensity, 1.0f, 100000.0f, "%.3f", ImGuiSliderFlags_Logarithmic);
-                }
-                ImGui::PopID();
+        samplerDescs[2].addressModes = {nri::AddressMode::CLAMP_TO_EDGE, nri::AddressMode::CLAMP_TO_EDGE};
+        samplerDescs[2].minification = nri::Filter::LINEAR;
+        samplerDescs[2].magnification = nri::Filter::LINEAR;
+    }
 
-                if (m_Settings.onScreen == 10)
-                    ImGui::SliderFloat("Units in 1 meter", &m_Settings.meterToUnitsMultiplier, 0.001f, 100.0f, "%.4f", ImGuiSliderFlags_Logarithmic);
-                else
-                {
-                    ImGui::NewLine();
-                    ImGui::PushID("WORLD");
-                    {
-                        ImGui::Text("WORLD");
-                        ImGui::Separator();
-                        ImGui::SliderFloat2("Sun position (deg)", &m_Settings.sunAzimuth, -180.0f, 180.0f);
-                        ImGui::SliderFloat("Sun angular size (deg)", &m_Settings.sunAngularDiameter, 0.0f, 3.0f);
-                        ImGui::Checkbox("Animate sun", &m_Settings.animateSun);
-                        ImGui::SameLine();
-                        ImGui::Checkbox("Animate objects", &m_Settings.animatedObjects);
-                        if (!m_Scene.animations.empty() && m_Scene.animations[m_Settings.activeAnimation].cameraNode.animationNodeID != -1)
-                        {
-                            ImGui::SameLine();
-                            ImGui::Checkbox("Animate camera", &m_Settings.animateCamera);
-                        }
+    const nri::DescriptorRangeDesc globalDescriptorRanges[] =
+    {
+        { 0, 1, nri::DescriptorType::CONSTANT_BUFFER, nri::ShaderStage::ALL },
+    };
 
-                        if (m_Settings.animatedObjects)
-                        {
-                            if (!m_Settings.nineBrothers)
-                                ImGui::SliderInt("Object number", &m_Settings.animatedObjectNum, 1, (int32_t)ANIMATED_INSTANCE_MAX_NUM);
-                            ImGui::SliderFloat("Object scale", &m_Settings.animatedObjectScale, 0.1f, 2.0f);
-                            ImGui::Checkbox("\"9 brothers\"", &m_Settings.nineBrothers);
-                            ImGui::SameLine();
-                            ImGui::Checkbox("Blink", &m_Settings.blink);
-                            ImGui::SameLine();
-                            ImGui::Checkbox("Emissive", &m_Settings.emissiveObjects);
-                        }
+    const nri::StaticSamplerDesc staticSamplersDesc[] =
+    {
+        { samplerDescs[0], 1, nri::ShaderStage::ALL },
+        { samplerDescs[1], 2, nri::ShaderStage::ALL },
+        { samplerDescs[2], 3, nri::ShaderStage::ALL },
+    };
 
-                        if (m_Settings.animateSun || m_Settings.animatedObjects || !m_Scene.animations.empty())
-                        {
-                            if (m_Settings.animatedObjects)
-                                ImGui::SameLine();
-                            ImGui::Checkbox("Pause (SPACE)", &m_Settings.pauseAnimation);
-                            ImGui::SliderFloat("Slower / Faster", &m_Settings.animationSpeed, -10.0f, 10.0f);
-                        }
+    { // Pipeline::IntegrateBRDF
+        const nri::DescriptorRangeDesc descriptorRanges[] =
+        {
+            { 0, 1, nri::DescriptorType::STORAGE_TEXTURE, nri::ShaderStage::ALL }
+        };
 
-                        if (!m_Scene.animations.empty())
-                        {
-                            if (m_Scene.animations[m_Settings.activeAnimation].durationMs != 0.0f)
-                            {
-                                char animationLabel[128];
-                                snprintf(animationLabel, sizeof(animationLabel), "Animation %.1f sec (%%)", 0.001f * m_Scene.animations[m_Settings.activeAnimation].durationMs / (m_Settings.animationSpeed < 0.0f ? 1.0f / (1.0f + Abs(m_Settings.animationSpeed)) : (1.0f + m_Settings.animationSpeed)));
-                                ImGui::SliderFloat(animationLabel, &m_Settings.animationProgress, 0.0f, 99.999f);
+        const nri::DescriptorSetDesc descriptorSetDesc[] =
+        {
+            { descriptorRanges, helper::GetCountOf(descriptorRanges) },
+        };
 
-                                if (m_Scene.animations.size() > 1)
-                                {
-                                    char items[1024] = {'\0'};
-                                    size_t offset = 0;
-                                    char* iterator = items;
-                                    for (auto animation : m_Scene.animations)
-                                    {
-                                        const size_t size = std::min(sizeof(items), animation.animationName.length() + 1);
-                                        memcpy(iterator + offset, animation.animationName.c_str(), size);
-                                        offset += animation.animationName.length() + 1;
-                                    }
-                                    ImGui::Combo("Animated scene", &m_Settings.activeAnimation, items, helper::GetCountOf(m_Scene.animations));
-                                }
-                            }
-                        }
+        nri::PipelineLayoutDesc pipelineLayoutDesc = {};
+        pipelineLayoutDesc.descriptorSetNum = helper::GetCountOf(descriptorSetDesc);
+        pipelineLayoutDesc.descriptorSets = descriptorSetDesc;
+        pipelineLayoutDesc.stageMask = nri::PipelineLayoutShaderStageBits::COMPUTE;
+
+        NRI_ABORT_ON_FAILURE(NRI.CreatePipelineLayout(*m_Device, pipelineLayoutDesc, pipelineLayout));
+        m_PipelineLayouts.push_back(pipelineLayout);
+
+        AddComputePipeline(Pipeline::IntegrateBRDF, pipelineLayout, "IntegrateBRDF.cs");
+    }
+
+    { // Pipeline::Raytracing
+        const nri::DescriptorRangeDesc descriptorRanges1[] =
+        {
+            { 0, 5, nri::DescriptorType::TEXTURE, nri::ShaderStage::RAYGEN },
+            { 5, 12, nri::DescriptorType::STORAGE_TEXTURE, nri::ShaderStage::RAYGEN },
+            { 17, 1, nri::DescriptorType::STORAGE_BUFFER, nri::ShaderStage::RAYGEN },
+            { 18, 1, nri::DescriptorType::TEXTURE, nri::ShaderStage::RAYGEN },
+            { 19, 1, nri::DescriptorType::STORAGE_BUFFER, nri::ShaderStage::RAYGEN },
+        };
+
+        const uint32_t textureNum = helper::GetCountOf(m_Scene.materials) * TEXTURES_PER_MATERIAL;
+        nri::DescriptorRangeDesc descriptorRanges2[] =
+        {
+            { 0, 1, nri::DescriptorType::ACCELERATION_STRUCTURE, nri::ShaderStage::RAYGEN },
+            { 1, 5, nri::DescriptorType::BUFFER, nri::ShaderStage::ALL },
+            { 6, textureNum, nri::DescriptorType::TEXTURE, nri::ShaderStage::ALL, nri::VARIABLE_DESCRIPTOR_NUM, nri::DESCRIPTOR_ARRAY },
+        };
+
+        const nri::DescriptorSetDesc descriptorSetDesc[] =
+        {
+            { globalDescriptorRanges, helper::GetCountOf(globalDescriptorRanges), staticSamplersDesc, helper::GetCountOf(staticSamplersDesc) },
+            { descriptorRanges1, helper::GetCountOf(descriptorRanges1) },
+            { descriptorRanges2, helper::GetCountOf(descriptorRanges2) }
+        };
+
+        nri::PipelineLayoutDesc pipelineLayoutDesc = {};
+        pipelineLayoutDesc.descriptorSets = descriptorSetDesc;
+        pipelineLayoutDesc.descriptorSetNum = helper::GetCountOf(descriptorSetDesc);
+        pipelineLayoutDesc.stageMask = nri::PipelineLayoutShaderStageBits::ALL_RAY_TRACING;
+
+        NRI_ABORT_ON_FAILURE(NRI.CreatePipelineLayout(*m_Device, pipelineLayoutDesc, pipelineLayout));
+        m_PipelineLayouts.push_back(pipelineLayout);
+
+        // Raygen permutations (see "Raytracing.rgen.hlsl"), a shader group per permutation in the same order. Permutations which can't be
+        // dispatched (transparency without transparent materials, ray sorting if not enabled) are not compiled, their groups reuse a reachable shader
+        bool hasTransparentMaterials = false;
+        for (const utils::Material& material : m_Scene.materials)
+            hasTransparentMaterials |= material.IsTransparent();
+
+        std::vector<nri::ShaderDesc> shaderDescs;
+        std::array<uint32_t, ShaderGroup::Main_rmiss> raygenShaderIndices;
+        for (uint32_t i = 0; i < ShaderGroup::Main_rmiss; i++)
+        {
+            // The transparency bit is the lowest one of "Raytracing" and "RaytracingPrimary" permutations (both ranges start at even indices)
+            uint32_t reachable = i;
+            if (i >= ShaderGroup::RaytracingPrimary_rgen && !m_IsRaySorting)
+                reachable = ShaderGroup::Raytracing_rgen;
+            else if (i < ShaderGroup::RaytracingSecondary_rgen && !hasTransparentMaterials)
+                reachable = i & ~0x1;
+
+            if (reachable != i)
+            {
+                raygenShaderIndices[i] = raygenShaderIndices[reachable];
+                continue;
+            }
+
+            char permutation[32];
+            if (i >= ShaderGroup::RaytracingSecondary_rgen)
+            {
+                const uint32_t j = i - ShaderGroup::RaytracingSecondary_rgen;
+                snprintf(permutation, sizeof(permutation), "RaytracingSecondary%u%u", j >> 1, j & 0x1);
+            }
+            else if (i >= ShaderGroup::RaytracingPrimary_rgen)
+            {
+                const uint32_t j = i - ShaderGroup::RaytracingPrimary_rgen;
+                snprintf(permutation, sizeof(permutation), "RaytracingPrimary%u%u", j >> 1, j & 0x1);
+            }
+            else
+                snprintf(permutation, sizeof(permutation), "Raytracing%u%u%u%u", i >> 3, (i >> 2) & 0x1, (i >> 1) & 0x1, i & 0x1);
+
+            raygenEntryPoints[i] = std::string(permutation) + "_rgen";
+            const std::string shaderName = std::string(permutation) + (m_IsCompactResources ? "Compact.rgen" : ".rgen");
+
+            raygenShaderIndices[i] = helper::GetCountOf(shaderDescs);
+            shaderDescs.push_back( utils::LoadShader(m_DeviceDesc->graphicsAPI, shaderName.c_str(), shaderCodeStorage, raygenEntryPoints[i].c_str()) );
+        }
+
+        const uint32_t raygenShaderNum = helper::GetCountOf(shaderDescs);
+        shaderDescs.push_back( utils::LoadShader(m_DeviceDesc->graphicsAPI, "Main.rmiss", shaderCodeStorage, "Main_rmiss") );
+        shaderDescs.push_back( utils::LoadShader(m_DeviceDesc->graphicsAPI, "Main.rchit", shaderCodeStorage, "Main_rchit") );
+        shaderDescs.push_back( utils::LoadShader(m_DeviceDesc->graphicsAPI, "Main.rahit", shaderCodeStorage, "Main_rahit") );
+
+        // The most expensive one goes first
+        pipelineJobs.insert(pipelineJobs.begin(), [this, pipelineLayout, shaderDescs, raygenShaderIndices, raygenShaderNum]()
+        {
+            nri::ShaderLibrary shaderLibrary = {};
+            shaderLibrary.shaderDescs = shaderDescs.data();
+            shaderLibrary.shaderNum = helper::GetCountOf(shaderDescs);
+
+            std::vector<nri::ShaderGroupDesc> shaderGroupDescs;
+            for (uint32_t i = 0; i < ShaderGroup::Main_rmiss; i++)
+                shaderGroupDescs.push_back( { raygenShaderIndices[i] + 1 } );                               // raygen permutations
+            shaderGroupDescs.push_back( { raygenShaderNum + 1 } );                                          // Main_rmiss
+            shaderGroupDescs.push_back( { raygenShaderNum + 2, raygenShaderNum + 3 } );                     // Main_rhit
+
+            nri::RayTracingPipelineDesc pipelineDesc = {};
+            pipelineDesc.recursionDepthMax = 1;
+            pipelineDesc.payloadAttributeSizeMax = 4 * sizeof(uint32_t);
+            pipelineDesc.intersectionAttributeSizeMax = 2 * sizeof(float);
+            pipelineDesc.pipelineLayout = pipelineLayout;
+            pipelineDesc.shaderGroupDescs = shaderGroupDescs.data();
+            pipelineDesc.shaderGroupDescNum = helper::GetCountOf(shaderGroupDescs);
+            pipelineDesc.shaderLibrary = &shaderLibrary;
+
+            NRI_ABORT_ON_FAILURE(NRI.CreateRayTracingPipeline(*m_Device, pipelineDesc, Get(Pipeline::Raytracing)));
+        });
+    }
+
+    { // Pipeline::Composition
+        const nri::DescriptorRangeDesc descriptorRanges[] =
+        {
+            { 0, 8, nri::DescriptorType::TEXTURE, nri::ShaderStage::ALL },
+            { 8, 1, nri::DescriptorType::STORAGE_TEXTURE, nri::ShaderStage::ALL }
+        };
+
+        const nri::DescriptorSetDesc descriptorSetDesc[] =
+        {
+            { globalDescriptorRanges, helper::GetCountOf(globalDescriptorRanges), staticSamplersDesc, helper::GetCountOf(staticSamplersDesc) },
+            { descriptorRanges, helper::GetCountOf(descriptorRanges) },
+        };
+
+        nri::PipelineLayoutDesc pipelineLayoutDesc = {};
+        pipelineLayoutDesc.descriptorSets = descriptorSetDesc;
+        pipelineLayoutDesc.descriptorSetNum = helper::GetCountOf(descriptorSetDesc);
+        pipelineLayoutDesc.stageMask = nri::PipelineLayoutShaderStageBits::COMPUTE;
+
+        NRI_ABORT_ON_FAILURE(NRI.CreatePipelineLayout(*m_Device, pipelineLayoutDesc, pipelineLayout));
+        m_PipelineLayouts.push_back(pipelineLayout);
+
+        AddComputePipeline(Pipeline::Composition, pipelineLayout, "Composition.cs");
+    }
+
+    { // Pipeline::Temporal
+        const nri::DescriptorRangeDesc descriptorRanges[] =
+        {
+            { 0, 4, nri::DescriptorType::TEXTURE, nri::ShaderStage::ALL },
+            { 4, 1, nri::DescriptorType::STORAGE_TEXTURE, nri::ShaderStage::ALL }
+        };
+
+        const nri::DescriptorSetDesc descriptorSetDesc[] =
+        {
+            { globalDescriptorRanges, helper::GetCountOf(globalDescriptorRanges), staticSamplersDesc, helper::GetCountOf(staticSamplersDesc) },
+            { descriptorRanges, helper::GetCountOf(descriptorRanges) },
+        };
+
+        nri::PipelineLayoutDesc pipelineLayoutDesc = {};
+        pipelineLayoutDesc.descriptorSets = descriptorSetDesc;
+        pipelineLayoutDesc.descriptorSetNum = helper::GetCountOf(descriptorSetDesc);
+        pipelineLayoutDesc.stageMask = nri::PipelineLayoutShaderStageBits::COMPUTE;
+
+        NRI_ABORT_ON_FAILURE(NRI.CreatePipelineLayout(*m_Device, pipelineLayoutDesc, pipelineLayout));
+        m_PipelineLayouts.push_back(pipelineLayout);
+
+        AddComputePipeline(Pipeline::Temporal, pipelineLayout, "Temporal.cs");
+    }
+
+    { // Pipeline::Upsample
+        const nri::DescriptorRangeDesc descriptorRanges[] =
+        {
+            { 0, 1, nri::DescriptorType::TEXTURE, nri::ShaderStage::ALL },
+            { 1, 1, nri::DescriptorType::STORAGE_TEXTURE, nri::ShaderStage::ALL }
+        };
+
+        const nri::DescriptorSetDesc descriptorSetDesc[] =
+        {
+            { globalDescriptorRanges, helper::GetCountOf(globalDescriptorRanges), staticSamplersDesc, helper::GetCountOf(staticSamplersDesc) },
+            { descriptorRanges, helper::GetCountOf(descriptorRanges) },
+        };
 
-                        m_Settings.sunElevation = Clamp(m_Settings.sunElevation, -90.0f, 90.0f);
-                    }
-                    ImGui::PopID();
-                    ImGui::NewLine();
-                    ImGui::PushID("INDIRECT RAYS");
-                    {
-                        char s[128];
-                        snprintf(s, sizeof(s), m_Settings.rpp == 0 ? "INDIRECT RAYS - 0.5 rpp (checkerboard)" : "INDIRECT RAYS - %u rpp", m_Settings.rpp);
+        nri::PipelineLayoutDesc pipelineLayoutDesc = {};
+        pipelineLayoutDesc.descriptorSets = descriptorSetDesc;
+        pipelineLayoutDesc.descriptorSetNum = helper::GetCountOf(descriptorSetDesc);
+        pipelineLayoutDesc.stageMask = nri::PipelineLayoutShaderStageBits::COMPUTE;
 
-                        ImGui::Text(s);
-                        ImGui::Separator();
-                        ImGui::SliderInt("Rays per pixel", &m_Settings.rpp, 0, 8);
-                        ImGui::SliderFloat("Sky ambient (%)", &m_Settings.skyAmbient, 0.0f, 20.0f, "%.3f", ImGuiSliderFlags_Logarithmic);
-                        ImGui::SliderFloat2("AO / SO range (m)", &m_Settings.diffHitDistScale, 0.0f, sceneRadius);
-                        ImGui::Checkbox("Full BRDF", &m_Settings.indirectFullBrdf);
-                        ImGui::SameLine();
-                        ImGui::SameLine();
-                        ImGui::Checkbox("Spec 2nd", &m_Settings.specSecondBounce);
-                        ImGui::SameLine();
-                        ImGui::Checkbox("Diff 2nd", &m_Settings.diffSecondBounce);
-                    }
-                    ImGui::PopID();
-                    ImGui::NewLine();
-                    ImGui::PushID("SWITCHES");
-                    {
-                        ImGui::Text("SWITCHES");
-                        ImGui::Separator();
-                        ImGui::Checkbox("Specular", &m_Settings.indirectSpecular);
-                        ImGui::SameLine();
-                        ImGui::Checkbox("Normal map", &m_Settings.normalMap);
-                        ImGui::SameLine();
-                        ImGui::PushStyleColor(ImGuiCol_Text, (m_Settings.nrdSettings.referenceAccumulation && m_Settings.specularLobeTrimming) ? UI_YELLOW : ImGui::GetStyleColorVec4(ImGuiCol_Text));
-                            ImGui::Checkbox("Trimming", &m_Settings.specularLobeTrimming);
-                        ImGui::PopStyleColor();
-                        ImGui::SameLine();
-                        ImGui::Checkbox("Mip", &m_Settings.mip);
-                        if (m_Settings.rpp < 2)
-                        {
-                            ImGui::SameLine();
-                            ImGui::Checkbox("Blue noise", &m_Settings.blueNoise);
-                        }
-                        ImGui::Checkbox("Diffuse", &m_Settings.indirectDiffuse);
-                        ImGui::SameLine();
+        NRI_ABORT_ON_FAILURE(NRI.CreatePipelineLayout(*m_Device, pipelineLayoutDesc, pipelineLayout));
+        m_PipelineLayouts.push_back(pipelineLayout);
 
-                        const float3& sunDirection = GetSunDirection();
-                        bool cmp = sunDirection.z < 0.0f && m_Settings.importanceSampling;
-                        if (cmp)
-                            ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(1.0f, 0.0f, 0.0f, 1.0f));
-                        ImGui::Checkbox("Importance sampling", &m_Settings.importanceSampling);
-                        if (cmp)
-                            ImGui::PopStyleColor();
+        AddComputePipeline(Pipeline::Upsample, pipelineLayout, "Upsample.cs");
+    }
 
-                        if (m_Settings.metalnessOverride != 0.0f)
-                        {
-                            ImGui::SameLine();
-                            ImGui::Checkbox("Metal ambient", &m_Settings.metalAmbient);
-                        }
-                    }
-                    ImGui::PopID();
-                    ImGui::NewLine();
-                    ImGui::PushID("DENOISER");
-                    {
-                        const nrd::LibraryDesc& nrdLibraryDesc = nrd::GetLibraryDesc();
+    { // Pipeline::PreDlss
+        const nri::DescriptorRangeDesc descriptorRanges[] =
+        {
+            { 0, 3, nri::DescriptorType::TEXTURE, nri::ShaderStage::ALL },
+            { 3, 3, nri::DescriptorType::STORAGE_TEXTURE, nri::ShaderStage::ALL }
+        };
 
-                        ImGui::Text("NRD v%u.%u.%u - %s / SIGMA (F2 - change)", nrdLibraryDesc.versionMajor, nrdLibraryDesc.versionMinor, nrdLibraryDesc.versionBuild, m_Settings.denoiser == REBLUR ? "REBLUR" : "RELAX");
-                        ImGui::Separator();
-                        ImGui::SliderFloat("Disocclusion (%)", &m_Settings.nrdSettings.disocclusionThreshold, 0.25f, 5.0f, "%.3f", ImGuiSliderFlags_Logarithmic);
+        const nri::DescriptorSetDesc descriptorSetDesc[] =
+        {
+            { globalDescriptorRanges, helper::GetCountOf(globalDescriptorRanges), staticSamplersDesc, helper::GetCountOf(staticSamplersDesc) },
+            { descriptorRanges, helper::GetCountOf(descriptorRanges) },
+        };
 
-                        float rppNormalized = Saturate(m_Settings.rpp / 8.0f);
-                        float f = rppNormalized + rppNormalized * rppNormalized * (1.0f - rppNormalized);
-                        int32_t recommendedMaxFastAccumulatedFrameNum = int32_t( Lerp(8.0f, 3.0f, f) - 1.0f + 0.5f ); // It's an estimate, just to provide some insights
-                        int32_t recommendedMaxAccumulatedFrameNum = int32_t( Lerp(32.0f, 8.0f, f) - 1.0f + 0.5f ); // It's an estimate, just to provide some insights
-                        bool cmp = recommendedMaxAccumulatedFrameNum != m_Settings.nrdSettings.maxAccumulatedFrameNum || (recommendedMaxFastAccumulatedFrameNum != m_Settings.nrdSettings.maxFastAccumulatedFrameNum && m_Settings.denoiser != REBLUR);
-                        if (cmp)
-                            ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(1.0f, 1.0f, 0.0f, 1.0f));
-                        if (m_Settings.denoiser == REBLUR)
-                            ImGui::Text("Recommended values: %d", recommendedMaxAccumulatedFrameNum);
-                        else
-                            ImGui::Text("Recommended values: %d (main) / %d (fast)", recommendedMaxAccumulatedFrameNum, recommendedMaxFastAccumulatedFrameNum);
-                        if (cmp)
-                            ImGui::PopStyleColor();
-                        if (m_Settings.denoiser == REBLUR)
-                            ImGui::SliderInt("History length (frames)", &m_Settings.nrdSettings.maxAccumulatedFrameNum, 0, nrd::REBLUR_MAX_HISTORY_FRAME_NUM);
-                        else
-                            ImGui::SliderInt2("History length (frames)", &m_Settings.nrdSettings.maxAccumulatedFrameNum, 0, nrd::REBLUR_MAX_HISTORY_FRAME_NUM);
+        nri::PipelineLayoutDesc pipelineLayoutDesc = {};
+        pipelineLayoutDesc.descriptorSets = descriptorSetDesc;
+        pipelineLayoutDesc.descriptorSetNum = helper::GetCountOf(descriptorSetDesc);
+        pipelineLayoutDesc.stageMask = nri::PipelineLayoutShaderStageBits::COMPUTE;
 
-                        static const char* prePassMode[] =
-                        {
-                            "Off",
-                            "Simple",
-                            "Advanced",
-                        };
+        NRI_ABORT_ON_FAILURE(NRI.CreatePipelineLayout(*m_Device, pipelineLayoutDesc, pipelineLayout));
+        m_PipelineLayouts.push_back(pipelineLayout);
 
-                        ImGui::SetNextItemWidth(90.0f);
-                        ImGui::Combo("Pre-pass mode", &m_Settings.nrdSettings.prePassMode, prePassMode, helper::GetCountOf(prePassMode));
-                        ImGui::SameLine();
-                        ImGui::Checkbox("Anti-firefly", &m_Settings.nrdSettings.enableAntiFirefly);
+        AddComputePipeline(Pipeline::PreDlss, pipelineLayout, "PreDlss.cs");
+    }
 
-                        if (m_Settings.denoiser == REBLUR)
-                        {
-                            ImGui::Text("SPATIAL FILTERING (DIFFUSE / SPECULAR):");
-                            ImGui::PushID("SPATIAL FILTERING (DIFFUSE / SPECULAR)");
-                            {
-                                ImGui::SliderFloat("Blur radius (px)", &m_Settings.nrdSettings.blurRadius, 0.0f, 60.0f, "%.1f");
-                                ImGui::SliderFloat("Adaptive radius scale", &m_Settings.nrdSettings.adaptiveRadiusScale, 0.0f, 10.0f, "%.1f");
-                                ImGui::SliderFloat("Normal weight strictness", &m_Settings.nrdSettings.normalWeightStrictness, 0.0f, 1.0f, "%.2f");
-                                ImGui::SliderFloat("Stabilization strength", &m_Settings.nrdSettings.stabilizationStrength, 0.0f, 1.0f, "%.2f");
-                                ImGui::SliderFloat("Residual noise level", &m_Settings.nrdSettings.residualNoiseLevel, 1.0f, 10.0f, "%.2f");
-                                ImGui::Checkbox("Reference", &m_Settings.nrdSettings.referenceAccumulation);
-                            }
-                            ImGui::PopID();
-                            ImGui::Text("ANTI-LAG (%%):");
-                            ImGui::PushID("ANTI-LAG");
-                            {
-                                char s[128];
+    { // Pipeline::AfterDlss
+        const nri::DescriptorRangeDesc descriptorRanges[] =
+        {
+            { 0, 1, nri::DescriptorType::TEXTURE, nri::ShaderStage::ALL },
+            { 1, 1, nri::DescriptorType::STORAGE_TEXTURE, nri::ShaderStage::ALL }
+        };
 
-                                nrd::AntilagIntensitySettings antilagIntensitySettings = {};
-                                nrd::AntilagHitDistanceSettings antilagHitDistanceSettings = {};
-                                GetAntilagSettings(antilagIntensitySettings, antilagHitDistanceSettings);
+        const nri::DescriptorSetDesc descriptorSetDesc[] =
+        {
+            { globalDescriptorRanges, helper::GetCountOf(globalDescriptorRanges), staticSamplersDesc, helper::GetCountOf(staticSamplersDesc) },
+            { descriptorRanges, helper::GetCountOf(descriptorRanges) },
+        };
 
-                                snprintf(s, sizeof(s), "[%.1f; %.1f]", antilagIntensitySettings.thresholdMin * 100.0f, antilagIntensitySettings.thresholdMax * 100.0f);
-                                ImGui::Checkbox("Intensity", &m_Settings.nrdSettings.antilagIntensity);
-                                ImGui::SameLine();
-                                ImGui::Text(s);
+        nri::PipelineLayoutDesc pipelineLayoutDesc = {};
+        pipelineLayoutDesc.descriptorSets = descriptorSetDesc;
+        pipelineLayoutDesc.descriptorSetNum = helper::GetCountOf(descriptorSetDesc);
+        pipelineLayoutDesc.stageMask = nri::PipelineLayoutShaderStageBits::COMPUTE;
 
-                                snprintf(s, sizeof(s), "[%.1f; %.1f]", antilagHitDistanceSettings.thresholdMin * 100.0f, antilagHitDistanceSettings.thresholdMax * 100.0f);
-                                ImGui::SameLine();
-                                ImGui::Checkbox("Hit distance", &m_Settings.nrdSettings.antilagHitDistance);
-                                ImGui::SameLine();
-                                ImGui::Text(s);
-                            }
-                            ImGui::PopID();
-                        }
-                        else if (m_Settings.denoiser == RELAX)
-                        {
-                            ImGui::Text("REPROJECTION:");
-                            ImGui::SliderFloat("Spec variance boost", &m_RelaxSettings.specularVarianceBoost, 0.0f, 8.0f, "%.2f");
-                            ImGui::SliderFloat("Clamping sigma scale", &m_RelaxSettings.historyClampingColorBoxSigmaScale, 0.0f, 10.0f, "%.1f");
+        NRI_ABORT_ON_FAILURE(NRI.CreatePipelineLayout(*m_Device, pipelineLayoutDesc, pipelineLayout));
+        m_PipelineLayouts.push_back(pipelineLayout);
 
-                            ImGui::Text("SPATIAL FILTERING:");
-                            ImGui::SliderInt("A-trous iterations", (int32_t*)&m_RelaxSettings.atrousIterationNum, 2, 8);
-                            ImGui::SliderFloat("Normal relaxation", &m_RelaxSettings.normalEdgeStoppingRelaxation, 0.0f, 1.0f, "%.2f");
-                            ImGui::SliderFloat("Luminance relaxation", &m_RelaxSettings.luminanceEdgeStoppingRelaxation, 0.0f, 1.0f, "%.2f");
-                            ImGui::SliderFloat("Depth weight", &m_RelaxSettings.phiDepth, 0.0f, 1.0f, "%.3f");
-                            ImGui::SliderFloat("Normal weight", &m_RelaxSettings.phiNormal, 1.0f, 256.0f, "%.0f");
-                            ImGui::SliderFloat("Diff luminance weight", &m_RelaxSettings.diffusePhiLuminance, 0.0f, 10.0f, "%.1f");
-                            ImGui::SliderFloat("Spec luminance weight", &m_RelaxSettings.specularPhiLuminance, 0.0f, 10.0f, "%.1f");
-                            ImGui::SliderFloat("Roughness relaxation", &m_RelaxSettings.roughnessEdgeStoppingRelaxation, 0.0f, 1.0f, "%.2f");
+        AddComputePipeline(Pipeline::AfterDlss, pipelineLayout, "AfterDlss.cs");
+    }
 
-                            ImGui::Text("DISOCCLUSION FIX:");
-                            ImGui::SliderFloat("Edge-stop normal power", &m_RelaxSettings.disocclusionFixEdgeStoppingNormalPower, 0.0f, 128.0f, "%.1f");
-                            ImGui::SliderFloat("Max kernel radius", &m_RelaxSettings.disocclusionFixMaxRadius, 0.0f, 100.0f, "%.1f");
-                            ImGui::SliderInt("Frames to fix", (int32_t*)&m_RelaxSettings.disocclusionFixNumFramesToFix, 0, 10);
+    { // Pipeline::SortRays
+        const nri::DescriptorRangeDesc descriptorRanges[] =
+        {
+            { 0, 1, nri::DescriptorType::STORAGE_BUFFER, nri::ShaderStage::ALL }
+        };
 
-                            ImGui::Text("SPATIAL VARIANCE ESTIMATION:");
-                            ImGui::SliderInt("History threshold", (int32_t*)&m_RelaxSettings.spatialVarianceEstimationHistoryThreshold, 0, 10);
-                        }
+        const nri::DescriptorSetDesc descriptorSetDesc[] =
+        {
+            { globalDescriptorRanges, helper::GetCountOf(globalDescriptorRanges), staticSamplersDesc, helper::GetCountOf(staticSamplersDesc) },
+            { descriptorRanges, helper::GetCountOf(descriptorRanges) },
+        };
 
-                        m_ForceHistoryReset = ImGui::Button("Reset history");
-                        ImGui::SameLine();
+        nri::PipelineLayoutDesc pipelineLayoutDesc = {};
+        pipelineLayoutDesc.descriptorSets = descriptorSetDesc;
+        pipelineLayoutDesc.descriptorSetNum = helper::GetCountOf(descriptorSetDesc);
+        pipelineLayoutDesc.stageMask = nri::PipelineLayoutShaderStageBits::COMPUTE;
 
-                        if (ImGui::Button("Change denoiser"))
-                            m_Settings.denoiser = (m_Settings.denoiser + 1) % DENOISER_MAX_NUM;
-                    }
-                    ImGui::PopID();
-                    ImGui::NewLine();
-                    ImGui::Separator();
-                    ImGui::SliderFloat("Debug (F3 - toggle)", &m_Settings.debug, 0.0f, 1.0f);
-                    ImGui::SliderFloat("Input / Denoised", &m_Settings.separator, 0.0f, 1.0f, "%.2f");
+        NRI_ABORT_ON_FAILURE(NRI.CreatePipelineLayout(*m_Device, pipelineLayoutDesc, pipelineLayout));
+        m_PipelineLayouts.push_back(pipelineLayout);
 
-                    if (ImGui::Button("Reload shaders"))
-                    {
-                        CreatePipelines();
-                        printf("Ready!\n");
-                    }
+        AddComputePipeline(Pipeline::SortRays, pipelineLayout, "SortRays.cs");
+    }
 
-                    ImGui::SameLine();
-                    if (ImGui::Button("Default settings"))
-                    {
-                        m_Camera.Initialize(m_Scene.aabb.GetCenter(), m_Scene.aabb.vMin, CAMERA_RELATIVE);
-                        m_Settings = m_DefaultSettings;
-                        m_AmbientInComposition = true;
-                    }
+    { // Pipeline::CompositionTemporal
+        const nri::DescriptorRangeDesc descriptorRanges[] =
+        {
+            { 0, 11, nri::DescriptorType::TEXTURE, nri::ShaderStage::ALL },
+            { 11, 2, nri::DescriptorType::STORAGE_TEXTURE, nri::ShaderStage::ALL }
+        };
 
-                    // Tests
-                    if (m_TestMode)
-                    {
-                        ImGui::NewLine();
-                        ImGui::Text("TESTS (F4 - next)");
-                        ImGui::Separator();
+        const nri::DescriptorSetDesc descriptorSetDesc[] =
+        {
+            { globalDescriptorRanges, helper::GetCountOf(globalDescriptorRanges), staticSamplersDesc, helper::GetCountOf(staticSamplersDesc) },
+            { descriptorRanges, helper::GetCountOf(descriptorRanges) },
+        };
 
-                        char s[64];
-                        std::string sceneName = std::string( utils::GetFileName(m_SceneFile) );
-                        size_t dotPos = sceneName.find_last_of(".");
-                        if (dotPos != std::string::npos)
-                            sceneName.replace(dotPos, 4, ".bin");
-                        const std::string path = utils::GetFullPath(sceneName, utils::DataFolder::TESTS);
-                        const uint32_t testByteSize = sizeof(m_Settings) + Camera::GetStateSize();
+        nri::PipelineLayoutDesc pipelineLayoutDesc = {};
+        pipelineLayoutDesc.descriptorSets = descriptorSetDesc;
+        pipelineLayoutDesc.descriptorSetNum = helper::GetCountOf(descriptorSetDesc);
+        pipelineLayoutDesc.stageMask = nri::PipelineLayoutShaderStageBits::COMPUTE;
 
-                        // Get number of tests
-                        if (m_TestNum == uint32_t(-1))
-                        {
-                            FILE* fp = fopen(path.c_str(), "rb");
-                            if (fp)
-                            {
-                                // Use this code to convert tests to reflect new Settings and Camera layouts
-                                #if 0
-                                    typedef Settings SettingsOld; // adjust if needed
-                                    typedef Camera CameraOld; // adjust if needed
+        NRI_ABORT_ON_FAILURE(NRI.CreatePipelineLayout(*m_Device, pipelineLayoutDesc, pipelineLayout));
+        m_PipelineLayouts.push_back(pipelineLayout);
 
-                                    const uint32_t oldItemSize = sizeof(SettingsOld) + CameraOld::GetStateSize();
+        AddComputePipeline(Pipeline::CompositionTemporal, pipelineLayout, "CompositionTemporal.cs");
+    }
+
+    { // Pipeline::SampleBudget
+        const nri::DescriptorRangeDesc descriptorRanges[] =
+        {
+            { 0, 5, nri::DescriptorType::TEXTURE, nri::ShaderStage::ALL },
+            { 5, 1, nri::DescriptorType::STORAGE_TEXTURE, nri::ShaderStage::ALL },
+        };
 
-                                    fseek(fp, 0, SEEK_END);
-                                    m_TestNum = ftell(fp) / oldItemSize;
-                                    fseek(fp, 0, SEEK_SET);
+        const nri::DescriptorSetDesc descriptorSetDesc[] =
+        {
+            { globalDescriptorRanges, helper::GetCountOf(globalDescriptorRanges), staticSamplersDesc, helper::GetCountOf(staticSamplersDesc) },
+            { descriptorRanges, helper::GetCountOf(descriptorRanges) },
+        };
 
-                                    FILE* fpNew;
-                                    fopen_s(&fpNew, (path + ".new").c_str(), "wb");
+        nri::PipelineLayoutDesc pipelineLayoutDesc = {};
+        pipelineLayoutDesc.descriptorSets = descriptorSetDesc;
+        pipelineLayoutDesc.descriptorSetNum = helper::GetCountOf(descriptorSetDesc);
+        pipelineLayoutDesc.stageMask = nri::PipelineLayoutShaderStageBits::COMPUTE;
 
-                                    for (uint32_t i = 0; i < m_TestNum && fpNew; i++)
-                                    {
-                                        SettingsOld settingsOld;
-                                        fread_s(&settingsOld, sizeof(SettingsOld), 1, sizeof(SettingsOld), fp);
+        NRI_ABORT_ON_FAILURE(NRI.CreatePipelineLayout(*m_Device, pipelineLayoutDesc, pipelineLayout));
+        m_PipelineLayouts.push_back(pipelineLayout);
 
-                                        CameraOld cameraOld;
-                                        fread_s(cameraOld.GetState(), CameraOld::GetStateSize(), 1, CameraOld::GetStateSize(), fp);
+        AddComputePipeline(Pipeline::SampleBudget, pipelineLayout, "SampleBudget.cs");
+    }
 
-                                        // Convert Old to New here
-                                        m_Settings = settingsOld;
-                                        m_Camera.state = cameraOld.state;
+    { // Pipeline::SampleNum
+        const nri::DescriptorRangeDesc descriptorRanges[] =
+        {
+            { 0, 1, nri::DescriptorType::TEXTURE, nri::ShaderStage::ALL },
+            { 1, 2, nri::DescriptorType::STORAGE_TEXTURE, nri::ShaderStage::ALL },
+            { 3, 1, nri::DescriptorType::STORAGE_BUFFER, nri::ShaderStage::ALL }
+        };
 
-                                        // ...
+        const nri::DescriptorSetDesc descriptorSetDesc[] =
+        {
+            { globalDescriptorRanges, helper::GetCountOf(globalDescriptorRanges), staticSamplersDesc, helper::GetCountOf(staticSamplersDesc) },
+            { descriptorRanges, helper::GetCountOf(descriptorRanges) },
+        };
 
-                                        fwrite(&m_Settings, 1, sizeof(m_Settings), fpNew);
-                                        fwrite(m_Camera.GetState(), 1, Camera::GetStateSize(), fpNew);
-                                    }
+        nri::PipelineLayoutDesc pipelineLayoutDesc = {};
+        pipelineLayoutDesc.descriptorSets = descriptorSetDesc;
+        pipelineLayoutDesc.descriptorSetNum = helper::GetCountOf(descriptorSetDesc);
+        pipelineLayoutDesc.stageMask = nri::PipelineLayoutShaderStageBits::COMPUTE;
 
-                                    fclose(fp);
-                                    fclose(fpNew);
+        NRI_ABORT_ON_FAILURE(NRI.CreatePipelineLayout(*m_Device, pipelineLayoutDesc, pipelineLayout));
+        m_PipelineLayouts.push_back(pipelineLayout);
 
-                                    __debugbreak();
-                                #endif
+        AddComputePipeline(Pipeline::SampleNum, pipelineLayout, "SampleNum.cs");
+    }
 
-                                fseek(fp, 0, SEEK_END);
-                                m_TestNum = ftell(fp) / testByteSize;
-                                fclose(fp);
-                            }
-                            else
-                                m_TestNum = 0;
-                        }
+    { // Pipeline::QualityReference
+        const nri::DescriptorRangeDesc descriptorRanges[] =
+        {
+            { 0, 1, nri::DescriptorType::TEXTURE, nri::ShaderStage::ALL },
+            { 1, 1, nri::DescriptorType::STORAGE_BUFFER, nri::ShaderStage::ALL }
+        };
 
-                        // Adjust current test index
-                        bool isTestChanged = false;
-                        if (IsKeyToggled(Key::F4) && m_TestNum)
-                        {
-                            m_LastSelectedTest++;
-                            isTestChanged = true;
-                        }
+        const nri::DescriptorSetDesc descriptorSetDesc[] =
+        {
+            { globalDescriptorRanges, helper::GetCountOf(globalDescriptorRanges), staticSamplersDesc, helper::GetCountOf(staticSamplersDesc) },
+            { descriptorRanges, helper::GetCountOf(descriptorRanges) },
+        };
 
-                        if (m_LastSelectedTest == uint32_t(-1) || !m_TestNum)
-                            m_LastSelectedTest = uint32_t(-1);
-                        else
-                            m_LastSelectedTest %= m_TestNum;
+        nri::PipelineLayoutDesc pipelineLayoutDesc = {};
+        pipelineLayoutDesc.descriptorSets = descriptorSetDesc;
+        pipelineLayoutDesc.descriptorSetNum = helper::GetCountOf(descriptorSetDesc);
+        pipelineLayoutDesc.stageMask = nri::PipelineLayoutShaderStageBits::COMPUTE;
 
-                        // Main buttons
-                        uint32_t i = 0;
-                        for (; i < m_TestNum; i++)
-                        {
-                            snprintf(s, sizeof(s), "%u", i + 1);
+        NRI_ABORT_ON_FAILURE(NRI.CreatePipelineLayout(*m_Device, pipelineLayoutDesc, pipelineLayout));
+        m_PipelineLayouts.push_back(pipelineLayout);
 
-                            if (i % 14 != 0)
-                                ImGui::SameLine();
+        AddComputePipeline(Pipeline::QualityReference, pipelineLayout, "QualityReference.cs");
+    }
 
-                            if (ImGui::Button(s, ImVec2(25.0f, 0.0f)) || isTestChanged)
-                            {
-                                uint32_t test = isTestChanged ? m_LastSelectedTest : i;
-                                FILE* fp = fopen(path.c_str(), "rb");
+    { // Pipeline::QualityMetrics
+        const nri::DescriptorRangeDesc descriptorRanges[] =
+        {
+            { 0, 1, nri::DescriptorType::TEXTURE, nri::ShaderStage::ALL },
+            { 1, 2, nri::DescriptorType::STORAGE_BUFFER, nri::ShaderStage::ALL }
+        };
 
-                                if (fp && fseek(fp, test * testByteSize, SEEK_SET) == 0)
-                                {
-                                    fread(&m_Settings, sizeof(m_Settings), 1, fp);
-                                    fread(m_Camera.GetState(), Camera::GetStateSize(), 1, fp);
+        const nri::DescriptorSetDesc descriptorSetDesc[] =
+        {
+            { globalDescriptorRanges, helper::GetCountOf(globalDescriptorRanges), staticSamplersDesc, helper::GetCountOf(staticSamplersDesc) },
+            { descriptorRanges, helper::GetCountOf(descriptorRanges) },
+        };
 
-                                    m_LastSelectedTest = test;
+        nri::PipelineLayoutDesc pipelineLayoutDesc = {};
+        pipelineLayoutDesc.descriptorSets = descriptorSetDesc;
+        pipelineLayoutDesc.descriptorSetNum = helper::GetCountOf(descriptorSetDesc);
+        pipelineLayoutDesc.stageMask = nri::PipelineLayoutShaderStageBits::COMPUTE;
 
-                                    // Reset some settings to defaults to avoid a potential confusion
-                                    m_Settings.debug = 0.0f;
-                                    m_Settings.denoiser = REBLUR;
-                                    m_AmbientInComposition = true;
-                                    m_ForceHistoryReset = true;
-                                }
+        NRI_ABORT_ON_FAILURE(NRI.CreatePipelineLayout(*m_Device, pipelineLayoutDesc, pipelineLayout));
+        m_PipelineLayouts.push_back(pipelineLayout);
 
-                                if (fp)
-                                    fclose(fp);
+        AddComputePipeline(Pipeline::QualityMetrics, pipelineLayout, "QualityMetrics.cs");
+    }
 
-                                isTestChanged = false;
-                            }
-                        }
+    m_WorkerPool.Execute(helper::GetCountOf(pipelineJobs), [&](uint32_t jobIndex)
+    {
+        pipelineJobs[jobIndex]();
+    });
 
-                        if (i % 14 != 0)
-                            ImGui::SameLine();
+    const double pipelineCreationTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - timeBegin).count();
+    printf("Pipelines: %u created in %.1f ms\n", helper::GetCountOf(pipelineJobs), pipelineCreationTime);
 
-                        // "Add" button
-                        if (ImGui::Button("Add"))
-                        {
-                            FILE* fp = fopen(path.c_str(), "ab");
+    // Raygen shaders
+    uint64_t shaderGroupOffset = 0;
+    for (uint32_t i = 0; i < ShaderGroup::Main_rmiss; i++)
+    {
+        shaderGroupOffset = helper::GetAlignedSize(shaderGroupOffset, m_DeviceDesc->rayTracingShaderTableAligment);
+        m_ShaderEntries.push_back(shaderGroupOffset); shaderGroupOffset += m_DeviceDesc->rayTracingShaderGroupIdentifierSize; //ShaderGroup::Raytracing_rgen + i
+    }
 
-                            if (fp)
-                            {
-                                m_Settings.motionStartTime = m_Settings.motionStartTime > 0.0 ? -1.0 : 0.0;
+    // Miss shaders
+    shaderGroupOffset = helper::GetAlignedSize(shaderGroupOffset, m_DeviceDesc->rayTracingShaderTableAligment);
+    m_ShaderEntries.push_back(shaderGroupOffset); shaderGroupOffset += m_DeviceDesc->rayTracingShaderGroupIdentifierSize; //ShaderGroup::Main_rmiss
 
-                                fwrite(&m_Settings, sizeof(m_Settings), 1, fp);
-                                fwrite(m_Camera.GetState(), Camera::GetStateSize(), 1, fp);
-                                fclose(fp);
+    // Hit shader groups
+    shaderGroupOffset = helper::GetAlignedSize(shaderGroupOffset, m_DeviceDesc->rayTracingShaderTableAligment);
+    m_ShaderEntries.push_back(shaderGroupOffset); shaderGroupOffset += m_DeviceDesc->rayTracingShaderGroupIdentifierSize; //ShaderGroup::Main_rhit
 
-                                m_TestNum = uint32_t(-1);
-                            }
-                        }
+    // Total size
+    m_ShaderEntries.push_back(shaderGroupOffset);
+}
 
-                        if ((i + 1) % 14 != 0)
-                            ImGui::SameLine();
+void Sample::CreateDescriptorSets()
+{
+    nri::DescriptorSet* descriptorSet = nullptr;
 
-                        // "Del" button
-                        snprintf(s, sizeof(s), "Del %u", m_LastSelectedTest + 1);
-                        if (m_TestNum != uint32_t(-1) && m_LastSelectedTest != uint32_t(-1) && ImGui::Button(s))
-                        {
-                            std::vector<uint8_t> data;
-                            utils::LoadFile(path, data);
+    nri::DescriptorPoolDesc descriptorPoolDesc = {};
+    descriptorPoolDesc.descriptorSetMaxNum = 128;
+    descriptorPoolDesc.staticSamplerMaxNum = 3 * m_FrameInFlightNum;
+    descriptorPoolDesc.storageTextureMaxNum = 128;
+    descriptorPoolDesc.textureMaxNum = 192 + uint32_t(m_Scene.materials.size()) * TEXTURES_PER_MATERIAL * m_FrameInFlightNum;
+    descriptorPoolDesc.accelerationStructureMaxNum = 1 * m_FrameInFlightNum;
+    descriptorPoolDesc.bufferMaxNum = 16 + 5 * m_FrameInFlightNum;
+    descriptorPoolDesc.storageBufferMaxNum = 32;
+    descriptorPoolDesc.constantBufferMaxNum = 1 * m_FrameInFlightNum;
+    NRI_ABORT_ON_FAILURE(NRI.CreateDescriptorPool(*m_Device, descriptorPoolDesc, m_DescriptorPool));
 
-                            FILE* fp = fopen(path.c_str(), "wb");
+    // Constant buffer
+    for (Frame& frame : m_Frames)
+    {
+        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *GetPipelineLayout(Pipeline::Raytracing), 0, &frame.globalConstantBufferDescriptorSet, 1, nri::WHOLE_DEVICE_GROUP, 0));
 
-                            if (fp)
-                            {
-                                for (i = 0; i < m_TestNum; i++)
-                                {
-                                    if (i != m_LastSelectedTest)
-                                        fwrite(&data[i * testByteSize], 1, testByteSize, fp);
-                                }
+        const nri::DescriptorRangeUpdateDesc descriptorRangeUpdateDesc[] =
+        {
+            { &frame.globalConstantBufferDescriptor, 1 },
+        };
 
-                                fclose(fp);
+        NRI.UpdateDescriptorRanges(*frame.globalConstantBufferDescriptorSet, nri::WHOLE_DEVICE_GROUP, 0, helper::GetCountOf(descriptorRangeUpdateDesc), descriptorRangeUpdateDesc);
 
-                                m_TestNum = uint32_t(-1);
-                            }
-                        }
-                    }
-                }
-            }
+        // The same set points to the constants of the GPU it's used on
+        for (uint32_t i = 1; i < m_PhysicalDeviceNum; i++)
+        {
+            const nri::DescriptorRangeUpdateDesc peerDescriptorRangeUpdateDesc = { &frame.peerConstantBufferDescriptors[i], 1 };
+            NRI.UpdateDescriptorRanges(*frame.globalConstantBufferDescriptorSet, 1u << i, 0, 1, &peerDescriptorRangeUpdateDesc);
         }
-        ImGui::End();
     }
 
-    // Update camera
-    cBoxf cameraLimits = m_Scene.aabb;
-    cameraLimits.Scale(2.0f);
+    { // DescriptorSet::IntegrateBRDF0
+        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *GetPipelineLayout(Pipeline::IntegrateBRDF), 0, &descriptorSet, 1, nri::WHOLE_DEVICE_GROUP, 0));
+        m_DescriptorSets.push_back(descriptorSet);
 
-    CameraDesc desc = {};
-    desc.limits = cameraLimits;
-    desc.aspectRatio = float( GetWindowWidth() ) / float( GetWindowHeight() );
-    desc.horizontalFov = RadToDeg( Atan( Tan( DegToRad( m_Settings.camFov ) * 0.5f ) *  desc.aspectRatio * 9.0f / 16.0f ) * 2.0f ); // recalculate to ultra-wide if needed
-    desc.nearZ = NEAR_Z * m_Settings.meterToUnitsMultiplier;
-    desc.farZ = 10000.0f * m_Settings.meterToUnitsMultiplier;
-    desc.isCustomMatrixSet = m_Settings.animateCamera;
-    desc.isLeftHanded = CAMERA_LEFT_HANDED;
-    desc.orthoRange = m_Settings.ortho ? Tan( DegToRad( m_Settings.camFov ) * 0.5f ) * 3.0f * m_Settings.meterToUnitsMultiplier : 0.0f;
-    GetCameraDescFromInputDevices(desc);
+        const nri::Descriptor* storageTextures[] =
+        {
+            Get(Descriptor::IntegrateBRDF_StorageTexture),
+        };
 
-    const float animationSpeed = m_Settings.pauseAnimation ? 0.0f : (m_Settings.animationSpeed < 0.0f ? 1.0f / (1.0f + Abs(m_Settings.animationSpeed)) : (1.0f + m_Settings.animationSpeed));
-    const float scale = m_Settings.animatedObjectScale * m_Settings.meterToUnitsMultiplier / 2.0f;
-    const float objectAnimationDelta = animationSpeed * m_Timer.GetElapsedTime() * 0.001f;
+        const nri::DescriptorRangeUpdateDesc descriptorRangeUpdateDesc[] =
+        {
+            { storageTextures, helper::GetCountOf(storageTextures) },
+        };
 
-    if (m_Settings.motionStartTime > 0.0)
+        NRI.UpdateDescriptorRanges(*descriptorSet, nri::WHOLE_DEVICE_GROUP, 0, helper::GetCountOf(descriptorRangeUpdateDesc), descriptorRangeUpdateDesc);
+    }
+
+    // Raytracing2 (per frame)
+    for (Frame& frame : m_Frames)
     {
-        float time = float(m_Timer.GetTimeStamp() - m_Settings.motionStartTime);
-        float amplitude = 40.0f * m_Camera.state.motionScale;
-        float period = 0.0003f * time * (m_Settings.emulateMotionSpeed < 0.0f ? 1.0f / (1.0f + Abs(m_Settings.emulateMotionSpeed)) : (1.0f + m_Settings.emulateMotionSpeed));
+        std::vector<nri::Descriptor*> textures;
+        GetMaterialTextureDescriptors(textures);
 
-        float3 localPos = m_Camera.state.mWorldToView.GetRow0().To3d();
-        if (m_Settings.motionMode == 1)
-            localPos = m_Camera.state.mWorldToView.GetRow1().To3d();
-        else if (m_Settings.motionMode == 2)
-            localPos = m_Camera.state.mWorldToView.GetRow2().To3d();
-        else if (m_Settings.motionMode == 3)
+        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *GetPipelineLayout(Pipeline::Raytracing), 2, &frame.raytracing2DescriptorSet, 1, nri::WHOLE_DEVICE_GROUP, helper::GetCountOf(textures)));
+
+        const nri::Descriptor* buffers[] =
         {
-            float3 rows[3] = { m_Camera.state.mWorldToView.GetRow0().To3d(), m_Camera.state.mWorldToView.GetRow1().To3d(), m_Camera.state.mWorldToView.GetRow2().To3d() };
-            float f = Sin( Pi(period * 3.0f) );
-            localPos = Normalize( f < 0.0f ? Lerp( rows[1], rows[0], float3( Abs(f) ) ) : Lerp( rows[1], rows[2], float3(f) ) );
-        }
-        localPos *= amplitude * (m_Settings.linearMotion ? WaveTriangle(period) - 0.5f : Sin( Pi(period) ) * 0.5f);
+            Get(Descriptor::LightData_Buffer),
+            Get(Descriptor::PrimitiveData_Buffer),
+            Get(Descriptor::InstanceData_Buffer),
+            Get(Descriptor::Indices_Buffer),
+            Get(Descriptor::VertexData_Buffer)
+        };
 
-        desc.dUser = localPos - m_PrevLocalPos;
-        m_PrevLocalPos = localPos;
-    }
-    else if (m_Settings.motionStartTime == -1.0)
-    {
-        m_Settings.motionStartTime = m_Timer.GetTimeStamp();
-        m_PrevLocalPos = float3::Zero();
-    }
+        const nri::Descriptor* accelerationStructures[] =
+        {
+            Get(Descriptor::World_AccelerationStructure)
+        };
 
-    m_Scene.Animate(animationSpeed, m_Timer.GetElapsedTime(), m_Settings.animationProgress, m_Settings.activeAnimation, m_Settings.animateCamera ? &desc.customMatrix : nullptr);
-    m_Camera.Update(desc, frameIndex);
+        const nri::DescriptorRangeUpdateDesc descriptorRangeUpdateDesc[] =
+        {
+            { accelerationStructures, helper::GetCountOf(accelerationStructures) },
+            { buffers, helper::GetCountOf(buffers) },
+            { textures.data(), helper::GetCountOf(textures) }
+        };
+        NRI.UpdateDescriptorRanges(*frame.raytracing2DescriptorSet, nri::WHOLE_DEVICE_GROUP, 0, helper::GetCountOf(descriptorRangeUpdateDesc), descriptorRangeUpdateDesc);
+    }
 
-    if (m_Settings.nineBrothers)
-    {
-        m_Settings.animatedObjectNum = 9;
+    { // DescriptorSet::Temporal1a
+        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *GetPipelineLayout(Pipeline::Temporal), 1, &descriptorSet, 1, nri::WHOLE_DEVICE_GROUP, 0));
+        m_DescriptorSets.push_back(descriptorSet);
 
-        const float3& vRight = m_Camera.state.mViewToWorld.GetCol0().xmm;
-        const float3& vTop = m_Camera.state.mViewToWorld.GetCol1().xmm;
-        const float3& vForward = m_Camera.state.mViewToWorld.GetCol2().xmm;
+        const nri::Descriptor* textures[] =
+        {
+            Get(Descriptor::ObjectMotion_Texture),
+            Get(Descriptor::ComposedLighting_ViewZ_Texture),
+            Get(Descriptor::TransparentLighting_Texture),
+            Get(Descriptor::TaaHistoryPrev_Texture),
+        };
 
-        float3 basePos = ToFloat(m_Camera.state.globalPosition);
+        const nri::Descriptor* storageTextures[] =
+        {
+            Get(Descriptor::TaaHistory_StorageTexture),
+        };
 
-        for (int32_t i = -1; i <= 1; i++ )
+        const nri::DescriptorRangeUpdateDesc descriptorRangeUpdateDesc[] =
         {
-            for (int32_t j = -1; j <= 1; j++ )
-            {
-                const uint32_t index = (i + 1) * 3 + (j + 1);
+            { textures, helper::GetCountOf(textures) },
+            { storageTextures, helper::GetCountOf(storageTextures) },
+        };
 
-                float x = float(i) * scale * 4.0f;
-                float y = float(j) * scale * 4.0f;
-                float z = 10.0f * scale * (CAMERA_LEFT_HANDED ? 1.0f : -1.0f);
+        NRI.UpdateDescriptorRanges(*descriptorSet, nri::WHOLE_DEVICE_GROUP, 0, helper::GetCountOf(descriptorRangeUpdateDesc), descriptorRangeUpdateDesc);
+    }
 
-                float3 pos = basePos + vRight * x + vTop * y + vForward * z;
+    { // DescriptorSet::Temporal1b
+        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *GetPipelineLayout(Pipeline::Temporal), 1, &descriptorSet, 1, nri::WHOLE_DEVICE_GROUP, 0));
+        m_DescriptorSets.push_back(descriptorSet);
 
-                utils::Instance& instance = m_Scene.instances[ m_AnimatedInstances[index].instanceID ];
-                instance.position = ToDouble( pos );
-                instance.rotation = m_Camera.state.mViewToWorld;
-                instance.rotation.SetTranslation( float3::Zero() );
-                instance.rotation.AddScale(scale);
-            }
-        }
-    }
-    else if (m_Settings.animatedObjects)
-    {
-        for (int32_t i = 0; i < m_Settings.animatedObjectNum; i++)
+        const nri::Descriptor* textures[] =
         {
-            float4x4 transform = m_AnimatedInstances[i].Animate(objectAnimationDelta, scale);
+            Get(Descriptor::ObjectMotion_Texture),
+            Get(Descriptor::ComposedLighting_ViewZ_Texture),
+            Get(Descriptor::TransparentLighting_Texture),
+            Get(Descriptor::TaaHistory_Texture),
+        };
 
-            utils::Instance& instance = m_Scene.instances[ m_AnimatedInstances[i].instanceID ];
-            instance.rotation = transform;
-            instance.position = m_AnimatedInstances[i].position;
-        }
+        const nri::Descriptor* storageTextures[] =
+        {
+            Get(Descriptor::TaaHistoryPrev_StorageTexture),
+        };
+
+        const nri::DescriptorRangeUpdateDesc descriptorRangeUpdateDesc[] =
+        {
+            { textures, helper::GetCountOf(textures) },
+            { storageTextures, helper::GetCountOf(storageTextures) },
+        };
+
+        NRI.UpdateDescriptorRanges(*descriptorSet, nri::WHOLE_DEVICE_GROUP, 0, helper::GetCountOf(descriptorRangeUpdateDesc), descriptorRangeUpdateDesc);
     }
 
-    m_ResolutionScale *= 0.01f;
+    { // DescriptorSet::Upsample1a
+        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *GetPipelineLayout(Pipeline::Upsample), 1, &descriptorSet, 1, nri::WHOLE_DEVICE_GROUP, 0));
+        m_DescriptorSets.push_back(descriptorSet);
 
-    // TODO: modify some settings to WAR unsupported and not working stuff in non-REBLUR
-    if (m_Settings.denoiser == RELAX)
-        m_AmbientInComposition = false;
-}
+        const nri::Descriptor* textures[] =
+        {
+            Get(Descriptor::TaaHistory_Texture),
+        };
 
-void Sample::CreateSwapChain(nri::Format& swapChainFormat)
-{
-    nri::SwapChainDesc swapChainDesc = {};
-    swapChainDesc.windowSystemType = GetWindowSystemType();
-    swapChainDesc.window = GetWindow();
-    swapChainDesc.commandQueue = m_CommandQueue;
-    swapChainDesc.format = nri::SwapChainFormat::BT709_G22_8BIT;
-    swapChainDesc.verticalSyncInterval = m_SwapInterval;
-    swapChainDesc.width = (uint16_t)m_OutputResolution.x;
-    swapChainDesc.height = (uint16_t)m_OutputResolution.y;
-    swapChainDesc.textureNum = SWAP_CHAIN_TEXTURE_NUM;
+        const nri::Descriptor* storageTextures[] =
+        {
+            Get(Descriptor::Final_StorageTexture),
+        };
 
-    NRI_ABORT_ON_FAILURE(NRI.CreateSwapChain(*m_Device, swapChainDesc, m_SwapChain));
+        const nri::DescriptorRangeUpdateDesc descriptorRangeUpdateDesc[] =
+        {
+            { textures, helper::GetCountOf(textures) },
+            { storageTextures, helper::GetCountOf(storageTextures) },
+        };
 
-    uint32_t swapChainTextureNum = 0;
-    nri::Texture* const* swapChainTextures = NRI.GetSwapChainTextures(*m_SwapChain, swapChainTextureNum, swapChainFormat);
+        NRI.UpdateDescriptorRanges(*descriptorSet, nri::WHOLE_DEVICE_GROUP, 0, helper::GetCountOf(descriptorRangeUpdateDesc), descriptorRangeUpdateDesc);
+    }
 
-    nri::ClearValueDesc clearColor = {};
-    nri::FrameBufferDesc frameBufferDesc = {};
-    frameBufferDesc.colorAttachmentNum = 1;
-    frameBufferDesc.colorClearValues = &clearColor;
+    { // DescriptorSet::Upsample1b
+        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *GetPipelineLayout(Pipeline::Upsample), 1, &descriptorSet, 1, nri::WHOLE_DEVICE_GROUP, 0));
+        m_DescriptorSets.push_back(descriptorSet);
 
-    for (uint32_t i = 0; i < swapChainTextureNum; i++)
-    {
-        m_SwapChainBuffers.emplace_back();
-        BackBuffer& backBuffer = m_SwapChainBuffers.back();
+        const nri::Descriptor* textures[] =
+        {
+            Get(Descriptor::TaaHistoryPrev_Texture),
+        };
 
-        backBuffer = {};
-        backBuffer.texture = swapChainTextures[i];
+        const nri::Descriptor* storageTextures[] =
+        {
+            Get(Descriptor::Final_StorageTexture),
+        };
 
-        nri::Texture2DViewDesc textureViewDesc = {backBuffer.texture, nri::Texture2DViewType::COLOR_ATTACHMENT, swapChainFormat};
-        NRI_ABORT_ON_FAILURE(NRI.CreateTexture2DView(textureViewDesc, backBuffer.colorAttachment));
+        const nri::DescriptorRangeUpdateDesc descriptorRangeUpdateDesc[] =
+        {
+            { textures, helper::GetCountOf(textures) },
+            { storageTextures, helper::GetCountOf(storageTextures) },
+        };
 
-        frameBufferDesc.colorAttachments = &backBuffer.colorAttachment;
-        NRI_ABORT_ON_FAILURE(NRI.CreateFrameBuffer(*m_Device, frameBufferDesc, backBuffer.frameBufferUI));
+        NRI.UpdateDescriptorRanges(*descriptorSet, nri::WHOLE_DEVICE_GROUP, 0, helper::GetCountOf(descriptorRangeUpdateDesc), descriptorRangeUpdateDesc);
     }
-}
 
-void Sample::CreateCommandBuffers()
-{
-    for (Frame& frame : m_Frames)
-    {
-        NRI_ABORT_ON_FAILURE(NRI.CreateDeviceSemaphore(*m_Device, true, frame.deviceSemaphore));
-        NRI_ABORT_ON_FAILURE(NRI.CreateCommandAllocator(*m_CommandQueue, nri::WHOLE_DEVICE_GROUP, frame.commandAllocator));
-        for (nri::CommandBuffer*& commandBuffer : frame.commandBuffers)
-            NRI_ABORT_ON_FAILURE(NRI.CreateCommandBuffer(*frame.commandAllocator, commandBuffer));
-    }
-}
+    { // DescriptorSet::AfterDlss1
+        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *GetPipelineLayout(Pipeline::AfterDlss), 1, &descriptorSet, 1, nri::WHOLE_DEVICE_GROUP, 0));
+        m_DescriptorSets.push_back(descriptorSet);
 
-void Sample::CreateTexture(std::vector<DescriptorDesc>& descriptorDescs, const char* debugName, nri::Format format, uint16_t width, uint16_t height, uint16_t mipNum, uint16_t arraySize, nri::TextureUsageBits usage, nri::AccessBits state)
-{
-    nri::Texture* texture = nullptr;
-    const nri::CTextureDesc textureDesc = nri::CTextureDesc::Texture2D(format, width, height, mipNum, arraySize, usage);
-    NRI_ABORT_ON_FAILURE(NRI.CreateTexture(*m_Device, textureDesc, texture));
-    m_Textures.push_back(texture);
+        const nri::Descriptor* textures[] =
+        {
+            Get(Descriptor::TaaHistory_Texture),
+        };
 
-    if (state != nri::AccessBits::UNKNOWN)
-    {
-        nri::TextureTransitionBarrierDesc transition = nri::TextureTransition(texture, state, state == nri::AccessBits::SHADER_RESOURCE ? nri::TextureLayout::SHADER_RESOURCE : nri::TextureLayout::GENERAL);
-        m_TextureStates.push_back(transition);
-        m_TextureFormats.push_back(format);
-    }
+        const nri::Descriptor* storageTextures[] =
+        {
+            Get(Descriptor::Final_StorageTexture),
+        };
 
-    descriptorDescs.push_back( {debugName, texture, format, usage, nri::BufferUsageBits::NONE, arraySize > 1} );
-}
+        const nri::DescriptorRangeUpdateDesc descriptorRangeUpdateDesc[] =
+        {
+            { textures, helper::GetCountOf(textures) },
+            { storageTextures, helper::GetCountOf(storageTextures) },
+        };
 
-void Sample::CreateBuffer(std::vector<DescriptorDesc>& descriptorDescs, const char* debugName, uint64_t elements, uint32_t stride, nri::BufferUsageBits usage, nri::Format format)
-{
-    nri::BufferDesc bufferDesc = {};
-    bufferDesc.size = elements * stride;
-    bufferDesc.structureStride = (format == nri::Format::UNKNOWN && stride != 1) ? stride : 0;
-    bufferDesc.usageMask = usage;
+        NRI.UpdateDescriptorRanges(*descriptorSet, nri::WHOLE_DEVICE_GROUP, 0, helper::GetCountOf(descriptorRangeUpdateDesc), descriptorRangeUpdateDesc);
+    }
 
-    nri::Buffer* buffer = nullptr;
-    NRI_ABORT_ON_FAILURE( NRI.CreateBuffer(*m_Device, bufferDesc, buffer) );
-    m_Buffers.push_back(buffer);
+    { // DescriptorSet::SortRays1
+        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *GetPipelineLayout(Pipeline::SortRays), 1, &descriptorSet, 1, nri::WHOLE_DEVICE_GROUP, 0));
+        m_DescriptorSets.push_back(descriptorSet);
 
-    descriptorDescs.push_back( {debugName, buffer, format, nri::TextureUsageBits::NONE, usage} );
-}
+        const nri::Descriptor* storageBuffers[] =
+        {
+            Get(Descriptor::RayRecords_StorageBuffer),
+        };
 
-inline nri::Format ConvertFormatToTextureStorageCompatible(nri::Format format)
-{
-    switch (format)
-    {
-        case nri::Format::D16_UNORM:                return nri::Format::R16_UNORM;
-        case nri::Format::D24_UNORM_S8_UINT:        return nri::Format::R24_UNORM_X8;
-        case nri::Format::D32_SFLOAT:               return nri::Format::R32_SFLOAT;
-        case nri::Format::D32_SFLOAT_S8_UINT_X24:   return nri::Format::R32_SFLOAT_X8_X24;
-        case nri::Format::RGBA8_SRGB:               return nri::Format::RGBA8_UNORM;
-        case nri::Format::BGRA8_SRGB:               return nri::Format::BGRA8_UNORM;
+        const nri::DescriptorRangeUpdateDesc descriptorRangeUpdateDesc[] =
+        {
+            { storageBuffers, helper::GetCountOf(storageBuffers) },
+        };
+
+        NRI.UpdateDescriptorRanges(*descriptorSet, nri::WHOLE_DEVICE_GROUP, 0, helper::GetCountOf(descriptorRangeUpdateDesc), descriptorRangeUpdateDesc);
     }
 
-    return format;
-}
+    { // DescriptorSet::SampleNum1
+        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *GetPipelineLayout(Pipeline::SampleNum), 1, &descriptorSet, 1, nri::WHOLE_DEVICE_GROUP, 0));
+        m_DescriptorSets.push_back(descriptorSet);
 
-void Sample::CreateDescriptors(const std::vector<DescriptorDesc>& descriptorDescs)
-{
-    nri::Descriptor* descriptor = nullptr;
-    for (const DescriptorDesc& desc : descriptorDescs)
-    {
-        if (desc.textureUsage == nri::TextureUsageBits::NONE)
+        const nri::Descriptor* textures[] =
         {
-            if (desc.bufferUsage == nri::BufferUsageBits::CONSTANT_BUFFER)
-            {
-                for (uint32_t i = 0; i < BUFFERED_FRAME_MAX_NUM; i++)
-                {
-                    nri::BufferViewDesc bufferDesc = {};
-                    bufferDesc.buffer = Get(Buffer::GlobalConstants);
-                    bufferDesc.viewType = nri::BufferViewType::CONSTANT;
-                    bufferDesc.offset = i * m_ConstantBufferSize;
-                    bufferDesc.size = m_ConstantBufferSize;
-
-                    NRI_ABORT_ON_FAILURE( NRI.CreateBufferView(bufferDesc, m_Frames[i].globalConstantBufferDescriptor) );
-                    m_Frames[i].globalConstantBufferOffset = bufferDesc.offset;
-                }
-            }
-            else if (desc.bufferUsage & nri::BufferUsageBits::SHADER_RESOURCE)
-            {
-                const nri::BufferViewDesc viewDesc = {(nri::Buffer*)desc.resource, nri::BufferViewType::SHADER_RESOURCE, desc.format};
-                NRI_ABORT_ON_FAILURE(NRI.CreateBufferView(viewDesc, descriptor));
-                m_Descriptors.push_back(descriptor);
-            }
+            Get(Descriptor::TileNoise_Texture),
+        };
 
-            NRI.SetBufferDebugName(*(nri::Buffer*)desc.resource, desc.debugName);
-        }
-        else
+        const nri::Descriptor* storageTextures[] =
         {
-            nri::Texture2DViewDesc viewDesc = {(nri::Texture*)desc.resource, desc.isArray ? nri::Texture2DViewType::SHADER_RESOURCE_2D_ARRAY : nri::Texture2DViewType::SHADER_RESOURCE_2D, desc.format};
-            NRI_ABORT_ON_FAILURE(NRI.CreateTexture2DView(viewDesc, descriptor));
-            m_Descriptors.push_back(descriptor);
+            Get(Descriptor::SampleNum_StorageTexture),
+            Get(Descriptor::DilatedNoise_StorageTexture),
+        };
 
-            if (desc.textureUsage & nri::TextureUsageBits::SHADER_RESOURCE_STORAGE)
-            {
-                viewDesc.format = ConvertFormatToTextureStorageCompatible(desc.format);
-                viewDesc.viewType = desc.isArray ? nri::Texture2DViewType::SHADER_RESOURCE_STORAGE_2D_ARRAY : nri::Texture2DViewType::SHADER_RESOURCE_STORAGE_2D;
-                NRI_ABORT_ON_FAILURE(NRI.CreateTexture2DView(viewDesc, descriptor));
-                m_Descriptors.push_back(descriptor);
-            }
+        const nri::Descriptor* storageBuffers[] =
+        {
+            Get(Descriptor::SampleSum_StorageBuffer),
+        };
 
-            NRI.SetTextureDebugName(*(nri::Texture*)desc.resource, desc.debugName);
-        }
-    }
-}
+        const nri::DescriptorRangeUpdateDesc descriptorRangeUpdateDesc[] =
+        {
+            { textures, helper::GetCountOf(textures) },
+            { storageTextures, helper::GetCountOf(storageTextures) },
+            { storageBuffers, helper::GetCountOf(storageBuffers) },
+        };
 
-void Sample::CreateResources(nri::Format swapChainFormat)
-{
-    std::vector<DescriptorDesc> descriptorDescs;
+        NRI.UpdateDescriptorRanges(*descriptorSet, nri::WHOLE_DEVICE_GROUP, 0, helper::GetCountOf(descriptorRangeUpdateDesc), descriptorRangeUpdateDesc);
+    }
 
-    const uint16_t w = (uint16_t)m_ScreenResolution.x;
-    const uint16_t h = (uint16_t)m_ScreenResolution.y;
-    const uint64_t instanceDataSize = (m_Scene.instances.size() + ANIMATED_INSTANCE_MAX_NUM) * sizeof(InstanceData);
-    const uint64_t worldScratchBufferSize = NRI.GetAccelerationStructureBuildScratchBufferSize(*m_WorldTlas);
-    const uint64_t lightScratchBufferSize = NRI.GetAccelerationStructureBuildScratchBufferSize(*m_LightTlas);
+    // "finalResult" can be any of these, see "GetQualityDescriptorSet"
+    const Descriptor finalResults[] = { Descriptor::Final_Texture, Descriptor::TaaHistory_Texture, Descriptor::TaaHistoryPrev_Texture };
 
-    // nri::MemoryLocation::HOST_UPLOAD
-    CreateBuffer(descriptorDescs, "Buffer::GlobalConstants", m_ConstantBufferSize * BUFFERED_FRAME_MAX_NUM, 1, nri::BufferUsageBits::CONSTANT_BUFFER);
-    CreateBuffer(descriptorDescs, "Buffer::InstanceDataStaging", instanceDataSize * BUFFERED_FRAME_MAX_NUM, 1, nri::BufferUsageBits::NONE);
-    CreateBuffer(descriptorDescs, "Buffer::WorldTlasDataStaging", (m_Scene.instances.size() + ANIMATED_INSTANCE_MAX_NUM) * sizeof(nri::GeometryObjectInstance) * BUFFERED_FRAME_MAX_NUM, 1, nri::BufferUsageBits::RAY_TRACING_BUFFER);
-    CreateBuffer(descriptorDescs, "Buffer::LightTlasDataStaging", (m_Scene.instances.size() + ANIMATED_INSTANCE_MAX_NUM) * sizeof(nri::GeometryObjectInstance) * BUFFERED_FRAME_MAX_NUM, 1, nri::BufferUsageBits::RAY_TRACING_BUFFER);
+    for (Descriptor finalResult : finalResults)
+    { // DescriptorSet::QualityReference1a-c
+        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *GetPipelineLayout(Pipeline::QualityReference), 1, &descriptorSet, 1, nri::WHOLE_DEVICE_GROUP, 0));
+        m_DescriptorSets.push_back(descriptorSet);
 
-    // nri::MemoryLocation::DEVICE
-    CreateBuffer(descriptorDescs, "Buffer::ShaderTable", m_ShaderEntries.back(), 1, nri::BufferUsageBits::NONE);
-    CreateBuffer(descriptorDescs, "Buffer::PrimitiveData", m_Scene.primitives.size(), sizeof(PrimitiveData), nri::BufferUsageBits::SHADER_RESOURCE, nri::Format::RGBA32_UINT);
-    CreateBuffer(descriptorDescs, "Buffer::InstanceData", instanceDataSize / (4 * sizeof(float)), 4 * sizeof(float), nri::BufferUsageBits::SHADER_RESOURCE, nri::Format::RGBA32_SFLOAT);
-    CreateBuffer(descriptorDescs, "Buffer::WorldScratch", worldScratchBufferSize, 1, nri::BufferUsageBits::RAY_TRACING_BUFFER | nri::BufferUsageBits::SHADER_RESOURCE_STORAGE);
-    CreateBuffer(descriptorDescs, "Buffer::LightScratch", lightScratchBufferSize, 1, nri::BufferUsageBits::RAY_TRACING_BUFFER | nri::BufferUsageBits::SHADER_RESOURCE_STORAGE);
+        const nri::Descriptor* textures[] =
+        {
+            Get(finalResult),
+        };
 
-#if( NRD_OCCLUSION_ONLY == 1 )
-    nri::Format dataFormat = nri::Format::R16_SFLOAT;
-#else
-    nri::Format dataFormat = nri::Format::RGBA16_SFLOAT;
-#endif
+        const nri::Descriptor* storageBuffers[] =
+        {
+            Get(Descriptor::QualityReference_StorageBuffer),
+        };
 
-    nri::Format outputFormat = m_DLSS.IsInitialized() ? nri::Format::RGBA16_SFLOAT : swapChainFormat;
+        const nri::DescriptorRangeUpdateDesc descriptorRangeUpdateDesc[] =
+        {
+            { textures, helper::GetCountOf(textures) },
+            { storageBuffers, helper::GetCountOf(storageBuffers) },
+        };
 
-    CreateTexture(descriptorDescs, "Texture::IntegrateBRDF", nri::Format::RG16_SFLOAT, FG_TEX_SIZE, FG_TEX_SIZE, 1, 1,
-        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE_STORAGE);
-    CreateTexture(descriptorDescs, "Texture::ViewZ", nri::Format::R32_SFLOAT, w, h, 1, 1,
-        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE);
-    CreateTexture(descriptorDescs, "Texture::DirectLighting", nri::Format::R11_G11_B10_UFLOAT, w, h, 1, 1,
-        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE);
-    CreateTexture(descriptorDescs, "Texture::TransparentLighting", nri::Format::RGBA16_SFLOAT, w, h, 1, 1,
-        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE);
-    CreateTexture(descriptorDescs, "Texture::ObjectMotion", nri::Format::RGBA16_SFLOAT, w, h, 1, 1,
-        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE);
-    CreateTexture(descriptorDescs, "Texture::Normal_Roughness", NORMAL_FORMAT, w, h, 1, 1,
-        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE);
-    CreateTexture(descriptorDescs, "Texture::BaseColor_Metalness", nri::Format::RGBA8_SRGB, w, h, 1, 1,
-        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE);
-    CreateTexture(descriptorDescs, "Texture::Shadow", nri::Format::RGBA8_UNORM, w, h, 1, 1,
-        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE);
-    CreateTexture(descriptorDescs, "Texture::Diff", dataFormat, w, h, 1, 1,
-        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE);
-    CreateTexture(descriptorDescs, "Texture::DiffDirectionPdf", nri::Format::RGBA16_SFLOAT, w, h, 1, 1,
-        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE);
-    CreateTexture(descriptorDescs, "Texture::Spec", dataFormat, w, h, 1, 1,
-        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE);
-    CreateTexture(descriptorDescs, "Texture::SpecDirectionPdf", nri::Format::RGBA16_SFLOAT, w, h, 1, 1,
-        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE);
-    CreateTexture(descriptorDescs, "Texture::Unfiltered_ShadowData", nri::Format::RG16_SFLOAT, w, h, 1, 1,
-        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE);
-    CreateTexture(descriptorDescs, "Texture::Unfiltered_Diff", dataFormat, w, h, 1, 1,
-        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE);
-    CreateTexture(descriptorDescs, "Texture::Unfiltered_Spec", dataFormat, w, h, 1, 1,
-        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE);
-    CreateTexture(descriptorDescs, "Texture::Unfiltered_Shadow_Translucency", nri::Format::RGBA8_UNORM, w, h, 1, 1,
-        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE);
-    CreateTexture(descriptorDescs, "Texture::ComposedLighting_ViewZ", nri::Format::RGBA16_SFLOAT, w, h, 1, 1,
-        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE_STORAGE);
-    CreateTexture(descriptorDescs, "Texture::TaaHistory", outputFormat, m_OutputResolution.x, m_OutputResolution.y, 1, 1,
-        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE);
-    CreateTexture(descriptorDescs, "Texture::TaaHistoryPrev", outputFormat, m_OutputResolution.x, m_OutputResolution.y, 1, 1,
-        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE_STORAGE);
-    CreateTexture(descriptorDescs, "Texture::Final", swapChainFormat, (uint16_t)m_OutputResolution.x, (uint16_t)m_OutputResolution.y, 1, 1,
-        nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::COPY_SOURCE);
+        NRI.UpdateDescriptorRanges(*descriptorSet, nri::WHOLE_DEVICE_GROUP, 0, helper::GetCountOf(descriptorRangeUpdateDesc), descriptorRangeUpdateDesc);
+    }
 
-    // Material textures
-    for (const utils::Texture* textureData : m_Scene.textures)
-        CreateTexture(descriptorDescs, "", textureData->GetFormat(), textureData->GetWidth(), textureData->GetHeight(), textureData->GetMipNum(), textureData->GetArraySize(), nri::TextureUsageBits::SHADER_RESOURCE, nri::AccessBits::UNKNOWN);
+    for (Descriptor finalResult : finalResults)
+    { // DescriptorSet::QualityMetrics1a-c
+        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *GetPipelineLayout(Pipeline::QualityMetrics), 1, &descriptorSet, 1, nri::WHOLE_DEVICE_GROUP, 0));
+        m_DescriptorSets.push_back(descriptorSet);
 
-    constexpr uint32_t offset = uint32_t(Buffer::UploadHeapBufferNum);
+        const nri::Descriptor* textures[] =
+        {
+            Get(finalResult),
+        };
 
-    nri::ResourceGroupDesc resourceGroupDesc = {};
-    resourceGroupDesc.memoryLocation = nri::MemoryLocation::HOST_UPLOAD;
-    resourceGroupDesc.bufferNum = offset;
-    resourceGroupDesc.buffers = m_Buffers.data();
+        const nri::Descriptor* storageBuffers[] =
+        {
+            Get(Descriptor::QualityReference_StorageBuffer),
+            Get(Descriptor::QualityMetrics_StorageBuffer),
+        };
 
-    size_t baseAllocation = m_MemoryAllocations.size();
-    m_MemoryAllocations.resize(baseAllocation + NRI.CalculateAllocationNumber(*m_Device, resourceGroupDesc), nullptr);
-    NRI_ABORT_ON_FAILURE( NRI.AllocateAndBindMemory(*m_Device, resourceGroupDesc, m_MemoryAllocations.data() + baseAllocation));
+        const nri::DescriptorRangeUpdateDesc descriptorRangeUpdateDesc[] =
+        {
+            { textures, helper::GetCountOf(textures) },
+            { storageBuffers, helper::GetCountOf(storageBuffers) },
+        };
 
-    resourceGroupDesc.memoryLocation = nri::MemoryLocation::DEVICE;
-    resourceGroupDesc.bufferNum = helper::GetCountOf(m_Buffers) - offset;
-    resourceGroupDesc.buffers = m_Buffers.data() + offset;
-    resourceGroupDesc.textureNum = helper::GetCountOf(m_Textures);
-    resourceGroupDesc.textures = m_Textures.data();
+        NRI.UpdateDescriptorRanges(*descriptorSet, nri::WHOLE_DEVICE_GROUP, 0, helper::GetCountOf(descriptorRangeUpdateDesc), descriptorRangeUpdateDesc);
+    }
 
-    baseAllocation = m_MemoryAllocations.size();
-    m_MemoryAllocations.resize(baseAllocation + NRI.CalculateAllocationNumber(*m_Device, resourceGroupDesc), nullptr);
-    NRI_ABORT_ON_FAILURE( NRI.AllocateAndBindMemory(*m_Device, resourceGroupDesc, m_MemoryAllocations.data() + baseAllocation));
+    // Sets for both data formats, the twins reference twins of the data textures
+    m_DescriptorSets.resize((size_t)DescriptorSet::MAX_NUM);
+    CreateDataDescriptorSets();
 
-    CreateDescriptors(descriptorDescs);
+    SwapDataTextureTwins();
+    CreateDataDescriptorSets();
+    SwapDataTextureTwins();
 }
 
-void Sample::CreatePipelines()
+void Sample::CreateDataDescriptorSets()
 {
-    if (!m_Pipelines.empty())
-    {
-        NRI.WaitForIdle(*m_CommandQueue);
+    nri::DescriptorSet* descriptorSet = nullptr;
 
-        for (uint32_t i = 0; i < m_Pipelines.size(); i++)
-            NRI.DestroyPipeline(*m_Pipelines[i]);
-        m_Pipelines.clear();
+    { // DescriptorSet::Raytracing1
+        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *GetPipelineLayout(Pipeline::Raytracing), 1, &descriptorSet, 1, nri::WHOLE_DEVICE_GROUP, 0));
+        Get(DescriptorSet::Raytracing1) = descriptorSet;
+
+        const nri::Descriptor* textures[] =
+        {
+            Get( Descriptor((uint32_t)Descriptor::MaterialTextures + utils::StaticTexture::ScramblingRanking1spp) ),
+            Get( Descriptor((uint32_t)Descriptor::MaterialTextures + utils::StaticTexture::ScramblingRanking32spp) ),
+            Get( Descriptor((uint32_t)Descriptor::MaterialTextures + utils::StaticTexture::SobolSequence) ),
+            Get(Descriptor::IntegrateBRDF_Texture),
+            Get(Descriptor::ComposedLighting_ViewZ_Texture),
+        };
+
+        const nri::Descriptor* storageTextures[] =
+        {
+            Get(Descriptor::DirectLighting_StorageTexture),
+            Get(Descriptor::TransparentLighting_StorageTexture),
+            Get(Descriptor::ObjectMotion_StorageTexture),
+            Get(Descriptor::ViewZ_StorageTexture),
+            Get(Descriptor::Normal_Roughness_StorageTexture),
+            Get(Descriptor::BaseColor_Metalness_StorageTexture),
+            Get(Descriptor::Unfiltered_ShadowData_StorageTexture),
+            Get(Descriptor::Unfiltered_Shadow_Translucency_StorageTexture),
+            Get(Descriptor::Unfiltered_Diff_StorageTexture),
+            Get(Descriptor::DiffDirectionPdf_StorageTexture),
+            Get(Descriptor::Unfiltered_Spec_StorageTexture),
+            Get(Descriptor::SpecDirectionPdf_StorageTexture),
+        };
+
+        const nri::Descriptor* storageBuffers[] =
+        {
+            Get(Descriptor::RayRecords_StorageBuffer),
+        };
+
+        const nri::Descriptor* sampleNumTextures[] =
+        {
+            Get(Descriptor::SampleNum_Texture),
+        };
+
+        const nri::Descriptor* mipFeedbackBuffers[] =
+        {
+            Get(Descriptor::MipFeedback_StorageBuffer),
+        };
+
+        const nri::DescriptorRangeUpdateDesc descriptorRangeUpdateDesc[] =
+        {
+            { textures, helper::GetCountOf(textures) },
+            { storageTextures, helper::GetCountOf(storageTextures) },
+            { storageBuffers, helper::GetCountOf(storageBuffers) },
+            { sampleNumTextures, helper::GetCountOf(sampleNumTextures) },
+            { mipFeedbackBuffers, helper::GetCountOf(mipFeedbackBuffers) },
+        };
 
-        m_Reblur.CreatePipelines();
-        m_Relax.CreatePipelines();
+        NRI.UpdateDescriptorRanges(*descriptorSet, nri::WHOLE_DEVICE_GROUP, 0, helper::GetCountOf(descriptorRangeUpdateDesc), descriptorRangeUpdateDesc);
     }
 
-    utils::ShaderCodeStorage shaderCodeStorage;
-    nri::PipelineLayout* pipelineLayout = nullptr;
-    nri::Pipeline* pipeline = nullptr;
+    { // DescriptorSet::Composition1
+        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *GetPipelineLayout(Pipeline::Composition), 1, &descriptorSet, 1, nri::WHOLE_DEVICE_GROUP, 0));
+        Get(DescriptorSet::Composition1) = descriptorSet;
 
-    nri::SamplerDesc samplerDescs[3] = {};
-    {
-        samplerDescs[0].addressModes = {nri::AddressMode::REPEAT, nri::AddressMode::REPEAT};
-        samplerDescs[0].minification = nri::Filter::LINEAR;
-        samplerDescs[0].magnification = nri::Filter::LINEAR;
-        samplerDescs[0].mip = nri::Filter::LINEAR;
-        samplerDescs[0].mipMax = 16.0f;
+        const nri::Descriptor* textures[] =
+        {
+            Get(Descriptor::ViewZ_Texture),
+            Get(Descriptor::DirectLighting_Texture),
+            Get(Descriptor::Normal_Roughness_Texture),
+            Get(Descriptor::BaseColor_Metalness_Texture),
+            Get(Descriptor::Shadow_Texture),
+            Get(Descriptor::Diff_Texture),
+            Get(Descriptor::Spec_Texture),
+            Get(Descriptor::IntegrateBRDF_Texture),
+        };
 
-        samplerDescs[1].addressModes = {nri::AddressMode::REPEAT, nri::AddressMode::REPEAT};
-        samplerDescs[1].minification = nri::Filter::NEAREST;
-        samplerDescs[1].magnification = nri::Filter::NEAREST;
-        samplerDescs[1].mip = nri::Filter::NEAREST;
-        samplerDescs[1].mipMax = 16.0f;
+        const nri::Descriptor* storageTextures[] =
+        {
+            Get(Descriptor::ComposedLighting_ViewZ_StorageTexture),
+        };
 
-        samplerDescs[2].addressModes = {nri::AddressMode::CLAMP_TO_EDGE, nri::AddressMode::CLAMP_TO_EDGE};
-        samplerDescs[2].minification = nri::Filter::LINEAR;
-        samplerDescs[2].magnification = nri::Filter::LINEAR;
+        const nri::DescriptorRangeUpdateDesc descriptorRangeUpdateDesc[] =
+        {
+            { textures, helper::GetCountOf(textures) },
+            { storageTextures, helper::GetCountOf(storageTextures) },
+        };
+
+        NRI.UpdateDescriptorRanges(*descriptorSet, nri::WHOLE_DEVICE_GROUP, 0, helper::GetCountOf(descriptorRangeUpdateDesc), descriptorRangeUpdateDesc);
     }
 
-    const nri::DescriptorRangeDesc globalDescriptorRanges[] =
-    {
-        { 0, 1, nri::DescriptorType::CONSTANT_BUFFER, nri::ShaderStage::ALL },
-    };
+    { // DescriptorSet::PreDlss1
+        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *GetPipelineLayout(Pipeline::PreDlss), 1, &descriptorSet, 1, nri::WHOLE_DEVICE_GROUP, 0));
+        Get(DescriptorSet::PreDlss1) = descriptorSet;
 
-    const nri::StaticSamplerDesc staticSamplersDesc[] =
-    {
-        { samplerDescs[0], 1, nri::ShaderStage::ALL },
-        { samplerDescs[1], 2, nri::ShaderStage::ALL },
-        { samplerDescs[2], 3, nri::ShaderStage::ALL },
-    };
+        const nri::Descriptor* textures[] =
+        {
+            Get(Descriptor::ObjectMotion_Texture),
+            Get(Descriptor::TransparentLighting_Texture),
+            Get(Descriptor::ComposedLighting_ViewZ_Texture),
+        };
 
-    { // Pipeline::IntegrateBRDF
-        const nri::DescriptorRangeDesc descriptorRanges[] =
+        const nri::Descriptor* storageTextures[] =
         {
-            { 0, 1, nri::DescriptorType::STORAGE_TEXTURE, nri::ShaderStage::ALL }
+            Get(Descriptor::ViewZ_StorageTexture),
+            Get(Descriptor::Unfiltered_ShadowData_StorageTexture),
+            Get(Descriptor::Unfiltered_Diff_StorageTexture),
         };
 
-        const nri::DescriptorSetDesc descriptorSetDesc[] =
+        const nri::DescriptorRangeUpdateDesc descriptorRangeUpdateDesc[] =
         {
-            { descriptorRanges, helper::GetCountOf(descriptorRanges) },
+            { textures, helper::GetCountOf(textures) },
+            { storageTextures, helper::GetCountOf(storageTextures) },
         };
 
-        nri::PipelineLayoutDesc pipelineLayoutDesc = {};
-        pipelineLayoutDesc.descriptorSetNum = helper::GetCountOf(descriptorSetDesc);
-        pipelineLayoutDesc.descriptorSets = descriptorSetDesc;
-        pipelineLayoutDesc.stageMask = nri::PipelineLayoutShaderStageBits::COMPUTE;
+        NRI.UpdateDescriptorRanges(*descriptorSet, nri::WHOLE_DEVICE_GROUP, 0, helper::GetCountOf(descriptorRangeUpdateDesc), descriptorRangeUpdateDesc);
+    }
 
-        NRI_ABORT_ON_FAILURE(NRI.CreatePipelineLayout(*m_Device, pipelineLayoutDesc, pipelineLayout));
-        m_PipelineLayouts.push_back(pipelineLayout);
+    { // DescriptorSet::CompositionTemporal1a
+        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *GetPipelineLayout(Pipeline::CompositionTemporal), 1, &descriptorSet, 1, nri::WHOLE_DEVICE_GROUP, 0));
+        Get(DescriptorSet::CompositionTemporal1a) = descriptorSet;
 
-        nri::ComputePipelineDesc pipelineDesc = {};
-        pipelineDesc.pipelineLayout = pipelineLayout;
-        pipelineDesc.computeShader = utils::LoadShader(m_DeviceDesc->graphicsAPI, "IntegrateBRDF.cs", shaderCodeStorage);
+        const nri::Descriptor* textures[] =
+        {
+            Get(Descriptor::ViewZ_Texture),
+            Get(Descriptor::DirectLighting_Texture),
+            Get(Descriptor::Normal_Roughness_Texture),
+            Get(Descriptor::BaseColor_Metalness_Texture),
+            Get(Descriptor::Shadow_Texture),
+            Get(Descriptor::Diff_Texture),
+            Get(Descriptor::Spec_Texture),
+            Get(Descriptor::IntegrateBRDF_Texture),
+            Get(Descriptor::ObjectMotion_Texture),
+            Get(Descriptor::TransparentLighting_Texture),
+            Get(Descriptor::TaaHistoryPrev_Texture),
+        };
+
+        const nri::Descriptor* storageTextures[] =
+        {
+            Get(Descriptor::ComposedLighting_ViewZ_StorageTexture),
+            Get(Descriptor::TaaHistory_StorageTexture),
+        };
+
+        const nri::DescriptorRangeUpdateDesc descriptorRangeUpdateDesc[] =
+        {
+            { textures, helper::GetCountOf(textures) },
+            { storageTextures, helper::GetCountOf(storageTextures) },
+        };
 
-        NRI_ABORT_ON_FAILURE(NRI.CreateComputePipeline(*m_Device, pipelineDesc, pipeline));
-        m_Pipelines.push_back(pipeline);
+        NRI.UpdateDescriptorRanges(*descriptorSet, nri::WHOLE_DEVICE_GROUP, 0, helper::GetCountOf(descriptorRangeUpdateDesc), descriptorRangeUpdateDesc);
     }
 
-    { // Pipeline::Raytracing
-        const nri::DescriptorRangeDesc descriptorRanges1[] =
+    { // DescriptorSet::CompositionTemporal1b
+        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *GetPipelineLayout(Pipeline::CompositionTemporal), 1, &descriptorSet, 1, nri::WHOLE_DEVICE_GROUP, 0));
+        Get(DescriptorSet::CompositionTemporal1b) = descriptorSet;
+
+        const nri::Descriptor* textures[] =
         {
-            { 0, 5, nri::DescriptorType::TEXTURE, nri::ShaderStage::RAYGEN },
-            { 5, 12, nri::DescriptorType::STORAGE_TEXTURE, nri::ShaderStage::RAYGEN },
+            Get(Descriptor::ViewZ_Texture),
+            Get(Descriptor::DirectLighting_Texture),
+            Get(Descriptor::Normal_Roughness_Texture),
+            Get(Descriptor::BaseColor_Metalness_Texture),
+            Get(Descriptor::Shadow_Texture),
+            Get(Descriptor::Diff_Texture),
+            Get(Descriptor::Spec_Texture),
+            Get(Descriptor::IntegrateBRDF_Texture),
+            Get(Descriptor::ObjectMotion_Texture),
+            Get(Descriptor::TransparentLighting_Texture),
+            Get(Descriptor::TaaHistory_Texture),
         };
 
-        const uint32_t textureNum = helper::GetCountOf(m_Scene.materials) * TEXTURES_PER_MATERIAL;
-        nri::DescriptorRangeDesc descriptorRanges2[] =
+        const nri::Descriptor* storageTextures[] =
         {
-            { 0, 2, nri::DescriptorType::ACCELERATION_STRUCTURE, nri::ShaderStage::RAYGEN },
-            { 2, 2, nri::DescriptorType::BUFFER, nri::ShaderStage::ALL },
-            { 4, textureNum, nri::DescriptorType::TEXTURE, nri::ShaderStage::ALL, nri::VARIABLE_DESCRIPTOR_NUM, nri::DESCRIPTOR_ARRAY },
+            Get(Descriptor::ComposedLighting_ViewZ_StorageTexture),
+            Get(Descriptor::TaaHistoryPrev_StorageTexture),
         };
 
-        const nri::DescriptorSetDesc descriptorSetDesc[] =
+        const nri::DescriptorRangeUpdateDesc descriptorRangeUpdateDesc[] =
         {
-            { globalDescriptorRanges, helper::GetCountOf(globalDescriptorRanges), staticSamplersDesc, helper::GetCountOf(staticSamplersDesc) },
-            { descriptorRanges1, helper::GetCountOf(descriptorRanges1) },
-            { descriptorRanges2, helper::GetCountOf(descriptorRanges2) }
+            { textures, helper::GetCountOf(textures) },
+            { storageTextures, helper::GetCountOf(storageTextures) },
         };
 
-        nri::PipelineLayoutDesc pipelineLayoutDesc = {};
-        pipelineLayoutDesc.descriptorSets = descriptorSetDesc;
-        pipelineLayoutDesc.descriptorSetNum = helper::GetCountOf(descriptorSetDesc);
-        pipelineLayoutDesc.stageMask = nri::PipelineLayoutShaderStageBits::ALL_RAY_TRACING;
+        NRI.UpdateDescriptorRanges(*descriptorSet, nri::WHOLE_DEVICE_GROUP, 0, helper::GetCountOf(descriptorRangeUpdateDesc), descriptorRangeUpdateDesc);
+    }
 
-        NRI_ABORT_ON_FAILURE(NRI.CreatePipelineLayout(*m_Device, pipelineLayoutDesc, pipelineLayout));
-        m_PipelineLayouts.push_back(pipelineLayout);
+    { // DescriptorSet::SampleBudget1
+        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *GetPipelineLayout(Pipeline::SampleBudget), 1, &descriptorSet, 1, nri::WHOLE_DEVICE_GROUP, 0));
+        Get(DescriptorSet::SampleBudget1) = descriptorSet;
 
-        const nri::ShaderDesc shaderDescs[] =
+        const nri::Descriptor* textures[] =
         {
-            utils::LoadShader(m_DeviceDesc->graphicsAPI, "Raytracing00.rgen", shaderCodeStorage, "Raytracing00_rgen"),
-            utils::LoadShader(m_DeviceDesc->graphicsAPI, "Raytracing01.rgen", shaderCodeStorage, "Raytracing01_rgen"),
-            utils::LoadShader(m_DeviceDesc->graphicsAPI, "Raytracing10.rgen", shaderCodeStorage, "Raytracing10_rgen"),
-            utils::LoadShader(m_DeviceDesc->graphicsAPI, "Raytracing11.rgen", shaderCodeStorage, "Raytracing11_rgen"),
-            utils::LoadShader(m_DeviceDesc->graphicsAPI, "Main.rmiss", shaderCodeStorage, "Main_rmiss"),
-            utils::LoadShader(m_DeviceDesc->graphicsAPI, "Main.rchit", shaderCodeStorage, "Main_rchit"),
-            utils::LoadShader(m_DeviceDesc->graphicsAPI, "Main.rahit", shaderCodeStorage, "Main_rahit"),
+            Get(Descriptor::Normal_Roughness_Texture),
+            Get(Descriptor::Unfiltered_Diff_Texture),
+            Get(Descriptor::Unfiltered_Spec_Texture),
+            Get(Descriptor::Diff_Texture),
+            Get(Descriptor::Spec_Texture),
         };
 
-        nri::ShaderLibrary shaderLibrary = {};
-        shaderLibrary.shaderDescs = shaderDescs;
-        shaderLibrary.shaderNum = helper::GetCountOf(shaderDescs);
-
-        const nri::ShaderGroupDesc shaderGroupDescs[] =
+        const nri::Descriptor* storageTextures[] =
         {
-            { 1 },          // Raytracing00_rgen - checkerboard = 0, 2nd bounce specular = 0
-            { 2 },          // Raytracing01_rgen - checkerboard = 0, 2nd bounce specular = 1
-            { 3 },          // Raytracing10_rgen - checkerboard = 1, 2nd bounce specular = 0
-            { 4 },          // Raytracing11_rgen - checkerboard = 1, 2nd bounce specular = 1
-            { 5 },          // Main_rmiss
-            { 6, 7 },       // Main_rhit
+            Get(Descriptor::TileNoise_StorageTexture),
         };
 
-        nri::RayTracingPipelineDesc pipelineDesc = {};
-        pipelineDesc.recursionDepthMax = 1;
-        pipelineDesc.payloadAttributeSizeMax = 4 * sizeof(uint32_t);
-        pipelineDesc.intersectionAttributeSizeMax = 2 * sizeof(float);
-        pipelineDesc.pipelineLayout = pipelineLayout;
-        pipelineDesc.shaderGroupDescs = shaderGroupDescs;
-        pipelineDesc.shaderGroupDescNum = helper::GetCountOf(shaderGroupDescs);
-        pipelineDesc.shaderLibrary = &shaderLibrary;
+        const nri::DescriptorRangeUpdateDesc descriptorRangeUpdateDesc[] =
+        {
+            { textures, helper::GetCountOf(textures) },
+            { storageTextures, helper::GetCountOf(storageTextures) },
+        };
 
-        NRI_ABORT_ON_FAILURE(NRI.CreateRayTracingPipeline(*m_Device, pipelineDesc, pipeline));
-        m_Pipelines.push_back(pipeline);
+        NRI.UpdateDescriptorRanges(*descriptorSet, nri::WHOLE_DEVICE_GROUP, 0, helper::GetCountOf(descriptorRangeUpdateDesc), descriptorRangeUpdateDesc);
     }
+}
 
-    { // Pipeline::Composition
-        const nri::DescriptorRangeDesc descriptorRanges[] =
+void Sample::SwapDataTextureTwins()
+{
+    for (DataTextureTwin& twin : m_DataTextureTwins)
+    {
+        const uint32_t textureIndex = (uint32_t)twin.texture;
+        std::swap(m_Textures[textureIndex], twin.resource);
+        std::swap(m_TextureFormats[textureIndex], twin.format);
+        std::swap(m_TextureStates[textureIndex], twin.state);
+        std::swap(Get(twin.descriptor), twin.textureView);
+        std::swap(Get(Descriptor((uint32_t)twin.descriptor + 1)), twin.storageView);
+
+        // Memory contents belonged to the other twin
+        for (TransientTexture& transientTexture : m_TransientTextures)
         {
-            { 0, 8, nri::DescriptorType::TEXTURE, nri::ShaderStage::ALL },
-            { 8, 1, nri::DescriptorType::STORAGE_TEXTURE, nri::ShaderStage::ALL }
-        };
+            if (transientTexture.texture == twin.texture)
+                transientTexture.isResident = false;
+        }
+    }
 
-        const nri::DescriptorSetDesc descriptorSetDesc[] =
-        {
-            { globalDescriptorRanges, helper::GetCountOf(globalDescriptorRanges), staticSamplersDesc, helper::GetCountOf(staticSamplersDesc) },
-            { descriptorRanges, helper::GetCountOf(descriptorRanges) },
-        };
+    for (uint32_t i = 0; i < m_DataDescriptorSetTwins.size(); i++)
+        std::swap(m_DescriptorSets[(uint32_t)DescriptorSet::Raytracing1 + i], m_DataDescriptorSetTwins[i]);
+}
 
-        nri::PipelineLayoutDesc pipelineLayoutDesc = {};
-        pipelineLayoutDesc.descriptorSets = descriptorSetDesc;
-        pipelineLayoutDesc.descriptorSetNum = helper::GetCountOf(descriptorSetDesc);
-        pipelineLayoutDesc.stageMask = nri::PipelineLayoutShaderStageBits::COMPUTE;
+void Sample::UploadStaticData()
+{
+    // PrimitiveData (the compact layout is cheap to pack, no need to cache it)
+    std::vector<PrimitiveData> primitiveData( m_IsCompactPrimitiveData ? 0 : m_Scene.primitives.size() );
+    std::vector<CompactPrimitiveData> compactPrimitiveData( m_IsCompactPrimitiveData ? helper::GetAlignedSize(m_Scene.primitives.size(), 2) : 0 );
+    std::vector<uint32_t> indices( m_IsCompactPrimitiveData ? m_Scene.indices.size() : 1, 0 );
+    std::vector<CompactVertexData> vertexData( m_IsCompactPrimitiveData ? m_Scene.unpackedVertices.size() : 1, CompactVertexData{} );
 
-        NRI_ABORT_ON_FAILURE(NRI.CreatePipelineLayout(*m_Device, pipelineLayoutDesc, pipelineLayout));
-        m_PipelineLayouts.push_back(pipelineLayout);
+    if (m_IsCompactPrimitiveData)
+    {
+        for (const utils::Mesh& mesh : m_Scene.meshes)
+        {
+            for (uint32_t j = 0; j < mesh.indexNum; j++)
+                indices[mesh.indexOffset + j] = mesh.vertexOffset + m_Scene.indices[mesh.indexOffset + j];
 
-        nri::ComputePipelineDesc pipelineDesc = {};
-        pipelineDesc.pipelineLayout = pipelineLayout;
-        pipelineDesc.computeShader = utils::LoadShader(m_DeviceDesc->graphicsAPI, "Composition.cs", shaderCodeStorage);
+            uint32_t triangleNum = mesh.indexNum / 3;
+            for (uint32_t j = 0; j < triangleNum; j++)
+            {
+                uint32_t primitiveIndex = mesh.indexOffset / 3 + j;
+                const utils::Primitive& primitive = m_Scene.primitives[primitiveIndex];
 
-        NRI_ABORT_ON_FAILURE(NRI.CreateComputePipeline(*m_Device, pipelineDesc, pipeline));
-        m_Pipelines.push_back(pipeline);
-    }
+                float4 nfp = Packed::uint_to_uf4<10, 10, 10, 2>(primitive.normal);
+                float3 nf = Normalize(float3(nfp.xmm) * 2.0f - 1.0f);
 
-    { // Pipeline::Temporal
-        const nri::DescriptorRangeDesc descriptorRanges[] =
-        {
-            { 0, 4, nri::DescriptorType::TEXTURE, nri::ShaderStage::ALL },
-            { 4, 1, nri::DescriptorType::STORAGE_TEXTURE, nri::ShaderStage::ALL }
-        };
+                CompactPrimitiveData& data = compactPrimitiveData[primitiveIndex];
+                data.fn = EncodeUnitVector(nf);
+                data.worldToUvUnits = primitive.worldToUvUnits;
+            }
+        }
 
-        const nri::DescriptorSetDesc descriptorSetDesc[] =
+        for (size_t i = 0; i < vertexData.size(); i++)
         {
-            { globalDescriptorRanges, helper::GetCountOf(globalDescriptorRanges), staticSamplersDesc, helper::GetCountOf(staticSamplersDesc) },
-            { descriptorRanges, helper::GetCountOf(descriptorRanges) },
-        };
+            const utils::UnpackedVertex& v = m_Scene.unpackedVertices[i];
 
-        nri::PipelineLayoutDesc pipelineLayoutDesc = {};
-        pipelineLayoutDesc.descriptorSets = descriptorSetDesc;
-        pipelineLayoutDesc.descriptorSetNum = helper::GetCountOf(descriptorSetDesc);
-        pipelineLayoutDesc.stageMask = nri::PipelineLayoutShaderStageBits::COMPUTE;
+            CompactVertexData& data = vertexData[i];
+            data.uv = Packed::sf2_to_h2(v.uv[0], v.uv[1]);
+            data.n = EncodeUnitVector(float3(v.normal));
+            data.t = EncodeUnitVector(float3(v.tangent));
+            data.bitangentSign = v.tangent[3];
+        }
 
-        NRI_ABORT_ON_FAILURE(NRI.CreatePipelineLayout(*m_Device, pipelineLayoutDesc, pipelineLayout));
-        m_PipelineLayouts.push_back(pipelineLayout);
+        uint64_t classicSize = m_Scene.primitives.size() * sizeof(PrimitiveData);
+        uint64_t compactSize = helper::GetByteSizeOf(compactPrimitiveData) + helper::GetByteSizeOf(indices) + helper::GetByteSizeOf(vertexData);
+        printf("Primitive data: compact, %.1f MB instead of %.1f MB\n", compactSize / (1024.0 * 1024.0), classicSize / (1024.0 * 1024.0));
+    }
+    else if (!LoadPrimitiveDataCache(primitiveData))
+    {
+        uint32_t n = 0;
+        for (const utils::Mesh& mesh : m_Scene.meshes)
+        {
+            uint32_t triangleNum = mesh.indexNum / 3;
+            for (uint32_t j = 0; j < triangleNum; j++)
+            {
+                uint32_t primitiveIndex = mesh.indexOffset / 3 + j;
+                const utils::Primitive& primitive = m_Scene.primitives[primitiveIndex];
+
+                const utils::UnpackedVertex& v0 = m_Scene.unpackedVertices[ mesh.vertexOffset + m_Scene.indices[primitiveIndex * 3] ];
+                const utils::UnpackedVertex& v1 = m_Scene.unpackedVertices[ mesh.vertexOffset + m_Scene.indices[primitiveIndex * 3 + 1] ];
+                const utils::UnpackedVertex& v2 = m_Scene.unpackedVertices[ mesh.vertexOffset + m_Scene.indices[primitiveIndex * 3 + 2] ];
+
+                float3 n0 = float3(v0.normal);
+                float3 n1 = float3(v1.normal);
+                float3 n2 = float3(v2.normal);
+                float4 t0 = float4(v0.tangent);
+                float4 t1 = float4(v1.tangent);
+                float4 t2 = float4(v2.tangent);
+
+                float4 nfp = Packed::uint_to_uf4<10, 10, 10, 2>(primitive.normal);
+                float3 nf = Normalize(float3(nfp.xmm) * 2.0f - 1.0f);
+
+                PrimitiveData& data = primitiveData[n++];
+                data.uv0 = Packed::sf2_to_h2(v0.uv[0], v0.uv[1]);
+                data.uv1 = Packed::sf2_to_h2(v1.uv[0], v1.uv[1]);
+                data.uv2 = Packed::sf2_to_h2(v2.uv[0], v2.uv[1]);
+                data.fnX_fnY = Packed::sf2_to_h2(nf.x, nf.y);
+
+                data.fnZ_worldToUvUnits = Packed::sf2_to_h2(nf.z, primitive.worldToUvUnits);
+                data.n0X_n0Y = Packed::sf2_to_h2(n0.x, n0.y);
+                data.n0Z_n1X = Packed::sf2_to_h2(n0.z, n1.x);
+                data.n1Y_n1Z = Packed::sf2_to_h2(n1.y, n1.z);
+
+                data.n2X_n2Y = Packed::sf2_to_h2(n2.x, n2.y);
+                data.n2Z_t0X = Packed::sf2_to_h2(n2.z, t0.x);
+                data.t0Y_t0Z = Packed::sf2_to_h2(t0.y, t0.z);
+                data.t1X_t1Y = Packed::sf2_to_h2(t1.x, t1.y);
+
+                data.t1Z_t2X = Packed::sf2_to_h2(t1.z, t2.x);
+                data.t2Y_t2Z = Packed::sf2_to_h2(t2.y, t2.z);
+                data.b0S_b1S = Packed::sf2_to_h2(t0.w, t1.w);
+                data.b2S_unused = Packed::sf2_to_h2(t2.w, 0.0f);
+            }
+        }
 
-        nri::ComputePipelineDesc pipelineDesc = {};
-        pipelineDesc.pipelineLayout = pipelineLayout;
-        pipelineDesc.computeShader = utils::LoadShader(m_DeviceDesc->graphicsAPI, "Temporal.cs", shaderCodeStorage);
+        m_IsSceneCached = false; // re-cached below, with packed "PrimitiveData"
+    }
 
-        NRI_ABORT_ON_FAILURE(NRI.CreateComputePipeline(*m_Device, pipelineDesc, pipeline));
-        m_Pipelines.push_back(pipeline);
+    // The compact layout doesn't need "PrimitiveData", it gets cached empty and a later run packs it if needed
+    if (!m_IsSceneCached)
+        SaveSceneCache(primitiveData);
+    m_CachedPrimitiveData = std::vector<PrimitiveData>();
+
+    // MaterialTextures (textures used by materials are streamed, the rest is uploaded right away)
+    std::vector<bool> isStreamed( m_Scene.textures.size(), false );
+    for (const utils::Material& material : m_Scene.materials)
+    {
+        isStreamed[material.diffuseMapIndex] = true;
+        isStreamed[material.specularMapIndex] = true;
+        isStreamed[material.normalMapIndex] = true;
+        isStreamed[material.emissiveMapIndex] = true;
     }
 
-    { // Pipeline::Upsample
-        const nri::DescriptorRangeDesc descriptorRanges[] =
-        {
-            { 0, 1, nri::DescriptorType::TEXTURE, nri::ShaderStage::ALL },
-            { 1, 1, nri::DescriptorType::STORAGE_TEXTURE, nri::ShaderStage::ALL }
-        };
+    m_TextureResidentMips.resize( m_Scene.textures.size(), 0 );
 
-        const nri::DescriptorSetDesc descriptorSetDesc[] =
+    uint32_t subresourceNum = 0;
+    for (const utils::Texture* texture : m_Scene.textures)
+        subresourceNum += texture->GetArraySize() * texture->GetMipNum();
+
+    std::vector<nri::TextureUploadDesc> textureData( m_Scene.textures.size() );
+    std::vector<nri::TextureSubresourceUploadDesc> subresources( subresourceNum );
+    uint32_t subresourceOffset = 0;
+
+    for (uint32_t i = 0; i < m_Scene.textures.size(); i++)
+    {
+        const utils::Texture* texture = m_Scene.textures[i];
+
+        nri::TextureUploadDesc& textureDataDesc = textureData[i];
+        textureDataDesc.texture = Get( (Texture)((uint32_t)Texture::MaterialTextures + i) );
+        textureDataDesc.nextLayout = nri::TextureLayout::SHADER_RESOURCE;
+        textureDataDesc.nextAccess = nri::AccessBits::SHADER_RESOURCE;
+
+        // Only a transition, mips come later from "StreamTextures"
+        if (isStreamed[i])
         {
-            { globalDescriptorRanges, helper::GetCountOf(globalDescriptorRanges), staticSamplersDesc, helper::GetCountOf(staticSamplersDesc) },
-            { descriptorRanges, helper::GetCountOf(descriptorRanges) },
-        };
+            m_TextureResidentMips[i] = (uint8_t)texture->GetMipNum();
+            m_StreamedTextures.push_back(i);
 
-        nri::PipelineLayoutDesc pipelineLayoutDesc = {};
-        pipelineLayoutDesc.descriptorSets = descriptorSetDesc;
-        pipelineLayoutDesc.descriptorSetNum = helper::GetCountOf(descriptorSetDesc);
-        pipelineLayoutDesc.stageMask = nri::PipelineLayoutShaderStageBits::COMPUTE;
+            continue;
+        }
 
-        NRI_ABORT_ON_FAILURE(NRI.CreatePipelineLayout(*m_Device, pipelineLayoutDesc, pipelineLayout));
-        m_PipelineLayouts.push_back(pipelineLayout);
+        for (uint32_t layer = 0; layer < texture->GetArraySize(); layer++)
+            for (uint32_t mip = 0; mip < texture->GetMipNum(); mip++)
+                texture->GetSubresource(subresources[subresourceOffset + layer * texture->GetMipNum() + mip], mip, layer);
 
-        nri::ComputePipelineDesc pipelineDesc = {};
-        pipelineDesc.pipelineLayout = pipelineLayout;
-        pipelineDesc.computeShader = utils::LoadShader(m_DeviceDesc->graphicsAPI, "Upsample.cs", shaderCodeStorage);
+        textureDataDesc.subresources = &subresources[subresourceOffset];
+        textureDataDesc.mipNum = texture->GetMipNum();
+        textureDataDesc.arraySize = texture->GetArraySize();
 
-        NRI_ABORT_ON_FAILURE(NRI.CreateComputePipeline(*m_Device, pipelineDesc, pipeline));
-        m_Pipelines.push_back(pipeline);
+        subresourceOffset += texture->GetArraySize() * texture->GetMipNum();
     }
 
-    { // Pipeline::PreDlss
-        const nri::DescriptorRangeDesc descriptorRanges[] =
-        {
-            { 0, 3, nri::DescriptorType::TEXTURE, nri::ShaderStage::ALL },
-            { 3, 3, nri::DescriptorType::STORAGE_TEXTURE, nri::ShaderStage::ALL }
-        };
+    for (const nri::TextureTransitionBarrierDesc& state : m_TextureStates)
+    {
+        nri::TextureUploadDesc desc = {};
+        desc.nextAccess = state.nextAccess;
+        desc.nextLayout = state.nextLayout;
+        desc.texture = (nri::Texture*)state.texture;
 
-        const nri::DescriptorSetDesc descriptorSetDesc[] =
-        {
-            { globalDescriptorRanges, helper::GetCountOf(globalDescriptorRanges), staticSamplersDesc, helper::GetCountOf(staticSamplersDesc) },
-            { descriptorRanges, helper::GetCountOf(descriptorRanges) },
-        };
+        textureData.push_back(desc);
+    }
 
-        nri::PipelineLayoutDesc pipelineLayoutDesc = {};
-        pipelineLayoutDesc.descriptorSets = descriptorSetDesc;
-        pipelineLayoutDesc.descriptorSetNum = helper::GetCountOf(descriptorSetDesc);
-        pipelineLayoutDesc.stageMask = nri::PipelineLayoutShaderStageBits::COMPUTE;
+    for (const DataTextureTwin& twin : m_DataTextureTwins)
+    {
+        nri::TextureUploadDesc desc = {};
+        desc.nextAccess = twin.state.nextAccess;
+        desc.nextLayout = twin.state.nextLayout;
+        desc.texture = twin.resource;
 
-        NRI_ABORT_ON_FAILURE(NRI.CreatePipelineLayout(*m_Device, pipelineLayoutDesc, pipelineLayout));
-        m_PipelineLayouts.push_back(pipelineLayout);
+        textureData.push_back(desc);
+    }
 
-        nri::ComputePipelineDesc pipelineDesc = {};
-        pipelineDesc.pipelineLayout = pipelineLayout;
-        pipelineDesc.computeShader = utils::LoadShader(m_DeviceDesc->graphicsAPI, "PreDlss.cs", shaderCodeStorage);
+    // Buffer data (ray bins must start from 0, then they are cleared on the GPU, mip feedback is tagged by frame and never cleared)
+    const std::vector<uint32_t> rayBins(2 * RAY_BIN_NUM, 0);
+    const uint32_t sampleSum = 0;
+    const std::vector<uint32_t> mipFeedback(m_Scene.materials.size(), 0);
+    const std::vector<uint32_t> qualityReference(m_IsQuality ? GetQualityReferenceSize() / sizeof(uint32_t) : 1, 0);
+    const std::vector<uint32_t> qualityMetrics(m_IsQuality ? m_QualityMetricsSize / sizeof(uint32_t) : 4, 0);
 
-        NRI_ABORT_ON_FAILURE(NRI.CreateComputePipeline(*m_Device, pipelineDesc, pipeline));
-        m_Pipelines.push_back(pipeline);
-    }
+    const void* primitiveDataPtr = m_IsCompactPrimitiveData ? (const void*)compactPrimitiveData.data() : (const void*)primitiveData.data();
+    const uint64_t primitiveDataSize = m_IsCompactPrimitiveData ? helper::GetByteSizeOf(compactPrimitiveData) : helper::GetByteSizeOf(primitiveData);
 
-    { // Pipeline::AfterDlss
-        const nri::DescriptorRangeDesc descriptorRanges[] =
-        {
-            { 0, 1, nri::DescriptorType::TEXTURE, nri::ShaderStage::ALL },
-            { 1, 1, nri::DescriptorType::STORAGE_TEXTURE, nri::ShaderStage::ALL }
-        };
+    nri::BufferUploadDesc dataDescArray[] =
+    {
+        { primitiveDataPtr, primitiveDataSize, Get(Buffer::PrimitiveData), 0, nri::AccessBits::SHADER_RESOURCE },
+        { indices.data(), helper::GetByteSizeOf(indices), Get(Buffer::Indices), 0, nri::AccessBits::SHADER_RESOURCE },
+        { vertexData.data(), helper::GetByteSizeOf(vertexData), Get(Buffer::VertexData), 0, nri::AccessBits::SHADER_RESOURCE },
+        { rayBins.data(), helper::GetByteSizeOf(rayBins), Get(Buffer::RayRecords), 0, nri::AccessBits::SHADER_RESOURCE_STORAGE },
+        { &sampleSum, sizeof(sampleSum), Get(Buffer::SampleSum), 0, SAMPLE_SUM_ACCESS },
+        { mipFeedback.data(), helper::GetByteSizeOf(mipFeedback), Get(Buffer::MipFeedback), 0, nri::AccessBits::COPY_SOURCE }, // the state after the readback copy
+        { qualityReference.data(), helper::GetByteSizeOf(qualityReference), Get(Buffer::QualityReference), 0, nri::AccessBits::SHADER_RESOURCE_STORAGE },
+        { qualityMetrics.data(), helper::GetByteSizeOf(qualityMetrics), Get(Buffer::QualityMetrics), 0, nri::AccessBits::SHADER_RESOURCE_STORAGE },
+    };
 
-        const nri::DescriptorSetDesc descriptorSetDesc[] =
-        {
-            { globalDescriptorRanges, helper::GetCountOf(globalDescriptorRanges), staticSamplersDesc, helper::GetCountOf(staticSamplersDesc) },
-            { descriptorRanges, helper::GetCountOf(descriptorRanges) },
-        };
+    NRI_ABORT_ON_FAILURE(NRI.UploadData(*m_CommandQueue, textureData.data(), helper::GetCountOf(textureData), dataDescArray, helper::GetCountOf(dataDescArray)));
 
-        nri::PipelineLayoutDesc pipelineLayoutDesc = {};
-        pipelineLayoutDesc.descriptorSets = descriptorSetDesc;
-        pipelineLayoutDesc.descriptorSetNum = helper::GetCountOf(descriptorSetDesc);
-        pipelineLayoutDesc.stageMask = nri::PipelineLayoutShaderStageBits::COMPUTE;
+    // Low mips of streamed textures, finer mips get streamed over the first frames (everything upfront with "--multiGpu", peers get copies)
+    const uint32_t mipSizeMax = m_PhysicalDeviceNum > 1 ? uint32_t(-1) : TEXTURE_STREAMING_INITIAL_MIP_SIZE;
 
-        NRI_ABORT_ON_FAILURE(NRI.CreatePipelineLayout(*m_Device, pipelineLayoutDesc, pipelineLayout));
-        m_PipelineLayouts.push_back(pipelineLayout);
+    nri::CommandAllocator* commandAllocator = nullptr;
+    NRI.CreateCommandAllocator(*m_CommandQueue, nri::WHOLE_DEVICE_GROUP, commandAllocator);
 
-        nri::ComputePipelineDesc pipelineDesc = {};
-        pipelineDesc.pipelineLayout = pipelineLayout;
-        pipelineDesc.computeShader = utils::LoadShader(m_DeviceDesc->graphicsAPI, "AfterDlss.cs", shaderCodeStorage);
+    nri::CommandBuffer* commandBuffer = nullptr;
+    NRI.CreateCommandBuffer(*commandAllocator, commandBuffer);
+
+    bool isUploaded = true;
+    while (isUploaded)
+    {
+        NRI.ResetCommandAllocator(*commandAllocator);
+        NRI.BeginCommandBuffer(*commandBuffer, nullptr, 0);
+        {
+            isUploaded = StreamTextures(*commandBuffer, 0, mipSizeMax);
+        }
+        NRI.EndCommandBuffer(*commandBuffer);
 
-        NRI_ABORT_ON_FAILURE(NRI.CreateComputePipeline(*m_Device, pipelineDesc, pipeline));
-        m_Pipelines.push_back(pipeline);
+        SubmitAndWait(*commandBuffer);
     }
 
-    // Raygen shaders
-    uint64_t shaderGroupOffset = 0;
-    m_ShaderEntries.push_back(shaderGroupOffset); shaderGroupOffset += m_DeviceDesc->rayTracingShaderGroupIdentifierSize; //ShaderGroup::Raytracing00_rgen
+    NRI.DestroyCommandBuffer(*commandBuffer);
+    NRI.DestroyCommandAllocator(*commandAllocator);
 
-    shaderGroupOffset = helper::GetAlignedSize(shaderGroupOffset, m_DeviceDesc->rayTracingShaderTableAligment);
-    m_ShaderEntries.push_back(shaderGroupOffset); shaderGroupOffset += m_DeviceDesc->rayTracingShaderGroupIdentifierSize; //ShaderGroup::Raytracing01_rgen
+    printf("Texture streaming: %.1f MB uploaded at startup, %u textures pending\n", m_StreamedTextureBytes / (1024.0 * 1024.0), helper::GetCountOf(m_StreamedTextures));
+}
 
-    shaderGroupOffset = helper::GetAlignedSize(shaderGroupOffset, m_DeviceDesc->rayTracingShaderTableAligment);
-    m_ShaderEntries.push_back(shaderGroupOffset); shaderGroupOffset += m_DeviceDesc->rayTracingShaderGroupIdentifierSize; //ShaderGroup::Raytracing10_rgen
+void Sample::CreateLightGeometry()
+{
+    // Scene geometry gets unloaded after the upload, "UpdateLightData" keeps its own copy of triangles of meshes which can emit:
+    // meshes with emissive materials and meshes of animated objects, which can get "forced emission" (see "SetupAnimatedObjects")
+    const uint32_t meshNum = helper::GetCountOf(m_Scene.meshes);
+    std::vector<bool> isLightMesh(meshNum, false);
 
-    shaderGroupOffset = helper::GetAlignedSize(shaderGroupOffset, m_DeviceDesc->rayTracingShaderTableAligment);
-    m_ShaderEntries.push_back(shaderGroupOffset); shaderGroupOffset += m_DeviceDesc->rayTracingShaderGroupIdentifierSize; //ShaderGroup::Raytracing11_rgen
+    for (size_t i = 0; i < m_Scene.instances.size(); i++)
+    {
+        const utils::Instance& instance = m_Scene.instances[i];
+        if (m_Scene.materials[instance.materialIndex].IsEmissive() || i < Min(m_DefaultInstancesOffset, ANIMATED_INSTANCE_MAX_NUM))
+            isLightMesh[instance.meshIndex] = true;
+    }
 
-    // Miss shaders
-    shaderGroupOffset = helper::GetAlignedSize(shaderGroupOffset, m_DeviceDesc->rayTracingShaderTableAligment);
-    m_ShaderEntries.push_back(shaderGroupOffset); shaderGroupOffset += m_DeviceDesc->rayTracingShaderGroupIdentifierSize; //ShaderGroup::Main_rmiss
+    m_LightMeshVertexOffsets.assign(meshNum, uint32_t(-1));
+    m_LightMeshVertices.clear();
 
-    // Hit shader groups
-    shaderGroupOffset = helper::GetAlignedSize(shaderGroupOffset, m_DeviceDesc->rayTracingShaderTableAligment);
-    m_ShaderEntries.push_back(shaderGroupOffset); shaderGroupOffset += m_DeviceDesc->rayTracingShaderGroupIdentifierSize; //ShaderGroup::Main_rhit
+    for (uint32_t meshIndex = 0; meshIndex < meshNum; meshIndex++)
+    {
+        if (!isLightMesh[meshIndex])
+            continue;
 
-    // Total size
-    m_ShaderEntries.push_back(shaderGroupOffset);
+        const utils::Mesh& mesh = m_Scene.meshes[meshIndex];
+        m_LightMeshVertexOffsets[meshIndex] = helper::GetCountOf(m_LightMeshVertices);
+
+        for (uint32_t i = 0; i < mesh.indexNum; i++)
+        {
+            const utils::UnpackedVertex& vertex = m_Scene.unpackedVertices[ mesh.vertexOffset + m_Scene.indices[mesh.indexOffset + i] ];
+            m_LightMeshVertices.push_back( float3(vertex.position[0], vertex.position[1], vertex.position[2]) );
+        }
+    }
+
+    m_LightTriangles.resize(3 * (size_t)m_LightTriangleMaxNum);
+    m_LightInstanceCaches.clear();
 }
 
-void Sample::CreateDescriptorSets()
+void Sample::ReplicateStaticData()
 {
-    nri::DescriptorSet* descriptorSet = nullptr;
+    // "--multiGpu": static data is uploaded to GPU 0 only, peers get peer-to-peer copies. Each GPU records its own barriers
+    const uint32_t textureNum = helper::GetCountOf(m_Scene.textures);
+    nri::Buffer* buffers[] = { Get(Buffer::PrimitiveData), Get(Buffer::Indices), Get(Buffer::VertexData) };
 
-    nri::DescriptorPoolDesc descriptorPoolDesc = {};
-    descriptorPoolDesc.descriptorSetMaxNum = 128;
-    descriptorPoolDesc.staticSamplerMaxNum = 3 * BUFFERED_FRAME_MAX_NUM;
-    descriptorPoolDesc.storageTextureMaxNum = 128;
-    descriptorPoolDesc.textureMaxNum = 128 + uint32_t(m_Scene.materials.size()) * TEXTURES_PER_MATERIAL;
-    descriptorPoolDesc.accelerationStructureMaxNum = 1 * BUFFERED_FRAME_MAX_NUM;
-    descriptorPoolDesc.bufferMaxNum = 16;
-    descriptorPoolDesc.constantBufferMaxNum = 1 * BUFFERED_FRAME_MAX_NUM;
-    NRI_ABORT_ON_FAILURE(NRI.CreateDescriptorPool(*m_Device, descriptorPoolDesc, m_DescriptorPool));
+    std::vector<nri::TextureTransitionBarrierDesc> textureTransitions(textureNum);
+    std::vector<nri::BufferTransitionBarrierDesc> bufferTransitions(helper::GetCountOf(buffers));
 
-    // Constant buffer
-    for (Frame& frame : m_Frames)
+    nri::TransitionBarrierDesc transitionBarriers = {};
+    transitionBarriers.textures = textureTransitions.data();
+    transitionBarriers.textureNum = textureNum;
+    transitionBarriers.buffers = bufferTransitions.data();
+    transitionBarriers.bufferNum = helper::GetCountOf(bufferTransitions);
+
+    const auto setTransitions = [&](nri::AccessBits prevAccess, nri::AccessBits nextAccess, nri::TextureLayout prevLayout, nri::TextureLayout nextLayout)
     {
-        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *GetPipelineLayout(Pipeline::Raytracing), 0, &frame.globalConstantBufferDescriptorSet, 1, nri::WHOLE_DEVICE_GROUP, 0));
+        for (uint32_t i = 0; i < textureNum; i++)
+            textureTransitions[i] = nri::TextureTransition(Get( (Texture)((uint32_t)Texture::MaterialTextures + i) ), prevAccess, nextAccess, prevLayout, nextLayout);
 
-        const nri::DescriptorRangeUpdateDesc descriptorRangeUpdateDesc[] =
-        {
-            { &frame.globalConstantBufferDescriptor, 1 },
-        };
+        for (uint32_t i = 0; i < helper::GetCountOf(buffers); i++)
+            bufferTransitions[i] = { buffers[i], prevAccess == nri::AccessBits::UNKNOWN ? nri::AccessBits::SHADER_RESOURCE : prevAccess, nextAccess };
+    };
 
-        NRI.UpdateDescriptorRanges(*frame.globalConstantBufferDescriptorSet, nri::WHOLE_DEVICE_GROUP, 0, helper::GetCountOf(descriptorRangeUpdateDesc), descriptorRangeUpdateDesc);
-    }
+    nri::CommandAllocator* commandAllocator = nullptr;
+    NRI.CreateCommandAllocator(*m_CommandQueue, nri::WHOLE_DEVICE_GROUP, commandAllocator);
 
-    { // DescriptorSet::IntegrateBRDF0
-        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *GetPipelineLayout(Pipeline::IntegrateBRDF), 0, &descriptorSet, 1, nri::WHOLE_DEVICE_GROUP, 0));
-        m_DescriptorSets.push_back(descriptorSet);
+    nri::CommandBuffer* commandBuffer = nullptr;
+    NRI.CreateCommandBuffer(*commandAllocator, commandBuffer);
 
-        const nri::Descriptor* storageTextures[] =
+    for (uint32_t physicalDeviceIndex = 0; physicalDeviceIndex < m_PhysicalDeviceNum; physicalDeviceIndex++)
+    {
+        NRI.ResetCommandAllocator(*commandAllocator);
+        NRI.BeginCommandBuffer(*commandBuffer, nullptr, physicalDeviceIndex);
         {
-            Get(Descriptor::IntegrateBRDF_StorageTexture),
-        };
+            if (physicalDeviceIndex == 0)
+                setTransitions(nri::AccessBits::SHADER_RESOURCE, nri::AccessBits::COPY_SOURCE, nri::TextureLayout::SHADER_RESOURCE, nri::TextureLayout::GENERAL);
+            else
+                setTransitions(nri::AccessBits::UNKNOWN, nri::AccessBits::COPY_DESTINATION, nri::TextureLayout::UNKNOWN, nri::TextureLayout::GENERAL);
 
-        const nri::DescriptorRangeUpdateDesc descriptorRangeUpdateDesc[] =
-        {
-            { storageTextures, helper::GetCountOf(storageTextures) },
-        };
+            NRI.CmdPipelineBarrier(*commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
+        }
+        NRI.EndCommandBuffer(*commandBuffer);
 
-        NRI.UpdateDescriptorRanges(*descriptorSet, nri::WHOLE_DEVICE_GROUP, 0, helper::GetCountOf(descriptorRangeUpdateDesc), descriptorRangeUpdateDesc);
+        SubmitAndWait(*commandBuffer, physicalDeviceIndex);
     }
 
-    { // DescriptorSet::Raytracing2
-        std::vector<nri::Descriptor*> textures(m_Scene.materials.size() * TEXTURES_PER_MATERIAL);
-        for (size_t i = 0; i < m_Scene.materials.size(); i++)
+    NRI.ResetCommandAllocator(*commandAllocator);
+    NRI.BeginCommandBuffer(*commandBuffer, nullptr, 0);
+    {
+        for (uint32_t physicalDeviceIndex = 1; physicalDeviceIndex < m_PhysicalDeviceNum; physicalDeviceIndex++)
         {
-            const uint32_t index = uint32_t(i) * TEXTURES_PER_MATERIAL;
-            const utils::Material& material = m_Scene.materials[i];
+            for (nri::Buffer* buffer : buffers)
+                NRI.CmdCopyBuffer(*commandBuffer, *buffer, physicalDeviceIndex, 0, *buffer, 0, 0, nri::WHOLE_SIZE);
 
-            textures[index] = Get( Descriptor((uint32_t)Descriptor::MaterialTextures + material.diffuseMapIndex) );
-            textures[index + 1] = Get( Descriptor((uint32_t)Descriptor::MaterialTextures + material.specularMapIndex) );
-            textures[index + 2] = Get( Descriptor((uint32_t)Descriptor::MaterialTextures + material.normalMapIndex) );
-            textures[index + 3] = Get( Descriptor((uint32_t)Descriptor::MaterialTextures + material.emissiveMapIndex) );
+            for (uint32_t i = 0; i < textureNum; i++)
+            {
+                nri::Texture* texture = Get( (Texture)((uint32_t)Texture::MaterialTextures + i) );
+                NRI.CmdCopyTexture(*commandBuffer, *texture, physicalDeviceIndex, nullptr, *texture, 0, nullptr);
+            }
         }
+    }
+    NRI.EndCommandBuffer(*commandBuffer);
 
-        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *GetPipelineLayout(Pipeline::Raytracing), 2, &descriptorSet, 1, nri::WHOLE_DEVICE_GROUP, helper::GetCountOf(textures)));
-        m_DescriptorSets.push_back(descriptorSet);
+    SubmitAndWait(*commandBuffer);
 
-        const nri::Descriptor* buffers[] =
+    for (uint32_t physicalDeviceIndex = 0; physicalDeviceIndex < m_PhysicalDeviceNum; physicalDeviceIndex++)
+    {
+        NRI.ResetCommandAllocator(*commandAllocator);
+        NRI.BeginCommandBuffer(*commandBuffer, nullptr, physicalDeviceIndex);
         {
-            Get(Descriptor::PrimitiveData_Buffer),
-            Get(Descriptor::InstanceData_Buffer)
-        };
+            if (physicalDeviceIndex == 0)
+                setTransitions(nri::AccessBits::COPY_SOURCE, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::GENERAL, nri::TextureLayout::SHADER_RESOURCE);
+            else
+                setTransitions(nri::AccessBits::COPY_DESTINATION, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::GENERAL, nri::TextureLayout::SHADER_RESOURCE);
 
-        const nri::Descriptor* accelerationStructures[] =
-        {
-            Get(Descriptor::World_AccelerationStructure),
-            Get(Descriptor::Light_AccelerationStructure)
-        };
+            NRI.CmdPipelineBarrier(*commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
+        }
+        NRI.EndCommandBuffer(*commandBuffer);
 
-        const nri::DescriptorRangeUpdateDesc descriptorRangeUpdateDesc[] =
-        {
-            { accelerationStructures, helper::GetCountOf(accelerationStructures) },
-            { buffers, helper::GetCountOf(buffers) },
-            { textures.data(), helper::GetCountOf(textures) }
-        };
-        NRI.UpdateDescriptorRanges(*descriptorSet, nri::WHOLE_DEVICE_GROUP, 0, helper::GetCountOf(descriptorRangeUpdateDesc), descriptorRangeUpdateDesc);
+        SubmitAndWait(*commandBuffer, physicalDeviceIndex);
     }
 
-    { // DescriptorSet::Raytracing1
-        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *GetPipelineLayout(Pipeline::Raytracing), 1, &descriptorSet, 1, nri::WHOLE_DEVICE_GROUP, 0));
-        m_DescriptorSets.push_back(descriptorSet);
+    NRI.DestroyCommandBuffer(*commandBuffer);
+    NRI.DestroyCommandAllocator(*commandAllocator);
 
-        const nri::Descriptor* textures[] =
-        {
-            Get( Descriptor((uint32_t)Descriptor::MaterialTextures + utils::StaticTexture::ScramblingRanking1spp) ),
-            Get( Descriptor((uint32_t)Descriptor::MaterialTextures + utils::StaticTexture::ScramblingRanking32spp) ),
-            Get( Descriptor((uint32_t)Descriptor::MaterialTextures + utils::StaticTexture::SobolSequence) ),
-            Get(Descriptor::IntegrateBRDF_Texture),
-            Get(Descriptor::ComposedLighting_ViewZ_Texture),
-        };
+    printf("Multi-GPU: static data replicated to %u peer GPUs\n", m_PhysicalDeviceNum - 1);
+}
 
-        const nri::Descriptor* storageTextures[] =
-        {
-            Get(Descriptor::DirectLighting_StorageTexture),
-            Get(Descriptor::TransparentLighting_StorageTexture),
-            Get(Descriptor::ObjectMotion_StorageTexture),
-            Get(Descriptor::ViewZ_StorageTexture),
-            Get(Descriptor::Normal_Roughness_StorageTexture),
-            Get(Descriptor::BaseColor_Metalness_StorageTexture),
-            Get(Descriptor::Unfiltered_ShadowData_StorageTexture),
-            Get(Descriptor::Unfiltered_Shadow_Translucency_StorageTexture),
-            Get(Descriptor::Unfiltered_Diff_StorageTexture),
-            Get(Descriptor::DiffDirectionPdf_StorageTexture),
-            Get(Descriptor::Unfiltered_Spec_StorageTexture),
-            Get(Descriptor::SpecDirectionPdf_StorageTexture),
-        };
+bool Sample::StreamTextures(nri::CommandBuffer& commandBuffer, uint32_t bufferedFrameIndex, uint32_t mipSizeMax)
+{
+    struct StreamedMip
+    {
+        uint32_t textureIndex;
+        uint32_t mip;
+        uint64_t stagingOffset;
+        uint32_t rowPitch;
+        uint32_t slicePitch;
+    };
 
-        const nri::DescriptorRangeUpdateDesc descriptorRangeUpdateDesc[] =
+    std::array<StreamedMip, TEXTURE_STREAMING_MIP_MAX_NUM> streamedMips;
+    uint32_t streamedMipNum = 0;
+    uint64_t stagingSize = 0;
+
+    // Coarse to fine: the next finer mip of each texture is taken only if it's not larger than the current mip size. The size grows when
+    // everything up to it is resident, which doesn't let big textures starve the rest
+    while (streamedMipNum == 0 && !m_StreamedTextures.empty())
+    {
+        for (uint32_t textureIndex : m_StreamedTextures)
         {
-            { textures, helper::GetCountOf(textures) },
-            { storageTextures, helper::GetCountOf(storageTextures) },
-        };
+            const utils::Texture* texture = m_Scene.textures[textureIndex];
+            const uint32_t mip = m_TextureResidentMips[textureIndex] - 1;
 
-        NRI.UpdateDescriptorRanges(*descriptorSet, nri::WHOLE_DEVICE_GROUP, 0, helper::GetCountOf(descriptorRangeUpdateDesc), descriptorRangeUpdateDesc);
-    }
+            // The smallest mip always goes first, otherwise a texture with a short mip chain can't be sampled at all
+            const uint32_t mipDim = uint32_t(Max(texture->GetWidth(), texture->GetHeight())) >> mip;
+            if (mipDim > m_TextureStreamingMipSize && mip + 1 != texture->GetMipNum())
+                continue;
 
-    { // DescriptorSet::Composition1
-        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *GetPipelineLayout(Pipeline::Composition), 1, &descriptorSet, 1, nri::WHOLE_DEVICE_GROUP, 0));
-        m_DescriptorSets.push_back(descriptorSet);
+            const uint64_t mipSize = GetStagedMipSize(*texture, mip);
+            if (stagingSize + mipSize > m_TextureStreamingStagingSize)
+                break;
 
-        const nri::Descriptor* textures[] =
-        {
-            Get(Descriptor::ViewZ_Texture),
-            Get(Descriptor::DirectLighting_Texture),
-            Get(Descriptor::Normal_Roughness_Texture),
-            Get(Descriptor::BaseColor_Metalness_Texture),
-            Get(Descriptor::Shadow_Texture),
-            Get(Descriptor::Diff_Texture),
-            Get(Descriptor::Spec_Texture),
-            Get(Descriptor::IntegrateBRDF_Texture),
-        };
+            streamedMips[streamedMipNum++] = {textureIndex, mip, stagingSize, 0, 0};
+            stagingSize += mipSize;
 
-        const nri::Descriptor* storageTextures[] =
-        {
-            Get(Descriptor::ComposedLighting_ViewZ_StorageTexture),
-        };
+            if (streamedMipNum == TEXTURE_STREAMING_MIP_MAX_NUM)
+                break;
+        }
 
-        const nri::DescriptorRangeUpdateDesc descriptorRangeUpdateDesc[] =
+        if (streamedMipNum == 0)
         {
-            { textures, helper::GetCountOf(textures) },
-            { storageTextures, helper::GetCountOf(storageTextures) },
-        };
+            if (m_TextureStreamingMipSize >= mipSizeMax)
+                break;
 
-        NRI.UpdateDescriptorRanges(*descriptorSet, nri::WHOLE_DEVICE_GROUP, 0, helper::GetCountOf(descriptorRangeUpdateDesc), descriptorRangeUpdateDesc);
+            m_TextureStreamingMipSize <<= 1;
+        }
     }
 
-    { // DescriptorSet::Temporal1a
-        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *GetPipelineLayout(Pipeline::Temporal), 1, &descriptorSet, 1, nri::WHOLE_DEVICE_GROUP, 0));
-        m_DescriptorSets.push_back(descriptorSet);
+    if (streamedMipNum == 0)
+        return false;
 
-        const nri::Descriptor* textures[] =
-        {
-            Get(Descriptor::ObjectMotion_Texture),
-            Get(Descriptor::ComposedLighting_ViewZ_Texture),
-            Get(Descriptor::TransparentLighting_Texture),
-            Get(Descriptor::TaaHistoryPrev_Texture),
-        };
+    // Staging
+    const uint64_t frameStagingOffset = m_TextureStreamingStagingSize * bufferedFrameIndex;
+    uint8_t* staging = (uint8_t*)NRI.MapBuffer(*Get(Buffer::TextureStreamingStaging), frameStagingOffset, m_TextureStreamingStagingSize);
 
-        const nri::Descriptor* storageTextures[] =
-        {
-            Get(Descriptor::TaaHistory_StorageTexture),
-        };
+    std::array<nri::TextureTransitionBarrierDesc, TEXTURE_STREAMING_MIP_MAX_NUM> transitions;
+    for (uint32_t i = 0; i < streamedMipNum; i++)
+    {
+        StreamedMip& streamedMip = streamedMips[i];
+        const utils::Texture* texture = m_Scene.textures[streamedMip.textureIndex];
+        nri::Texture* dstTexture = Get( (Texture)((uint32_t)Texture::MaterialTextures + streamedMip.textureIndex) );
 
-        const nri::DescriptorRangeUpdateDesc descriptorRangeUpdateDesc[] =
+        uint8_t* dst = staging + streamedMip.stagingOffset;
+        for (uint32_t layer = 0; layer < texture->GetArraySize(); layer++)
         {
-            { textures, helper::GetCountOf(textures) },
-            { storageTextures, helper::GetCountOf(storageTextures) },
-        };
+            nri::TextureSubresourceUploadDesc subresource = {};
+            texture->GetSubresource(subresource, streamedMip.mip, layer);
 
-        NRI.UpdateDescriptorRanges(*descriptorSet, nri::WHOLE_DEVICE_GROUP, 0, helper::GetCountOf(descriptorRangeUpdateDesc), descriptorRangeUpdateDesc);
+            const uint32_t rowNum = subresource.slicePitch / subresource.rowPitch;
+            const uint64_t rowPitch = helper::GetAlignedSize((uint64_t)subresource.rowPitch, m_DeviceDesc->uploadBufferTextureRowAlignment);
+            const uint64_t slicePitch = helper::GetAlignedSize(rowPitch * rowNum, m_DeviceDesc->uploadBufferTextureSliceAlignment);
+            streamedMip.rowPitch = (uint32_t)rowPitch;
+            streamedMip.slicePitch = (uint32_t)slicePitch;
+
+            // Material textures are 2D, i.e. a single slice per layer
+            const uint8_t* src = (const uint8_t*)subresource.slices;
+            for (uint32_t row = 0; row < rowNum; row++)
+                memcpy(dst + row * rowPitch, src + row * subresource.rowPitch, subresource.rowPitch);
+
+            dst += slicePitch;
+        }
+
+        const nri::TextureTransitionBarrierDesc shaderResourceState = nri::TextureTransition(dstTexture, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE);
+        const uint32_t dstMip = streamedMip.mip - m_ResidentTextures[streamedMip.textureIndex].mipOffset;
+        transitions[i] = nri::TextureTransition(shaderResourceState, nri::AccessBits::COPY_DESTINATION, nri::TextureLayout::GENERAL, (uint16_t)dstMip, 1);
     }
 
-    { // DescriptorSet::Temporal1b
-        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *GetPipelineLayout(Pipeline::Temporal), 1, &descriptorSet, 1, nri::WHOLE_DEVICE_GROUP, 0));
-        m_DescriptorSets.push_back(descriptorSet);
+    NRI.UnmapBuffer(*Get(Buffer::TextureStreamingStaging));
 
-        const nri::Descriptor* textures[] =
-        {
-            Get(Descriptor::ObjectMotion_Texture),
-            Get(Descriptor::ComposedLighting_ViewZ_Texture),
-            Get(Descriptor::TransparentLighting_Texture),
-            Get(Descriptor::TaaHistory_Texture),
-        };
+    // Copy
+    nri::TransitionBarrierDesc transitionBarriers = {};
+    transitionBarriers.textures = transitions.data();
+    transitionBarriers.textureNum = streamedMipNum;
+    NRI.CmdPipelineBarrier(commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
 
-        const nri::Descriptor* storageTextures[] =
-        {
-            Get(Descriptor::TaaHistoryPrev_StorageTexture),
-        };
+    for (uint32_t i = 0; i < streamedMipNum; i++)
+    {
+        const StreamedMip& streamedMip = streamedMips[i];
+        const utils::Texture* texture = m_Scene.textures[streamedMip.textureIndex];
+        nri::Texture* dstTexture = Get( (Texture)((uint32_t)Texture::MaterialTextures + streamedMip.textureIndex) );
 
-        const nri::DescriptorRangeUpdateDesc descriptorRangeUpdateDesc[] =
+        const uint32_t dstMip = streamedMip.mip - m_ResidentTextures[streamedMip.textureIndex].mipOffset;
+
+        uint64_t stagingOffset = frameStagingOffset + streamedMip.stagingOffset;
+        for (uint32_t layer = 0; layer < texture->GetArraySize(); layer++)
         {
-            { textures, helper::GetCountOf(textures) },
-            { storageTextures, helper::GetCountOf(storageTextures) },
-        };
+            nri::TextureRegionDesc dstRegion = {};
+            dstRegion.size[0] = (uint16_t)Max(texture->GetWidth() >> streamedMip.mip, 1);
+            dstRegion.size[1] = (uint16_t)Max(texture->GetHeight() >> streamedMip.mip, 1);
+            dstRegion.size[2] = 1;
+            dstRegion.mipOffset = (uint16_t)dstMip;
+            dstRegion.arrayOffset = (uint16_t)layer;
 
-        NRI.UpdateDescriptorRanges(*descriptorSet, nri::WHOLE_DEVICE_GROUP, 0, helper::GetCountOf(descriptorRangeUpdateDesc), descriptorRangeUpdateDesc);
+            nri::TextureDataLayoutDesc srcLayout = {};
+            srcLayout.offset = stagingOffset;
+            srcLayout.rowPitch = streamedMip.rowPitch;
+            srcLayout.slicePitch = streamedMip.slicePitch;
+
+            NRI.CmdUploadBufferToTexture(commandBuffer, *dstTexture, dstRegion, *Get(Buffer::TextureStreamingStaging), srcLayout);
+
+            stagingOffset += streamedMip.slicePitch;
+        }
+
+        transitions[i] = nri::TextureTransition(transitions[i], nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE, (uint16_t)dstMip, 1);
+        m_TextureResidentMips[streamedMip.textureIndex] = (uint8_t)streamedMip.mip;
     }
 
-    { // DescriptorSet::Upsample1a
-        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *GetPipelineLayout(Pipeline::Upsample), 1, &descriptorSet, 1, nri::WHOLE_DEVICE_GROUP, 0));
-        m_DescriptorSets.push_back(descriptorSet);
+    NRI.CmdPipelineBarrier(commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
 
-        const nri::Descriptor* textures[] =
-        {
-            Get(Descriptor::TaaHistory_Texture),
-        };
+    // Retire fully resident textures
+    m_StreamedTextures.erase(std::remove_if(m_StreamedTextures.begin(), m_StreamedTextures.end(), [this](uint32_t textureIndex)
+        { return m_TextureResidentMips[textureIndex] <= m_ResidentTextures[textureIndex].mipOffset; }), m_StreamedTextures.end());
 
-        const nri::Descriptor* storageTextures[] =
-        {
-            Get(Descriptor::Final_StorageTexture),
-        };
+    m_StreamedTextureBytes += stagingSize;
 
-        const nri::DescriptorRangeUpdateDesc descriptorRangeUpdateDesc[] =
-        {
-            { textures, helper::GetCountOf(textures) },
-            { storageTextures, helper::GetCountOf(storageTextures) },
-        };
+    return true;
+}
 
-        NRI.UpdateDescriptorRanges(*descriptorSet, nri::WHOLE_DEVICE_GROUP, 0, helper::GetCountOf(descriptorRangeUpdateDesc), descriptorRangeUpdateDesc);
-    }
+void Sample::UpdateTextureResidency(nri::CommandBuffer& commandBuffer, uint32_t frameIndex)
+{
+    if (!m_IsTextureResidency)
+        return;
 
-    { // DescriptorSet::Upsample1b
-        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *GetPipelineLayout(Pipeline::Upsample), 1, &descriptorSet, 1, nri::WHOLE_DEVICE_GROUP, 0));
-        m_DescriptorSets.push_back(descriptorSet);
+    // Frames in flight are done with allocations retired "m_FrameInFlightNum" frames ago
+    m_RetiredTextures.erase(std::remove_if(m_RetiredTextures.begin(), m_RetiredTextures.end(), [this, frameIndex](const RetiredTexture& retiredTexture)
+    {
+        if (frameIndex < retiredTexture.frameIndex + m_FrameInFlightNum)
+            return false;
 
-        const nri::Descriptor* textures[] =
-        {
-            Get(Descriptor::TaaHistoryPrev_Texture),
-        };
+        NRI.DestroyDescriptor(*retiredTexture.descriptor);
+        NRI.DestroyTexture(*retiredTexture.texture);
+        NRI.FreeMemory(*retiredTexture.memory);
 
-        const nri::Descriptor* storageTextures[] =
-        {
-            Get(Descriptor::Final_StorageTexture),
-        };
+        return true;
+    }), m_RetiredTextures.end());
 
-        const nri::DescriptorRangeUpdateDesc descriptorRangeUpdateDesc[] =
-        {
-            { textures, helper::GetCountOf(textures) },
-            { storageTextures, helper::GetCountOf(storageTextures) },
-        };
+    if (frameIndex >= m_TextureResidencyUpdateFrame + TEXTURE_RESIDENCY_UPDATE_PERIOD)
+        ReallocateResidentTextures(commandBuffer, frameIndex);
 
-        NRI.UpdateDescriptorRanges(*descriptorSet, nri::WHOLE_DEVICE_GROUP, 0, helper::GetCountOf(descriptorRangeUpdateDesc), descriptorRangeUpdateDesc);
+    // The descriptor set of this frame is not in use anymore, the others get updated when their frames come
+    const uint32_t bufferedFrameIndex = frameIndex % m_FrameInFlightNum;
+    if (m_MaterialViewsDirtyMask & (1 << bufferedFrameIndex))
+    {
+        std::vector<nri::Descriptor*> textures;
+        GetMaterialTextureDescriptors(textures);
+
+        const nri::DescriptorRangeUpdateDesc descriptorRangeUpdateDesc = { textures.data(), helper::GetCountOf(textures) };
+        NRI.UpdateDescriptorRanges(*m_Frames[bufferedFrameIndex].raytracing2DescriptorSet, nri::WHOLE_DEVICE_GROUP, 2, 1, &descriptorRangeUpdateDesc);
+
+        m_MaterialViewsDirtyMask &= ~(1 << bufferedFrameIndex);
     }
+}
 
-    { // DescriptorSet::PreDlss1
-        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *GetPipelineLayout(Pipeline::PreDlss), 1, &descriptorSet, 1, nri::WHOLE_DEVICE_GROUP, 0));
-        m_DescriptorSets.push_back(descriptorSet);
+void Sample::ReallocateResidentTextures(nri::CommandBuffer& commandBuffer, uint32_t frameIndex)
+{
+    m_TextureResidencyUpdateFrame = frameIndex;
 
-        const nri::Descriptor* textures[] =
-        {
-            Get(Descriptor::ObjectMotion_Texture),
-            Get(Descriptor::TransparentLighting_Texture),
-            Get(Descriptor::ComposedLighting_ViewZ_Texture),
-        };
+    // Requested mips make an allocation grow right away. Shrinking keeps a mip finer than requested to avoid ping-ponging at mip boundaries,
+    // textures not sampled for a while shrink to the minimal size
+    std::vector<uint8_t> mipOffsets(m_ResidentTextures.size());
+    uint64_t residentSize = 0;
+    for (uint32_t i = 0; i < m_ResidentTextures.size(); i++)
+    {
+        ResidentTexture& residentTexture = m_ResidentTextures[i];
+        uint32_t mipOffset = residentTexture.mipOffset;
 
-        const nri::Descriptor* storageTextures[] =
+        if (residentTexture.isManaged)
         {
-            Get(Descriptor::ViewZ_StorageTexture),
-            Get(Descriptor::Unfiltered_ShadowData_StorageTexture),
-            Get(Descriptor::Unfiltered_Diff_StorageTexture),
-        };
+            if (residentTexture.requestedMip != TEXTURE_RESIDENCY_NOT_REQUESTED)
+            {
+                const uint32_t requestedMip = Min((uint32_t)residentTexture.requestedMip, (uint32_t)residentTexture.mipOffsetMax);
+                if (requestedMip < mipOffset)
+                    mipOffset = requestedMip;
+                else if (requestedMip > mipOffset + 1)
+                    mipOffset = requestedMip - 1;
+            }
+            else if (frameIndex - residentTexture.lastRequestFrame > TEXTURE_RESIDENCY_EVICTION_FRAMES)
+                mipOffset = residentTexture.mipOffsetMax;
 
-        const nri::DescriptorRangeUpdateDesc descriptorRangeUpdateDesc[] =
-        {
-            { textures, helper::GetCountOf(textures) },
-            { storageTextures, helper::GetCountOf(storageTextures) },
-        };
+            residentTexture.requestedMip = TEXTURE_RESIDENCY_NOT_REQUESTED;
+            residentSize += GetResidentTextureSize(*m_Scene.textures[i], mipOffset);
+        }
 
-        NRI.UpdateDescriptorRanges(*descriptorSet, nri::WHOLE_DEVICE_GROUP, 0, helper::GetCountOf(descriptorRangeUpdateDesc), descriptorRangeUpdateDesc);
+        mipOffsets[i] = (uint8_t)mipOffset;
     }
 
-    { // DescriptorSet::AfterDlss1
-        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *GetPipelineLayout(Pipeline::AfterDlss), 1, &descriptorSet, 1, nri::WHOLE_DEVICE_GROUP, 0));
-        m_DescriptorSets.push_back(descriptorSet);
-
-        const nri::Descriptor* textures[] =
+    // Over budget: the largest top mip goes first, until everything fits or all textures are minimal
+    const uint64_t budget = uint64_t(m_TextureBudget) * 1024 * 1024;
+    while (budget && residentSize > budget)
+    {
+        uint32_t largestIndex = uint32_t(-1);
+        uint64_t largestSize = 0;
+        for (uint32_t i = 0; i < m_ResidentTextures.size(); i++)
         {
-            Get(Descriptor::TaaHistory_Texture),
-        };
+            if (!m_ResidentTextures[i].isManaged || mipOffsets[i] >= m_ResidentTextures[i].mipOffsetMax)
+                continue;
 
-        const nri::Descriptor* storageTextures[] =
-        {
-            Get(Descriptor::Final_StorageTexture),
-        };
+            const uint64_t topMipSize = GetStagedMipSize(*m_Scene.textures[i], mipOffsets[i]);
+            if (topMipSize > largestSize)
+            {
+                largestIndex = i;
+                largestSize = topMipSize;
+            }
+        }
 
-        const nri::DescriptorRangeUpdateDesc descriptorRangeUpdateDesc[] =
-        {
-            { textures, helper::GetCountOf(textures) },
-            { storageTextures, helper::GetCountOf(storageTextures) },
-        };
+        if (largestIndex == uint32_t(-1))
+            break;
 
-        NRI.UpdateDescriptorRanges(*descriptorSet, nri::WHOLE_DEVICE_GROUP, 0, helper::GetCountOf(descriptorRangeUpdateDesc), descriptorRangeUpdateDesc);
+        mipOffsets[largestIndex]++;
+        residentSize -= largestSize;
     }
-}
 
-void Sample::UploadStaticData()
-{
-    // PrimitiveData
-    std::vector<PrimitiveData> primitiveData( m_Scene.primitives.size() );
-    uint32_t n = 0;
-    for (const utils::Mesh& mesh : m_Scene.meshes)
+    uint32_t resizedNum = 0;
+    for (uint32_t i = 0; i < m_ResidentTextures.size(); i++)
+        resizedNum += mipOffsets[i] != m_ResidentTextures[i].mipOffset ? 1 : 0;
+
+    if (!resizedNum)
+        return;
+
+    // Copies go into the frame, the queue orders them after the frames in flight still sampling the old allocations
+    for (uint32_t i = 0; i < m_ResidentTextures.size(); i++)
     {
-        uint32_t triangleNum = mesh.indexNum / 3;
-        for (uint32_t j = 0; j < triangleNum; j++)
-        {
-            uint32_t primitiveIndex = mesh.indexOffset / 3 + j;
-            const utils::Primitive& primitive = m_Scene.primitives[primitiveIndex];
+        if (mipOffsets[i] != m_ResidentTextures[i].mipOffset)
+            ResizeResidentTexture(commandBuffer, i, mipOffsets[i], frameIndex);
+    }
 
-            const utils::UnpackedVertex& v0 = m_Scene.unpackedVertices[ mesh.vertexOffset + m_Scene.indices[primitiveIndex * 3] ];
-            const utils::UnpackedVertex& v1 = m_Scene.unpackedVertices[ mesh.vertexOffset + m_Scene.indices[primitiveIndex * 3 + 1] ];
-            const utils::UnpackedVertex& v2 = m_Scene.unpackedVertices[ mesh.vertexOffset + m_Scene.indices[primitiveIndex * 3 + 2] ];
+    // New views go into the bindless ranges of all frames, resident mips relative to new allocations - into "InstanceData"
+    m_MaterialViewsDirtyMask = (1 << m_FrameInFlightNum) - 1;
+    m_IsStaticInstancesDirty = true;
 
-            float3 n0 = float3(v0.normal);
-            float3 n1 = float3(v1.normal);
-            float3 n2 = float3(v2.normal);
-            float4 t0 = float4(v0.tangent);
-            float4 t1 = float4(v1.tangent);
-            float4 t2 = float4(v2.tangent);
+    printf("Texture residency: %u textures reallocated at frame %u, %.1f MB of material textures\n", resizedNum, frameIndex,
+        m_MemoryCategorySizes[(uint32_t)MemoryCategory::MaterialTextures] / (1024.0 * 1024.0));
+}
 
-            float4 nfp = Packed::uint_to_uf4<10, 10, 10, 2>(primitive.normal);
-            float3 nf = Normalize(float3(nfp.xmm) * 2.0f - 1.0f);
+void Sample::ResizeResidentTexture(nri::CommandBuffer& commandBuffer, uint32_t textureIndex, uint32_t mipOffset, uint32_t frameIndex)
+{
+    const utils::Texture* textureData = m_Scene.textures[textureIndex];
+    ResidentTexture& residentTexture = m_ResidentTextures[textureIndex];
+    nri::Texture*& texture = Get( (Texture)((uint32_t)Texture::MaterialTextures + textureIndex) );
+    nri::Descriptor*& descriptor = Get( (Descriptor)((uint32_t)Descriptor::MaterialTextures + textureIndex) );
 
-            PrimitiveData& data = primitiveData[n++];
-            data.uv0 = Packed::sf2_to_h2(v0.uv[0], v0.uv[1]);
-            data.uv1 = Packed::sf2_to_h2(v1.uv[0], v1.uv[1]);
-            data.uv2 = Packed::sf2_to_h2(v2.uv[0], v2.uv[1]);
-            data.fnX_fnY = Packed::sf2_to_h2(nf.x, nf.y);
+    // A new texture with its own memory
+    nri::Texture* newTexture = nullptr;
+    const nri::CTextureDesc textureDesc = nri::CTextureDesc::Texture2D(textureData->GetFormat(), (uint16_t)Max(textureData->GetWidth() >> mipOffset, 1), (uint16_t)Max(textureData->GetHeight() >> mipOffset, 1),
+        uint16_t(textureData->GetMipNum() - mipOffset), textureData->GetArraySize(), nri::TextureUsageBits::SHADER_RESOURCE);
+    NRI_ABORT_ON_FAILURE(NRI.CreateTexture(*m_Device, textureDesc, newTexture));
 
-            data.fnZ_worldToUvUnits = Packed::sf2_to_h2(nf.z, primitive.worldToUvUnits);
-            data.n0X_n0Y = Packed::sf2_to_h2(n0.x, n0.y);
-            data.n0Z_n1X = Packed::sf2_to_h2(n0.z, n1.x);
-            data.n1Y_n1Z = Packed::sf2_to_h2(n1.y, n1.z);
+    nri::MemoryDesc memoryDesc = {};
+    NRI.GetTextureMemoryInfo(*newTexture, nri::MemoryLocation::DEVICE, memoryDesc);
 
-            data.n2X_n2Y = Packed::sf2_to_h2(n2.x, n2.y);
-            data.n2Z_t0X = Packed::sf2_to_h2(n2.z, t0.x);
-            data.t0Y_t0Z = Packed::sf2_to_h2(t0.y, t0.z);
-            data.t1X_t1Y = Packed::sf2_to_h2(t1.x, t1.y);
+    nri::Memory* memory = nullptr;
+    NRI_ABORT_ON_FAILURE(NRI.AllocateMemory(*m_Device, nri::WHOLE_DEVICE_GROUP, memoryDesc.type, memoryDesc.size, memory));
 
-            data.t1Z_t2X = Packed::sf2_to_h2(t1.z, t2.x);
-            data.t2Y_t2Z = Packed::sf2_to_h2(t2.y, t2.z);
-            data.b0S_b1S = Packed::sf2_to_h2(t0.w, t1.w);
-            data.b2S_unused = Packed::sf2_to_h2(t2.w, 0.0f);
-        }
-    }
+    const nri::TextureMemoryBindingDesc binding = {memory, newTexture, 0};
+    NRI_ABORT_ON_FAILURE(NRI.BindTextureMemory(*m_Device, &binding, 1));
 
-    // MaterialTextures
-    uint32_t subresourceNum = 0;
-    for (const utils::Texture* texture : m_Scene.textures)
-        subresourceNum += texture->GetArraySize() * texture->GetMipNum();
+    nri::Descriptor* newDescriptor = nullptr;
+    const nri::Texture2DViewDesc viewDesc = {newTexture, textureData->GetArraySize() > 1 ? nri::Texture2DViewType::SHADER_RESOURCE_2D_ARRAY : nri::Texture2DViewType::SHADER_RESOURCE_2D, textureData->GetFormat()};
+    NRI_ABORT_ON_FAILURE(NRI.CreateTexture2DView(viewDesc, newDescriptor));
 
-    std::vector<nri::TextureUploadDesc> textureData( m_Scene.textures.size() );
-    std::vector<nri::TextureSubresourceUploadDesc> subresources( subresourceNum );
-    uint32_t subresourceOffset = 0;
+    // Mips resident in both get copied, finer ones (if the texture grows) get streamed later
+    const uint32_t residentMip = Max((uint32_t)m_TextureResidentMips[textureIndex], mipOffset);
+
+    nri::TextureTransitionBarrierDesc transitions[] =
+    {
+        nri::TextureTransition(newTexture, nri::AccessBits::UNKNOWN, nri::AccessBits::COPY_DESTINATION, nri::TextureLayout::UNKNOWN, nri::TextureLayout::GENERAL),
+        nri::TextureTransition(texture, nri::AccessBits::SHADER_RESOURCE, nri::AccessBits::COPY_SOURCE, nri::TextureLayout::SHADER_RESOURCE, nri::TextureLayout::GENERAL),
+    };
 
-    nri::TextureUploadDesc* textureDataDesc = textureData.data();
-    for (const utils::Texture* texture : m_Scene.textures)
+    nri::TransitionBarrierDesc transitionBarriers = {};
+    transitionBarriers.textures = transitions;
+    transitionBarriers.textureNum = helper::GetCountOf(transitions);
+    NRI.CmdPipelineBarrier(commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
+
+    for (uint32_t mip = residentMip; mip < textureData->GetMipNum(); mip++)
     {
-        for (uint32_t layer = 0; layer < texture->GetArraySize(); layer++)
-            for (uint32_t mip = 0; mip < texture->GetMipNum(); mip++)
-                texture->GetSubresource(subresources[subresourceOffset + layer * texture->GetMipNum() + mip], mip, layer);
+        for (uint32_t layer = 0; layer < textureData->GetArraySize(); layer++)
+        {
+            nri::TextureRegionDesc srcRegion = {};
+            srcRegion.size[0] = (uint16_t)Max(textureData->GetWidth() >> mip, 1);
+            srcRegion.size[1] = (uint16_t)Max(textureData->GetHeight() >> mip, 1);
+            srcRegion.size[2] = 1;
+            srcRegion.mipOffset = uint16_t(mip - residentTexture.mipOffset);
+            srcRegion.arrayOffset = (uint16_t)layer;
 
-        textureDataDesc->subresources = &subresources[subresourceOffset];
-        textureDataDesc->mipNum = texture->GetMipNum();
-        textureDataDesc->arraySize = texture->GetArraySize();
-        textureDataDesc->texture = Get( (Texture)((uint32_t)Texture::MaterialTextures + textureDataDesc - textureData.data()) );
-        textureDataDesc->nextLayout = nri::TextureLayout::SHADER_RESOURCE;
-        textureDataDesc->nextAccess = nri::AccessBits::SHADER_RESOURCE;
-        textureDataDesc++;
+            nri::TextureRegionDesc dstRegion = srcRegion;
+            dstRegion.mipOffset = uint16_t(mip - mipOffset);
 
-        subresourceOffset += texture->GetArraySize() * texture->GetMipNum();
+            NRI.CmdCopyTexture(commandBuffer, *newTexture, 0, &dstRegion, *texture, 0, &srcRegion);
+        }
     }
 
-    for (const nri::TextureTransitionBarrierDesc& state : m_TextureStates)
-    {
-        nri::TextureUploadDesc desc = {};
-        desc.nextAccess = state.nextAccess;
-        desc.nextLayout = state.nextLayout;
-        desc.texture = (nri::Texture*)state.texture;
+    transitions[0] = nri::TextureTransition(newTexture, nri::AccessBits::COPY_DESTINATION, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::GENERAL, nri::TextureLayout::SHADER_RESOURCE);
+    transitionBarriers.textureNum = 1;
+    NRI.CmdPipelineBarrier(commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
 
-        textureData.push_back(desc);
-    }
+    // The old allocation lives until the copy and the frames in flight are done
+    m_RetiredTextures.push_back({texture, residentTexture.memory, descriptor, frameIndex});
 
-    // Buffer data
-    nri::BufferUploadDesc dataDescArray[] =
-    {
-        { primitiveData.data(), helper::GetByteSizeOf(primitiveData), Get(Buffer::PrimitiveData), 0, nri::AccessBits::SHADER_RESOURCE },
-    };
+    m_MemoryCategorySizes[(uint32_t)MemoryCategory::MaterialTextures] -= residentTexture.memorySize;
+    m_MemoryCategorySizes[(uint32_t)MemoryCategory::MaterialTextures] += memoryDesc.size;
 
-    NRI_ABORT_ON_FAILURE(NRI.UploadData(*m_CommandQueue, textureData.data(), helper::GetCountOf(textureData), dataDescArray, helper::GetCountOf(dataDescArray)));
+    texture = newTexture;
+    descriptor = newDescriptor;
+    residentTexture.memory = memory;
+    residentTexture.memorySize = memoryDesc.size;
+    residentTexture.mipOffset = (uint8_t)mipOffset;
+    m_TextureResidentMips[textureIndex] = (uint8_t)residentMip;
+
+    if (residentMip > mipOffset && std::find(m_StreamedTextures.begin(), m_StreamedTextures.end(), textureIndex) == m_StreamedTextures.end())
+        m_StreamedTextures.push_back(textureIndex);
 }
 
 void Sample::CreateBottomLevelAccelerationStructures()
 {
-    for (const utils::Mesh& mesh : m_Scene.meshes)
+    constexpr auto BLAS_BUILD_FLAGS = BUILD_FLAGS | nri::AccelerationStructureBuildBits::ALLOW_COMPACTION;
+
+    const uint32_t meshNum = helper::GetCountOf(m_Scene.meshes);
+
+    // Geometry of all meshes goes into a single upload buffer
+    std::vector<uint64_t> geometryOffsets(meshNum);
+    uint64_t geometrySize = 0;
+    for (uint32_t i = 0; i < meshNum; i++)
+    {
+        const utils::Mesh& mesh = m_Scene.meshes[i];
+        geometryOffsets[i] = geometrySize;
+        geometrySize += helper::GetAlignedSize(mesh.vertexNum * sizeof(utils::Vertex) + mesh.indexNum * sizeof(utils::Index), BLAS_GEOMETRY_ALIGNMENT);
+    }
+
+    nri::Buffer* geometryBuffer = nullptr;
+    nri::Memory* geometryMemory = nullptr;
+    CreateUploadBuffer(geometrySize, geometryBuffer, geometryMemory);
+
+    std::vector<nri::GeometryObject> geometryObjects(meshNum);
+    uint8_t* data = (uint8_t*)NRI.MapBuffer(*geometryBuffer, 0, nri::WHOLE_SIZE);
+    for (uint32_t i = 0; i < meshNum; i++)
     {
+        const utils::Mesh& mesh = m_Scene.meshes[i];
         const uint64_t vertexDataSize = mesh.vertexNum * sizeof(utils::Vertex);
         const uint64_t indexDataSize = mesh.indexNum * sizeof(utils::Index);
 
-        nri::Buffer* tempBuffer = nullptr;
-        nri::Memory* tempMemory = nullptr;
-        CreateUploadBuffer(vertexDataSize + indexDataSize, tempBuffer, tempMemory);
+        memcpy(data + geometryOffsets[i], &m_Scene.vertices[mesh.vertexOffset], (size_t)vertexDataSize);
+        memcpy(data + geometryOffsets[i] + vertexDataSize, &m_Scene.indices[mesh.indexOffset], (size_t)indexDataSize);
 
-        uint8_t* data = (uint8_t*)NRI.MapBuffer(*tempBuffer, 0, nri::WHOLE_SIZE);
-        memcpy(data, &m_Scene.vertices[mesh.vertexOffset], (size_t)vertexDataSize);
-        memcpy(data + vertexDataSize, &m_Scene.indices[mesh.indexOffset], (size_t)indexDataSize);
-        NRI.UnmapBuffer(*tempBuffer);
-
-        nri::GeometryObject geometryObject = {};
+        nri::GeometryObject& geometryObject = geometryObjects[i];
         geometryObject.type = nri::GeometryType::TRIANGLES;
         geometryObject.flags = nri::BottomLevelGeometryBits::NONE;
-        geometryObject.triangles.vertexBuffer = tempBuffer;
-        geometryObject.triangles.vertexOffset = 0;
+        geometryObject.triangles.vertexBuffer = geometryBuffer;
+        geometryObject.triangles.vertexOffset = geometryOffsets[i];
         geometryObject.triangles.vertexNum = mesh.vertexNum;
         geometryObject.triangles.vertexFormat = nri::Format::RGB32_SFLOAT;
         geometryObject.triangles.vertexStride = sizeof(utils::Vertex);
-        geometryObject.triangles.indexBuffer = tempBuffer;
-        geometryObject.triangles.indexOffset = vertexDataSize;
+        geometryObject.triangles.indexBuffer = geometryBuffer;
+        geometryObject.triangles.indexOffset = geometryOffsets[i] + vertexDataSize;
         geometryObject.triangles.indexNum = mesh.indexNum;
         geometryObject.triangles.indexType = sizeof(utils::Index) == 2 ? nri::IndexType::UINT16 : nri::IndexType::UINT32;
+    }
+    NRI.UnmapBuffer(*geometryBuffer);
 
+    // Build BLASes, placed into a single memory allocation
+    std::vector<nri::AccelerationStructure*> buildBlases(meshNum);
+    uint64_t scratchSizeMax = 0;
+    for (uint32_t i = 0; i < meshNum; i++)
+    {
         nri::AccelerationStructureDesc blasDesc = {};
         blasDesc.type = nri::AccelerationStructureType::BOTTOM_LEVEL;
-        blasDesc.flags = BUILD_FLAGS;
+        blasDesc.flags = BLAS_BUILD_FLAGS;
         blasDesc.instanceOrGeometryObjectNum = 1;
-        blasDesc.geometryObjects = &geometryObject;
+        blasDesc.geometryObjects = &geometryObjects[i];
 
-        nri::AccelerationStructure* blas = nullptr;
-        NRI_ABORT_ON_FAILURE(NRI.CreateAccelerationStructure(*m_Device, blasDesc, blas));
-        m_BLASs.push_back(blas);
+        NRI_ABORT_ON_FAILURE(NRI.CreateAccelerationStructure(*m_Device, blasDesc, buildBlases[i]));
 
-        nri::MemoryDesc memoryDesc = {};
-        NRI.GetAccelerationStructureMemoryInfo(*blas, memoryDesc);
+        const uint64_t scratchSize = helper::GetAlignedSize(NRI.GetAccelerationStructureBuildScratchBufferSize(*buildBlases[i]), BLAS_SCRATCH_ALIGNMENT);
+        scratchSizeMax = Max(scratchSizeMax, scratchSize);
+    }
 
-        nri::Memory* memory = nullptr;
-        NRI_ABORT_ON_FAILURE(NRI.AllocateMemory(*m_Device, nri::WHOLE_DEVICE_GROUP, memoryDesc.type, memoryDesc.size, memory));
-        m_MemoryAllocations.push_back(memory);
+    nri::Memory* buildMemory = nullptr;
+    const uint64_t buildSize = AllocateAndBindAccelerationStructureMemory(buildBlases, buildMemory);
 
-        const nri::AccelerationStructureMemoryBindingDesc memoryBindingDesc = { memory, blas };
-        NRI_ABORT_ON_FAILURE(NRI.BindAccelerationStructureMemory(*m_Device, &memoryBindingDesc, 1));
+    // Scratch is a pool shared by all builds. Builds are independent, so only reusing a scratch region needs a barrier
+    const uint64_t scratchPoolSize = Max(scratchSizeMax, BLAS_SCRATCH_POOL_SIZE);
+
+    nri::Buffer* scratchBuffer = nullptr;
+    nri::Memory* scratchMemory = nullptr;
+    CreateScratchBuffer(scratchPoolSize, scratchBuffer, scratchMemory);
+
+    nri::CommandAllocator* commandAllocator = nullptr;
+    NRI.CreateCommandAllocator(*m_CommandQueue, nri::WHOLE_DEVICE_GROUP, commandAllocator);
+
+    nri::CommandBuffer* commandBuffer = nullptr;
+    NRI.CreateCommandBuffer(*commandAllocator, commandBuffer);
+
+    // Every GPU of the group builds its own copies ("--multiGpu"), compacted sizes are the same
+    for (uint32_t physicalDeviceIndex = 0; physicalDeviceIndex < m_PhysicalDeviceNum; physicalDeviceIndex++)
+    {
+        NRI.ResetCommandAllocator(*commandAllocator);
+        NRI.BeginCommandBuffer(*commandBuffer, nullptr, physicalDeviceIndex);
+        {
+            const nri::BufferTransitionBarrierDesc scratchTransition = { scratchBuffer, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE_STORAGE };
 
-        BuildBottomLevelAccelerationStructure(*blas, &geometryObject, 1);
+            nri::TransitionBarrierDesc transitionBarriers = {};
+            transitionBarriers.buffers = &scratchTransition;
+            transitionBarriers.bufferNum = 1;
+
+            uint64_t scratchOffset = 0;
+            for (uint32_t i = 0; i < meshNum; i++)
+            {
+                const uint64_t scratchSize = helper::GetAlignedSize(NRI.GetAccelerationStructureBuildScratchBufferSize(*buildBlases[i]), BLAS_SCRATCH_ALIGNMENT);
+                if (scratchOffset + scratchSize > scratchPoolSize)
+                {
+                    NRI.CmdPipelineBarrier(*commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
+                    scratchOffset = 0;
+                }
 
-        NRI.DestroyBuffer(*tempBuffer);
-        NRI.FreeMemory(*tempMemory);
+                NRI.CmdBuildBottomLevelAccelerationStructure(*commandBuffer, 1, &geometryObjects[i], BLAS_BUILD_FLAGS, *buildBlases[i], *scratchBuffer, scratchOffset);
+                scratchOffset += scratchSize;
+            }
+        }
+        NRI.EndCommandBuffer(*commandBuffer);
+        SubmitAndWait(*commandBuffer, physicalDeviceIndex);
     }
-}
 
-void Sample::CreateTopLevelAccelerationStructure()
-{
+    NRI.DestroyBuffer(*scratchBuffer);
+    NRI.FreeMemory(*scratchMemory);
+    NRI.DestroyBuffer(*geometryBuffer);
+    NRI.FreeMemory(*geometryMemory);
+
+    // Geometry descs are reused below only for counts and formats, don't leave them pointing to the destroyed buffer
+    for (nri::GeometryObject& geometryObject : geometryObjects)
     {
-        nri::AccelerationStructureDesc tlasDesc = {};
-        tlasDesc.type = nri::AccelerationStructureType::TOP_LEVEL;
-        tlasDesc.flags = BUILD_FLAGS;
-        tlasDesc.instanceOrGeometryObjectNum = helper::GetCountOf(m_Scene.instances) + ANIMATED_INSTANCE_MAX_NUM;
+        geometryObject.triangles.vertexBuffer = nullptr;
+        geometryObject.triangles.indexBuffer = nullptr;
+    }
 
-        NRI_ABORT_ON_FAILURE(NRI.CreateAccelerationStructure(*m_Device, tlasDesc, m_WorldTlas));
+    // Compaction: query compacted sizes...
+    nri::QueryPoolDesc queryPoolDesc = {};
+    queryPoolDesc.queryType = nri::QueryType::ACCELERATION_STRUCTURE_COMPACTED_SIZE;
+    queryPoolDesc.capacity = meshNum;
+    queryPoolDesc.physicalDeviceMask = nri::WHOLE_DEVICE_GROUP;
 
-        nri::MemoryDesc memoryDesc = {};
-        NRI.GetAccelerationStructureMemoryInfo(*m_WorldTlas, memoryDesc);
+    nri::QueryPool* queryPool = nullptr;
+    NRI_ABORT_ON_FAILURE( NRI.CreateQueryPool(*m_Device, queryPoolDesc, queryPool) );
 
-        nri::Memory* memory = nullptr;
-        NRI_ABORT_ON_FAILURE(NRI.AllocateMemory(*m_Device, nri::WHOLE_DEVICE_GROUP, memoryDesc.type, memoryDesc.size, memory));
-        m_MemoryAllocations.push_back(memory);
+    const uint32_t querySize = NRI.GetQuerySize(*queryPool);
 
-        const nri::AccelerationStructureMemoryBindingDesc memoryBindingDesc = { memory, m_WorldTlas };
-        NRI_ABORT_ON_FAILURE(NRI.BindAccelerationStructureMemory(*m_Device, &memoryBindingDesc, 1));
+    nri::Buffer* readbackBuffer = nullptr;
+    nri::Memory* readbackMemory = nullptr;
+    CreateReadbackBuffer(uint64_t(meshNum) * querySize, readbackBuffer, readbackMemory);
 
-        // Descriptor::World_AccelerationStructure
-        nri::Descriptor* descriptor;
-        NRI.CreateAccelerationStructureDescriptor(*m_WorldTlas, 0, descriptor);
-        m_Descriptors.push_back(descriptor);
+    NRI.ResetCommandAllocator(*commandAllocator);
+    NRI.BeginCommandBuffer(*commandBuffer, nullptr, 0);
+    {
+        NRI.CmdResetQueries(*commandBuffer, *queryPool, 0, meshNum);
+        NRI.CmdWriteAccelerationStructureSize(*commandBuffer, buildBlases.data(), meshNum, *queryPool, 0);
+        NRI.CmdCopyQueries(*commandBuffer, *queryPool, 0, meshNum, *readbackBuffer, 0);
+    }
+    NRI.EndCommandBuffer(*commandBuffer);
+    SubmitAndWait(*commandBuffer);
+
+    // ... create final BLASes of these sizes...
+    m_BLASs.resize(meshNum);
+
+    const uint8_t* sizes = (uint8_t*)NRI.MapBuffer(*readbackBuffer, 0, nri::WHOLE_SIZE);
+    for (uint32_t i = 0; i < meshNum; i++)
+    {
+        nri::AccelerationStructureDesc blasDesc = {};
+        blasDesc.type = nri::AccelerationStructureType::BOTTOM_LEVEL;
+        blasDesc.flags = BLAS_BUILD_FLAGS;
+        blasDesc.instanceOrGeometryObjectNum = 1;
+        blasDesc.geometryObjects = &geometryObjects[i];
+        blasDesc.optimizedSize = *(const uint64_t*)(sizes + i * querySize);
+
+        NRI_ABORT_ON_FAILURE(NRI.CreateAccelerationStructure(*m_Device, blasDesc, m_BLASs[i]));
     }
+    NRI.UnmapBuffer(*readbackBuffer);
+
+    nri::Memory* memory = nullptr;
+    const uint64_t compactedSize = AllocateAndBindAccelerationStructureMemory(m_BLASs, memory);
+    m_MemoryAllocations.push_back(memory);
+
+    // ... and copy into them
+    for (uint32_t physicalDeviceIndex = 0; physicalDeviceIndex < m_PhysicalDeviceNum; physicalDeviceIndex++)
+    {
+        NRI.ResetCommandAllocator(*commandAllocator);
+        NRI.BeginCommandBuffer(*commandBuffer, nullptr, physicalDeviceIndex);
+        {
+            for (uint32_t i = 0; i < meshNum; i++)
+                NRI.CmdCopyAccelerationStructure(*commandBuffer, *m_BLASs[i], *buildBlases[i], nri::CopyMode::COMPACT);
+        }
+        NRI.EndCommandBuffer(*commandBuffer);
+        SubmitAndWait(*commandBuffer, physicalDeviceIndex);
+    }
+
+    for (nri::AccelerationStructure* blas : buildBlases)
+        NRI.DestroyAccelerationStructure(*blas);
 
+    NRI.FreeMemory(*buildMemory);
+    NRI.DestroyQueryPool(*queryPool);
+    NRI.DestroyBuffer(*readbackBuffer);
+    NRI.FreeMemory(*readbackMemory);
+    NRI.DestroyCommandBuffer(*commandBuffer);
+    NRI.DestroyCommandAllocator(*commandAllocator);
+
+    m_MemoryCategorySizes[(uint32_t)MemoryCategory::AccelerationStructures] += compactedSize;
+
+    printf("BLAS: %u meshes, %.1f MB compacted to %.1f MB\n", meshNum, buildSize / (1024.0 * 1024.0), compactedSize / (1024.0 * 1024.0));
+}
+
+void Sample::CreateTopLevelAccelerationStructure()
+{
     {
         nri::AccelerationStructureDesc tlasDesc = {};
         tlasDesc.type = nri::AccelerationStructureType::TOP_LEVEL;
-        tlasDesc.flags = BUILD_FLAGS;
+        tlasDesc.flags = TLAS_BUILD_FLAGS;
         tlasDesc.instanceOrGeometryObjectNum = helper::GetCountOf(m_Scene.instances) + ANIMATED_INSTANCE_MAX_NUM;
 
-        NRI_ABORT_ON_FAILURE(NRI.CreateAccelerationStructure(*m_Device, tlasDesc, m_LightTlas));
+        NRI_ABORT_ON_FAILURE(NRI.CreateAccelerationStructure(*m_Device, tlasDesc, m_WorldTlas));
 
         nri::MemoryDesc memoryDesc = {};
-        NRI.GetAccelerationStructureMemoryInfo(*m_LightTlas, memoryDesc);
+        NRI.GetAccelerationStructureMemoryInfo(*m_WorldTlas, memoryDesc);
+        m_MemoryCategorySizes[(uint32_t)MemoryCategory::AccelerationStructures] += memoryDesc.size;
 
         nri::Memory* memory = nullptr;
         NRI_ABORT_ON_FAILURE(NRI.AllocateMemory(*m_Device, nri::WHOLE_DEVICE_GROUP, memoryDesc.type, memoryDesc.size, memory));
         m_MemoryAllocations.push_back(memory);
 
-        const nri::AccelerationStructureMemoryBindingDesc memoryBindingDesc = { memory, m_LightTlas };
+        const nri::AccelerationStructureMemoryBindingDesc memoryBindingDesc = { memory, m_WorldTlas };
         NRI_ABORT_ON_FAILURE(NRI.BindAccelerationStructureMemory(*m_Device, &memoryBindingDesc, 1));
 
-        // Descriptor::Light_AccelerationStructure
+        // Descriptor::World_AccelerationStructure
         nri::Descriptor* descriptor;
-        NRI.CreateAccelerationStructureDescriptor(*m_LightTlas, 0, descriptor);
+        NRI.CreateAccelerationStructureDescriptor(*m_WorldTlas, 0, descriptor);
         m_Descriptors.push_back(descriptor);
     }
 }
@@ -2549,11 +6863,9 @@ void Sample::CreateUploadBuffer(uint64_t size, nri::Buffer*& buffer, nri::Memory
     NRI_ABORT_ON_FAILURE(NRI.BindBufferMemory(*m_Device, &bufferMemoryBindingDesc, 1));
 }
 
-void Sample::CreateScratchBuffer(nri::AccelerationStructure& accelerationStructure, nri::Buffer*& buffer, nri::Memory*& memory)
+void Sample::CreateScratchBuffer(uint64_t size, nri::Buffer*& buffer, nri::Memory*& memory)
 {
-    const uint64_t scratchBufferSize = NRI.GetAccelerationStructureBuildScratchBufferSize(accelerationStructure);
-
-    const nri::BufferDesc bufferDesc = { scratchBufferSize, 0, nri::BufferUsageBits::RAY_TRACING_BUFFER | nri::BufferUsageBits::SHADER_RESOURCE_STORAGE };
+    const nri::BufferDesc bufferDesc = { size, 0, nri::BufferUsageBits::RAY_TRACING_BUFFER | nri::BufferUsageBits::SHADER_RESOURCE_STORAGE };
     NRI_ABORT_ON_FAILURE(NRI.CreateBuffer(*m_Device, bufferDesc, buffer));
 
     nri::MemoryDesc memoryDesc = {};
@@ -2565,147 +6877,527 @@ void Sample::CreateScratchBuffer(nri::AccelerationStructure& accelerationStructu
     NRI_ABORT_ON_FAILURE(NRI.BindBufferMemory(*m_Device, &bufferMemoryBindingDesc, 1));
 }
 
-void Sample::BuildBottomLevelAccelerationStructure(nri::AccelerationStructure& accelerationStructure, const nri::GeometryObject* objects, const uint32_t objectNum)
+void Sample::CreateReadbackBuffer(uint64_t size, nri::Buffer*& buffer, nri::Memory*& memory)
 {
-    nri::Buffer* scratchBuffer = nullptr;
-    nri::Memory* scratchBufferMemory = nullptr;
-    CreateScratchBuffer(accelerationStructure, scratchBuffer, scratchBufferMemory);
+    const nri::BufferDesc bufferDesc = { size, 0, nri::BufferUsageBits::NONE };
+    NRI_ABORT_ON_FAILURE(NRI.CreateBuffer(*m_Device, bufferDesc, buffer));
+
+    nri::MemoryDesc memoryDesc = {};
+    NRI.GetBufferMemoryInfo(*buffer, nri::MemoryLocation::HOST_READBACK, memoryDesc);
+
+    NRI_ABORT_ON_FAILURE(NRI.AllocateMemory(*m_Device, nri::WHOLE_DEVICE_GROUP, memoryDesc.type, memoryDesc.size, memory));
+
+    const nri::BufferMemoryBindingDesc bufferMemoryBindingDesc = { memory, buffer };
+    NRI_ABORT_ON_FAILURE(NRI.BindBufferMemory(*m_Device, &bufferMemoryBindingDesc, 1));
+}
+
+uint64_t Sample::AllocateAndBindAccelerationStructureMemory(const std::vector<nri::AccelerationStructure*>& accelerationStructures, nri::Memory*& memory)
+{
+    std::vector<nri::AccelerationStructureMemoryBindingDesc> memoryBindingDescs(accelerationStructures.size());
+    nri::MemoryType memoryType = {};
+    uint64_t size = 0;
+
+    for (size_t i = 0; i < accelerationStructures.size(); i++)
+    {
+        nri::MemoryDesc memoryDesc = {};
+        NRI.GetAccelerationStructureMemoryInfo(*accelerationStructures[i], memoryDesc);
+
+        assert( i == 0 || memoryDesc.type == memoryType );
+        memoryType = memoryDesc.type;
+
+        size = helper::GetAlignedSize(size, memoryDesc.alignment);
+        memoryBindingDescs[i] = { nullptr, accelerationStructures[i], size };
+        size += memoryDesc.size;
+    }
+
+    NRI_ABORT_ON_FAILURE(NRI.AllocateMemory(*m_Device, nri::WHOLE_DEVICE_GROUP, memoryType, size, memory));
+
+    for (nri::AccelerationStructureMemoryBindingDesc& memoryBindingDesc : memoryBindingDescs)
+        memoryBindingDesc.memory = memory;
+
+    NRI_ABORT_ON_FAILURE(NRI.BindAccelerationStructureMemory(*m_Device, memoryBindingDescs.data(), helper::GetCountOf(memoryBindingDescs)));
+
+    return size;
+}
+
+void Sample::SubmitAndWait(nri::CommandBuffer& commandBuffer, uint32_t physicalDeviceIndex)
+{
+    nri::CommandBuffer* commandBuffers = &commandBuffer;
+
+    nri::WorkSubmissionDesc workSubmissionDesc = {};
+    workSubmissionDesc.commandBuffers = &commandBuffers;
+    workSubmissionDesc.commandBufferNum = 1;
+    workSubmissionDesc.physicalDeviceIndex = physicalDeviceIndex;
+    NRI.SubmitQueueWork(*m_CommandQueue, workSubmissionDesc, nullptr);
+
+    NRI.WaitForIdle(*m_CommandQueue);
+}
+
+uint32_t Sample::GetInstanceFlags(size_t instanceIndex)
+{
+    const utils::Material& material = m_Scene.materials[m_Scene.instances[instanceIndex].materialIndex];
+    const size_t staticInstanceCount = m_Scene.instances.size() - m_AnimatedInstances.size();
+
+    if (material.IsEmissive())
+        return m_Settings.emission ? FLAG_EMISSION : FLAG_OPAQUE_OR_ALPHA_OPAQUE;
+    else if (m_Settings.emissiveObjects && instanceIndex > staticInstanceCount && Rand::uf1(&m_FastRandState) > 0.66f)
+        return m_Settings.emission ? FLAG_FORCED_EMISSION : FLAG_OPAQUE_OR_ALPHA_OPAQUE;
+    else if (material.IsTransparent())
+        return FLAG_TRANSPARENT;
+
+    return FLAG_OPAQUE_OR_ALPHA_OPAQUE;
+}
+
+void Sample::PackInstances(const InstanceRef* instanceRefs, uint32_t instanceNum, bool isStatic, InstanceData* instanceData, nri::GeometryObjectInstance* tlasData)
+{
+    assert( instanceNum <= INSTANCE_BLOCK_SIZE );
+
+    // SoA rows of the 3x4 "object to world" matrices. Use fp64 to avoid imprecision problems on close up views (InvertOrtho can't be used due to scaling factors)
+    alignas(32) double m[12][INSTANCE_BLOCK_SIZE];
+    alignas(32) double inv[12][INSTANCE_BLOCK_SIZE];
+    float4x4 mObjectToWorld[INSTANCE_BLOCK_SIZE];
+
+    // Static instances are packed without the camera relative translation, it gets added per frame
+    for (uint32_t j = 0; j < instanceNum; j++)
+    {
+        const utils::Instance& instance = m_Scene.instances[instanceRefs[j].instanceIndex];
+
+        float4x4& mat = mObjectToWorld[j];
+        mat = instance.rotation;
+        if (!isStatic)
+            mat.AddTranslation( m_Camera.GetRelative( instance.position ) );
+
+        const float4* cols[4] = { &mat.col0, &mat.col1, &mat.col2, &mat.col3 };
+        for (uint32_t c = 0; c < 4; c++)
+        {
+            m[c][j] = cols[c]->x;
+            m[4 + c][j] = cols[c]->y;
+            m[8 + c][j] = cols[c]->z;
+        }
+    }
+
+    // Affine inverse via the adjugate, no branches, so the compiler vectorizes it across instances
+    for (uint32_t j = 0; j < instanceNum; j++)
+    {
+        const double a = m[0][j], b = m[1][j], c = m[2][j], tx = m[3][j];
+        const double d = m[4][j], e = m[5][j], f = m[6][j], ty = m[7][j];
+        const double g = m[8][j], h = m[9][j], k = m[10][j], tz = m[11][j];
+
+        const double c00 = e * k - f * h, c01 = c * h - b * k, c02 = b * f - c * e;
+        const double c10 = f * g - d * k, c11 = a * k - c * g, c12 = c * d - a * f;
+        const double c20 = d * h - e * g, c21 = b * g - a * h, c22 = a * e - b * d;
+
+        const double invDet = 1.0 / (a * c00 + b * c10 + c * c20);
+
+        inv[0][j] = c00 * invDet;
+        inv[1][j] = c01 * invDet;
+        inv[2][j] = c02 * invDet;
+        inv[4][j] = c10 * invDet;
+        inv[5][j] = c11 * invDet;
+        inv[6][j] = c12 * invDet;
+        inv[8][j] = c20 * invDet;
+        inv[9][j] = c21 * invDet;
+        inv[10][j] = c22 * invDet;
+
+        inv[3][j] = -(inv[0][j] * tx + inv[1][j] * ty + inv[2][j] * tz);
+        inv[7][j] = -(inv[4][j] * tx + inv[5][j] * ty + inv[6][j] * tz);
+        inv[11][j] = -(inv[8][j] * tx + inv[9][j] * ty + inv[10][j] * tz);
+    }
+
+    for (uint32_t j = 0; j < instanceNum; j++)
+    {
+        const InstanceRef& instanceRef = instanceRefs[j];
+        utils::Instance& instance = m_Scene.instances[instanceRef.instanceIndex];
+        const utils::Mesh& mesh = m_Scene.meshes[instance.meshIndex];
+        const utils::Material& material = m_Scene.materials[instance.materialIndex];
+
+        float4x4 mObjectToWorldPrev = instance.rotationPrev;
+        if (!isStatic)
+            mObjectToWorldPrev.AddTranslation( m_Camera.GetRelative( instance.positionPrev ) );
+
+        float4x4 mWorldToObject = float4x4::Identity();
+        mWorldToObject.col0 = float4(float(inv[0][j]), float(inv[4][j]), float(inv[8][j]), 0.0f);
+        mWorldToObject.col1 = float4(float(inv[1][j]), float(inv[5][j]), float(inv[9][j]), 0.0f);
+        mWorldToObject.col2 = float4(float(inv[2][j]), float(inv[6][j]), float(inv[10][j]), 0.0f);
+        mWorldToObject.col3 = float4(float(inv[3][j]), float(inv[7][j]), float(inv[11][j]), 1.0f);
+
+        float4x4 mWorldToWorldPrev = mObjectToWorldPrev * mWorldToObject;
+        mWorldToWorldPrev.Transpose3x4();
+
+        instance.positionPrev = instance.position;
+        instance.rotationPrev = instance.rotation;
+
+        float4x4& mat = mObjectToWorld[j];
+        mat.Transpose3x4();
+
+        uint32_t basePrimitiveId = mesh.indexOffset / 3;
+        uint32_t instanceIdAndFlags = instanceRef.worldIndex | (instanceRef.flags << FLAG_FIRST_BIT);
+
+        uint32_t packedMaterial = Packed::uf4_to_uint<7, 7, 7, 0>(material.avgBaseColor);
+        packedMaterial |= Packed::uf4_to_uint<11, 10, 6, 5>( float4(0.0f, 0.0f, material.avgSpecularColor.y, material.avgSpecularColor.z) );
+
+        InstanceData& data = instanceData[instanceRef.worldIndex];
+        data.mObjectToWorld0_basePrimitiveId = mat.col0;
+        data.mObjectToWorld0_basePrimitiveId.w = AsFloat(basePrimitiveId);
+        data.mObjectToWorld1_baseTextureIndex = mat.col1;
+        data.mObjectToWorld1_baseTextureIndex.w = AsFloat(instance.materialIndex | (GetMaterialMinMip(material) << MATERIAL_INDEX_BITS));
+        data.mObjectToWorld2_averageBaseColor = mat.col2;
+        data.mObjectToWorld2_averageBaseColor.w = AsFloat(packedMaterial);
+        data.mWorldToWorldPrev0 = mWorldToWorldPrev.col0;
+        data.mWorldToWorldPrev1 = mWorldToWorldPrev.col1;
+        data.mWorldToWorldPrev2 = mWorldToWorldPrev.col2;
+
+        nri::GeometryObjectInstance tlasInstance = {};
+        memcpy(tlasInstance.transform, mat.a16, sizeof(tlasInstance.transform));
+        tlasInstance.instanceId = instanceIdAndFlags;
+        tlasInstance.mask = instanceRef.flags;
+        tlasInstance.shaderBindingTableLocalOffset = 0;
+        tlasInstance.flags = nri::TopLevelInstanceBits::TRIANGLE_CULL_DISABLE | (material.IsOpaque() ? nri::TopLevelInstanceBits::FORCE_OPAQUE : nri::TopLevelInstanceBits::NONE);
+        tlasInstance.accelerationStructureHandle = NRI.GetAccelerationStructureHandle(*m_BLASs[instance.meshIndex], 0);
+
+        // Output slots are known upfront, so blocks write straight into mapped memory in any order
+        tlasData[instanceRef.worldIndex] = tlasInstance;
+    }
+}
+
+uint32_t Sample::GatherInstances(size_t instanceBegin, size_t instanceEnd, uint32_t worldIndex, bool& hasTransparentObjects)
+{
+    m_InstanceRefs.clear();
+    hasTransparentObjects = false;
+
+    for (size_t i = instanceBegin; i < instanceEnd; i++)
+    {
+        const utils::Material& material = m_Scene.materials[m_Scene.instances[i].materialIndex];
+        if (material.IsOff()) // TODO: not an elegant way to skip "bad objects" (alpha channel is set to 0)
+            continue;
+
+        assert( worldIndex <= INSTANCE_ID_MASK );
+
+        // Serial, because forced emission consumes the random sequence in instance order
+        InstanceRef instanceRef = {};
+        instanceRef.instanceIndex = (uint32_t)i;
+        instanceRef.flags = GetInstanceFlags(i);
+        instanceRef.worldIndex = worldIndex++;
+
+        hasTransparentObjects |= (instanceRef.flags & FLAG_TRANSPARENT) != 0;
+
+        m_InstanceRefs.push_back(instanceRef);
+    }
+
+    return helper::GetCountOf(m_InstanceRefs);
+}
+
+void Sample::PackInstancesParallel(bool isStatic, InstanceData* instanceData, nri::GeometryObjectInstance* tlasData)
+{
+    const uint32_t instanceNum = helper::GetCountOf(m_InstanceRefs);
+    const uint32_t blockNum = (instanceNum + INSTANCE_BLOCK_SIZE - 1) / INSTANCE_BLOCK_SIZE;
+
+    m_WorkerPool.Execute(blockNum, [&](uint32_t blockIndex)
+    {
+        const uint32_t first = blockIndex * INSTANCE_BLOCK_SIZE;
+        const uint32_t num = std::min(instanceNum - first, INSTANCE_BLOCK_SIZE);
+
+        PackInstances(m_InstanceRefs.data() + first, num, isStatic, instanceData, tlasData);
+    });
+}
+
+void Sample::BuildTopLevelAccelerationStructure(nri::CommandBuffer& commandBuffer, uint32_t bufferedFrameIndex)
+{
+    CPU_ZONE("BuildTopLevelAccelerationStructure");
+
+    bool isAnimatedObjects = m_Settings.animatedObjects;
+    if (m_Settings.blink)
+    {
+        double period = 0.0003 * m_Timer.GetTimeStamp() * (m_Settings.animationSpeed < 0.0f ? 1.0f / (1.0f + Abs(m_Settings.animationSpeed)) : (1.0f + m_Settings.animationSpeed));
+        isAnimatedObjects &= WaveTriangle(period) > 0.5;
+    }
+
+    const uint64_t tlasCount = m_Scene.instances.size() - m_DefaultInstancesOffset;
+    const uint64_t instanceCount = m_Scene.instances.size() - (m_AnimatedInstances.size() - m_Settings.animatedObjectNum * isAnimatedObjects);
+
+    // Scene animations can move any instance, otherwise only animated objects are dynamic
+    const size_t staticInstanceEnd = m_Scene.animations.empty() ? m_Scene.instances.size() - m_AnimatedInstances.size() : m_DefaultInstancesOffset;
+
+    // Host visible "InstanceData" is written in place, otherwise it goes through the upload ring
+    uint64_t tlasDataOffset = 0;
+    uint64_t instanceDataOffset = 0;
+    auto worldTlasData = (nri::GeometryObjectInstance*)AllocateFromUploadRing(tlasCount * sizeof(nri::GeometryObjectInstance), tlasDataOffset);
+    InstanceData* instanceData = nullptr;
+    if (m_IsInstanceDataHostVisible)
+        instanceData = m_InstanceData + bufferedFrameIndex * m_InstanceDataFrameCapacity;
+    else
+        instanceData = (InstanceData*)AllocateFromUploadRing(tlasCount * sizeof(InstanceData), instanceDataOffset);
+
+    // Static instances: packed only if something they depend on has changed. "InstanceData" stays on the device, TLAS instances get the camera relative translation
+    m_IsStaticInstancesDirty |= m_StaticInstancesEmission != m_Settings.emission;
+
+    const bool isStaticInstancesRepacked = m_IsStaticInstancesDirty;
+    if (m_IsStaticInstancesDirty)
+    {
+        const uint32_t staticInstanceNum = GatherInstances(m_DefaultInstancesOffset, staticInstanceEnd, 0, m_HasStaticTransparentObjects);
+
+        m_StaticTlasInstances.resize(staticInstanceNum);
+        m_StaticTlasInstanceIndices.resize(staticInstanceNum);
+        m_StaticLightInstances.clear();
+
+        for (const InstanceRef& instanceRef : m_InstanceRefs)
+        {
+            m_StaticTlasInstanceIndices[instanceRef.worldIndex] = instanceRef.instanceIndex;
+            if (instanceRef.flags & (FLAG_EMISSION | FLAG_FORCED_EMISSION))
+                m_StaticLightInstances.push_back(instanceRef.worldIndex);
+        }
+
+        m_StaticInstanceData.resize(staticInstanceNum);
+        PackInstancesParallel(true, m_StaticInstanceData.data(), m_StaticTlasInstances.data());
+
+        m_StaticInstancesEmission = m_Settings.emission;
+        m_StaticInstanceDataMask = 0;
+        m_IsStaticInstancesDirty = false;
+    }
+
+    // Device local "InstanceData" needs static instances only after repacking, host visible copies - once per frame in flight
+    const uint32_t staticInstanceNum = helper::GetCountOf(m_StaticTlasInstances);
+    const uint32_t frameMask = m_IsInstanceDataHostVisible ? 1 << bufferedFrameIndex : 0;
+    if (isStaticInstancesRepacked || (m_StaticInstanceDataMask & frameMask) != frameMask)
+    {
+        memcpy(instanceData, m_StaticInstanceData.data(), staticInstanceNum * sizeof(InstanceData));
+        m_StaticInstanceDataMask |= frameMask;
+    }
+
+    for (uint32_t i = 0; i < staticInstanceNum; i++)
+    {
+        const float3 position = m_Camera.GetRelative( m_Scene.instances[m_StaticTlasInstanceIndices[i]].position );
+
+        nri::GeometryObjectInstance& tlasInstance = worldTlasData[i];
+        tlasInstance = m_StaticTlasInstances[i];
+        tlasInstance.transform[0][3] += position.x;
+        tlasInstance.transform[1][3] += position.y;
+        tlasInstance.transform[2][3] += position.z;
+    }
+
+    // Dynamic instances: fully repacked every frame, blocks are spread across worker threads
+    Rand::Seed(105361, &m_FastRandState);
+
+    bool hasDynamicTransparentObjects = false;
+    const uint32_t dynamicInstanceNum = GatherInstances(staticInstanceEnd, instanceCount, staticInstanceNum, hasDynamicTransparentObjects);
+
+    PackInstancesParallel(false, instanceData, worldTlasData);
+
+    const uint32_t worldInstanceNum = staticInstanceNum + dynamicInstanceNum;
+    m_HasTransparentObjects = m_HasStaticTransparentObjects || hasDynamicTransparentObjects;
+
+    // Emissive instances, in world TLAS order
+    m_LightInstances.clear();
+    for (uint32_t instanceId : m_StaticLightInstances)
+        m_LightInstances.push_back( {m_StaticTlasInstanceIndices[instanceId], m_StaticTlasInstances[instanceId].instanceId, 0} );
+
+    for (const InstanceRef& instanceRef : m_InstanceRefs)
+    {
+        if (instanceRef.flags & (FLAG_EMISSION | FLAG_FORCED_EMISSION))
+            m_LightInstances.push_back( {instanceRef.instanceIndex, instanceRef.worldIndex | (instanceRef.flags << FLAG_FIRST_BIT), 0} );
+    }
+
+    const nri::BufferTransitionBarrierDesc transitions[] =
+    {
+        { Get(Buffer::LightData), nri::AccessBits::SHADER_RESOURCE,  nri::AccessBits::COPY_DESTINATION },
+        { Get(Buffer::InstanceData), nri::AccessBits::SHADER_RESOURCE,  nri::AccessBits::COPY_DESTINATION },
+    };
+
+    nri::TransitionBarrierDesc transitionBarriers = {};
+    transitionBarriers.buffers = transitions;
+    transitionBarriers.bufferNum = m_IsInstanceDataHostVisible ? 1 : helper::GetCountOf(transitions);
+    NRI.CmdPipelineBarrier(commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
 
-    nri::CommandAllocator* commandAllocator = nullptr;
-    NRI.CreateCommandAllocator(*m_CommandQueue, nri::WHOLE_DEVICE_GROUP, commandAllocator);
+    const uint64_t copyOffset = isStaticInstancesRepacked ? 0 : staticInstanceNum * sizeof(InstanceData);
+    const uint64_t copySize = worldInstanceNum * sizeof(InstanceData) - copyOffset;
+    if (copySize && !m_IsInstanceDataHostVisible)
+        NRI.CmdCopyBuffer(commandBuffer, *Get(Buffer::InstanceData), 0, copyOffset, *Get(Buffer::UploadRing), 0, instanceDataOffset + copyOffset, copySize);
 
-    nri::CommandBuffer* commandBuffer = nullptr;
-    NRI.CreateCommandBuffer(*commandAllocator, commandBuffer);
+    UpdateLightData(commandBuffer, bufferedFrameIndex);
 
-    NRI.BeginCommandBuffer(*commandBuffer, nullptr, 0);
-    {
-        NRI.CmdBuildBottomLevelAccelerationStructure(*commandBuffer, objectNum, objects, BUILD_FLAGS, accelerationStructure, *scratchBuffer, 0);
-    }
-    NRI.EndCommandBuffer(*commandBuffer);
+    // Refit if the instance set is the same, but rebuild periodically to keep the quality
+    const bool isWorldTlasUpdate = !isStaticInstancesRepacked && worldInstanceNum == m_WorldTlasInstanceNum && m_WorldTlasUpdateNum < TLAS_REBUILD_PERIOD;
 
-    nri::WorkSubmissionDesc workSubmissionDesc = {};
-    workSubmissionDesc.commandBuffers = &commandBuffer;
-    workSubmissionDesc.commandBufferNum = 1;
-    NRI.SubmitQueueWork(*m_CommandQueue, workSubmissionDesc, nullptr);
+    if (isWorldTlasUpdate)
+        NRI.CmdUpdateTopLevelAccelerationStructure(commandBuffer, worldInstanceNum, *Get(Buffer::UploadRing), tlasDataOffset, TLAS_BUILD_FLAGS, *m_WorldTlas, *m_WorldTlas, *Get(Buffer::WorldScratch), 0);
+    else
+        NRI.CmdBuildTopLevelAccelerationStructure(commandBuffer, worldInstanceNum, *Get(Buffer::UploadRing), tlasDataOffset, TLAS_BUILD_FLAGS, *m_WorldTlas, *Get(Buffer::WorldScratch), 0);
 
-    NRI.WaitForIdle(*m_CommandQueue);
+    m_WorldTlasUpdateNum = isWorldTlasUpdate ? m_WorldTlasUpdateNum + 1 : 0;
+    m_WorldTlasInstanceNum = worldInstanceNum;
 
-    NRI.DestroyCommandBuffer(*commandBuffer);
-    NRI.DestroyCommandAllocator(*commandAllocator);
-    NRI.DestroyBuffer(*scratchBuffer);
-    NRI.FreeMemory(*scratchBufferMemory);
+    m_WorldTlasBuild.tlasDataOffset = tlasDataOffset;
+    m_WorldTlasBuild.instanceDataOffset = instanceDataOffset;
+    m_WorldTlasBuild.instanceDataCopyOffset = copyOffset;
+    m_WorldTlasBuild.instanceDataCopySize = m_IsInstanceDataHostVisible ? 0 : copySize;
+    m_WorldTlasBuild.instanceNum = worldInstanceNum;
+    m_WorldTlasBuild.isUpdate = isWorldTlasUpdate;
 }
 
-void Sample::BuildTopLevelAccelerationStructure(nri::CommandBuffer& commandBuffer, uint32_t bufferedFrameIndex)
+void Sample::UpdateLightData(nri::CommandBuffer& commandBuffer, uint32_t bufferedFrameIndex)
 {
-    bool isAnimatedObjects = m_Settings.animatedObjects;
-    if (m_Settings.blink)
+    CPU_ZONE("UpdateLightData");
+
+    // Layout (in float4): [0] - header, [1; 1 + 3N) - camera relative triangle vertices, [1 + 3N; 1 + 4N) - alias table
+    uint64_t lightSetHash = 14695981039346656037ull;
+    uint32_t lightTriangleNum = 0;
+    for (size_t i = 0; i < m_LightInstances.size(); i++)
     {
-        double period = 0.0003 * m_Timer.GetTimeStamp() * (m_Settings.animationSpeed < 0.0f ? 1.0f / (1.0f + Abs(m_Settings.animationSpeed)) : (1.0f + m_Settings.animationSpeed));
-        isAnimatedObjects &= WaveTriangle(period) > 0.5;
+        LightInstance& lightInstance = m_LightInstances[i];
+        const utils::Mesh& mesh = m_Scene.meshes[m_Scene.instances[lightInstance.instanceIndex].meshIndex];
+        const uint32_t triangleNum = mesh.indexNum / 3;
+
+        // Can't happen, the capacity covers all instances which can emit
+        if (lightTriangleNum + triangleNum > m_LightTriangleMaxNum)
+        {
+            m_LightInstances.resize(i);
+            break;
+        }
+
+        lightInstance.triangleOffset = lightTriangleNum;
+        lightTriangleNum += triangleNum;
+
+        lightSetHash = (lightSetHash ^ lightInstance.instanceIndex) * 1099511628211ull;
+        lightSetHash = (lightSetHash ^ lightInstance.instanceIdAndFlags) * 1099511628211ull;
     }
 
-    const uint64_t tlasCount = m_Scene.instances.size() - m_DefaultInstancesOffset;
-    const uint64_t tlasDataSize = tlasCount * sizeof(nri::GeometryObjectInstance);
-    const uint64_t tlasDataOffset = tlasDataSize * bufferedFrameIndex;
-    const uint64_t instanceDataSize = tlasCount * sizeof(InstanceData);
-    const uint64_t instanceDataOffset = instanceDataSize * bufferedFrameIndex;
-    const uint64_t instanceCount = m_Scene.instances.size() - (m_AnimatedInstances.size() - m_Settings.animatedObjectNum * isAnimatedObjects);
-    const uint64_t staticInstanceCount = m_Scene.instances.size() - m_AnimatedInstances.size();
+    // Triangle powers don't change under rigid motion, the alias table is rebuilt only if the set of emissive instances changes
+    const bool isAliasTableDirty = lightSetHash != m_LightSetHash;
+    m_LightSetHash = lightSetHash;
 
-    auto instanceData = (InstanceData*)NRI.MapBuffer(*Get(Buffer::InstanceDataStaging), instanceDataOffset, instanceDataSize);
-    auto worldTlasData = (nri::GeometryObjectInstance*)NRI.MapBuffer(*Get(Buffer::WorldTlasDataStaging), tlasDataOffset, tlasDataSize);
-    auto lightTlasData = (nri::GeometryObjectInstance*)NRI.MapBuffer(*Get(Buffer::LightTlasDataStaging), tlasDataOffset, tlasDataSize);
+    if (isAliasTableDirty)
+        m_LightTrianglePowers.resize(lightTriangleNum);
 
-    Rand::Seed(105361, &m_FastRandState);
+    const uint64_t lightDataSize = (1 + 4 * (uint64_t)m_LightTriangleMaxNum) * sizeof(float4);
+    const uint64_t lightDataOffset = lightDataSize * bufferedFrameIndex;
+    float4* lightData = (float4*)NRI.MapBuffer(*Get(Buffer::LightDataStaging), lightDataOffset, lightDataSize);
+
+    // Cached triangles are re-transformed only if the slot got another instance or the camera relative transform has changed
+    m_LightInstanceCaches.resize(m_LightInstances.size(), {float4x4::Identity(), uint32_t(-1), 0, 0});
 
-    uint32_t worldInstanceNum = 0;
-    uint32_t lightInstanceNum = 0;
-    m_HasTransparentObjects = false;
-    for (size_t i = m_DefaultInstancesOffset; i < instanceCount; i++)
+    m_WorkerPool.Execute(helper::GetCountOf(m_LightInstances), [&](uint32_t lightInstanceIndex)
     {
-        utils::Instance& instance = m_Scene.instances[i];
+        const LightInstance& lightInstance = m_LightInstances[lightInstanceIndex];
+        const utils::Instance& instance = m_Scene.instances[lightInstance.instanceIndex];
         const utils::Mesh& mesh = m_Scene.meshes[instance.meshIndex];
         const utils::Material& material = m_Scene.materials[instance.materialIndex];
 
-        if (material.IsOff()) // TODO: not an elegant way to skip "bad objects" (alpha channel is set to 0)
-            continue;
-
-        assert( worldInstanceNum <= INSTANCE_ID_MASK );
-
         float4x4 mObjectToWorld = instance.rotation;
         mObjectToWorld.AddTranslation( m_Camera.GetRelative( instance.position ) );
 
-        float4x4 mObjectToWorldPrev = instance.rotationPrev;
-        mObjectToWorldPrev.AddTranslation( m_Camera.GetRelative( instance.positionPrev ) );
+        LightInstanceCache& cache = m_LightInstanceCaches[lightInstanceIndex];
+        const bool isTransformed = isAliasTableDirty
+            || cache.instanceIndex != lightInstance.instanceIndex
+            || cache.instanceIdAndFlags != lightInstance.instanceIdAndFlags
+            || cache.triangleOffset != lightInstance.triangleOffset
+            || memcmp(&cache.mObjectToWorld, &mObjectToWorld, sizeof(mObjectToWorld)) != 0;
+
+        if (!isTransformed)
+            return;
+
+        cache.mObjectToWorld = mObjectToWorld;
+        cache.instanceIndex = lightInstance.instanceIndex;
+        cache.instanceIdAndFlags = lightInstance.instanceIdAndFlags;
+        cache.triangleOffset = lightInstance.triangleOffset;
+
+        // Only relative power matters, the average color is a good enough estimation of the emission texture. Forced emission matches "GetForcedEmissionColor"
+        const bool isForcedEmission = ((lightInstance.instanceIdAndFlags >> FLAG_FIRST_BIT) & FLAG_FORCED_EMISSION) != 0;
+        float3 emission = float3(material.avgBaseColor.x, material.avgBaseColor.y, material.avgBaseColor.z);
+        if (isForcedEmission)
+            emission = (instance.materialIndex & 0x1) ? float3(1.0f, 0.0f, 0.0f) : float3(0.0f, 1.0f, 0.0f);
+        const float luminance = Max(0.2126f * emission.x + 0.7152f * emission.y + 0.0722f * emission.z, 0.001f);
+
+        const float3* vertices = m_LightMeshVertices.data() + m_LightMeshVertexOffsets[instance.meshIndex];
+        float4* triangleData = m_LightTriangles.data() + lightInstance.triangleOffset * 3;
+        const uint32_t triangleNum = mesh.indexNum / 3;
+        for (uint32_t i = 0; i < triangleNum; i++)
+        {
+            float3 v[3];
+            for (uint32_t j = 0; j < 3; j++)
+            {
+                const float3& vertex = *vertices++;
+                const float4 position = mObjectToWorld.col0 * vertex.x + mObjectToWorld.col1 * vertex.y + mObjectToWorld.col2 * vertex.z + mObjectToWorld.col3;
+                v[j] = float3(position.x, position.y, position.z);
+            }
 
-        // Use fp64 to avoid imprecision problems on close up views (InvertOrtho can't be used due to scaling factors)
-        double4x4 mWorldToObjectd = ToDouble( mObjectToWorld );
-        mWorldToObjectd.Invert();
-        float4x4 mWorldToObject = ToFloat( mWorldToObjectd );
+            // Same "InstanceID" and "PrimitiveIndex" as a ray hit would report
+            *triangleData++ = float4(v[0].x, v[0].y, v[0].z, AsFloat(lightInstance.instanceIdAndFlags));
+            *triangleData++ = float4(v[1].x, v[1].y, v[1].z, AsFloat(i));
+            *triangleData++ = float4(v[2].x, v[2].y, v[2].z, 0.0f);
 
-        float4x4 mWorldToWorldPrev = mObjectToWorldPrev * mWorldToObject;
-        mWorldToWorldPrev.Transpose3x4();
+            if (isAliasTableDirty)
+                m_LightTrianglePowers[lightInstance.triangleOffset + i] = 0.5f * Length( Cross(v[1] - v[0], v[2] - v[0]) ) * luminance;
+        }
+    });
 
-        instance.positionPrev = instance.position;
-        instance.rotationPrev = instance.rotation;
+    // Staging is per frame in flight, i.e. all triangles get copied every frame
+    if (lightTriangleNum)
+        memcpy(lightData + 1, m_LightTriangles.data(), lightTriangleNum * 3 * sizeof(float4));
+
+    if (isAliasTableDirty)
+    {
+        // Vose's alias method: O(1) sampling proportional to power
+        double powerSum = 0.0;
+        for (float power : m_LightTrianglePowers)
+            powerSum += power;
 
-        mObjectToWorld.Transpose3x4();
+        std::vector<float> scaledPowers(lightTriangleNum);
+        std::vector<uint32_t> smallIndices;
+        std::vector<uint32_t> largeIndices;
 
-        uint32_t flags = 0;
-        if (material.IsEmissive()) // TODO: importance sampling can be significantly accelerated if ALL emissives will be placed into a single BLAS, which will be the only one in a special TLAS!
-            flags = m_Settings.emission ? FLAG_EMISSION : FLAG_OPAQUE_OR_ALPHA_OPAQUE;
-        else if (m_Settings.emissiveObjects && i > staticInstanceCount && Rand::uf1(&m_FastRandState) > 0.66f)
-            flags = m_Settings.emission ? FLAG_FORCED_EMISSION : FLAG_OPAQUE_OR_ALPHA_OPAQUE;
-        else if (material.IsTransparent())
+        m_LightAliasTable.resize(lightTriangleNum);
+        for (uint32_t i = 0; i < lightTriangleNum; i++)
         {
-            flags = FLAG_TRANSPARENT;
-            m_HasTransparentObjects = true;
-        }
-        else
-            flags = FLAG_OPAQUE_OR_ALPHA_OPAQUE;
+            const float pdf = powerSum != 0.0 ? float(m_LightTrianglePowers[i] / powerSum) : 1.0f / float(lightTriangleNum);
+            scaledPowers[i] = pdf * float(lightTriangleNum);
 
-        uint32_t basePrimitiveId = mesh.indexOffset / 3;
-        uint32_t instanceIdAndFlags = worldInstanceNum | (flags << FLAG_FIRST_BIT);
+            // x - probability to keep the slot, y - alias, z - PDF of the triangle
+            m_LightAliasTable[i] = float4(1.0f, AsFloat(i), pdf, 0.0f);
 
-        uint32_t packedMaterial = Packed::uf4_to_uint<7, 7, 7, 0>(material.avgBaseColor);
-        packedMaterial |= Packed::uf4_to_uint<11, 10, 6, 5>( float4(0.0f, 0.0f, material.avgSpecularColor.y, material.avgSpecularColor.z) );
+            if (scaledPowers[i] < 1.0f)
+                smallIndices.push_back(i);
+            else
+                largeIndices.push_back(i);
+        }
 
-        instanceData->mObjectToWorld0_basePrimitiveId = mObjectToWorld.col0;
-        instanceData->mObjectToWorld0_basePrimitiveId.w = AsFloat(basePrimitiveId);
-        instanceData->mObjectToWorld1_baseTextureIndex = mObjectToWorld.col1;
-        instanceData->mObjectToWorld1_baseTextureIndex.w = AsFloat(instance.materialIndex);
-        instanceData->mObjectToWorld2_averageBaseColor = mObjectToWorld.col2;
-        instanceData->mObjectToWorld2_averageBaseColor.w = AsFloat(packedMaterial);
-        instanceData->mWorldToWorldPrev0 = mWorldToWorldPrev.col0;
-        instanceData->mWorldToWorldPrev1 = mWorldToWorldPrev.col1;
-        instanceData->mWorldToWorldPrev2 = mWorldToWorldPrev.col2;
-        instanceData++;
+        while (!smallIndices.empty() && !largeIndices.empty())
+        {
+            const uint32_t smallIndex = smallIndices.back();
+            smallIndices.pop_back();
+            const uint32_t largeIndex = largeIndices.back();
 
-        nri::GeometryObjectInstance tlasInstance = {};
-        memcpy(tlasInstance.transform, mObjectToWorld.a16, sizeof(tlasInstance.transform));
-        tlasInstance.instanceId = instanceIdAndFlags;
-        tlasInstance.mask = flags;
-        tlasInstance.shaderBindingTableLocalOffset = 0;
-        tlasInstance.flags = nri::TopLevelInstanceBits::TRIANGLE_CULL_DISABLE | (material.IsOpaque() ? nri::TopLevelInstanceBits::FORCE_OPAQUE : nri::TopLevelInstanceBits::NONE);
-        tlasInstance.accelerationStructureHandle = NRI.GetAccelerationStructureHandle(*m_BLASs[instance.meshIndex], 0);
+            m_LightAliasTable[smallIndex].x = scaledPowers[smallIndex];
+            m_LightAliasTable[smallIndex].y = AsFloat(largeIndex);
 
-        if (flags & (FLAG_EMISSION | FLAG_FORCED_EMISSION))
-        {
-            *lightTlasData++ = tlasInstance;
-            lightInstanceNum++;
+            scaledPowers[largeIndex] -= 1.0f - scaledPowers[smallIndex];
+            if (scaledPowers[largeIndex] < 1.0f)
+            {
+                largeIndices.pop_back();
+                smallIndices.push_back(largeIndex);
+            }
         }
 
-        *worldTlasData++ = tlasInstance;
-        worldInstanceNum++;
+        if (lightTriangleNum)
+            memcpy(lightData + 1 + lightTriangleNum * 3, m_LightAliasTable.data(), lightTriangleNum * sizeof(float4));
     }
 
-    NRI.UnmapBuffer(*Get(Buffer::InstanceDataStaging));
-    NRI.UnmapBuffer(*Get(Buffer::WorldTlasDataStaging));
-    NRI.UnmapBuffer(*Get(Buffer::LightTlasDataStaging));
+    lightData[0] = float4(AsFloat(lightTriangleNum), 0.0f, 0.0f, 0.0f);
+
+    NRI.UnmapBuffer(*Get(Buffer::LightDataStaging));
 
+    const uint64_t copySize = (1 + lightTriangleNum * 3 + (isAliasTableDirty ? lightTriangleNum : 0)) * sizeof(float4);
+    NRI.CmdCopyBuffer(commandBuffer, *Get(Buffer::LightData), 0, 0, *Get(Buffer::LightDataStaging), 0, lightDataOffset, copySize);
+
+    m_WorldTlasBuild.lightDataOffset = lightDataOffset;
+    m_WorldTlasBuild.lightDataCopySize = copySize;
+}
+
+void Sample::ReplayWorldTlasBuild(nri::CommandBuffer& commandBuffer, uint32_t physicalDeviceIndex)
+{
+    // Peer GPUs get exactly the same copies and builds as GPU 0, i.e. incremental updates of device data stay in sync
     const nri::BufferTransitionBarrierDesc transitions[] =
     {
+        { Get(Buffer::LightData), nri::AccessBits::SHADER_RESOURCE,  nri::AccessBits::COPY_DESTINATION },
         { Get(Buffer::InstanceData), nri::AccessBits::SHADER_RESOURCE,  nri::AccessBits::COPY_DESTINATION },
     };
 
@@ -2714,9 +7406,25 @@ void Sample::BuildTopLevelAccelerationStructure(nri::CommandBuffer& commandBuffe
     transitionBarriers.bufferNum = helper::GetCountOf(transitions);
     NRI.CmdPipelineBarrier(commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
 
-    NRI.CmdCopyBuffer(commandBuffer, *Get(Buffer::InstanceData), 0, 0, *Get(Buffer::InstanceDataStaging), 0, instanceDataOffset, instanceDataSize);
-    NRI.CmdBuildTopLevelAccelerationStructure(commandBuffer, worldInstanceNum, *Get(Buffer::WorldTlasDataStaging), tlasDataOffset, BUILD_FLAGS, *m_WorldTlas, *Get(Buffer::WorldScratch), 0);
-    NRI.CmdBuildTopLevelAccelerationStructure(commandBuffer, lightInstanceNum, *Get(Buffer::LightTlasDataStaging), tlasDataOffset, BUILD_FLAGS, *m_LightTlas, *Get(Buffer::LightScratch), 0);
+    const WorldTlasBuild& build = m_WorldTlasBuild;
+    if (build.instanceDataCopySize)
+        NRI.CmdCopyBuffer(commandBuffer, *Get(Buffer::InstanceData), physicalDeviceIndex, build.instanceDataCopyOffset, *Get(Buffer::UploadRing), physicalDeviceIndex, build.instanceDataOffset + build.instanceDataCopyOffset, build.instanceDataCopySize);
+    NRI.CmdCopyBuffer(commandBuffer, *Get(Buffer::LightData), physicalDeviceIndex, 0, *Get(Buffer::LightDataStaging), physicalDeviceIndex, build.lightDataOffset, build.lightDataCopySize);
+
+    if (build.isUpdate)
+        NRI.CmdUpdateTopLevelAccelerationStructure(commandBuffer, build.instanceNum, *Get(Buffer::UploadRing), build.tlasDataOffset, TLAS_BUILD_FLAGS, *m_WorldTlas, *m_WorldTlas, *Get(Buffer::WorldScratch), 0);
+    else
+        NRI.CmdBuildTopLevelAccelerationStructure(commandBuffer, build.instanceNum, *Get(Buffer::UploadRing), build.tlasDataOffset, TLAS_BUILD_FLAGS, *m_WorldTlas, *Get(Buffer::WorldScratch), 0);
+
+    const nri::BufferTransitionBarrierDesc afterTransitions[] =
+    {
+        { Get(Buffer::LightData), nri::AccessBits::COPY_DESTINATION,  nri::AccessBits::SHADER_RESOURCE },
+        { Get(Buffer::InstanceData), nri::AccessBits::COPY_DESTINATION,  nri::AccessBits::SHADER_RESOURCE },
+    };
+
+    transitionBarriers.buffers = afterTransitions;
+    transitionBarriers.bufferNum = helper::GetCountOf(afterTransitions);
+    NRI.CmdPipelineBarrier(commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
 }
 
 void Sample::UpdateShaderTable()
@@ -2740,18 +7448,17 @@ void Sample::UpdateShaderTable()
     nri::CommandBuffer* commandBuffer = nullptr;
     NRI.CreateCommandBuffer(*commandAllocator, commandBuffer);
 
-    NRI.BeginCommandBuffer(*commandBuffer, nullptr, 0);
+    for (uint32_t physicalDeviceIndex = 0; physicalDeviceIndex < m_PhysicalDeviceNum; physicalDeviceIndex++)
     {
-        NRI.CmdCopyBuffer(*commandBuffer, *Get(Buffer::ShaderTable), 0, 0, *buffer, 0, 0, shaderTableSize);
-    }
-    NRI.EndCommandBuffer(*commandBuffer);
-
-    nri::WorkSubmissionDesc workSubmissionDesc = {};
-    workSubmissionDesc.commandBuffers = &commandBuffer;
-    workSubmissionDesc.commandBufferNum = 1;
-    NRI.SubmitQueueWork(*m_CommandQueue, workSubmissionDesc, nullptr);
+        NRI.ResetCommandAllocator(*commandAllocator);
+        NRI.BeginCommandBuffer(*commandBuffer, nullptr, physicalDeviceIndex);
+        {
+            NRI.CmdCopyBuffer(*commandBuffer, *Get(Buffer::ShaderTable), physicalDeviceIndex, 0, *buffer, physicalDeviceIndex, 0, shaderTableSize);
+        }
+        NRI.EndCommandBuffer(*commandBuffer);
 
-    NRI.WaitForIdle(*m_CommandQueue);
+        SubmitAndWait(*commandBuffer, physicalDeviceIndex);
+    }
 
     NRI.DestroyCommandBuffer(*commandBuffer);
     NRI.DestroyCommandAllocator(*commandAllocator);
@@ -2761,6 +7468,8 @@ void Sample::UpdateShaderTable()
 
 void Sample::UpdateConstantBuffer(uint32_t frameIndex)
 {
+    CPU_ZONE("UpdateConstantBuffer");
+
     if (m_Settings.animateSun)
     {
         const float animationSpeed = m_Settings.pauseAnimation ? 0.0f : (m_Settings.animationSpeed < 0.0f ? 1.0f / (1.0f + Abs(m_Settings.animationSpeed)) : (1.0f + m_Settings.animationSpeed));
@@ -2774,14 +7483,14 @@ void Sample::UpdateConstantBuffer(uint32_t frameIndex)
     float f = Smoothstep(-0.9f, 0.05f, sunDirection.z);
     float ambient = Lerp(1000.0f, 10000.0f, Sqrt( Saturate(sunDirection.z) )) * f * ambientAmount;
 
-    uint32_t rectW = uint32_t(m_ScreenResolution.x * m_ResolutionScale + 0.5f);
-    uint32_t rectH = uint32_t(m_ScreenResolution.y * m_ResolutionScale + 0.5f);
+    const uint2 rectSizeInPixels = GetRectSize();
+    const float2 resolutionScale = GetEffectiveResolutionScale();
 
     float2 outputSize = float2( float(m_OutputResolution.x), float(m_OutputResolution.y) );
     float2 screenSize = float2( float(m_ScreenResolution.x), float(m_ScreenResolution.y) );
-    float2 rectSize = float2( float(rectW), float(rectH) );
+    float2 rectSize = float2( float(rectSizeInPixels.x), float(rectSizeInPixels.y) );
     float2 jitter = (m_Settings.TAA ? m_Camera.state.viewportJitter : 0.0f) / rectSize;
-    float baseMipBias = -0.5f + log2f(m_ResolutionScale);
+    float baseMipBias = -0.5f + 0.5f * log2f(resolutionScale.x * resolutionScale.y); // must match "commonSettings.resolutionScale"
 
     float3 viewDir = m_Camera.state.mViewToWorld * float3(0.0f, 0.0f, 1.0f);
 
@@ -2791,10 +7500,10 @@ void Sample::UpdateConstantBuffer(uint32_t frameIndex)
     nrd::HitDistanceParameters specHitDistanceParameters = {};
     specHitDistanceParameters.A = m_Settings.specHitDistScale;
 
-    const uint32_t bufferedFrameIndex = frameIndex % BUFFERED_FRAME_MAX_NUM;
-    const uint64_t rangeOffset = m_Frames[bufferedFrameIndex].globalConstantBufferOffset;
-    nri::Buffer* globalConstants = Get(Buffer::GlobalConstants);
-    auto data = (GlobalConstantBufferData*)NRI.MapBuffer(*globalConstants, rangeOffset, sizeof(GlobalConstantBufferData));
+    const uint32_t bufferedFrameIndex = frameIndex % m_FrameInFlightNum;
+    uint64_t rangeOffset = 0;
+    auto data = (GlobalConstantBufferData*)AllocateFromUploadRing(sizeof(GlobalConstantBufferData), rangeOffset);
+    assert( rangeOffset == m_Frames[bufferedFrameIndex].globalConstantBufferOffset );
     {
         data->gWorldToView = m_Camera.state.mWorldToView;
         data->gViewToWorld = m_Camera.state.mViewToWorld;
@@ -2807,7 +7516,7 @@ void Sample::UpdateConstantBuffer(uint32_t frameIndex)
         data->gSunDirection_gExposure = sunDirection;
         data->gSunDirection_gExposure.w = m_Settings.exposure;
         data->gWorldOrigin_gMipBias = ToFloat( m_Camera.state.globalPosition );
-        data->gWorldOrigin_gMipBias.w = m_DLSS.IsInitialized() ? (baseMipBias + log2f(float(m_ScreenResolution.x) / float(m_OutputResolution.x))) : (m_Settings.TAA ? baseMipBias : 0.0f);
+        data->gWorldOrigin_gMipBias.w = m_DLSS.IsInitialized() ? (baseMipBias + log2f(float(GetRenderResolution().x) / float(m_OutputResolution.x))) : (m_Settings.TAA ? baseMipBias : 0.0f);
         data->gTrimmingParams_gEmissionIntensity = GetTrimmingParams();
         data->gTrimmingParams_gEmissionIntensity.w = emissionIntensity;
         data->gViewDirection_gIsOrtho = float4( viewDir.x, viewDir.y, viewDir.z, m_Camera.m_IsOrtho );
@@ -2837,11 +7546,7 @@ void Sample::UpdateConstantBuffer(uint32_t frameIndex)
         data->gTransparent = m_HasTransparentObjects ? 1.0f : 0.0f;
         data->gDenoiserType = (uint32_t)m_Settings.denoiser;
         data->gDisableShadowsAndEnableImportanceSampling = (sunDirection.z < 0.0f && m_Settings.importanceSampling) ? 1 : 0;
-    #if( NRD_OCCLUSION_ONLY == 1 )
-        data->gOnScreen = m_Settings.onScreen + 1; // preserve original mapping
-    #else
-        data->gOnScreen = m_Settings.onScreen;
-    #endif
+        data->gOnScreen = m_Settings.onScreen + (m_IsOcclusionOnly ? 1 : 0); // preserve original mapping
         data->gFrameIndex = frameIndex;
         data->gForcedMaterial = m_Settings.forcedMaterial;
         data->gPrimaryFullBrdf = m_Settings.primaryFullBrdf;
@@ -2850,21 +7555,276 @@ void Sample::UpdateConstantBuffer(uint32_t frameIndex)
         data->gWorldSpaceMotion = m_Settings.isMotionVectorInWorldSpace ? 1 : 0;
         data->gBlueNoise = (m_Settings.nrdSettings.referenceAccumulation || m_Settings.rpp > 1) ? 0 : m_Settings.blueNoise;
         data->gSampleNum = m_Settings.rpp == 0 ? 1 : m_Settings.rpp;
-        data->gOcclusionOnly = NRD_OCCLUSION_ONLY;
+        data->gOcclusionOnly = m_IsOcclusionOnly ? 1 : 0;
+        data->gAdaptiveSampling = (m_IsAdaptiveSampling && m_Settings.rpp > 1 && m_SampleBudgetFrameNum != 0) ? 1 : 0; // the map is made by the previous frame
+        data->gMipFeedback = m_IsTextureResidency ? 1 : 0;
+        data->gCompactPrimitiveData = m_IsCompactPrimitiveData ? 1 : 0;
+        data->gInstanceDataOffset = m_IsInstanceDataHostVisible ? bufferedFrameIndex * m_InstanceDataFrameCapacity * uint32_t(sizeof(InstanceData) / sizeof(float4)) : 0;
+        data->gBandOrigin = 0;
+    }
+
+    // Peer GPUs get a copy with their own band
+    for (uint32_t i = 1; i < m_PhysicalDeviceNum; i++)
+    {
+        auto peerData = (GlobalConstantBufferData*)AllocateFromUploadRing(sizeof(GlobalConstantBufferData), rangeOffset);
+        memcpy(peerData, data, sizeof(GlobalConstantBufferData));
+        peerData->gBandOrigin = GetRaytracingBand(i).x;
     }
-    NRI.UnmapBuffer(*globalConstants);
 
     m_RectSizePrev = rectSize;
 }
 
+constexpr uint64_t FNV_OFFSET_BASIS = 0xCBF29CE484222325ull;
+constexpr uint64_t FNV_PRIME = 0x100000001B3ull;
+
+inline uint64_t HashFile(const std::string& path, uint64_t hash)
+{
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (!fp)
+        return hash;
+
+    // FNV-1a, a sequential read is way cheaper than parsing
+    std::vector<uint8_t> chunk(1024 * 1024);
+    size_t size = 0;
+    while ((size = fread(chunk.data(), 1, chunk.size(), fp)) != 0)
+    {
+        for (size_t i = 0; i < size; i++)
+            hash = (hash ^ chunk[i]) * FNV_PRIME;
+    }
+
+    fclose(fp);
+
+    return hash;
+}
+
+// Cheap enough to be checked before parsing: a file is considered unchanged if its size and modification time are the same
+inline uint64_t HashFileStamp(const std::string& path, uint64_t hash)
+{
+    std::error_code error;
+    const uint64_t stamp[] =
+    {
+        (uint64_t)std::filesystem::file_size(path, error),
+        (uint64_t)std::filesystem::last_write_time(path, error).time_since_epoch().count(),
+    };
+
+    for (uint64_t value : stamp)
+    {
+        for (uint32_t i = 0; i < sizeof(value); i++)
+            hash = (hash ^ ((value >> (i * 8)) & 0xFF)) * FNV_PRIME;
+    }
+
+    return hash;
+}
+
+// An array is stored as the element size, the element number and raw elements
+template<typename T> inline void WriteCacheArray(FILE* fp, const std::vector<T>& array)
+{
+    static_assert(std::is_trivially_copyable<T>::value, "Only plain data can be cached");
+
+    const uint64_t info[] = { sizeof(T), array.size() };
+    fwrite(info, sizeof(info), 1, fp);
+    fwrite(array.data(), sizeof(T), array.size(), fp);
+}
+
+template<typename T> inline bool ReadCacheArray(FILE* fp, std::vector<T>& array)
+{
+    uint64_t info[2] = {};
+    if (fread(info, sizeof(info), 1, fp) != 1 || info[0] != sizeof(T))
+        return false;
+
+    array.resize((size_t)info[1]);
+
+    return fread(array.data(), sizeof(T), array.size(), fp) == array.size();
+}
+
+bool Sample::LoadSceneCache()
+{
+    FILE* fp = fopen(GetSceneCachePath().c_str(), "rb");
+    if (!fp)
+        return false;
+
+    SceneCacheHeader header = {};
+    bool isValid = fread(&header, sizeof(header), 1, fp) == 1;
+    isValid = isValid && header.magic == SCENE_CACHE_MAGIC && header.version == SCENE_CACHE_VERSION && header.sourceHash == m_SceneHash;
+    isValid = isValid && ReadCacheArray(fp, m_Scene.meshes);
+    isValid = isValid && ReadCacheArray(fp, m_Scene.instances);
+    isValid = isValid && ReadCacheArray(fp, m_Scene.materials);
+    isValid = isValid && ReadCacheArray(fp, m_Scene.vertices);
+    isValid = isValid && ReadCacheArray(fp, m_Scene.unpackedVertices);
+    isValid = isValid && ReadCacheArray(fp, m_Scene.indices);
+    isValid = isValid && ReadCacheArray(fp, m_Scene.primitives);
+    isValid = isValid && fread(&m_Scene.aabb, sizeof(m_Scene.aabb), 1, fp) == 1;
+
+    // Texture data is not duplicated, textures are loaded from their own files ("name" is the full path)
+    std::vector<std::string> textureNames(isValid ? header.textureNum : 0);
+    for (std::string& textureName : textureNames)
+    {
+        uint32_t length = 0;
+        isValid = isValid && fread(&length, sizeof(length), 1, fp) == 1;
+        if (isValid)
+        {
+            textureName.resize(length);
+            isValid = fread(&textureName[0], 1, length, fp) == length;
+        }
+    }
+
+    isValid = isValid && ReadCacheArray(fp, m_CachedPrimitiveData);
+
+    fclose(fp);
+
+    for (size_t i = 0; i < textureNames.size() && isValid; i++)
+    {
+        utils::Texture* texture = new utils::Texture;
+        m_Scene.textures.push_back(texture);
+        isValid = utils::LoadTexture(textureNames[i], *texture);
+    }
+
+    // A broken or outdated cache falls back to parsing
+    if (!isValid)
+    {
+        m_Scene.UnloadResources();
+        m_Scene = utils::Scene();
+        m_CachedPrimitiveData.clear();
+
+        return false;
+    }
+
+    m_DefaultInstancesOffset = header.defaultInstancesOffset;
+    printf("Scene cache: '%s' is up to date\n", GetSceneCachePath().c_str());
+
+    return true;
+}
+
+bool Sample::LoadPrimitiveDataCache(std::vector<PrimitiveData>& primitiveData)
+{
+    // Empty if the scene was parsed or the previous run used the compact layout
+    const bool isValid = m_CachedPrimitiveData.size() == primitiveData.size();
+    if (isValid)
+        primitiveData.swap(m_CachedPrimitiveData);
+
+    m_CachedPrimitiveData = std::vector<PrimitiveData>();
+
+    return isValid;
+}
+
+bool Sample::LoadQualityReference(uint32_t test)
+{
+    const std::string path = GetQualityReferencePath(test);
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (!fp)
+        return false;
+
+    QualityReferenceHeader header = {};
+    bool isValid = fread(&header, sizeof(header), 1, fp) == 1;
+    isValid = isValid && header.magic == QUALITY_REFERENCE_MAGIC && header.frameNum == m_QualityReferenceFrameNum && header.sourceHash == m_QualitySourceHash;
+    isValid = isValid && header.width == m_OutputResolution.x && header.height == m_OutputResolution.y;
+
+    // The previous upload is long done, i.e. the staging buffer is free
+    if (isValid)
+    {
+        const size_t size = (size_t)GetQualityReferenceSize();
+        void* data = NRI.MapBuffer(*m_QualityUploadBuffer, 0, size);
+        isValid = fread(data, 1, size, fp) == size;
+        NRI.UnmapBuffer(*m_QualityUploadBuffer);
+    }
+
+    fclose(fp);
+
+    if (isValid)
+        printf("Quality: reference '%s' is up to date\n", path.c_str());
+
+    return isValid;
+}
+
+void Sample::SaveQualityReference(uint32_t test, const void* data) const
+{
+    const std::string path = GetQualityReferencePath(test);
+    FILE* fp = fopen(path.c_str(), "wb");
+    if (!fp)
+    {
+        printf("Quality: can't write '%s'\n", path.c_str());
+        return;
+    }
+
+    QualityReferenceHeader header = {};
+    header.magic = QUALITY_REFERENCE_MAGIC;
+    header.frameNum = m_QualityReferenceFrameNum;
+    header.width = m_OutputResolution.x;
+    header.height = m_OutputResolution.y;
+    header.sourceHash = m_QualitySourceHash;
+
+    fwrite(&header, sizeof(header), 1, fp);
+    fwrite(data, 1, (size_t)GetQualityReferenceSize(), fp);
+    fclose(fp);
+
+    printf("Quality: reference saved to '%s'\n", path.c_str());
+}
+
+void Sample::SaveSceneCache(const std::vector<PrimitiveData>& primitiveData) const
+{
+    // Animations are node trees, scenes having them are always parsed
+    if (!m_Scene.animations.empty())
+        return;
+
+    FILE* fp = fopen(GetSceneCachePath().c_str(), "wb");
+    if (!fp)
+    {
+        printf("Scene cache: can't write '%s'\n", GetSceneCachePath().c_str());
+        return;
+    }
+
+    // The valid header goes last, i.e. an interrupted write leaves an invalid cache behind
+    SceneCacheHeader header = {};
+    header.version = SCENE_CACHE_VERSION;
+    header.sourceHash = m_SceneHash;
+    header.defaultInstancesOffset = m_DefaultInstancesOffset;
+    header.textureNum = helper::GetCountOf(m_Scene.textures);
+
+    fwrite(&header, sizeof(header), 1, fp);
+    WriteCacheArray(fp, m_Scene.meshes);
+    WriteCacheArray(fp, m_Scene.instances);
+    WriteCacheArray(fp, m_Scene.materials);
+    WriteCacheArray(fp, m_Scene.vertices);
+    WriteCacheArray(fp, m_Scene.unpackedVertices);
+    WriteCacheArray(fp, m_Scene.indices);
+    WriteCacheArray(fp, m_Scene.primitives);
+    fwrite(&m_Scene.aabb, sizeof(m_Scene.aabb), 1, fp);
+
+    for (const utils::Texture* texture : m_Scene.textures)
+    {
+        const uint32_t length = (uint32_t)texture->name.size();
+        fwrite(&length, sizeof(length), 1, fp);
+        fwrite(texture->name.data(), 1, length, fp);
+    }
+
+    WriteCacheArray(fp, primitiveData);
+
+    header.magic = SCENE_CACHE_MAGIC;
+    fseek(fp, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, fp);
+    fclose(fp);
+}
+
 void Sample::LoadScene()
 {
-    std::string sceneFile = utils::GetFullPath("Cubes/Cubes.obj", utils::DataFolder::SCENES);
-    NRI_ABORT_ON_FALSE( utils::LoadScene(sceneFile, m_Scene, false) );
-    m_DefaultInstancesOffset = helper::GetCountOf(m_Scene.meshes);
+    const std::string defaultSceneFile = utils::GetFullPath("Cubes/Cubes.obj", utils::DataFolder::SCENES);
+    const std::string sceneFile = utils::GetFullPath(m_SceneFile, utils::DataFolder::SCENES);
+    m_SceneHash = HashFileStamp(defaultSceneFile, FNV_OFFSET_BASIS);
+    m_SceneHash = HashFileStamp(sceneFile, m_SceneHash);
+
+    // Warm loads skip parsing
+    m_IsSceneCached = LoadSceneCache();
+    if (!m_IsSceneCached)
+    {
+        NRI_ABORT_ON_FALSE( utils::LoadScene(defaultSceneFile, m_Scene, false) );
+        m_DefaultInstancesOffset = helper::GetCountOf(m_Scene.meshes);
+
+        NRI_ABORT_ON_FALSE( utils::LoadScene(sceneFile, m_Scene, false) );
+    }
 
-    sceneFile = utils::GetFullPath(m_SceneFile, utils::DataFolder::SCENES);
-    NRI_ABORT_ON_FALSE( utils::LoadScene(sceneFile, m_Scene, false) );
+    // Cached quality references are invalidated by changes of the scene or its tests
+    if (m_IsQuality)
+        m_QualitySourceHash = HashFile(GetTestPath(), m_SceneHash);
 
     if (m_SceneFile.find("BistroInterior") != std::string::npos)
     {
@@ -2883,72 +7843,317 @@ void Sample::LoadScene()
         m_Settings.emission = true;
         m_Settings.specHitDistScale = 10.0f;
     }
-    else if (m_SceneFile.find("ShaderBalls") != std::string::npos)
+    else if (m_SceneFile.find("ShaderBalls") != std::string::npos)
+    {
+        m_Settings.exposure = 0.00017f;
+        m_Settings.specSecondBounce = true;
+        m_Settings.diffSecondBounce = false;
+        m_Settings.skyAmbient = 10.0f;
+    }
+    else if (m_SceneFile.find("ZeroDay") != std::string::npos)
+    {
+        m_Settings.exposure = 0.0025f;
+        m_Settings.emissionIntensity = 23000.0f;
+        m_Settings.emission = true;
+        m_Settings.roughnessOverride = 0.07f;
+        m_Settings.metalnessOverride = 0.25f;
+        m_Settings.specSecondBounce = true;
+        m_Settings.camFov = 75.0f;
+        m_Settings.indirectFullBrdf = false;
+        m_Settings.primaryFullBrdf = false;
+        m_Settings.animationSpeed = -0.6f;
+        m_Settings.sunElevation = -90.0f;
+        m_Settings.sunAngularDiameter = 0.0f;
+        m_Settings.diffHitDistScale = 2.0f;
+        m_Settings.specHitDistScale = 2.0f;
+    }
+}
+
+void Sample::AddFramePass(const FramePassDesc& framePassDesc, std::function<void(nri::CommandBuffer&)>&& execute)
+{
+    assert( framePassDesc.isAsyncCompute || m_FramePasses.empty() || m_FramePasses.back().commandBufferIndex <= framePassDesc.commandBufferIndex );
+
+    FramePass framePass = {};
+    framePass.execute = std::move(execute);
+    framePass.name = framePassDesc.name;
+    framePass.textureOffset = helper::GetCountOf(m_FramePassTextures);
+    framePass.textureNum = framePassDesc.textureNum;
+    framePass.bufferOffset = helper::GetCountOf(m_FramePassBuffers);
+    framePass.bufferNum = framePassDesc.bufferNum;
+    framePass.untrackedTextureOffset = helper::GetCountOf(m_FramePassUntrackedTextures);
+    framePass.untrackedTextureNum = framePassDesc.untrackedTextureNum;
+    framePass.stage = framePassDesc.stage;
+    framePass.isExternal = framePassDesc.isExternal;
+    framePass.isAsyncCompute = framePassDesc.isAsyncCompute;
+    framePass.commandBufferIndex = framePassDesc.isAsyncCompute ? (m_FramePasses.empty() ? 0 : m_FramePasses.back().commandBufferIndex) : framePassDesc.commandBufferIndex;
+    m_FramePasses.push_back(framePass);
+
+    m_FramePassTextures.insert(m_FramePassTextures.end(), framePassDesc.textures, framePassDesc.textures + framePassDesc.textureNum);
+    m_FramePassBuffers.insert(m_FramePassBuffers.end(), framePassDesc.buffers, framePassDesc.buffers + framePassDesc.bufferNum);
+    m_FramePassUntrackedTextures.insert(m_FramePassUntrackedTextures.end(), framePassDesc.untrackedTextures, framePassDesc.untrackedTextures + framePassDesc.untrackedTextureNum);
+}
+
+void Sample::CompileFrameGraph()
+{
+    // Every transition is hoisted to the earliest point where it's legal (right after the previous use of the texture or, for aliased textures, of any texture sharing its memory),
+    // so barriers of independent passes end up merged into a single batch. NRI has no split barriers, hoisting is the closest analogue
+    constexpr int32_t PREVIOUS_FRAME = -1;
+
+    // Async compute passes are recorded by the job of the next graphics pass
+    for (uint32_t passIndex = helper::GetCountOf(m_FramePasses); passIndex > 1; passIndex--)
+    {
+        if (m_FramePasses[passIndex - 2].isAsyncCompute)
+            m_FramePasses[passIndex - 2].commandBufferIndex = m_FramePasses[passIndex - 1].commandBufferIndex;
+    }
+
+    // States are simulated up front, so command buffers can be recorded in any order
+    std::vector<int32_t> lastUses(m_Textures.size(), PREVIOUS_FRAME);
+    m_FrameTextureStates = m_TextureStates;
+    m_FramePassTextureStates.resize(m_FramePassTextures.size());
+    m_FrameBarriers.clear();
+
+    for (uint32_t passIndex = 0; passIndex < m_FramePasses.size(); passIndex++)
+    {
+        const FramePass& framePass = m_FramePasses[passIndex];
+
+        for (uint32_t i = 0; i < framePass.textureNum; i++)
+        {
+            const TextureState& state = m_FramePassTextures[framePass.textureOffset + i];
+            nri::TextureTransitionBarrierDesc& textureState = m_FrameTextureStates[(uint32_t)state.texture];
+            int32_t prevUse = lastUses[(uint32_t)state.texture];
+
+            // Aliasing
+            bool isAliasing = false;
+            for (TransientTexture& transientTexture : m_TransientTextures)
+            {
+                if (transientTexture.texture != state.texture || transientTexture.isResident)
+                    continue;
+
+                for (TransientTexture& other : m_TransientTextures)
+                {
+                    bool isOverlapped = &other != &transientTexture && other.memory == transientTexture.memory && other.offset < transientTexture.offset + transientTexture.size && transientTexture.offset < other.offset + other.size;
+                    if (isOverlapped)
+                    {
+                        prevUse = Max(prevUse, lastUses[(uint32_t)other.texture]);
+                        other.isResident = false;
+                    }
+                }
+
+                transientTexture.isResident = true;
+                isAliasing = true;
+            }
+
+            // Transitions of external passes are done by the passes themselves
+            bool isStateChanged = textureState.nextAccess != state.nextAccess || textureState.nextLayout != state.nextLayout;
+            bool isStorageBarrier = textureState.nextAccess == nri::AccessBits::SHADER_RESOURCE_STORAGE && state.nextAccess == nri::AccessBits::SHADER_RESOURCE_STORAGE;
+            if (!isAliasing && (framePass.isExternal || !(isStateChanged || isStorageBarrier)))
+                continue;
+
+            // Barriers are recorded on the queue of the consumer. Across queues hoisting is not possible, the consumer must be recorded after the queues get synchronized
+            uint32_t batchIndex = uint32_t(prevUse + 1);
+            if (prevUse != PREVIOUS_FRAME && m_FramePasses[prevUse].isAsyncCompute != framePass.isAsyncCompute)
+                batchIndex = passIndex;
+            while (m_FramePasses[batchIndex].isAsyncCompute != framePass.isAsyncCompute)
+                batchIndex++;
+
+            FrameBarrier frameBarrier = {};
+            frameBarrier.transition = nri::TextureTransition(textureState, state.nextAccess, state.nextLayout);
+            frameBarrier.texture = state.texture;
+            frameBarrier.batchIndex = batchIndex;
+            frameBarrier.srcStage = prevUse == PREVIOUS_FRAME ? nri::BarrierDependency::ALL_STAGES : m_FramePasses[prevUse].stage;
+            frameBarrier.dstStage = framePass.stage;
+            frameBarrier.isAliasing = isAliasing;
+            m_FrameBarriers.push_back(frameBarrier);
+        }
+
+        // External passes see the states they start with and are expected to leave declared states behind ("RecordFramePass" enforces that)
+        for (uint32_t i = 0; i < framePass.textureNum && framePass.isExternal; i++)
+        {
+            const TextureState& state = m_FramePassTextures[framePass.textureOffset + i];
+            nri::TextureTransitionBarrierDesc& textureState = m_FrameTextureStates[(uint32_t)state.texture];
+
+            m_FramePassTextureStates[framePass.textureOffset + i] = textureState;
+            nri::TextureTransition(textureState, state.nextAccess, state.nextLayout);
+        }
+
+        for (uint32_t i = 0; i < framePass.textureNum; i++)
+            lastUses[(uint32_t)m_FramePassTextures[framePass.textureOffset + i].texture] = (int32_t)passIndex;
+    }
+}
+
+void Sample::RecordFramePass(uint32_t passIndex, nri::CommandBuffer& commandBuffer, std::vector<nri::TextureTransitionBarrierDesc>& transitions)
+{
+    const FramePass& framePass = m_FramePasses[passIndex];
+    CPU_ZONE(framePass.name);
+
+    // The annotation must be closed before "EndCommandBuffer"
+    helper::Annotation annotation(NRI, commandBuffer, framePass.name);
+
+    // Batch
+    std::array<nri::TextureAliasingBarrierDesc, 8> aliasingTextureBarriers = {};
+    uint32_t aliasingTextureBarrierNum = 0;
+    transitions.clear();
+
+    nri::BarrierDependency dependency = nri::BarrierDependency::ALL_STAGES;
+    bool isDependencyKnown = false;
+    for (const FrameBarrier& frameBarrier : m_FrameBarriers)
+    {
+        if (frameBarrier.batchIndex != passIndex)
+            continue;
+
+        if (frameBarrier.isAliasing)
+        {
+            assert( aliasingTextureBarrierNum < aliasingTextureBarriers.size() );
+            aliasingTextureBarriers[aliasingTextureBarrierNum++] = {nullptr, Get(frameBarrier.texture), frameBarrier.transition.nextAccess, frameBarrier.transition.nextLayout};
+        }
+        else
+            transitions.push_back(frameBarrier.transition);
+
+        // A single stage only if all batched barriers are between passes of the same kind
+        if (!isDependencyKnown)
+        {
+            dependency = frameBarrier.srcStage == frameBarrier.dstStage ? frameBarrier.srcStage : nri::BarrierDependency::ALL_STAGES;
+            isDependencyKnown = true;
+        }
+        else if (frameBarrier.srcStage != dependency || frameBarrier.dstStage != dependency)
+            dependency = nri::BarrierDependency::ALL_STAGES;
+    }
+
+    const nri::TextureTransitionBarrierDesc* untrackedTextures = m_FramePassUntrackedTextures.data() + framePass.untrackedTextureOffset;
+    transitions.insert(transitions.end(), untrackedTextures, untrackedTextures + framePass.untrackedTextureNum);
+
+    // Untracked resources come from unknown stages
+    if (framePass.bufferNum || framePass.untrackedTextureNum)
+        dependency = nri::BarrierDependency::ALL_STAGES;
+
+    if (!transitions.empty() || framePass.bufferNum || aliasingTextureBarrierNum)
+    {
+        nri::TransitionBarrierDesc transitionBarriers = {};
+        transitionBarriers.textures = transitions.data();
+        transitionBarriers.textureNum = helper::GetCountOf(transitions);
+        transitionBarriers.buffers = m_FramePassBuffers.data() + framePass.bufferOffset;
+        transitionBarriers.bufferNum = framePass.bufferNum;
+
+        nri::AliasingBarrierDesc aliasingBarriers = {};
+        aliasingBarriers.textures = aliasingTextureBarriers.data();
+        aliasingBarriers.textureNum = aliasingTextureBarrierNum;
+
+        NRI.CmdPipelineBarrier(commandBuffer, &transitionBarriers, aliasingTextureBarrierNum ? &aliasingBarriers : nullptr, dependency);
+    }
+
+    // External passes track states via "GetState", which is touched only by the job recording them
+    const TextureState* textures = m_FramePassTextures.data() + framePass.textureOffset;
+    if (framePass.isExternal)
     {
-        m_Settings.exposure = 0.00017f;
-        m_Settings.specSecondBounce = true;
-        m_Settings.diffSecondBounce = false;
-        m_Settings.skyAmbient = 10.0f;
+        for (uint32_t i = 0; i < framePass.textureNum; i++)
+            GetState(textures[i].texture) = m_FramePassTextureStates[framePass.textureOffset + i];
     }
-    else if (m_SceneFile.find("ZeroDay") != std::string::npos)
+
+    // Pass
+    framePass.execute(commandBuffer);
+
+    if (framePass.isExternal)
     {
-        m_Settings.exposure = 0.0025f;
-        m_Settings.emissionIntensity = 23000.0f;
-        m_Settings.emission = true;
-        m_Settings.roughnessOverride = 0.07f;
-        m_Settings.metalnessOverride = 0.25f;
-        m_Settings.specSecondBounce = true;
-        m_Settings.camFov = 75.0f;
-        m_Settings.indirectFullBrdf = false;
-        m_Settings.primaryFullBrdf = false;
-        m_Settings.animationSpeed = -0.6f;
-        m_Settings.sunElevation = -90.0f;
-        m_Settings.sunAngularDiameter = 0.0f;
-        m_Settings.diffHitDistScale = 2.0f;
-        m_Settings.specHitDistScale = 2.0f;
+        transitions.clear();
+        for (uint32_t i = 0; i < framePass.textureNum; i++)
+        {
+            nri::TextureTransitionBarrierDesc& transition = GetState(textures[i].texture);
+            if (transition.nextAccess != textures[i].nextAccess || transition.nextLayout != textures[i].nextLayout)
+                transitions.push_back( nri::TextureTransition(transition, textures[i].nextAccess, textures[i].nextLayout) );
+        }
+
+        if (!transitions.empty())
+        {
+            nri::TransitionBarrierDesc transitionBarriers = {};
+            transitionBarriers.textures = transitions.data();
+            transitionBarriers.textureNum = helper::GetCountOf(transitions);
+            NRI.CmdPipelineBarrier(commandBuffer, &transitionBarriers, nullptr, framePass.stage);
+        }
     }
 }
 
-uint32_t Sample::BuildOptimizedTransitions(const TextureState* states, uint32_t stateNum, nri::TextureTransitionBarrierDesc* transitions, uint32_t transitionMaxNum)
+void Sample::ExecuteFrameGraph(const Frame& frame)
 {
-    uint32_t n = 0;
+    CPU_ZONE("ExecuteFrameGraph");
 
-    for (uint32_t i = 0; i < stateNum; i++)
+    // "commandBuffers[0]" must be in the recording state, the last one is left in the recording state
+    CompileFrameGraph();
+
+    // A job per graphics command buffer, each has its own allocator
+    const uint32_t jobNum = helper::GetCountOf(frame.commandBuffers);
+    m_WorkerPool.Execute(jobNum, [&](uint32_t jobIndex)
     {
-        const TextureState& state = states[i];
-        nri::TextureTransitionBarrierDesc& transition = GetState(state.texture);
+        nri::CommandBuffer& commandBuffer = *frame.commandBuffers[jobIndex];
+        std::vector<nri::TextureTransitionBarrierDesc> transitions;
+        bool isRecording = jobIndex == 0;
 
-        bool isStateChanged = transition.nextAccess != state.nextAccess || transition.nextLayout != state.nextLayout;
-        bool isStorageBarrier = transition.nextAccess == nri::AccessBits::SHADER_RESOURCE_STORAGE && state.nextAccess == nri::AccessBits::SHADER_RESOURCE_STORAGE;
-        if (isStateChanged || isStorageBarrier)
+        for (uint32_t passIndex = 0; passIndex < m_FramePasses.size(); passIndex++)
         {
-            assert( n < transitionMaxNum );
-            transitions[n++] = nri::TextureTransition(transition, state.nextAccess, state.nextLayout);
+            const FramePass& framePass = m_FramePasses[passIndex];
+            if (framePass.commandBufferIndex != jobIndex)
+                continue;
+
+            if (framePass.isAsyncCompute)
+            {
+                NRI.BeginCommandBuffer(*frame.computeCommandBuffer, framePass.isExternal ? nullptr : m_DescriptorPool, 0);
+                RecordFramePass(passIndex, *frame.computeCommandBuffer, transitions);
+                NRI.EndCommandBuffer(*frame.computeCommandBuffer);
+
+                continue;
+            }
+
+            if (!isRecording)
+            {
+                NRI.BeginCommandBuffer(commandBuffer, framePass.isExternal ? nullptr : m_DescriptorPool, 0);
+                isRecording = true;
+            }
+
+            RecordFramePass(passIndex, commandBuffer, transitions);
         }
-    }
 
-    return n;
+        if (!isRecording)
+            NRI.BeginCommandBuffer(commandBuffer, m_DescriptorPool, 0);
+
+        if (jobIndex + 1 != jobNum)
+            NRI.EndCommandBuffer(commandBuffer);
+    });
+
+    // External passes have left declared states behind, i.e. the simulation matches
+    m_TextureStates = m_FrameTextureStates;
+
+    m_FramePasses.clear();
+    m_FramePassTextures.clear();
+    m_FramePassBuffers.clear();
+    m_FramePassUntrackedTextures.clear();
 }
 
 void Sample::RenderFrame(uint32_t frameIndex)
 {
-    std::array<nri::TextureTransitionBarrierDesc, 32> optimizedTransitions = {};
+    CPU_ZONE("RenderFrame");
 
-    const uint32_t bufferedFrameIndex = frameIndex % BUFFERED_FRAME_MAX_NUM;
+    const uint32_t bufferedFrameIndex = frameIndex % m_FrameInFlightNum;
     const Frame& frame = m_Frames[bufferedFrameIndex];
-    const uint32_t backBufferIndex = NRI.AcquireNextSwapChainTexture(*m_SwapChain, *m_BackBufferAcquireSemaphore);
+    // Offline capture doesn't present
+    const uint32_t backBufferIndex = m_IsCapture ? 0 : NRI.AcquireNextSwapChainTexture(*m_SwapChain, *m_BackBufferAcquireSemaphore);
     const BackBuffer* backBuffer = &m_SwapChainBuffers[backBufferIndex];
     const bool isEven = !(frameIndex & 0x1);
     nri::TransitionBarrierDesc transitionBarriers = {};
 
-    NRI.WaitForSemaphore(*m_CommandQueue, *frame.deviceSemaphore);
-    NRI.ResetCommandAllocator(*frame.commandAllocator);
+    if (!m_IsLowLatency)
+        WaitForFrame(frameIndex);
+
+    const float2 resolutionScale = GetEffectiveResolutionScale();
+    m_TimestampFrameIndices[bufferedFrameIndex] = frameIndex;
+    const uint2 renderResolution = GetRenderResolution();
+    const uint2 timestampRectSize = GetRectSize();
+    m_TimestampPixelRatios[bufferedFrameIndex] = float(timestampRectSize.x * timestampRectSize.y) / float(renderResolution.x * renderResolution.y); // relative to the current DLSS quality
 
     UpdateConstantBuffer(frameIndex);
 
     // Sizes
-    uint32_t rectW = uint32_t(m_ScreenResolution.x * m_ResolutionScale + 0.5f);
-    uint32_t rectH = uint32_t(m_ScreenResolution.y * m_ResolutionScale + 0.5f);
+    const uint2 rectSize = GetRectSize();
+    uint32_t rectW = rectSize.x;
+    uint32_t rectH = rectSize.y;
     uint32_t outputGridW = (m_OutputResolution.x + 15) / 16;
     uint32_t outputGridH = (m_OutputResolution.y + 15) / 16;
     uint32_t screenGridW = (m_ScreenResolution.x + 15) / 16;
@@ -2956,14 +8161,34 @@ void Sample::RenderFrame(uint32_t frameIndex)
     uint32_t rectGridW = (rectW + 15) / 16;
     uint32_t rectGridH = (rectH + 15) / 16;
 
+    // Capture: the slot gets read back when this frame is waited for ("Final" format is known later)
+    CaptureSlot& captureSlot = m_CaptureSlots[bufferedFrameIndex];
+    if (m_IsCaptureFrame)
+    {
+        captureSlot.frameIndex = frameIndex + 1;
+        captureSlot.test = m_CaptureTest;
+        captureSlot.testFrame = m_CaptureRunFrame - 1 - m_BenchmarkWarmupFrameNum;
+
+        for (uint32_t i = 0; i < (uint32_t)CaptureTarget::MAX_NUM; i++)
+        {
+            captureSlot.sizes[i] = i == (uint32_t)CaptureTarget::Final ? m_OutputResolution : uint2(rectW, rectH);
+            captureSlot.formats[i] = i == (uint32_t)CaptureTarget::Final ? nri::Format::UNKNOWN : GetFormat(CAPTURE_TARGET_TEXTURES[i]);
+        }
+    }
+
     // MAIN
     NRI.BeginCommandBuffer(*frame.commandBuffers[0], m_DescriptorPool, 0);
     {
         nri::CommandBuffer& commandBuffer1 = *frame.commandBuffers[0];
 
+        NRI.CmdResetQueries(commandBuffer1, *m_TimestampQueryPool, bufferedFrameIndex * GPU_PASS_QUERY_NUM, GPU_PASS_QUERY_NUM);
+        BeginGpuPass(commandBuffer1, bufferedFrameIndex, GpuPass::Frame);
+
         // Preintegrate F (for specular) and G (for diffuse) terms (only once)
         if (frameIndex == 0)
         {
+            BeginGpuPass(commandBuffer1, bufferedFrameIndex, GpuPass::IntegrateBRDF);
+
             NRI.CmdSetPipelineLayout(commandBuffer1, *GetPipelineLayout(Pipeline::IntegrateBRDF));
             NRI.CmdSetPipeline(commandBuffer1, *Get(Pipeline::IntegrateBRDF));
             NRI.CmdSetDescriptorSets(commandBuffer1, 0, 1, &Get(DescriptorSet::IntegrateBRDF0), nullptr);
@@ -2972,6 +8197,8 @@ void Sample::RenderFrame(uint32_t frameIndex)
             const uint32_t gridHeight = (FG_TEX_SIZE + 15) / 16;
             NRI.CmdDispatch(commandBuffer1, gridWidth, gridHeight, 1);
 
+            EndGpuPass(commandBuffer1, bufferedFrameIndex, GpuPass::IntegrateBRDF);
+
             const nri::TextureTransitionBarrierDesc transitions[] =
             {
                 nri::TextureTransition(GetState(Texture::IntegrateBRDF), nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE),
@@ -2981,65 +8208,34 @@ void Sample::RenderFrame(uint32_t frameIndex)
             NRI.CmdPipelineBarrier(commandBuffer1, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
         }
 
-        { // TLAS
-            helper::Annotation annotation(NRI, commandBuffer1, "TLAS");
+        { // Texture residency, reallocations can start streaming
+            helper::Annotation annotation(NRI, commandBuffer1, "Texture residency");
 
-            BuildTopLevelAccelerationStructure(commandBuffer1, bufferedFrameIndex);
+            UpdateTextureResidency(commandBuffer1, frameIndex);
         }
 
-        { // Raytracing
-            helper::Annotation annotation(NRI, commandBuffer1, "Raytracing");
+        if (!m_StreamedTextures.empty())
+        { // Texture streaming
+            helper::Annotation annotation(NRI, commandBuffer1, "Texture streaming");
 
-            const nri::BufferTransitionBarrierDesc bufferTransitions[] =
-            {
-                { Get(Buffer::InstanceData), nri::AccessBits::COPY_DESTINATION,  nri::AccessBits::SHADER_RESOURCE },
-            };
+            // Resident mips are baked into "InstanceData"
+            m_IsStaticInstancesDirty |= StreamTextures(commandBuffer1, bufferedFrameIndex, uint32_t(-1));
 
-            const TextureState transitions[] =
+            if (m_StreamedTextures.empty() && !m_IsTextureResidency)
             {
-                // Input
-                {Texture::ComposedLighting_ViewZ, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                // Output
-                {Texture::DirectLighting, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-                {Texture::TransparentLighting, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-                {Texture::ObjectMotion, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-                {Texture::ViewZ, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-                {Texture::Normal_Roughness, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-                {Texture::BaseColor_Metalness, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-                {Texture::Unfiltered_ShadowData, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-                {Texture::Unfiltered_Shadow_Translucency, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-                {Texture::Unfiltered_Diff, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-                {Texture::DiffDirectionPdf, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-                {Texture::Unfiltered_Spec, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-                {Texture::SpecDirectionPdf, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-            };
-            transitionBarriers.textures = optimizedTransitions.data();
-            transitionBarriers.textureNum = BuildOptimizedTransitions(transitions, helper::GetCountOf(transitions), optimizedTransitions.data(), helper::GetCountOf(optimizedTransitions));
-            transitionBarriers.buffers = bufferTransitions;
-            transitionBarriers.bufferNum = helper::GetCountOf(bufferTransitions);
-            NRI.CmdPipelineBarrier(commandBuffer1, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
-            transitionBarriers.bufferNum = 0;
-
-            NRI.CmdSetPipelineLayout(commandBuffer1, *GetPipelineLayout(Pipeline::Raytracing));
-            NRI.CmdSetPipeline(commandBuffer1, *Get(Pipeline::Raytracing));
-
-            const nri::DescriptorSet* descriptorSets[] = { frame.globalConstantBufferDescriptorSet, Get(DescriptorSet::Raytracing1), Get(DescriptorSet::Raytracing2) };
-            NRI.CmdSetDescriptorSets(commandBuffer1, 0, helper::GetCountOf(descriptorSets), descriptorSets, nullptr);
+                printf("Texture streaming: %.1f MB uploaded, finished at frame %u\n", m_StreamedTextureBytes / (1024.0 * 1024.0), frameIndex);
+                m_Scene.UnloadResources();
+            }
+        }
 
-            uint32_t raygenIndex = m_Settings.rpp == 0 ? 2 : 0;
-            raygenIndex += m_Settings.specSecondBounce ? 1 : 0;
+        { // TLAS
+            helper::Annotation annotation(NRI, commandBuffer1, "TLAS");
 
-            nri::DispatchRaysDesc dispatchRaysDesc = {};
-            dispatchRaysDesc.raygenShader = { Get(Buffer::ShaderTable), m_ShaderEntries[ShaderGroup::Raytracing00_rgen + raygenIndex], m_DeviceDesc->rayTracingShaderGroupIdentifierSize, m_DeviceDesc->rayTracingShaderGroupIdentifierSize };
-            dispatchRaysDesc.missShaders = { Get(Buffer::ShaderTable), m_ShaderEntries[ShaderGroup::Main_rmiss], m_DeviceDesc->rayTracingShaderGroupIdentifierSize, m_DeviceDesc->rayTracingShaderGroupIdentifierSize };
-            dispatchRaysDesc.hitShaderGroups = { Get(Buffer::ShaderTable), m_ShaderEntries[ShaderGroup::Main_rhit], m_DeviceDesc->rayTracingShaderGroupIdentifierSize, m_DeviceDesc->rayTracingShaderGroupIdentifierSize };
-            dispatchRaysDesc.width = rectW;
-            dispatchRaysDesc.height = rectH;
-            dispatchRaysDesc.depth = 1;
-            NRI.CmdDispatchRays(commandBuffer1, dispatchRaysDesc);
+            BeginGpuPass(commandBuffer1, bufferedFrameIndex, GpuPass::Tlas);
+            BuildTopLevelAccelerationStructure(commandBuffer1, bufferedFrameIndex);
+            EndGpuPass(commandBuffer1, bufferedFrameIndex, GpuPass::Tlas);
         }
     }
-    NRI.EndCommandBuffer(*frame.commandBuffers[0]);
 
     // DENOISING
     float sunCurr = Smoothstep( -0.9f, 0.05f, Sin( DegToRad(m_Settings.sunElevation) ) );
@@ -3056,309 +8252,751 @@ void Sample::RenderFrame(uint32_t frameIndex)
         resetHistoryFactor = 0.0f;
     if (m_ForceHistoryReset)
         resetHistoryFactor = 0.0f;
+    m_ForceHistoryReset = false; // the UI sets it every frame, but tests can be loaded with the UI hidden
+
+    const bool isDlssHistoryReset = m_IsDlssHistoryReset;
+    m_IsDlssHistoryReset = false;
+
+    uint32_t maxAccumulatedFrameNum = uint32_t(m_Settings.nrdSettings.maxAccumulatedFrameNum * resetHistoryFactor + 0.5f);
+    uint32_t maxFastAccumulatedFrameNum = uint32_t(m_Settings.nrdSettings.maxFastAccumulatedFrameNum * resetHistoryFactor + 0.5f);
+
+    // NRD inputs are shared by all denoisers
+    float2 jitter = m_Settings.TAA ? m_Camera.state.viewportJitter : 0.0f;
+
+    nrd::CommonSettings commonSettings = {};
+    memcpy(commonSettings.viewToClipMatrix, &m_Camera.state.mViewToClip, sizeof(m_Camera.state.mViewToClip));
+    memcpy(commonSettings.viewToClipMatrixPrev, &m_Camera.statePrev.mViewToClip, sizeof(m_Camera.statePrev.mViewToClip));
+    memcpy(commonSettings.worldToViewMatrix, &m_Camera.state.mWorldToView, sizeof(m_Camera.state.mWorldToView));
+    memcpy(commonSettings.worldToViewMatrixPrev, &m_Camera.statePrev.mWorldToView, sizeof(m_Camera.statePrev.mWorldToView));
+    commonSettings.motionVectorScale[0] = m_Settings.isMotionVectorInWorldSpace ? 1.0f : 1.0f / float(rectW);
+    commonSettings.motionVectorScale[1] = m_Settings.isMotionVectorInWorldSpace ? 1.0f : 1.0f / float(rectH);
+    commonSettings.cameraJitter[0] = jitter.x;
+    commonSettings.cameraJitter[1] = jitter.y;
+    commonSettings.resolutionScale[0] = resolutionScale.x;
+    commonSettings.resolutionScale[1] = resolutionScale.y;
+    commonSettings.meterToUnitsMultiplier = m_Settings.meterToUnitsMultiplier;
+    commonSettings.denoisingRange = 4.0f * m_Scene.aabb.GetRadius() / m_Settings.meterToUnitsMultiplier;
+    commonSettings.disocclusionThreshold = m_Settings.nrdSettings.disocclusionThreshold * 0.01f;
+    commonSettings.splitScreen = m_Settings.separator;
+    commonSettings.debug = m_Settings.debug;
+    commonSettings.frameIndex = frameIndex;
+    commonSettings.accumulationMode = resetHistoryFactor == 0.0f ? nrd::AccumulationMode::CLEAR_AND_RESTART : nrd::AccumulationMode::CONTINUE;
+    commonSettings.isMotionVectorInWorldSpace = m_Settings.isMotionVectorInWorldSpace;
+    commonSettings.isRadianceMultipliedByExposure = true;
+
+    nrd::SigmaShadowSettings shadowSettings = {};
+
+    NrdUserPool userPool =
+    {{
+        // IN_MV
+        {&GetState(Texture::ObjectMotion), GetFormat(Texture::ObjectMotion)},
+
+        // IN_NORMAL_ROUGHNESS
+        {&GetState(Texture::Normal_Roughness), GetFormat(Texture::Normal_Roughness)},
+
+        // IN_VIEWZ
+        {&GetState(Texture::ViewZ), GetFormat(Texture::ViewZ)},
+
+        // IN_DIFF_RADIANCE_HITDIST
+        {&GetState(Texture::Unfiltered_Diff), GetFormat(Texture::Unfiltered_Diff)},
+
+        // IN_SPEC_RADIANCE_HITDIST
+        {&GetState(Texture::Unfiltered_Spec), GetFormat(Texture::Unfiltered_Spec)},
+
+        // IN_DIFF_HITDIST
+        {&GetState(Texture::Unfiltered_Diff), GetFormat(Texture::Unfiltered_Diff)}, // needed for occlusion-only mode
+
+        // IN_SPEC_HITDIST
+        {&GetState(Texture::Unfiltered_Spec), GetFormat(Texture::Unfiltered_Spec)}, // needed for occlusion-only mode
+
+        // IN_DIFF_DIRECTION_PDF
+        {&GetState(Texture::DiffDirectionPdf), GetFormat(Texture::DiffDirectionPdf)},
+
+        // IN_SPEC_DIRECTION_PDF
+        {&GetState(Texture::SpecDirectionPdf), GetFormat(Texture::SpecDirectionPdf)},
+
+        // IN_DIFF_CONFIDENCE
+        {nullptr, nri::Format::UNKNOWN},
+
+        // IN_SPEC_CONFIDENCE
+        {nullptr, nri::Format::UNKNOWN},
+
+        // IN_SHADOWDATA
+        {&GetState(Texture::Unfiltered_ShadowData), GetFormat(Texture::Unfiltered_ShadowData)},
+
+        // IN_SHADOW_TRANSLUCENCY
+        {&GetState(Texture::Unfiltered_Shadow_Translucency), GetFormat(Texture::Unfiltered_Shadow_Translucency)},
+
+        // OUT_SHADOW_TRANSLUCENCY
+        {&GetState(Texture::Shadow), GetFormat(Texture::Shadow)},
+
+        // OUT_DIFF_RADIANCE_HITDIST
+        {&GetState(Texture::Diff), GetFormat(Texture::Diff)},
+
+        // OUT_SPEC_RADIANCE_HITDIST
+        {&GetState(Texture::Spec), GetFormat(Texture::Spec)},
+
+        // OUT_DIFF_HITDIST
+        {&GetState(Texture::Diff), GetFormat(Texture::Diff)}, // needed for occlusion-only mode
+
+        // OUT_SPEC_HITDIST
+        {&GetState(Texture::Spec), GetFormat(Texture::Spec)}, // needed for occlusion-only mode
+    }};
+
+    // FRAME GRAPH: passes declare what they read and write, barriers are batched and issued by "ExecuteFrameGraph"
+    const Texture taaSrc = isEven ? Texture::TaaHistoryPrev : Texture::TaaHistory;
+    const Texture taaDst = isEven ? Texture::TaaHistory : Texture::TaaHistoryPrev;
+    Texture finalResult = Texture::Final;
+
+    // Ray tracing outputs, with "--multiGpu" peer GPUs produce their bands of them
+    const Texture raytracingOutputs[] =
+    {
+        Texture::DirectLighting,
+        Texture::TransparentLighting,
+        Texture::ObjectMotion,
+        Texture::ViewZ,
+        Texture::Normal_Roughness,
+        Texture::BaseColor_Metalness,
+        Texture::Unfiltered_ShadowData,
+        Texture::Unfiltered_Shadow_Translucency,
+        Texture::Unfiltered_Diff,
+        Texture::Unfiltered_Spec,
+        Texture::DiffDirectionPdf, // 1x1 placeholders with "--compactResources", must be last
+        Texture::SpecDirectionPdf,
+    };
+    const uint32_t raytracingOutputNum = helper::GetCountOf(raytracingOutputs) - (m_IsCompactResources ? 2 : 0);
+
+    uint32_t raygenIndex = (uint32_t)Min(m_Settings.rpp, 2);
+    raygenIndex = (raygenIndex << 1) | (m_Settings.specSecondBounce ? 1 : 0);
+    raygenIndex = (raygenIndex << 1) | (m_Settings.emission ? 1 : 0);
+    raygenIndex = (raygenIndex << 1) | (m_HasTransparentObjects ? 1 : 0);
+
+    { // Raytracing
+        const nri::BufferTransitionBarrierDesc bufferTransitions[] =
+        {
+            { Get(Buffer::MipFeedback), nri::AccessBits::COPY_SOURCE,  nri::AccessBits::SHADER_RESOURCE_STORAGE },
+            { Get(Buffer::LightData), nri::AccessBits::COPY_DESTINATION,  nri::AccessBits::SHADER_RESOURCE },
+            { Get(Buffer::InstanceData), nri::AccessBits::COPY_DESTINATION,  nri::AccessBits::SHADER_RESOURCE },
+        };
+        const uint32_t bufferOffset = m_IsTextureResidency ? 0 : 1;
+
+        const TextureState transitions[] =
+        {
+            // Input
+            {Texture::ComposedLighting_ViewZ, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+            {Texture::SampleNum, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+            // Output
+            {Texture::DirectLighting, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+            {Texture::TransparentLighting, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+            {Texture::ObjectMotion, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+            {Texture::ViewZ, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+            {Texture::Normal_Roughness, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+            {Texture::BaseColor_Metalness, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+            {Texture::Unfiltered_ShadowData, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+            {Texture::Unfiltered_Shadow_Translucency, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+            {Texture::Unfiltered_Diff, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+            {Texture::DiffDirectionPdf, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+            {Texture::Unfiltered_Spec, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+            {Texture::SpecDirectionPdf, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+        };
+
+        FramePassDesc framePassDesc = {};
+        framePassDesc.name = "Raytracing";
+        framePassDesc.textures = transitions;
+        framePassDesc.textureNum = helper::GetCountOf(transitions);
+        framePassDesc.buffers = bufferTransitions + bufferOffset;
+        framePassDesc.bufferNum = (m_IsInstanceDataHostVisible ? 2 : 3) - bufferOffset;
+        framePassDesc.commandBufferIndex = 0;
+        framePassDesc.stage = nri::BarrierDependency::RAYTRACING_STAGE;
+
+        AddFramePass(framePassDesc, [&](nri::CommandBuffer& commandBuffer1)
+        {
+            auto DispatchRays = [&](uint32_t shaderGroup, uint32_t width, uint32_t height)
+            {
+                NRI.CmdSetPipelineLayout(commandBuffer1, *GetPipelineLayout(Pipeline::Raytracing));
+                NRI.CmdSetPipeline(commandBuffer1, *Get(Pipeline::Raytracing));
+
+                const nri::DescriptorSet* descriptorSets[] = { frame.globalConstantBufferDescriptorSet, Get(DescriptorSet::Raytracing1), frame.raytracing2DescriptorSet };
+                NRI.CmdSetDescriptorSets(commandBuffer1, 0, helper::GetCountOf(descriptorSets), descriptorSets, nullptr);
+
+                nri::DispatchRaysDesc dispatchRaysDesc = {};
+                dispatchRaysDesc.raygenShader = { Get(Buffer::ShaderTable), m_ShaderEntries[shaderGroup], m_DeviceDesc->rayTracingShaderGroupIdentifierSize, m_DeviceDesc->rayTracingShaderGroupIdentifierSize };
+                dispatchRaysDesc.missShaders = { Get(Buffer::ShaderTable), m_ShaderEntries[ShaderGroup::Main_rmiss], m_DeviceDesc->rayTracingShaderGroupIdentifierSize, m_DeviceDesc->rayTracingShaderGroupIdentifierSize };
+                dispatchRaysDesc.hitShaderGroups = { Get(Buffer::ShaderTable), m_ShaderEntries[ShaderGroup::Main_rhit], m_DeviceDesc->rayTracingShaderGroupIdentifierSize, m_DeviceDesc->rayTracingShaderGroupIdentifierSize };
+                dispatchRaysDesc.width = width;
+                dispatchRaysDesc.height = height;
+                dispatchRaysDesc.depth = 1;
+
+                NRI.CmdDispatchRays(commandBuffer1, dispatchRaysDesc);
+            };
+
+            auto RayRecordsBarrier = [&]()
+            {
+                const nri::BufferTransitionBarrierDesc transitions[] =
+                {
+                    { Get(Buffer::RayRecords), nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE_STORAGE },
+                };
+
+                nri::TransitionBarrierDesc transitionBarriers = {};
+                transitionBarriers.buffers = transitions;
+                transitionBarriers.bufferNum = helper::GetCountOf(transitions);
+                NRI.CmdPipelineBarrier(commandBuffer1, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
+            };
+
+            BeginGpuPass(commandBuffer1, bufferedFrameIndex, GpuPass::Raytracing);
+
+            // See "Raytracing.rgen.hlsl" ("gSampleNum", "gBlueNoise", "gEmissionIntensity" and "gTransparent" must agree)
+            if (m_IsRaySorting && m_Settings.rpp > 1)
+            {
+                // Primary rays write a key per pixel and bin sizes, pixels get sorted by key, secondary rays are traced in this order
+                RayRecordsBarrier();
+                DispatchRays(ShaderGroup::RaytracingPrimary_rgen + (m_Settings.emission ? 2 : 0) + (m_HasTransparentObjects ? 1 : 0), rectW, rectH);
+                RayRecordsBarrier();
+
+                NRI.CmdSetPipelineLayout(commandBuffer1, *GetPipelineLayout(Pipeline::SortRays));
+                NRI.CmdSetPipeline(commandBuffer1, *Get(Pipeline::SortRays));
+
+                const nri::DescriptorSet* descriptorSets[] = { frame.globalConstantBufferDescriptorSet, Get(DescriptorSet::SortRays1) };
+                NRI.CmdSetDescriptorSets(commandBuffer1, 0, helper::GetCountOf(descriptorSets), descriptorSets, nullptr);
+
+                NRI.CmdDispatch(commandBuffer1, (rectW * rectH + RAY_SORT_GROUP_SIZE - 1) / RAY_SORT_GROUP_SIZE, 1, 1);
+                RayRecordsBarrier();
+
+                DispatchRays(ShaderGroup::RaytracingSecondary_rgen + (m_Settings.specSecondBounce ? 2 : 0) + (m_Settings.emission ? 1 : 0), rectW * rectH, 1);
+            }
+            else
+                DispatchRays(ShaderGroup::Raytracing_rgen + raygenIndex, rectW, GetRaytracingBand(0).y);
+
+            EndGpuPass(commandBuffer1, bufferedFrameIndex, GpuPass::Raytracing);
+        });
+    }
+
+    if (m_IsTextureResidency)
+    { // Mip feedback readback
+        const nri::BufferTransitionBarrierDesc bufferTransitions[] =
+        {
+            { Get(Buffer::MipFeedback), nri::AccessBits::SHADER_RESOURCE_STORAGE,  nri::AccessBits::COPY_SOURCE },
+        };
+
+        FramePassDesc framePassDesc = {};
+        framePassDesc.name = "MipFeedback";
+        framePassDesc.buffers = bufferTransitions;
+        framePassDesc.bufferNum = helper::GetCountOf(bufferTransitions);
+        framePassDesc.commandBufferIndex = 0;
+        framePassDesc.stage = nri::BarrierDependency::ALL_STAGES;
+
+        m_MipFeedbackFrameIndices[bufferedFrameIndex] = frameIndex + 1;
+
+        AddFramePass(framePassDesc, [&](nri::CommandBuffer& commandBuffer1)
+        {
+            const uint64_t size = m_Scene.materials.size() * sizeof(uint32_t);
+            NRI.CmdCopyBuffer(commandBuffer1, *m_MipFeedbackBuffer, 0, bufferedFrameIndex * size, *Get(Buffer::MipFeedback), 0, 0, size);
+        });
+    }
+
+    if (m_PhysicalDeviceNum > 1)
+    { // Peer copy
+        // Bands of peer GPUs are pulled into GPU 0 resources ("commandBuffers[1]" waits for peers)
+        std::vector<TextureState> transitions;
+        for (uint32_t i = 0; i < raytracingOutputNum; i++)
+            transitions.push_back({raytracingOutputs[i], nri::AccessBits::COPY_DESTINATION, nri::TextureLayout::GENERAL});
+
+        FramePassDesc framePassDesc = {};
+        framePassDesc.name = "PeerCopy";
+        framePassDesc.textures = transitions.data();
+        framePassDesc.textureNum = helper::GetCountOf(transitions);
+        framePassDesc.commandBufferIndex = 1;
+        framePassDesc.stage = nri::BarrierDependency::COPY_STAGE;
+
+        AddFramePass(framePassDesc, [&](nri::CommandBuffer& commandBuffer2)
+        {
+            for (uint32_t i = 1; i < m_PhysicalDeviceNum; i++)
+            {
+                const uint2 band = GetRaytracingBand(i);
+
+                nri::TextureRegionDesc region = {};
+                region.offset[1] = (uint16_t)band.x;
+                region.size[0] = (uint16_t)rectW;
+                region.size[1] = (uint16_t)band.y;
+                region.size[2] = 1;
+
+                for (uint32_t j = 0; j < raytracingOutputNum; j++)
+                    NRI.CmdCopyTexture(commandBuffer2, *Get(raytracingOutputs[j]), 0, &region, *Get(raytracingOutputs[j]), i, &region);
+            }
+        });
+    }
+
+    if (m_IsCaptureFrame && (m_CaptureTargetMask & ((1 << (uint32_t)CaptureTarget::Unfiltered_Diff) | (1 << (uint32_t)CaptureTarget::Unfiltered_Spec))))
+    { // Capture unfiltered
+        // Denoisers overwrite "Unfiltered_*" (and "Final" aliases them), i.e. they get read back right after tracing
+        std::vector<CaptureTarget> targets;
+        std::vector<TextureState> transitions;
+        for (CaptureTarget target : {CaptureTarget::Unfiltered_Diff, CaptureTarget::Unfiltered_Spec})
+        {
+            if (m_CaptureTargetMask & (1 << (uint32_t)target))
+            {
+                targets.push_back(target);
+                transitions.push_back({CAPTURE_TARGET_TEXTURES[(uint32_t)target], nri::AccessBits::COPY_SOURCE, nri::TextureLayout::GENERAL});
+            }
+        }
+
+        FramePassDesc framePassDesc = {};
+        framePassDesc.name = "CaptureUnfiltered";
+        framePassDesc.textures = transitions.data();
+        framePassDesc.textureNum = helper::GetCountOf(transitions);
+        framePassDesc.commandBufferIndex = m_PhysicalDeviceNum > 1 ? 1 : 0;
+        framePassDesc.stage = nri::BarrierDependency::COPY_STAGE;
+
+        AddFramePass(framePassDesc, [this, targets, bufferedFrameIndex](nri::CommandBuffer& commandBuffer)
+        {
+            for (CaptureTarget target : targets)
+                CmdReadbackCaptureTarget(commandBuffer, bufferedFrameIndex, target, CAPTURE_TARGET_TEXTURES[(uint32_t)target]);
+        });
+    }
+
+    // Instances for a new method set are created here, not in the recording jobs
+    NrdIntegration& denoiser = GetDenoiser();
+
+    // SIGMA runs on the compute queue in parallel with REBLUR / RELAX (there is no SIGMA in REBLUR occlusion-only mode)
+    const bool isShadowDenoisingAsync = m_IsAsyncCompute && (!m_IsOcclusionOnly || m_Settings.denoiser == RELAX);
+    if (isShadowDenoisingAsync)
+    {
+        { // Async compute handoff
+            // Everything SIGMA touches is moved into the needed state on the graphics queue, read-only inputs are shared with the other denoiser
+            const TextureState transitions[] =
+            {
+                {Texture::ObjectMotion, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                {Texture::Normal_Roughness, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                {Texture::ViewZ, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                {Texture::Unfiltered_ShadowData, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                {Texture::Unfiltered_Shadow_Translucency, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                {Texture::Shadow, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+            };
+
+            FramePassDesc framePassDesc = {};
+            framePassDesc.name = "Async compute handoff";
+            framePassDesc.textures = transitions;
+            framePassDesc.textureNum = helper::GetCountOf(transitions);
+            framePassDesc.commandBufferIndex = 0;
+            framePassDesc.stage = nri::BarrierDependency::COMPUTE_STAGE;
+
+            AddFramePass(framePassDesc, [](nri::CommandBuffer&) {});
+        }
+
+        { // Shadow denoising
+            const TextureState transitions[] =
+            {
+                // Input
+                {Texture::ObjectMotion, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                {Texture::Normal_Roughness, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                {Texture::ViewZ, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                {Texture::Unfiltered_ShadowData, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                {Texture::Unfiltered_Shadow_Translucency, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                // Output
+                {Texture::Shadow, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+            };
+
+            FramePassDesc framePassDesc = {};
+            framePassDesc.name = "Shadow denoising";
+            framePassDesc.textures = transitions;
+            framePassDesc.textureNum = helper::GetCountOf(transitions);
+            framePassDesc.stage = nri::BarrierDependency::COMPUTE_STAGE;
+            framePassDesc.isExternal = true;
+            framePassDesc.isAsyncCompute = true;
+
+            AddFramePass(framePassDesc, [&](nri::CommandBuffer& computeCommandBuffer)
+            {
+                m_Sigma.SetMethodSettings(nrd::Method::SIGMA_SHADOW_TRANSLUCENCY, &shadowSettings);
+
+                CPU_ZONE("NRD Denoise");
+                BeginGpuPass(computeCommandBuffer, bufferedFrameIndex, GpuPass::Sigma);
+                m_Sigma.Denoise(frameIndex, computeCommandBuffer, commonSettings, userPool);
+                EndGpuPass(computeCommandBuffer, bufferedFrameIndex, GpuPass::Sigma);
+            });
+        }
+    }
+
+    { // Denoising
+        // NRD does transitions on its own (states are shared via "GetState"), declared for lifetime tracking only
+        const TextureState transitions[] =
+        {
+            // Input
+            {Texture::ObjectMotion, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+            {Texture::Normal_Roughness, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+            {Texture::ViewZ, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+            {Texture::Unfiltered_Diff, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+            {Texture::Unfiltered_Spec, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+            {Texture::DiffDirectionPdf, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+            {Texture::SpecDirectionPdf, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+            {Texture::Unfiltered_ShadowData, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+            {Texture::Unfiltered_Shadow_Translucency, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+            // Output
+            {Texture::Shadow, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+            {Texture::Diff, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+            {Texture::Spec, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+        };
+
+        FramePassDesc framePassDesc = {};
+        framePassDesc.name = "Denoising";
+        framePassDesc.textures = transitions;
+        framePassDesc.textureNum = helper::GetCountOf(transitions);
+        framePassDesc.commandBufferIndex = 1;
+        framePassDesc.stage = nri::BarrierDependency::COMPUTE_STAGE;
+        framePassDesc.isExternal = true;
+
+        AddFramePass(framePassDesc, [&](nri::CommandBuffer& commandBuffer2)
+        {
+            if (m_Settings.denoiser == REBLUR)
+            {
+                const float3 trimmingParams = GetTrimmingParams();
+
+                nrd::AntilagIntensitySettings antilagIntensitySettings = {};
+                nrd::AntilagHitDistanceSettings antilagHitDistanceSettings = {};
+                GetAntilagSettings(antilagIntensitySettings, antilagHitDistanceSettings);
+
+                nrd::HitDistanceParameters diffHitDistanceParameters = {};
+                diffHitDistanceParameters.A = m_Settings.diffHitDistScale;
+
+                nrd::HitDistanceParameters specHitDistanceParameters = {};
+                specHitDistanceParameters.A = m_Settings.specHitDistScale;
+
+                // Also clamped in the UI, but tests can be loaded with the UI hidden
+                int32_t prePassMode = m_Settings.nrdSettings.prePassMode;
+                if (m_IsCompactResources)
+                    prePassMode = Min(prePassMode, (int32_t)nrd::PrePassMode::SIMPLE);
+
+                nrd::ReblurDiffuseSpecularSettings reblurSettings = {};
+                reblurSettings.diffuseSettings.hitDistanceParameters = diffHitDistanceParameters;
+                reblurSettings.diffuseSettings.antilagIntensitySettings = antilagIntensitySettings;
+                reblurSettings.diffuseSettings.antilagHitDistanceSettings = antilagHitDistanceSettings;
+                reblurSettings.diffuseSettings.maxAccumulatedFrameNum = maxAccumulatedFrameNum;
+                reblurSettings.diffuseSettings.blurRadius = m_Settings.nrdSettings.blurRadius;
+                reblurSettings.diffuseSettings.maxAdaptiveRadiusScale = m_Settings.nrdSettings.adaptiveRadiusScale;
+                reblurSettings.diffuseSettings.normalWeightStrictness = m_Settings.nrdSettings.normalWeightStrictness * (1.0f + (1 - prePassMode) * 0.33f);
+                reblurSettings.diffuseSettings.stabilizationStrength = m_Settings.nrdSettings.stabilizationStrength;
+                reblurSettings.diffuseSettings.residualNoiseLevel = m_Settings.nrdSettings.residualNoiseLevel * 0.01f;
+                reblurSettings.diffuseSettings.checkerboardMode = m_Settings.rpp == 0 ? nrd::CheckerboardMode::WHITE : nrd::CheckerboardMode::OFF;
+                reblurSettings.diffuseSettings.prePassMode = (nrd::PrePassMode)prePassMode;
+                reblurSettings.diffuseSettings.enableAntiFirefly = m_Settings.nrdSettings.enableAntiFirefly;
+                reblurSettings.diffuseSettings.enableReferenceAccumulation = m_Settings.nrdSettings.referenceAccumulation;
+
+                reblurSettings.specularSettings.hitDistanceParameters = specHitDistanceParameters;
+                reblurSettings.specularSettings.lobeTrimmingParameters = { trimmingParams.x, trimmingParams.y, trimmingParams.z };
+                reblurSettings.specularSettings.antilagIntensitySettings = antilagIntensitySettings;
+                reblurSettings.specularSettings.antilagHitDistanceSettings = antilagHitDistanceSettings;
+                reblurSettings.specularSettings.maxAccumulatedFrameNum = reblurSettings.diffuseSettings.maxAccumulatedFrameNum;
+                reblurSettings.specularSettings.blurRadius = m_Settings.nrdSettings.blurRadius;
+                reblurSettings.specularSettings.maxAdaptiveRadiusScale = m_Settings.nrdSettings.adaptiveRadiusScale;
+                reblurSettings.specularSettings.normalWeightStrictness = m_Settings.nrdSettings.normalWeightStrictness * (1.0f + (1 - prePassMode) * 0.33f);
+                reblurSettings.specularSettings.stabilizationStrength = m_Settings.nrdSettings.stabilizationStrength;
+                reblurSettings.specularSettings.residualNoiseLevel = m_Settings.nrdSettings.residualNoiseLevel * 0.01f;
+                reblurSettings.specularSettings.checkerboardMode = m_Settings.rpp == 0 ? nrd::CheckerboardMode::BLACK : nrd::CheckerboardMode::OFF;
+                reblurSettings.specularSettings.prePassMode = (nrd::PrePassMode)prePassMode;
+                reblurSettings.specularSettings.enableAntiFirefly = m_Settings.nrdSettings.enableAntiFirefly;
+                reblurSettings.specularSettings.enableReferenceAccumulation = m_Settings.nrdSettings.referenceAccumulation;
+
+                if (!m_IsOcclusionOnly)
+                {
+                    if (m_IsNrdCombined)
+                        denoiser.SetMethodSettings(nrd::Method::REBLUR_DIFFUSE_SPECULAR, &reblurSettings);
+                    else
+                    {
+                        denoiser.SetMethodSettings(nrd::Method::REBLUR_DIFFUSE, &reblurSettings.diffuseSettings);
+                        denoiser.SetMethodSettings(nrd::Method::REBLUR_SPECULAR, &reblurSettings.specularSettings);
+                    }
+
+                    if (!m_IsAsyncCompute)
+                        denoiser.SetMethodSettings(nrd::Method::SIGMA_SHADOW_TRANSLUCENCY, &shadowSettings);
+                }
+                else
+                {
+                    if (m_IsNrdCombined)
+                        denoiser.SetMethodSettings(nrd::Method::REBLUR_DIFFUSE_SPECULAR_OCCLUSION, &reblurSettings);
+                    else
+                    {
+                        denoiser.SetMethodSettings(nrd::Method::REBLUR_DIFFUSE_OCCLUSION, &reblurSettings.diffuseSettings);
+                        denoiser.SetMethodSettings(nrd::Method::REBLUR_SPECULAR_OCCLUSION, &reblurSettings.specularSettings);
+                    }
+                }
+
+                CPU_ZONE("NRD Denoise");
+                BeginGpuPass(commandBuffer2, bufferedFrameIndex, GpuPass::Reblur);
+                denoiser.Denoise(frameIndex, commandBuffer2, commonSettings, userPool);
+                EndGpuPass(commandBuffer2, bufferedFrameIndex, GpuPass::Reblur);
+            }
+            else if (m_Settings.denoiser == RELAX)
+            {
+                m_RelaxSettings.diffuseMaxAccumulatedFrameNum = maxAccumulatedFrameNum;
+                m_RelaxSettings.diffuseMaxFastAccumulatedFrameNum = maxFastAccumulatedFrameNum;
+                m_RelaxSettings.specularMaxAccumulatedFrameNum = maxAccumulatedFrameNum;
+                m_RelaxSettings.specularMaxFastAccumulatedFrameNum = maxFastAccumulatedFrameNum;
+                m_RelaxSettings.checkerboardMode = m_Settings.rpp == 0 ? nrd::CheckerboardMode::WHITE : nrd::CheckerboardMode::OFF;
+                m_RelaxSettings.enableAntiFirefly = m_Settings.nrdSettings.enableAntiFirefly;
+                m_RelaxSettings.diffusePrepassBlurRadius = (nrd::PrePassMode)m_Settings.nrdSettings.prePassMode == nrd::PrePassMode::OFF ? 0 : 50.0f;
+                m_RelaxSettings.specularPrepassBlurRadius = (nrd::PrePassMode)m_Settings.nrdSettings.prePassMode == nrd::PrePassMode::OFF ? 0 : 30.0f;
+
+                if (m_IsNrdCombined)
+                    denoiser.SetMethodSettings(nrd::Method::RELAX_DIFFUSE_SPECULAR, &m_RelaxSettings);
+                else
+                {
+                    nrd::RelaxDiffuseSettings diffuseSettings = {};
+                    diffuseSettings.prepassBlurRadius                            = m_RelaxSettings.diffusePrepassBlurRadius;
+                    diffuseSettings.diffuseMaxAccumulatedFrameNum                = m_RelaxSettings.diffuseMaxAccumulatedFrameNum;
+                    diffuseSettings.diffuseMaxFastAccumulatedFrameNum            = m_RelaxSettings.diffuseMaxFastAccumulatedFrameNum;
+                    diffuseSettings.disocclusionFixEdgeStoppingNormalPower       = m_RelaxSettings.disocclusionFixEdgeStoppingNormalPower;
+                    diffuseSettings.disocclusionFixMaxRadius                     = m_RelaxSettings.disocclusionFixMaxRadius;
+                    diffuseSettings.disocclusionFixNumFramesToFix                = m_RelaxSettings.disocclusionFixNumFramesToFix;
+                    diffuseSettings.historyClampingColorBoxSigmaScale            = m_RelaxSettings.historyClampingColorBoxSigmaScale;
+                    diffuseSettings.spatialVarianceEstimationHistoryThreshold    = m_RelaxSettings.spatialVarianceEstimationHistoryThreshold;
+                    diffuseSettings.atrousIterationNum                           = m_RelaxSettings.atrousIterationNum;
+                    diffuseSettings.diffusePhiLuminance                          = m_RelaxSettings.diffusePhiLuminance;
+                    diffuseSettings.minLuminanceWeight                           = m_RelaxSettings.minLuminanceWeight;
+                    diffuseSettings.phiNormal                                    = m_RelaxSettings.phiNormal;
+                    diffuseSettings.phiDepth                                     = m_RelaxSettings.phiDepth;
+                    diffuseSettings.checkerboardMode                             = m_Settings.rpp == 0 ? nrd::CheckerboardMode::WHITE : nrd::CheckerboardMode::OFF;
+                    diffuseSettings.enableAntiFirefly                            = m_RelaxSettings.enableAntiFirefly;
+
+                    nrd::RelaxSpecularSettings specularSettings = {};
+                    specularSettings.prepassBlurRadius                           = m_RelaxSettings.specularPrepassBlurRadius;
+                    specularSettings.specularMaxAccumulatedFrameNum              = m_RelaxSettings.specularMaxAccumulatedFrameNum;
+                    specularSettings.specularMaxFastAccumulatedFrameNum          = m_RelaxSettings.specularMaxFastAccumulatedFrameNum;
+                    specularSettings.specularVarianceBoost                       = m_RelaxSettings.specularVarianceBoost;
+                    specularSettings.disocclusionFixEdgeStoppingNormalPower      = m_RelaxSettings.disocclusionFixEdgeStoppingNormalPower;
+                    specularSettings.disocclusionFixMaxRadius                    = m_RelaxSettings.disocclusionFixMaxRadius;
+                    specularSettings.disocclusionFixNumFramesToFix               = m_RelaxSettings.disocclusionFixNumFramesToFix;
+                    specularSettings.historyClampingColorBoxSigmaScale           = m_RelaxSettings.historyClampingColorBoxSigmaScale;
+                    specularSettings.spatialVarianceEstimationHistoryThreshold   = m_RelaxSettings.spatialVarianceEstimationHistoryThreshold;
+                    specularSettings.atrousIterationNum                          = m_RelaxSettings.atrousIterationNum;
+                    specularSettings.specularPhiLuminance                        = m_RelaxSettings.specularPhiLuminance;
+                    specularSettings.minLuminanceWeight                          = m_RelaxSettings.minLuminanceWeight;
+                    specularSettings.phiNormal                                   = m_RelaxSettings.phiNormal;
+                    specularSettings.phiDepth                                    = m_RelaxSettings.phiDepth;
+                    specularSettings.specularLobeAngleFraction                   = m_RelaxSettings.specularLobeAngleFraction;
+                    specularSettings.specularLobeAngleSlack                      = m_RelaxSettings.specularLobeAngleSlack;
+                    specularSettings.roughnessEdgeStoppingRelaxation             = m_RelaxSettings.roughnessEdgeStoppingRelaxation;
+                    specularSettings.normalEdgeStoppingRelaxation                = m_RelaxSettings.normalEdgeStoppingRelaxation;
+                    specularSettings.luminanceEdgeStoppingRelaxation             = m_RelaxSettings.luminanceEdgeStoppingRelaxation;
+                    specularSettings.checkerboardMode                            = m_Settings.rpp == 0 ? nrd::CheckerboardMode::BLACK : nrd::CheckerboardMode::OFF;
+                    specularSettings.enableSpecularVirtualHistoryClamping        = m_RelaxSettings.enableSpecularVirtualHistoryClamping;
+                    specularSettings.enableRoughnessBasedSpecularAccumulation    = m_RelaxSettings.enableRoughnessBasedSpecularAccumulation;
+                    specularSettings.enableRoughnessEdgeStopping                 = m_RelaxSettings.enableRoughnessEdgeStopping;
+                    specularSettings.enableAntiFirefly                           = m_RelaxSettings.enableAntiFirefly;
+
+                    denoiser.SetMethodSettings(nrd::Method::RELAX_DIFFUSE, &diffuseSettings);
+                    denoiser.SetMethodSettings(nrd::Method::RELAX_SPECULAR, &specularSettings);
+                }
+
+                if (!m_IsAsyncCompute)
+                    denoiser.SetMethodSettings(nrd::Method::SIGMA_SHADOW_TRANSLUCENCY, &shadowSettings);
+
+                CPU_ZONE("NRD Denoise");
+                BeginGpuPass(commandBuffer2, bufferedFrameIndex, GpuPass::Relax);
+                denoiser.Denoise(frameIndex, commandBuffer2, commonSettings, userPool);
+                EndGpuPass(commandBuffer2, bufferedFrameIndex, GpuPass::Relax);
+            }
+        });
+    }
+
+    // Adaptive sampling: noise of the noisy input relative to the denoised output gets turned into rays per tile for the next frame
+    if (m_IsAdaptiveSampling && m_Settings.rpp > 1)
+    {
+        { // Tile noise
+            const TextureState transitions[] =
+            {
+                // Input
+                {Texture::Normal_Roughness, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                {Texture::Unfiltered_Diff, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                {Texture::Unfiltered_Spec, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                {Texture::Diff, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                {Texture::Spec, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                // Output
+                {Texture::TileNoise, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+            };
+
+            FramePassDesc framePassDesc = {};
+            framePassDesc.name = "SampleBudget";
+            framePassDesc.textures = transitions;
+            framePassDesc.textureNum = helper::GetCountOf(transitions);
+            framePassDesc.commandBufferIndex = 2;
+            framePassDesc.stage = nri::BarrierDependency::COMPUTE_STAGE;
+
+            AddFramePass(framePassDesc, [&](nri::CommandBuffer& commandBuffer3)
+            {
+                NRI.CmdSetPipelineLayout(commandBuffer3, *GetPipelineLayout(Pipeline::SampleBudget));
+                NRI.CmdSetPipeline(commandBuffer3, *Get(Pipeline::SampleBudget));
+
+                const nri::DescriptorSet* descriptorSets[] = { frame.globalConstantBufferDescriptorSet, Get(DescriptorSet::SampleBudget1) };
+                NRI.CmdSetDescriptorSets(commandBuffer3, 0, helper::GetCountOf(descriptorSets), descriptorSets, nullptr);
+
+                // Both passes are measured together (same command buffer)
+                BeginGpuPass(commandBuffer3, bufferedFrameIndex, GpuPass::SampleBudget);
+                NRI.CmdDispatch(commandBuffer3, rectGridW, rectGridH, 1);
+            });
+        }
+
+        { // Rays per tile
+            const nri::BufferTransitionBarrierDesc bufferTransitions[] =
+            {
+                { Get(Buffer::SampleSum), SAMPLE_SUM_ACCESS, nri::AccessBits::SHADER_RESOURCE_STORAGE },
+            };
+
+            const TextureState transitions[] =
+            {
+                // Input
+                {Texture::TileNoise, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                // Output
+                {Texture::DilatedNoise, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+                {Texture::SampleNum, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+            };
+
+            FramePassDesc framePassDesc = {};
+            framePassDesc.name = "SampleNum";
+            framePassDesc.textures = transitions;
+            framePassDesc.textureNum = helper::GetCountOf(transitions);
+            framePassDesc.buffers = bufferTransitions;
+            framePassDesc.bufferNum = helper::GetCountOf(bufferTransitions);
+            framePassDesc.commandBufferIndex = 2;
+            framePassDesc.stage = nri::BarrierDependency::COMPUTE_STAGE;
+
+            AddFramePass(framePassDesc, [&](nri::CommandBuffer& commandBuffer3)
+            {
+                NRI.CmdSetPipelineLayout(commandBuffer3, *GetPipelineLayout(Pipeline::SampleNum));
+                NRI.CmdSetPipeline(commandBuffer3, *Get(Pipeline::SampleNum));
+
+                const nri::DescriptorSet* descriptorSets[] = { frame.globalConstantBufferDescriptorSet, Get(DescriptorSet::SampleNum1) };
+                NRI.CmdSetDescriptorSets(commandBuffer3, 0, helper::GetCountOf(descriptorSets), descriptorSets, nullptr);
+
+                // A single group, the exact total needs reductions over all tiles
+                NRI.CmdDispatch(commandBuffer3, 1, 1, 1);
+                EndGpuPass(commandBuffer3, bufferedFrameIndex, GpuPass::SampleBudget);
+            });
+        }
+
+#ifdef _DEBUG
+        { // Distributed samples readback
+            const nri::BufferTransitionBarrierDesc bufferTransitions[] =
+            {
+                { Get(Buffer::SampleSum), nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::COPY_SOURCE },
+            };
 
-    uint32_t maxAccumulatedFrameNum = uint32_t(m_Settings.nrdSettings.maxAccumulatedFrameNum * resetHistoryFactor + 0.5f);
-    uint32_t maxFastAccumulatedFrameNum = uint32_t(m_Settings.nrdSettings.maxFastAccumulatedFrameNum * resetHistoryFactor + 0.5f);
+            FramePassDesc framePassDesc = {};
+            framePassDesc.name = "SampleSum";
+            framePassDesc.buffers = bufferTransitions;
+            framePassDesc.bufferNum = helper::GetCountOf(bufferTransitions);
+            framePassDesc.commandBufferIndex = 2;
+            framePassDesc.stage = nri::BarrierDependency::ALL_STAGES;
 
-    NRI.BeginCommandBuffer(*frame.commandBuffers[1], nullptr, 0);
-    {
-        nri::CommandBuffer& commandBuffer2 = *frame.commandBuffers[1];
-        helper::Annotation annotation(NRI, commandBuffer2, "Denoising");
+            // See "SampleNum.cs.hlsl" ("gSampleNum" is "rpp" here)
+            m_SampleSumBudgets[bufferedFrameIndex] = uint32_t(m_Settings.rpp) * rectGridW * rectGridH;
 
-        float2 jitter = m_Settings.TAA ? m_Camera.state.viewportJitter : 0.0f;
+            AddFramePass(framePassDesc, [&](nri::CommandBuffer& commandBuffer3)
+            {
+                NRI.CmdCopyBuffer(commandBuffer3, *m_SampleSumBuffer, 0, bufferedFrameIndex * sizeof(uint32_t), *Get(Buffer::SampleSum), 0, 0, sizeof(uint32_t));
+            });
+        }
+#endif
 
-        nrd::CommonSettings commonSettings = {};
-        memcpy(commonSettings.viewToClipMatrix, &m_Camera.state.mViewToClip, sizeof(m_Camera.state.mViewToClip));
-        memcpy(commonSettings.viewToClipMatrixPrev, &m_Camera.statePrev.mViewToClip, sizeof(m_Camera.statePrev.mViewToClip));
-        memcpy(commonSettings.worldToViewMatrix, &m_Camera.state.mWorldToView, sizeof(m_Camera.state.mWorldToView));
-        memcpy(commonSettings.worldToViewMatrixPrev, &m_Camera.statePrev.mWorldToView, sizeof(m_Camera.statePrev.mWorldToView));
-        commonSettings.motionVectorScale[0] = m_Settings.isMotionVectorInWorldSpace ? 1.0f : 1.0f / float(rectW);
-        commonSettings.motionVectorScale[1] = m_Settings.isMotionVectorInWorldSpace ? 1.0f : 1.0f / float(rectH);
-        commonSettings.cameraJitter[0] = jitter.x;
-        commonSettings.cameraJitter[1] = jitter.y;
-        commonSettings.resolutionScale[0] = m_ResolutionScale;
-        commonSettings.resolutionScale[1] = m_ResolutionScale;
-        commonSettings.meterToUnitsMultiplier = m_Settings.meterToUnitsMultiplier;
-        commonSettings.denoisingRange = 4.0f * m_Scene.aabb.GetRadius() / m_Settings.meterToUnitsMultiplier;
-        commonSettings.disocclusionThreshold = m_Settings.nrdSettings.disocclusionThreshold * 0.01f;
-        commonSettings.splitScreen = m_Settings.separator;
-        commonSettings.debug = m_Settings.debug;
-        commonSettings.frameIndex = frameIndex;
-        commonSettings.accumulationMode = resetHistoryFactor == 0.0f ? nrd::AccumulationMode::CLEAR_AND_RESTART : nrd::AccumulationMode::CONTINUE;
-        commonSettings.isMotionVectorInWorldSpace = m_Settings.isMotionVectorInWorldSpace;
-        commonSettings.isRadianceMultipliedByExposure = true;
-
-        nrd::SigmaShadowSettings shadowSettings = {};
-
-        NrdUserPool userPool =
-        {{
-            // IN_MV
-            {&GetState(Texture::ObjectMotion), GetFormat(Texture::ObjectMotion)},
-
-            // IN_NORMAL_ROUGHNESS
-            {&GetState(Texture::Normal_Roughness), GetFormat(Texture::Normal_Roughness)},
-
-            // IN_VIEWZ
-            {&GetState(Texture::ViewZ), GetFormat(Texture::ViewZ)},
-
-            // IN_DIFF_RADIANCE_HITDIST
-            {&GetState(Texture::Unfiltered_Diff), GetFormat(Texture::Unfiltered_Diff)},
-
-            // IN_SPEC_RADIANCE_HITDIST
-            {&GetState(Texture::Unfiltered_Spec), GetFormat(Texture::Unfiltered_Spec)},
-
-            // IN_DIFF_HITDIST
-            {&GetState(Texture::Unfiltered_Diff), GetFormat(Texture::Unfiltered_Diff)}, // needed for NRD_OCCLUSION_ONLY
-
-            // IN_SPEC_HITDIST
-            {&GetState(Texture::Unfiltered_Spec), GetFormat(Texture::Unfiltered_Spec)}, // needed for NRD_OCCLUSION_ONLY
-
-            // IN_DIFF_DIRECTION_PDF
-            {&GetState(Texture::DiffDirectionPdf), GetFormat(Texture::DiffDirectionPdf)},
-
-            // IN_SPEC_DIRECTION_PDF
-            {&GetState(Texture::SpecDirectionPdf), GetFormat(Texture::SpecDirectionPdf)},
-
-            // IN_DIFF_CONFIDENCE
-            {nullptr, nri::Format::UNKNOWN},
-
-            // IN_SPEC_CONFIDENCE
-            {nullptr, nri::Format::UNKNOWN},
-
-            // IN_SHADOWDATA
-            {&GetState(Texture::Unfiltered_ShadowData), GetFormat(Texture::Unfiltered_ShadowData)},
-
-            // IN_SHADOW_TRANSLUCENCY
-            {&GetState(Texture::Unfiltered_Shadow_Translucency), GetFormat(Texture::Unfiltered_Shadow_Translucency)},
-
-            // OUT_SHADOW_TRANSLUCENCY
-            {&GetState(Texture::Shadow), GetFormat(Texture::Shadow)},
-
-            // OUT_DIFF_RADIANCE_HITDIST
-            {&GetState(Texture::Diff), GetFormat(Texture::Diff)},
-
-            // OUT_SPEC_RADIANCE_HITDIST
-            {&GetState(Texture::Spec), GetFormat(Texture::Spec)},
-
-            // OUT_DIFF_HITDIST
-            {&GetState(Texture::Diff), GetFormat(Texture::Diff)}, // needed for NRD_OCCLUSION_ONLY
-
-            // OUT_SPEC_HITDIST
-            {&GetState(Texture::Spec), GetFormat(Texture::Spec)}, // needed for NRD_OCCLUSION_ONLY
-        }};
-
-        if (m_Settings.denoiser == REBLUR)
-        {
-            const float3 trimmingParams = GetTrimmingParams();
-
-            nrd::AntilagIntensitySettings antilagIntensitySettings = {};
-            nrd::AntilagHitDistanceSettings antilagHitDistanceSettings = {};
-            GetAntilagSettings(antilagIntensitySettings, antilagHitDistanceSettings);
-
-            nrd::HitDistanceParameters diffHitDistanceParameters = {};
-            diffHitDistanceParameters.A = m_Settings.diffHitDistScale;
-
-            nrd::HitDistanceParameters specHitDistanceParameters = {};
-            specHitDistanceParameters.A = m_Settings.specHitDistScale;
-
-            nrd::ReblurDiffuseSpecularSettings reblurSettings = {};
-            reblurSettings.diffuseSettings.hitDistanceParameters = diffHitDistanceParameters;
-            reblurSettings.diffuseSettings.antilagIntensitySettings = antilagIntensitySettings;
-            reblurSettings.diffuseSettings.antilagHitDistanceSettings = antilagHitDistanceSettings;
-            reblurSettings.diffuseSettings.maxAccumulatedFrameNum = maxAccumulatedFrameNum;
-            reblurSettings.diffuseSettings.blurRadius = m_Settings.nrdSettings.blurRadius;
-            reblurSettings.diffuseSettings.maxAdaptiveRadiusScale = m_Settings.nrdSettings.adaptiveRadiusScale;
-            reblurSettings.diffuseSettings.normalWeightStrictness = m_Settings.nrdSettings.normalWeightStrictness * (1.0f + (1 - m_Settings.nrdSettings.prePassMode) * 0.33f);
-            reblurSettings.diffuseSettings.stabilizationStrength = m_Settings.nrdSettings.stabilizationStrength;
-            reblurSettings.diffuseSettings.residualNoiseLevel = m_Settings.nrdSettings.residualNoiseLevel * 0.01f;
-            reblurSettings.diffuseSettings.checkerboardMode = m_Settings.rpp == 0 ? nrd::CheckerboardMode::WHITE : nrd::CheckerboardMode::OFF;
-            reblurSettings.diffuseSettings.prePassMode = (nrd::PrePassMode)m_Settings.nrdSettings.prePassMode;
-            reblurSettings.diffuseSettings.enableAntiFirefly = m_Settings.nrdSettings.enableAntiFirefly;
-            reblurSettings.diffuseSettings.enableReferenceAccumulation = m_Settings.nrdSettings.referenceAccumulation;
-
-            reblurSettings.specularSettings.hitDistanceParameters = specHitDistanceParameters;
-            reblurSettings.specularSettings.lobeTrimmingParameters = { trimmingParams.x, trimmingParams.y, trimmingParams.z };
-            reblurSettings.specularSettings.antilagIntensitySettings = antilagIntensitySettings;
-            reblurSettings.specularSettings.antilagHitDistanceSettings = antilagHitDistanceSettings;
-            reblurSettings.specularSettings.maxAccumulatedFrameNum = reblurSettings.diffuseSettings.maxAccumulatedFrameNum;
-            reblurSettings.specularSettings.blurRadius = m_Settings.nrdSettings.blurRadius;
-            reblurSettings.specularSettings.maxAdaptiveRadiusScale = m_Settings.nrdSettings.adaptiveRadiusScale;
-            reblurSettings.specularSettings.normalWeightStrictness = m_Settings.nrdSettings.normalWeightStrictness * (1.0f + (1 - m_Settings.nrdSettings.prePassMode) * 0.33f);
-            reblurSettings.specularSettings.stabilizationStrength = m_Settings.nrdSettings.stabilizationStrength;
-            reblurSettings.specularSettings.residualNoiseLevel = m_Settings.nrdSettings.residualNoiseLevel * 0.01f;
-            reblurSettings.specularSettings.checkerboardMode = m_Settings.rpp == 0 ? nrd::CheckerboardMode::BLACK : nrd::CheckerboardMode::OFF;
-            reblurSettings.specularSettings.prePassMode = (nrd::PrePassMode)m_Settings.nrdSettings.prePassMode;
-            reblurSettings.specularSettings.enableAntiFirefly = m_Settings.nrdSettings.enableAntiFirefly;
-            reblurSettings.specularSettings.enableReferenceAccumulation = m_Settings.nrdSettings.referenceAccumulation;
-
-            #if( NRD_OCCLUSION_ONLY == 0 )
-                #if( NRD_COMBINED == 1 )
-                    m_Reblur.SetMethodSettings(nrd::Method::REBLUR_DIFFUSE_SPECULAR, &reblurSettings);
-                #else
-                    m_Reblur.SetMethodSettings(nrd::Method::REBLUR_DIFFUSE, &reblurSettings.diffuseSettings);
-                    m_Reblur.SetMethodSettings(nrd::Method::REBLUR_SPECULAR, &reblurSettings.specularSettings);
-                #endif
-
-                m_Reblur.SetMethodSettings(nrd::Method::SIGMA_SHADOW_TRANSLUCENCY, &shadowSettings);
-            #else
-                #if( NRD_COMBINED == 1 )
-                    m_Reblur.SetMethodSettings(nrd::Method::REBLUR_DIFFUSE_SPECULAR_OCCLUSION, &reblurSettings);
-                #else
-                    m_Reblur.SetMethodSettings(nrd::Method::REBLUR_DIFFUSE_OCCLUSION, &reblurSettings.diffuseSettings);
-                    m_Reblur.SetMethodSettings(nrd::Method::REBLUR_SPECULAR_OCCLUSION, &reblurSettings.specularSettings);
-                #endif
-            #endif
-
-            m_Reblur.Denoise(frameIndex, commandBuffer2, commonSettings, userPool);
-        }
-        else if (m_Settings.denoiser == RELAX)
-        {
-            m_RelaxSettings.diffuseMaxAccumulatedFrameNum = maxAccumulatedFrameNum;
-            m_RelaxSettings.diffuseMaxFastAccumulatedFrameNum = maxFastAccumulatedFrameNum;
-            m_RelaxSettings.specularMaxAccumulatedFrameNum = maxAccumulatedFrameNum;
-            m_RelaxSettings.specularMaxFastAccumulatedFrameNum = maxFastAccumulatedFrameNum;
-            m_RelaxSettings.checkerboardMode = m_Settings.rpp == 0 ? nrd::CheckerboardMode::WHITE : nrd::CheckerboardMode::OFF;
-            m_RelaxSettings.enableAntiFirefly = m_Settings.nrdSettings.enableAntiFirefly;
-            m_RelaxSettings.diffusePrepassBlurRadius = (nrd::PrePassMode)m_Settings.nrdSettings.prePassMode == nrd::PrePassMode::OFF ? 0 : 50.0f;
-            m_RelaxSettings.specularPrepassBlurRadius = (nrd::PrePassMode)m_Settings.nrdSettings.prePassMode == nrd::PrePassMode::OFF ? 0 : 30.0f;
-
-            #if( NRD_COMBINED == 1 )
-                m_Relax.SetMethodSettings(nrd::Method::RELAX_DIFFUSE_SPECULAR, &m_RelaxSettings);
-            #else
-                nrd::RelaxDiffuseSettings diffuseSettings = {};
-                diffuseSettings.prepassBlurRadius                            = m_RelaxSettings.diffusePrepassBlurRadius;
-                diffuseSettings.diffuseMaxAccumulatedFrameNum                = m_RelaxSettings.diffuseMaxAccumulatedFrameNum;
-                diffuseSettings.diffuseMaxFastAccumulatedFrameNum            = m_RelaxSettings.diffuseMaxFastAccumulatedFrameNum;
-                diffuseSettings.disocclusionFixEdgeStoppingNormalPower       = m_RelaxSettings.disocclusionFixEdgeStoppingNormalPower;
-                diffuseSettings.disocclusionFixMaxRadius                     = m_RelaxSettings.disocclusionFixMaxRadius;
-                diffuseSettings.disocclusionFixNumFramesToFix                = m_RelaxSettings.disocclusionFixNumFramesToFix;
-                diffuseSettings.historyClampingColorBoxSigmaScale            = m_RelaxSettings.historyClampingColorBoxSigmaScale;
-                diffuseSettings.spatialVarianceEstimationHistoryThreshold    = m_RelaxSettings.spatialVarianceEstimationHistoryThreshold;
-                diffuseSettings.atrousIterationNum                           = m_RelaxSettings.atrousIterationNum;
-                diffuseSettings.diffusePhiLuminance                          = m_RelaxSettings.diffusePhiLuminance;
-                diffuseSettings.minLuminanceWeight                           = m_RelaxSettings.minLuminanceWeight;
-                diffuseSettings.phiNormal                                    = m_RelaxSettings.phiNormal;
-                diffuseSettings.phiDepth                                     = m_RelaxSettings.phiDepth;
-                diffuseSettings.checkerboardMode                             = m_Settings.rpp == 0 ? nrd::CheckerboardMode::WHITE : nrd::CheckerboardMode::OFF;
-                diffuseSettings.enableAntiFirefly                            = m_RelaxSettings.enableAntiFirefly;
-
-                nrd::RelaxSpecularSettings specularSettings = {};
-                specularSettings.prepassBlurRadius                           = m_RelaxSettings.specularPrepassBlurRadius;
-                specularSettings.specularMaxAccumulatedFrameNum              = m_RelaxSettings.specularMaxAccumulatedFrameNum;
-                specularSettings.specularMaxFastAccumulatedFrameNum          = m_RelaxSettings.specularMaxFastAccumulatedFrameNum;
-                specularSettings.specularVarianceBoost                       = m_RelaxSettings.specularVarianceBoost;
-                specularSettings.disocclusionFixEdgeStoppingNormalPower      = m_RelaxSettings.disocclusionFixEdgeStoppingNormalPower;
-                specularSettings.disocclusionFixMaxRadius                    = m_RelaxSettings.disocclusionFixMaxRadius;
-                specularSettings.disocclusionFixNumFramesToFix               = m_RelaxSettings.disocclusionFixNumFramesToFix;
-                specularSettings.historyClampingColorBoxSigmaScale           = m_RelaxSettings.historyClampingColorBoxSigmaScale;
-                specularSettings.spatialVarianceEstimationHistoryThreshold   = m_RelaxSettings.spatialVarianceEstimationHistoryThreshold;
-                specularSettings.atrousIterationNum                          = m_RelaxSettings.atrousIterationNum;
-                specularSettings.specularPhiLuminance                        = m_RelaxSettings.specularPhiLuminance;
-                specularSettings.minLuminanceWeight                          = m_RelaxSettings.minLuminanceWeight;
-                specularSettings.phiNormal                                   = m_RelaxSettings.phiNormal;
-                specularSettings.phiDepth                                    = m_RelaxSettings.phiDepth;
-                specularSettings.specularLobeAngleFraction                   = m_RelaxSettings.specularLobeAngleFraction;
-                specularSettings.specularLobeAngleSlack                      = m_RelaxSettings.specularLobeAngleSlack;
-                specularSettings.roughnessEdgeStoppingRelaxation             = m_RelaxSettings.roughnessEdgeStoppingRelaxation;
-                specularSettings.normalEdgeStoppingRelaxation                = m_RelaxSettings.normalEdgeStoppingRelaxation;
-                specularSettings.luminanceEdgeStoppingRelaxation             = m_RelaxSettings.luminanceEdgeStoppingRelaxation;
-                specularSettings.checkerboardMode                            = m_Settings.rpp == 0 ? nrd::CheckerboardMode::BLACK : nrd::CheckerboardMode::OFF;
-                specularSettings.enableSpecularVirtualHistoryClamping        = m_RelaxSettings.enableSpecularVirtualHistoryClamping;
-                specularSettings.enableRoughnessBasedSpecularAccumulation    = m_RelaxSettings.enableRoughnessBasedSpecularAccumulation;
-                specularSettings.enableRoughnessEdgeStopping                 = m_RelaxSettings.enableRoughnessEdgeStopping;
-                specularSettings.enableAntiFirefly                           = m_RelaxSettings.enableAntiFirefly;
-
-                m_Relax.SetMethodSettings(nrd::Method::RELAX_DIFFUSE, &diffuseSettings);
-                m_Relax.SetMethodSettings(nrd::Method::RELAX_SPECULAR, &specularSettings);
-            #endif
-
-            m_Relax.SetMethodSettings(nrd::Method::SIGMA_SHADOW_TRANSLUCENCY, &shadowSettings);
-
-            m_Relax.Denoise(frameIndex, commandBuffer2, commonSettings, userPool);
-        }
-    }
-    NRI.EndCommandBuffer(*frame.commandBuffers[1]);
-
-    // COMPOSITION
-    NRI.BeginCommandBuffer(*frame.commandBuffers[2], m_DescriptorPool, 0);
-    {
-        nri::CommandBuffer& commandBuffer3 = *frame.commandBuffers[2];
+        m_SampleBudgetFrameNum++;
+    }
+    else
+        m_SampleBudgetFrameNum = 0;
 
-        { // Composition
-            helper::Annotation annotation(NRI, commandBuffer3, "Composition");
+    // Composition is fused into TAA, if there is no DLSS
+    const bool isCompositionFused = m_IsCompositionFused && !m_DLSS.IsInitialized();
 
-            const TextureState transitions[] =
-            {
-                // Input
-                {Texture::ViewZ, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                {Texture::DirectLighting, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                {Texture::Normal_Roughness, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                {Texture::BaseColor_Metalness, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                {Texture::Shadow, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                {Texture::Diff, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                {Texture::Spec, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                // Output
-                {Texture::ComposedLighting_ViewZ, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-            };
-            transitionBarriers.textures = optimizedTransitions.data();
-            transitionBarriers.textureNum = BuildOptimizedTransitions(transitions, helper::GetCountOf(transitions), optimizedTransitions.data(), helper::GetCountOf(optimizedTransitions));
-            NRI.CmdPipelineBarrier(commandBuffer3, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
+    if (!isCompositionFused)
+    { // Composition
+        const TextureState transitions[] =
+        {
+            // Input
+            {Texture::ViewZ, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+            {Texture::DirectLighting, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+            {Texture::Normal_Roughness, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+            {Texture::BaseColor_Metalness, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+            {Texture::Shadow, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+            {Texture::Diff, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+            {Texture::Spec, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+            // Output
+            {Texture::ComposedLighting_ViewZ, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+        };
+
+        FramePassDesc framePassDesc = {};
+        framePassDesc.name = "Composition";
+        framePassDesc.textures = transitions;
+        framePassDesc.textureNum = helper::GetCountOf(transitions);
+        framePassDesc.commandBufferIndex = 2;
+        framePassDesc.stage = nri::BarrierDependency::COMPUTE_STAGE;
 
+        AddFramePass(framePassDesc, [&](nri::CommandBuffer& commandBuffer3)
+        {
             NRI.CmdSetPipelineLayout(commandBuffer3, *GetPipelineLayout(Pipeline::Composition));
             NRI.CmdSetPipeline(commandBuffer3, *Get(Pipeline::Composition));
 
             const nri::DescriptorSet* descriptorSets[] = { frame.globalConstantBufferDescriptorSet, Get(DescriptorSet::Composition1) };
             NRI.CmdSetDescriptorSets(commandBuffer3, 0, helper::GetCountOf(descriptorSets), descriptorSets, nullptr);
 
+            BeginGpuPass(commandBuffer3, bufferedFrameIndex, GpuPass::Composition);
             NRI.CmdDispatch(commandBuffer3, rectGridW, rectGridH, 1);
-        }
+            EndGpuPass(commandBuffer3, bufferedFrameIndex, GpuPass::Composition);
+        });
+    }
 
-        Texture finalResult = Texture::Final;
-        if (m_DLSS.IsInitialized())
-        {
-            { // Pre
-                helper::Annotation annotation(NRI, commandBuffer3, "PreDlss");
+    if (m_DLSS.IsInitialized())
+    {
+        { // Pre
+            const TextureState transitions[] =
+            {
+                // Input
+                {Texture::ObjectMotion, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                {Texture::TransparentLighting, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                {Texture::ComposedLighting_ViewZ, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                // Output
+                {Texture::ViewZ, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+                {Texture::Unfiltered_ShadowData, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+                {Texture::Unfiltered_Diff, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+            };
 
-                const TextureState transitions[] =
-                {
-                    // Input
-                    {Texture::ObjectMotion, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                    {Texture::TransparentLighting, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                    {Texture::ComposedLighting_ViewZ, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                    // Output
-                    {Texture::ViewZ, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-                    {Texture::Unfiltered_ShadowData, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-                    {Texture::Unfiltered_Diff, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-                };
-                transitionBarriers.textures = optimizedTransitions.data();
-                transitionBarriers.textureNum = BuildOptimizedTransitions(transitions, helper::GetCountOf(transitions), optimizedTransitions.data(), helper::GetCountOf(optimizedTransitions));
-                NRI.CmdPipelineBarrier(commandBuffer3, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
+            FramePassDesc framePassDesc = {};
+            framePassDesc.name = "PreDlss";
+            framePassDesc.textures = transitions;
+            framePassDesc.textureNum = helper::GetCountOf(transitions);
+            framePassDesc.commandBufferIndex = 2;
+            framePassDesc.stage = nri::BarrierDependency::COMPUTE_STAGE;
 
+            AddFramePass(framePassDesc, [&](nri::CommandBuffer& commandBuffer3)
+            {
                 NRI.CmdSetPipelineLayout(commandBuffer3, *GetPipelineLayout(Pipeline::PreDlss));
                 NRI.CmdSetPipeline(commandBuffer3, *Get(Pipeline::PreDlss));
 
                 const nri::DescriptorSet* descriptorSets[] = { frame.globalConstantBufferDescriptorSet, Get(DescriptorSet::PreDlss1) };
                 NRI.CmdSetDescriptorSets(commandBuffer3, 0, helper::GetCountOf(descriptorSets), descriptorSets, nullptr);
 
+                BeginGpuPass(commandBuffer3, bufferedFrameIndex, GpuPass::PreDlss);
                 NRI.CmdDispatch(commandBuffer3, rectGridW, rectGridH, 1);
-            }
+                EndGpuPass(commandBuffer3, bufferedFrameIndex, GpuPass::PreDlss);
+            });
+        }
 
-            { // DLSS
-                helper::Annotation annotation(NRI, commandBuffer3, "Dlss");
+        { // DLSS
+            const TextureState transitions[] =
+            {
+                // Input
+                {Texture::ViewZ, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                {Texture::Unfiltered_ShadowData, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                {Texture::Unfiltered_Diff, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                // Output
+                {Texture::TaaHistory, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+            };
 
-                const TextureState transitions[] =
-                {
-                    // Input
-                    {Texture::ViewZ, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                    {Texture::Unfiltered_ShadowData, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                    {Texture::Unfiltered_Diff, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                    // Output
-                    {Texture::TaaHistory, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-                };
-                transitionBarriers.textures = optimizedTransitions.data();
-                transitionBarriers.textureNum = BuildOptimizedTransitions(transitions, helper::GetCountOf(transitions), optimizedTransitions.data(), helper::GetCountOf(optimizedTransitions));
-                NRI.CmdPipelineBarrier(commandBuffer3, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
+            FramePassDesc framePassDesc = {};
+            framePassDesc.name = "Dlss";
+            framePassDesc.textures = transitions;
+            framePassDesc.textureNum = helper::GetCountOf(transitions);
+            framePassDesc.commandBufferIndex = 2;
+            framePassDesc.stage = nri::BarrierDependency::COMPUTE_STAGE;
 
+            AddFramePass(framePassDesc, [&](nri::CommandBuffer& commandBuffer3)
+            {
                 DlssDispatchDesc dlssDesc = {};
                 dlssDesc.texInput = Get(Texture::Unfiltered_Diff);
                 dlssDesc.texMv = Get(Texture::Unfiltered_ShadowData);
@@ -3376,142 +9014,625 @@ void Sample::RenderFrame(uint32_t frameIndex)
                 dlssDesc.jitter[0] = -m_Camera.state.viewportJitter.x;
                 dlssDesc.jitter[1] = -m_Camera.state.viewportJitter.y;
                 dlssDesc.physicalDeviceIndex = 0;
-                dlssDesc.reset = resetHistoryFactor == 0.0f;
+                dlssDesc.descriptorPool = m_DescriptorPool;
+                dlssDesc.reset = resetHistoryFactor == 0.0f || isDlssHistoryReset;
 
+                BeginGpuPass(commandBuffer3, bufferedFrameIndex, GpuPass::Dlss);
                 m_DLSS.Evaluate(&commandBuffer3, dlssDesc);
+                EndGpuPass(commandBuffer3, bufferedFrameIndex, GpuPass::Dlss);
+            });
+        }
 
-                NRI.CmdSetDescriptorPool(commandBuffer3, *m_DescriptorPool);
-            }
-
-            { // After
-                helper::Annotation annotation(NRI, commandBuffer3, "AfterDlss");
+        { // After
+            const TextureState transitions[] =
+            {
+                // Input
+                {Texture::TaaHistory, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                // Output
+                {Texture::Final, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+            };
 
-                const TextureState transitions[] =
-                {
-                    // Input
-                    {Texture::TaaHistory, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                    // Output
-                    {Texture::Final, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-                };
-                transitionBarriers.textures = optimizedTransitions.data();
-                transitionBarriers.textureNum = BuildOptimizedTransitions(transitions, helper::GetCountOf(transitions), optimizedTransitions.data(), helper::GetCountOf(optimizedTransitions));
-                NRI.CmdPipelineBarrier(commandBuffer3, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
+            FramePassDesc framePassDesc = {};
+            framePassDesc.name = "AfterDlss";
+            framePassDesc.textures = transitions;
+            framePassDesc.textureNum = helper::GetCountOf(transitions);
+            framePassDesc.commandBufferIndex = 2;
+            framePassDesc.stage = nri::BarrierDependency::COMPUTE_STAGE;
 
+            AddFramePass(framePassDesc, [&](nri::CommandBuffer& commandBuffer3)
+            {
                 NRI.CmdSetPipelineLayout(commandBuffer3, *GetPipelineLayout(Pipeline::AfterDlss));
                 NRI.CmdSetPipeline(commandBuffer3, *Get(Pipeline::AfterDlss));
 
                 const nri::DescriptorSet* descriptorSets[] = { frame.globalConstantBufferDescriptorSet, Get(DescriptorSet::AfterDlss1) };
                 NRI.CmdSetDescriptorSets(commandBuffer3, 0, helper::GetCountOf(descriptorSets), descriptorSets, nullptr);
 
+                BeginGpuPass(commandBuffer3, bufferedFrameIndex, GpuPass::AfterDlss);
                 NRI.CmdDispatch(commandBuffer3, outputGridW, outputGridH, 1);
-            }
+                EndGpuPass(commandBuffer3, bufferedFrameIndex, GpuPass::AfterDlss);
+            });
         }
-        else
-        {
-            const Texture taaSrc = isEven ? Texture::TaaHistoryPrev : Texture::TaaHistory;
-            const Texture taaDst = isEven ? Texture::TaaHistory : Texture::TaaHistoryPrev;
+    }
+    else
+    {
+        if (isCompositionFused)
+        { // Composition + Temporal
+            const TextureState transitions[] =
+            {
+                // Input
+                {Texture::ViewZ, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                {Texture::DirectLighting, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                {Texture::Normal_Roughness, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                {Texture::BaseColor_Metalness, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                {Texture::Shadow, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                {Texture::Diff, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                {Texture::Spec, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                {Texture::ObjectMotion, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                {Texture::TransparentLighting, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                {taaSrc, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                // Output
+                {Texture::ComposedLighting_ViewZ, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+                {taaDst, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+            };
 
-            { // Temporal
-                helper::Annotation annotation(NRI, commandBuffer3, "Temporal");
+            FramePassDesc framePassDesc = {};
+            framePassDesc.name = "CompositionTemporal";
+            framePassDesc.textures = transitions;
+            framePassDesc.textureNum = helper::GetCountOf(transitions);
+            framePassDesc.commandBufferIndex = 2;
+            framePassDesc.stage = nri::BarrierDependency::COMPUTE_STAGE;
 
-                const TextureState transitions[] =
-                {
-                    // Input
-                    {Texture::ObjectMotion, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                    {Texture::ComposedLighting_ViewZ, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                    {Texture::TransparentLighting, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                    {taaSrc, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                    // Output
-                    {taaDst, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-                };
-                transitionBarriers.textures = optimizedTransitions.data();
-                transitionBarriers.textureNum = BuildOptimizedTransitions(transitions, helper::GetCountOf(transitions), optimizedTransitions.data(), helper::GetCountOf(optimizedTransitions));
-                NRI.CmdPipelineBarrier(commandBuffer3, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
+            AddFramePass(framePassDesc, [&](nri::CommandBuffer& commandBuffer3)
+            {
+                NRI.CmdSetPipelineLayout(commandBuffer3, *GetPipelineLayout(Pipeline::CompositionTemporal));
+                NRI.CmdSetPipeline(commandBuffer3, *Get(Pipeline::CompositionTemporal));
+
+                const nri::DescriptorSet* descriptorSets[] = { frame.globalConstantBufferDescriptorSet, Get(isEven ? DescriptorSet::CompositionTemporal1a : DescriptorSet::CompositionTemporal1b) };
+                NRI.CmdSetDescriptorSets(commandBuffer3, 0, helper::GetCountOf(descriptorSets), descriptorSets, nullptr);
+
+                BeginGpuPass(commandBuffer3, bufferedFrameIndex, GpuPass::CompositionTemporal);
+                NRI.CmdDispatch(commandBuffer3, rectGridW, rectGridH, 1);
+                EndGpuPass(commandBuffer3, bufferedFrameIndex, GpuPass::CompositionTemporal);
+            });
+        }
+        else
+        { // Temporal
+            const TextureState transitions[] =
+            {
+                // Input
+                {Texture::ObjectMotion, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                {Texture::ComposedLighting_ViewZ, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                {Texture::TransparentLighting, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                {taaSrc, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                // Output
+                {taaDst, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+            };
 
+            FramePassDesc framePassDesc = {};
+            framePassDesc.name = "Temporal";
+            framePassDesc.textures = transitions;
+            framePassDesc.textureNum = helper::GetCountOf(transitions);
+            framePassDesc.commandBufferIndex = 2;
+            framePassDesc.stage = nri::BarrierDependency::COMPUTE_STAGE;
+
+            AddFramePass(framePassDesc, [&](nri::CommandBuffer& commandBuffer3)
+            {
                 NRI.CmdSetPipelineLayout(commandBuffer3, *GetPipelineLayout(Pipeline::Temporal));
                 NRI.CmdSetPipeline(commandBuffer3, *Get(Pipeline::Temporal));
 
                 const nri::DescriptorSet* descriptorSets[] = { frame.globalConstantBufferDescriptorSet, Get(isEven ? DescriptorSet::Temporal1a : DescriptorSet::Temporal1b) };
                 NRI.CmdSetDescriptorSets(commandBuffer3, 0, helper::GetCountOf(descriptorSets), descriptorSets, nullptr);
 
+                BeginGpuPass(commandBuffer3, bufferedFrameIndex, GpuPass::Temporal);
                 NRI.CmdDispatch(commandBuffer3, rectGridW, rectGridH, 1);
-            }
+                EndGpuPass(commandBuffer3, bufferedFrameIndex, GpuPass::Temporal);
+            });
+        }
 
-            // Upsample
-            if (m_ResolutionScale < 1.0f)
+        // Upsample
+        if (m_ResolutionScale < 1.0f)
+        {
+            const TextureState transitions[] =
             {
-                helper::Annotation annotation(NRI, commandBuffer3, "Upsample");
+                // Input
+                {taaDst, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+                // Output
+                {Texture::Final, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
+            };
 
-                const TextureState transitions[] =
-                {
-                    // Input
-                    {taaDst, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
-                    // Output
-                    {Texture::Final, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL},
-                };
-                transitionBarriers.textures = optimizedTransitions.data();
-                transitionBarriers.textureNum = BuildOptimizedTransitions(transitions, helper::GetCountOf(transitions), optimizedTransitions.data(), helper::GetCountOf(optimizedTransitions));
-                NRI.CmdPipelineBarrier(commandBuffer3, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
+            FramePassDesc framePassDesc = {};
+            framePassDesc.name = "Upsample";
+            framePassDesc.textures = transitions;
+            framePassDesc.textureNum = helper::GetCountOf(transitions);
+            framePassDesc.commandBufferIndex = 2;
+            framePassDesc.stage = nri::BarrierDependency::COMPUTE_STAGE;
 
+            AddFramePass(framePassDesc, [&](nri::CommandBuffer& commandBuffer3)
+            {
                 NRI.CmdSetPipelineLayout(commandBuffer3, *GetPipelineLayout(Pipeline::Upsample));
                 NRI.CmdSetPipeline(commandBuffer3, *Get(Pipeline::Upsample));
 
                 const nri::DescriptorSet* descriptorSets[] = { frame.globalConstantBufferDescriptorSet, Get(isEven ? DescriptorSet::Upsample1a : DescriptorSet::Upsample1b) };
                 NRI.CmdSetDescriptorSets(commandBuffer3, 0, helper::GetCountOf(descriptorSets), descriptorSets, nullptr);
 
+                BeginGpuPass(commandBuffer3, bufferedFrameIndex, GpuPass::Upsample);
                 NRI.CmdDispatch(commandBuffer3, screenGridW, screenGridH, 1);
-            }
-            else
-                finalResult = taaDst;
+                EndGpuPass(commandBuffer3, bufferedFrameIndex, GpuPass::Upsample);
+            });
         }
+        else
+            finalResult = taaDst;
+    }
+
+    // Quality harness: passes restore the default state of the buffers they copy
+    const uint32_t qualityGridW = (m_OutputResolution.x + QUALITY_TILE_SIZE - 1) / QUALITY_TILE_SIZE;
+    const uint32_t qualityGridH = (m_OutputResolution.y + QUALITY_TILE_SIZE - 1) / QUALITY_TILE_SIZE;
+
+    auto QualityBufferBarrier = [&](nri::CommandBuffer& commandBuffer, Buffer buffer, nri::AccessBits prevAccess, nri::AccessBits nextAccess)
+    {
+        const nri::BufferTransitionBarrierDesc transitions[] =
+        {
+            { Get(buffer), prevAccess, nextAccess },
+        };
+
+        nri::TransitionBarrierDesc transitionBarriers = {};
+        transitionBarriers.buffers = transitions;
+        transitionBarriers.bufferNum = helper::GetCountOf(transitions);
+        NRI.CmdPipelineBarrier(commandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
+    };
+
+    if (m_IsQualityReferenceUpload)
+    { // Quality reference upload
+        const nri::BufferTransitionBarrierDesc bufferTransitions[] =
+        {
+            { Get(Buffer::QualityReference), nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::COPY_DESTINATION },
+        };
+
+        FramePassDesc framePassDesc = {};
+        framePassDesc.name = "QualityReferenceUpload";
+        framePassDesc.buffers = bufferTransitions;
+        framePassDesc.bufferNum = helper::GetCountOf(bufferTransitions);
+        framePassDesc.commandBufferIndex = 2;
+        framePassDesc.stage = nri::BarrierDependency::COPY_STAGE;
+
+        AddFramePass(framePassDesc, [&](nri::CommandBuffer& commandBuffer3)
+        {
+            NRI.CmdCopyBuffer(commandBuffer3, *Get(Buffer::QualityReference), 0, 0, *m_QualityUploadBuffer, 0, 0, GetQualityReferenceSize());
+            QualityBufferBarrier(commandBuffer3, Buffer::QualityReference, nri::AccessBits::COPY_DESTINATION, nri::AccessBits::SHADER_RESOURCE_STORAGE);
+        });
+    }
 
-        { // Copy to back-buffer
-            const nri::TextureTransitionBarrierDesc copyTransitions[] =
+    if (m_IsQualityReferenceFrame)
+    { // Quality reference
+        const TextureState transitions[] =
+        {
+            // Input
+            {finalResult, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+        };
+
+        const nri::BufferTransitionBarrierDesc bufferTransitions[] =
+        {
+            { Get(Buffer::QualityReference), nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE_STORAGE },
+        };
+
+        FramePassDesc framePassDesc = {};
+        framePassDesc.name = "QualityReference";
+        framePassDesc.textures = transitions;
+        framePassDesc.textureNum = helper::GetCountOf(transitions);
+        framePassDesc.buffers = bufferTransitions;
+        framePassDesc.bufferNum = helper::GetCountOf(bufferTransitions);
+        framePassDesc.commandBufferIndex = 2;
+        framePassDesc.stage = nri::BarrierDependency::COMPUTE_STAGE;
+
+        m_QualitySlots[bufferedFrameIndex].referenceTest = m_QualityTest + 1;
+
+        AddFramePass(framePassDesc, [&](nri::CommandBuffer& commandBuffer3)
+        {
+            NRI.CmdSetPipelineLayout(commandBuffer3, *GetPipelineLayout(Pipeline::QualityReference));
+            NRI.CmdSetPipeline(commandBuffer3, *Get(Pipeline::QualityReference));
+
+            const nri::DescriptorSet* descriptorSets[] = { frame.globalConstantBufferDescriptorSet, GetQualityDescriptorSet(DescriptorSet::QualityReference1a, finalResult) };
+            NRI.CmdSetDescriptorSets(commandBuffer3, 0, helper::GetCountOf(descriptorSets), descriptorSets, nullptr);
+
+            NRI.CmdDispatch(commandBuffer3, qualityGridW, qualityGridH, 1);
+
+            // Also goes to disk
+            QualityBufferBarrier(commandBuffer3, Buffer::QualityReference, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::COPY_SOURCE);
+            NRI.CmdCopyBuffer(commandBuffer3, *m_QualityReadbackBuffer, 0, m_QualityMetricsSize * m_FrameInFlightNum, *Get(Buffer::QualityReference), 0, 0, GetQualityReferenceSize());
+            QualityBufferBarrier(commandBuffer3, Buffer::QualityReference, nri::AccessBits::COPY_SOURCE, nri::AccessBits::SHADER_RESOURCE_STORAGE);
+        });
+    }
+
+    if (m_IsQualityMetricsFrame)
+    { // Quality metrics
+        const TextureState transitions[] =
+        {
+            // Input
+            {finalResult, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE},
+        };
+
+        const nri::BufferTransitionBarrierDesc bufferTransitions[] =
+        {
+            { Get(Buffer::QualityReference), nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE_STORAGE },
+            { Get(Buffer::QualityMetrics), nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::SHADER_RESOURCE_STORAGE },
+        };
+
+        FramePassDesc framePassDesc = {};
+        framePassDesc.name = "QualityMetrics";
+        framePassDesc.textures = transitions;
+        framePassDesc.textureNum = helper::GetCountOf(transitions);
+        framePassDesc.buffers = bufferTransitions;
+        framePassDesc.bufferNum = helper::GetCountOf(bufferTransitions);
+        framePassDesc.commandBufferIndex = 2;
+        framePassDesc.stage = nri::BarrierDependency::COMPUTE_STAGE;
+
+        m_QualitySlots[bufferedFrameIndex].run = helper::GetCountOf(m_BenchmarkRuns);
+
+        AddFramePass(framePassDesc, [&](nri::CommandBuffer& commandBuffer3)
+        {
+            NRI.CmdSetPipelineLayout(commandBuffer3, *GetPipelineLayout(Pipeline::QualityMetrics));
+            NRI.CmdSetPipeline(commandBuffer3, *Get(Pipeline::QualityMetrics));
+
+            const nri::DescriptorSet* descriptorSets[] = { frame.globalConstantBufferDescriptorSet, GetQualityDescriptorSet(DescriptorSet::QualityMetrics1a, finalResult) };
+            NRI.CmdSetDescriptorSets(commandBuffer3, 0, helper::GetCountOf(descriptorSets), descriptorSets, nullptr);
+
+            NRI.CmdDispatch(commandBuffer3, qualityGridW, qualityGridH, 1);
+
+            QualityBufferBarrier(commandBuffer3, Buffer::QualityMetrics, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::COPY_SOURCE);
+            NRI.CmdCopyBuffer(commandBuffer3, *m_QualityReadbackBuffer, 0, bufferedFrameIndex * m_QualityMetricsSize, *Get(Buffer::QualityMetrics), 0, 0, m_QualityMetricsSize);
+            QualityBufferBarrier(commandBuffer3, Buffer::QualityMetrics, nri::AccessBits::COPY_SOURCE, nri::AccessBits::SHADER_RESOURCE_STORAGE);
+        });
+    }
+
+    if (m_IsCaptureFrame)
+    { // Capture
+        captureSlot.formats[(uint32_t)CaptureTarget::Final] = GetFormat(finalResult);
+
+        std::vector<std::pair<CaptureTarget, Texture>> targets;
+        std::vector<TextureState> transitions;
+        for (CaptureTarget target : {CaptureTarget::Final, CaptureTarget::Diff, CaptureTarget::Spec, CaptureTarget::ViewZ, CaptureTarget::Normal_Roughness, CaptureTarget::ObjectMotion})
+        {
+            if (m_CaptureTargetMask & (1 << (uint32_t)target))
             {
-                nri::TextureTransition(GetState(finalResult), nri::AccessBits::COPY_SOURCE, nri::TextureLayout::GENERAL),
-                nri::TextureTransition(backBuffer->texture, nri::AccessBits::UNKNOWN, nri::AccessBits::COPY_DESTINATION, nri::TextureLayout::UNKNOWN, nri::TextureLayout::GENERAL),
-            };
-            transitionBarriers.textures = copyTransitions;
-            transitionBarriers.textureNum = helper::GetCountOf(copyTransitions);
-            NRI.CmdPipelineBarrier(commandBuffer3, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
+                const Texture texture = target == CaptureTarget::Final ? finalResult : CAPTURE_TARGET_TEXTURES[(uint32_t)target];
+                targets.push_back({target, texture});
+                transitions.push_back({texture, nri::AccessBits::COPY_SOURCE, nri::TextureLayout::GENERAL});
+            }
+        }
+
+        FramePassDesc framePassDesc = {};
+        framePassDesc.name = "Capture";
+        framePassDesc.textures = transitions.data();
+        framePassDesc.textureNum = helper::GetCountOf(transitions);
+        framePassDesc.commandBufferIndex = 2;
+        framePassDesc.stage = nri::BarrierDependency::COPY_STAGE;
+
+        AddFramePass(framePassDesc, [this, targets, bufferedFrameIndex](nri::CommandBuffer& commandBuffer3)
+        {
+            for (const auto& target : targets)
+                CmdReadbackCaptureTarget(commandBuffer3, bufferedFrameIndex, target.first, target.second);
+        });
+    }
 
+    if (!m_IsCapture)
+    { // Copy to back-buffer
+        const TextureState transitions[] =
+        {
+            {finalResult, nri::AccessBits::COPY_SOURCE, nri::TextureLayout::GENERAL},
+        };
+
+        const nri::TextureTransitionBarrierDesc untrackedTransitions[] =
+        {
+            nri::TextureTransition(backBuffer->texture, nri::AccessBits::UNKNOWN, nri::AccessBits::COPY_DESTINATION, nri::TextureLayout::UNKNOWN, nri::TextureLayout::GENERAL),
+        };
+
+        FramePassDesc framePassDesc = {};
+        framePassDesc.name = "Copy to back-buffer";
+        framePassDesc.textures = transitions;
+        framePassDesc.textureNum = helper::GetCountOf(transitions);
+        framePassDesc.untrackedTextures = untrackedTransitions;
+        framePassDesc.untrackedTextureNum = helper::GetCountOf(untrackedTransitions);
+        framePassDesc.commandBufferIndex = 2;
+        framePassDesc.stage = nri::BarrierDependency::COPY_STAGE;
+
+        AddFramePass(framePassDesc, [&](nri::CommandBuffer& commandBuffer3)
+        {
             NRI.CmdCopyTexture(commandBuffer3, *backBuffer->texture, 0, nullptr, *Get(finalResult), 0, nullptr);
-        }
+        });
+    }
 
-        { // UI
-            const nri::TextureTransitionBarrierDesc beforeTransitions = nri::TextureTransition(backBuffer->texture, nri::AccessBits::COPY_DESTINATION, nri::AccessBits::COLOR_ATTACHMENT, nri::TextureLayout::GENERAL, nri::TextureLayout::COLOR_ATTACHMENT);
-            transitionBarriers.textures = &beforeTransitions;
-            transitionBarriers.textureNum = 1;
-            NRI.CmdPipelineBarrier(commandBuffer3, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
+    if (!m_IsCapture)
+    { // UI
+        const nri::TextureTransitionBarrierDesc untrackedTransitions[] =
+        {
+            nri::TextureTransition(backBuffer->texture, nri::AccessBits::COPY_DESTINATION, nri::AccessBits::COLOR_ATTACHMENT, nri::TextureLayout::GENERAL, nri::TextureLayout::COLOR_ATTACHMENT),
+        };
 
+        FramePassDesc framePassDesc = {};
+        framePassDesc.name = "UI";
+        framePassDesc.untrackedTextures = untrackedTransitions;
+        framePassDesc.untrackedTextureNum = helper::GetCountOf(untrackedTransitions);
+        framePassDesc.commandBufferIndex = 2;
+        framePassDesc.stage = nri::BarrierDependency::GRAPHICS_STAGE;
+
+        AddFramePass(framePassDesc, [&](nri::CommandBuffer& commandBuffer3)
+        {
+            BeginGpuPass(commandBuffer3, bufferedFrameIndex, GpuPass::UI);
             NRI.CmdBeginRenderPass(commandBuffer3, *backBuffer->frameBufferUI, nri::RenderPassBeginFlag::SKIP_FRAME_BUFFER_CLEAR);
             RenderUserInterface(commandBuffer3);
             NRI.CmdEndRenderPass(commandBuffer3);
+            EndGpuPass(commandBuffer3, bufferedFrameIndex, GpuPass::UI);
 
             const nri::TextureTransitionBarrierDesc afterTransitions = nri::TextureTransition(backBuffer->texture, nri::AccessBits::COLOR_ATTACHMENT, nri::AccessBits::UNKNOWN, nri::TextureLayout::COLOR_ATTACHMENT, nri::TextureLayout::PRESENT);
+
+            nri::TransitionBarrierDesc transitionBarriers = {};
             transitionBarriers.textures = &afterTransitions;
             transitionBarriers.textureNum = 1;
             NRI.CmdPipelineBarrier(commandBuffer3, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
+        });
+    }
+
+    if (m_PhysicalDeviceNum > 1)
+    { // Peer history
+        // Peer GPUs need the composed lighting of this frame as the previous frame input
+        const TextureState transitions[] =
+        {
+            {Texture::ComposedLighting_ViewZ, nri::AccessBits::COPY_SOURCE, nri::TextureLayout::GENERAL},
+        };
+
+        FramePassDesc framePassDesc = {};
+        framePassDesc.name = "PeerHistory";
+        framePassDesc.textures = transitions;
+        framePassDesc.textureNum = helper::GetCountOf(transitions);
+        framePassDesc.commandBufferIndex = 2;
+        framePassDesc.stage = nri::BarrierDependency::COPY_STAGE;
+
+        AddFramePass(framePassDesc, [&](nri::CommandBuffer& commandBuffer3)
+        {
+            for (uint32_t i = 1; i < m_PhysicalDeviceNum; i++)
+                NRI.CmdCopyTexture(commandBuffer3, *Get(Texture::ComposedLighting_ViewZ), i, nullptr, *Get(Texture::ComposedLighting_ViewZ), 0, nullptr);
+        });
+    }
+
+    ExecuteFrameGraph(frame);
+
+    // PEER GPUS: states of peer resources are not tracked by the frame graph, each frame leaves them in the same states. The only
+    // exception is a data texture twin swapped in by "SwitchNrdMode", which stays in the initial state until traced for the first time
+    uint32_t peerUninitializedOutputMask = 0;
+    for (uint32_t j = 0; j < raytracingOutputNum && m_PhysicalDeviceNum > 1; j++)
+    {
+        const nri::Texture* texture = Get(raytracingOutputs[j]);
+        if (std::find(m_PeerInitializedTextures.begin(), m_PeerInitializedTextures.end(), texture) == m_PeerInitializedTextures.end())
+        {
+            peerUninitializedOutputMask |= 1 << j;
+            m_PeerInitializedTextures.push_back(texture);
+        }
+    }
+
+    for (uint32_t i = 1; i < m_PhysicalDeviceNum; i++)
+    {
+        nri::CommandBuffer& peerCommandBuffer = *frame.peerCommandBuffers[i];
+        const bool isFirstFrame = frameIndex == 0;
+        const uint2 band = GetRaytracingBand(i);
+
+        NRI.BeginCommandBuffer(peerCommandBuffer, m_DescriptorPool, i);
+        {
+            helper::Annotation annotation(NRI, peerCommandBuffer, "Peer raytracing");
+
+            std::vector<nri::TextureTransitionBarrierDesc> transitions;
+
+            // Preintegrate F and G terms (only once)
+            if (isFirstFrame)
+            {
+                transitions.push_back( nri::TextureTransition(Get(Texture::IntegrateBRDF), nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL) );
+                transitionBarriers.textures = transitions.data();
+                transitionBarriers.textureNum = helper::GetCountOf(transitions);
+                NRI.CmdPipelineBarrier(peerCommandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
+
+                NRI.CmdSetPipelineLayout(peerCommandBuffer, *GetPipelineLayout(Pipeline::IntegrateBRDF));
+                NRI.CmdSetPipeline(peerCommandBuffer, *Get(Pipeline::IntegrateBRDF));
+                NRI.CmdSetDescriptorSets(peerCommandBuffer, 0, 1, &Get(DescriptorSet::IntegrateBRDF0), nullptr);
+                NRI.CmdDispatch(peerCommandBuffer, (FG_TEX_SIZE + 15) / 16, (FG_TEX_SIZE + 15) / 16, 1);
+
+                transitions[0] = nri::TextureTransition(transitions[0], nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE);
+                transitions.push_back( nri::TextureTransition(Get(Texture::SampleNum), nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE) );
+            }
+
+            // Outputs are copied by GPU 0 at the end of the previous frame, the content is not needed. The history is copied by GPU 0 too
+            for (uint32_t j = 0; j < raytracingOutputNum; j++)
+            {
+                nri::Texture* texture = Get(raytracingOutputs[j]);
+                transitions.push_back( (peerUninitializedOutputMask & (1 << j)) ?
+                    nri::TextureTransition(texture, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL) :
+                    nri::TextureTransition(texture, nri::AccessBits::COPY_SOURCE, nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::TextureLayout::GENERAL, nri::TextureLayout::GENERAL) );
+            }
+
+            nri::Texture* history = Get(Texture::ComposedLighting_ViewZ);
+            transitions.push_back( isFirstFrame ?
+                nri::TextureTransition(history, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::SHADER_RESOURCE) :
+                nri::TextureTransition(history, nri::AccessBits::COPY_DESTINATION, nri::AccessBits::SHADER_RESOURCE, nri::TextureLayout::GENERAL, nri::TextureLayout::SHADER_RESOURCE) );
+
+            transitionBarriers.textures = transitions.data();
+            transitionBarriers.textureNum = helper::GetCountOf(transitions);
+            NRI.CmdPipelineBarrier(peerCommandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
+
+            // TLAS, the same as on GPU 0
+            ReplayWorldTlasBuild(peerCommandBuffer, i);
+
+            // Raytracing of the band (the raygen shader offsets "DispatchRaysIndex" by "gBandOrigin")
+            NRI.CmdSetPipelineLayout(peerCommandBuffer, *GetPipelineLayout(Pipeline::Raytracing));
+            NRI.CmdSetPipeline(peerCommandBuffer, *Get(Pipeline::Raytracing));
+
+            const nri::DescriptorSet* descriptorSets[] = { frame.globalConstantBufferDescriptorSet, Get(DescriptorSet::Raytracing1), frame.raytracing2DescriptorSet };
+            NRI.CmdSetDescriptorSets(peerCommandBuffer, 0, helper::GetCountOf(descriptorSets), descriptorSets, nullptr);
+
+            nri::DispatchRaysDesc dispatchRaysDesc = {};
+            dispatchRaysDesc.raygenShader = { Get(Buffer::ShaderTable), m_ShaderEntries[ShaderGroup::Raytracing_rgen + raygenIndex], m_DeviceDesc->rayTracingShaderGroupIdentifierSize, m_DeviceDesc->rayTracingShaderGroupIdentifierSize };
+            dispatchRaysDesc.missShaders = { Get(Buffer::ShaderTable), m_ShaderEntries[ShaderGroup::Main_rmiss], m_DeviceDesc->rayTracingShaderGroupIdentifierSize, m_DeviceDesc->rayTracingShaderGroupIdentifierSize };
+            dispatchRaysDesc.hitShaderGroups = { Get(Buffer::ShaderTable), m_ShaderEntries[ShaderGroup::Main_rhit], m_DeviceDesc->rayTracingShaderGroupIdentifierSize, m_DeviceDesc->rayTracingShaderGroupIdentifierSize };
+            dispatchRaysDesc.width = rectW;
+            dispatchRaysDesc.height = band.y;
+            dispatchRaysDesc.depth = 1;
+
+            NRI.CmdDispatchRays(peerCommandBuffer, dispatchRaysDesc);
+
+            // Ready for copies of GPU 0
+            transitions.clear();
+            for (uint32_t j = 0; j < raytracingOutputNum; j++)
+                transitions.push_back( nri::TextureTransition(Get(raytracingOutputs[j]), nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::AccessBits::COPY_SOURCE, nri::TextureLayout::GENERAL, nri::TextureLayout::GENERAL) );
+            transitions.push_back( nri::TextureTransition(history, nri::AccessBits::SHADER_RESOURCE, nri::AccessBits::COPY_DESTINATION, nri::TextureLayout::SHADER_RESOURCE, nri::TextureLayout::GENERAL) );
+
+            transitionBarriers.textures = transitions.data();
+            transitionBarriers.textureNum = helper::GetCountOf(transitions);
+            NRI.CmdPipelineBarrier(peerCommandBuffer, &transitionBarriers, nullptr, nri::BarrierDependency::ALL_STAGES);
+        }
+        NRI.EndCommandBuffer(peerCommandBuffer);
+    }
+
+    { // Timestamps
+        nri::CommandBuffer& commandBuffer3 = *frame.commandBuffers[2];
+
+        EndGpuPass(commandBuffer3, bufferedFrameIndex, GpuPass::Frame);
+
+        // Only passes recorded this frame have written their queries, resolving the others is undefined. Copy contiguous runs of them
+        const uint32_t mask = m_TimestampMasks[bufferedFrameIndex].load(std::memory_order_relaxed);
+        for (uint32_t i = 0; i < (uint32_t)GpuPass::MAX_NUM; )
+        {
+            if (!(mask & (1 << i)))
+            {
+                i++;
+                continue;
+            }
+
+            uint32_t passNum = 1;
+            while (i + passNum < (uint32_t)GpuPass::MAX_NUM && (mask & (1 << (i + passNum))))
+                passNum++;
+
+            const uint32_t queryOffset = bufferedFrameIndex * GPU_PASS_QUERY_NUM + i * 2;
+            NRI.CmdCopyQueries(commandBuffer3, *m_TimestampQueryPool, queryOffset, passNum * 2, *m_TimestampBuffer, uint64_t(queryOffset) * m_TimestampQuerySize);
+
+            i += passNum;
         }
     }
     NRI.EndCommandBuffer(*frame.commandBuffers[2]);
 
-    nri::WorkSubmissionDesc workSubmissionDesc = {};
-    workSubmissionDesc.wait = &m_BackBufferAcquireSemaphore;
-    workSubmissionDesc.waitNum = 1;
-    workSubmissionDesc.commandBuffers = frame.commandBuffers.data();
-    workSubmissionDesc.commandBufferNum = (uint32_t)frame.commandBuffers.size();
-    workSubmissionDesc.signal = &m_BackBufferReleaseSemaphore;
-    workSubmissionDesc.signalNum = 1;
-    NRI.SubmitQueueWork(*m_CommandQueue, workSubmissionDesc, frame.deviceSemaphore);
+    // Offline capture doesn't wait for a back buffer and doesn't present
+    const uint32_t swapChainSemaphoreNum = m_IsCapture ? 0 : 1;
+
+    { // Submit
+        CPU_ZONE("Submit");
+        m_CpuSubmitTimes[bufferedFrameIndex] = m_CpuProfiler.Now(); // GPU passes of this frame get aligned to it in the trace
 
-    NRI.SwapChainPresent(*m_SwapChain, *m_BackBufferReleaseSemaphore);
+        if (m_PhysicalDeviceNum > 1)
+        {
+            // Peers: ray tracing of bands, waits for the history of the previous frame
+            for (uint32_t i = 1; i < m_PhysicalDeviceNum; i++)
+            {
+                nri::WorkSubmissionDesc workSubmissionDesc = {};
+                workSubmissionDesc.wait = &m_PeerHistorySemaphores[i];
+                workSubmissionDesc.waitNum = frameIndex == 0 ? 0 : 1;
+                workSubmissionDesc.commandBuffers = &frame.peerCommandBuffers[i];
+                workSubmissionDesc.commandBufferNum = 1;
+                workSubmissionDesc.signal = &m_PeerRaytracingSemaphores[i];
+                workSubmissionDesc.signalNum = 1;
+                workSubmissionDesc.physicalDeviceIndex = i;
+                NRI.SubmitQueueWork(*m_CommandQueue, workSubmissionDesc, nullptr);
+            }
+
+            // GPU 0: ray tracing of the first band, overlaps with peers
+            nri::WorkSubmissionDesc workSubmissionDesc = {};
+            workSubmissionDesc.commandBuffers = &frame.commandBuffers[0];
+            workSubmissionDesc.commandBufferNum = 1;
+            NRI.SubmitQueueWork(*m_CommandQueue, workSubmissionDesc, nullptr);
+
+            // GPU 0: peer copies and denoising, needs all bands
+            workSubmissionDesc = {};
+            workSubmissionDesc.wait = &m_PeerRaytracingSemaphores[1];
+            workSubmissionDesc.waitNum = m_PhysicalDeviceNum - 1;
+            workSubmissionDesc.commandBuffers = &frame.commandBuffers[1];
+            workSubmissionDesc.commandBufferNum = 1;
+            NRI.SubmitQueueWork(*m_CommandQueue, workSubmissionDesc, nullptr);
+
+            // GPU 0: the rest, the history gets pushed to peers
+            std::array<nri::QueueSemaphore*, MULTI_GPU_MAX_NUM> signalSemaphores = { m_BackBufferReleaseSemaphore };
+            for (uint32_t i = 1; i < m_PhysicalDeviceNum; i++)
+                signalSemaphores[i] = m_PeerHistorySemaphores[i];
+
+            workSubmissionDesc = {};
+            workSubmissionDesc.wait = &m_BackBufferAcquireSemaphore;
+            workSubmissionDesc.waitNum = swapChainSemaphoreNum;
+            workSubmissionDesc.commandBuffers = &frame.commandBuffers[2];
+            workSubmissionDesc.commandBufferNum = 1;
+            workSubmissionDesc.signal = signalSemaphores.data() + 1 - swapChainSemaphoreNum;
+            workSubmissionDesc.signalNum = m_PhysicalDeviceNum - 1 + swapChainSemaphoreNum;
+            NRI.SubmitQueueWork(*m_CommandQueue, workSubmissionDesc, frame.deviceSemaphore);
+        }
+        else if (isShadowDenoisingAsync)
+        {
+            // Graphics: ray tracing
+            nri::WorkSubmissionDesc workSubmissionDesc = {};
+            workSubmissionDesc.commandBuffers = &frame.commandBuffers[0];
+            workSubmissionDesc.commandBufferNum = 1;
+            workSubmissionDesc.signal = &m_RaytracingSemaphore;
+            workSubmissionDesc.signalNum = 1;
+            NRI.SubmitQueueWork(*m_CommandQueue, workSubmissionDesc, nullptr);
+
+            // Compute: SIGMA
+            workSubmissionDesc = {};
+            workSubmissionDesc.wait = &m_RaytracingSemaphore;
+            workSubmissionDesc.waitNum = 1;
+            workSubmissionDesc.commandBuffers = &frame.computeCommandBuffer;
+            workSubmissionDesc.commandBufferNum = 1;
+            workSubmissionDesc.signal = &m_ShadowDenoisingSemaphore;
+            workSubmissionDesc.signalNum = 1;
+            NRI.SubmitQueueWork(*m_ComputeQueue, workSubmissionDesc, nullptr);
+
+            // Graphics: REBLUR / RELAX, overlaps with SIGMA
+            workSubmissionDesc = {};
+            workSubmissionDesc.commandBuffers = &frame.commandBuffers[1];
+            workSubmissionDesc.commandBufferNum = 1;
+            NRI.SubmitQueueWork(*m_CommandQueue, workSubmissionDesc, nullptr);
+
+            // Graphics: the rest, needs denoised shadows and the back buffer
+            nri::QueueSemaphore* waitSemaphores[] = { m_ShadowDenoisingSemaphore, m_BackBufferAcquireSemaphore };
+
+            workSubmissionDesc = {};
+            workSubmissionDesc.wait = waitSemaphores;
+            workSubmissionDesc.waitNum = 1 + swapChainSemaphoreNum;
+            workSubmissionDesc.commandBuffers = &frame.commandBuffers[2];
+            workSubmissionDesc.commandBufferNum = 1;
+            workSubmissionDesc.signal = &m_BackBufferReleaseSemaphore;
+            workSubmissionDesc.signalNum = swapChainSemaphoreNum;
+            NRI.SubmitQueueWork(*m_CommandQueue, workSubmissionDesc, frame.deviceSemaphore);
+        }
+        else
+        {
+            nri::WorkSubmissionDesc workSubmissionDesc = {};
+            workSubmissionDesc.wait = &m_BackBufferAcquireSemaphore;
+            workSubmissionDesc.waitNum = swapChainSemaphoreNum;
+            workSubmissionDesc.commandBuffers = frame.commandBuffers.data();
+            workSubmissionDesc.commandBufferNum = (uint32_t)frame.commandBuffers.size();
+            workSubmissionDesc.signal = &m_BackBufferReleaseSemaphore;
+            workSubmissionDesc.signalNum = swapChainSemaphoreNum;
+            NRI.SubmitQueueWork(*m_CommandQueue, workSubmissionDesc, frame.deviceSemaphore);
+        }
+    }
+
+    if (!m_IsCapture)
+    {
+        CPU_ZONE("Present");
+        NRI.SwapChainPresent(*m_SwapChain, *m_BackBufferReleaseSemaphore);
+    }
 
     m_Timer.UpdateElapsedTimeSinceLastSave();
 
     float msLimit = 1000.0f / m_Settings.maxFps;
-    while( m_Timer.GetElapsedTime() < msLimit && m_Settings.limitFps)
-        m_Timer.UpdateElapsedTimeSinceLastSave();
+    if (m_Settings.limitFps)
+    {
+        CPU_ZONE("FPS limiter (busy-wait)");
+        while( m_Timer.GetElapsedTime() < msLimit && m_Settings.limitFps)
+            m_Timer.UpdateElapsedTimeSinceLastSave();
+    }
 
     m_Timer.SaveCurrentTime();
 }
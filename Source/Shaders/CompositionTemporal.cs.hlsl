@@ -0,0 +1,32 @@
+/*
+Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+
+NVIDIA CORPORATION and its licensors retain all intellectual property
+and proprietary rights in and to this software, related documentation
+and any modifications thereto. Any use, reproduction, disclosure or
+distribution of this software and related documentation without an express
+license agreement from NVIDIA CORPORATION is strictly prohibited.
+*/
+
+#include "Composition.hlsli"
+
+NRI_RESOURCE( Texture2D<float3>, gIn_ObjectMotion, t, 8, 1 );
+NRI_RESOURCE( Texture2D<float4>, gIn_TransparentLighting, t, 9, 1 );
+NRI_RESOURCE( Texture2D<float4>, gIn_History, t, 10, 1 );
+
+NRI_RESOURCE( RWTexture2D<float4>, gOut_ComposedLighting_ViewZ, u, 11, 1 );
+NRI_RESOURCE( RWTexture2D<float3>, gOut_History, u, 12, 1 );
+
+// Composition + TAA in one pass: the tile (with the border) gets composed right into shared memory. Composed lighting is still
+// stored (the group's own pixels only), because it's fed back into ray tracing of the next frame, but it's not read back here
+float4 GetComposedLighting_ViewZ( int2 globalId, bool isGroupPixel )
+{
+    float4 color_viewZ = Compose( globalId );
+
+    if( isGroupPixel )
+        gOut_ComposedLighting_ViewZ[ globalId ] = color_viewZ;
+
+    return color_viewZ;
+}
+
+#include "Temporal.hlsli"
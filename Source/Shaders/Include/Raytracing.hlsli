@@ -11,6 +11,15 @@ license agreement from NVIDIA CORPORATION is strictly prohibited.
 #include "Shared.hlsli"
 #include "RaytracingShared.hlsli"
 
+// Permutations, see "Raytracing.rgen.hlsl"
+#define CHECKERBOARD                ( RPP == 0 )
+
+#define USE_BLUE_NOISE              ( RPP != 2 && gBlueNoise != 0 ) // "gBlueNoise" is 0 if rpp > 1
+
+#ifndef RAY_SORTING
+    #define RAY_SORTING             0 // 1 - primary rays, writes ray records, 2 - secondary rays of pixels sorted by ray records
+#endif
+
 NRI_RESOURCE( Texture2D<uint3>, gIn_Scrambling_Ranking_1spp, t, 0, 1 );
 NRI_RESOURCE( Texture2D<uint3>, gIn_Scrambling_Ranking_32spp, t, 1, 1 );
 NRI_RESOURCE( Texture2D<uint4>, gIn_Sobol, t, 2, 1 );
@@ -28,7 +37,26 @@ NRI_RESOURCE( RWTexture2D<unorm float4>, gOut_Shadow_Translucency, u, 12, 1 );
 NRI_RESOURCE( RWTexture2D<float4>, gOut_Diff, u, 13, 1 );
 NRI_RESOURCE( RWTexture2D<float4>, gOut_DiffDirectionPdf, u, 14, 1 );
 NRI_RESOURCE( RWTexture2D<float4>, gOut_Spec, u, 15, 1 );
-NRI_RESOURCE( RWTexture2D<float4>, gOut_SpecDirectionPdf, u, 16, 1 );
+NRI_RESOURCE( RWTexture2D<float4>, gOut_SpecDirectionPdf, u, 16, 1 ); // "DIRECTION_PDF = 0" - 1x1 placeholders, not written
+NRI_RESOURCE( RWBuffer<uint>, gInOut_RayRecords, u, 17, 1 ); // "RAY_SORTING != 0" only
+NRI_RESOURCE( Texture2D<uint>, gIn_SampleNum, t, 18, 1 ); // "gAdaptiveSampling != 0" only
+NRI_RESOURCE( RWBuffer<uint>, gInOut_MipFeedback, u, 19, 1 ); // "gMipFeedback != 0" only
+
+// Texture residency: the finest mip requested by each material, read back by the CPU. "GetRealMip" turns it into a real mip per texture, the CPU does the same.
+// The frame index in the upper bits makes values of older frames smaller, i.e. the buffer never needs to be cleared
+void RecordMipFeedback( GeometryProps geometryProps, bool useSimplifiedModel )
+{
+    if( !gMipFeedback || useSimplifiedModel || USE_SIMPLIFIED_BRDF_MODEL || geometryProps.IsSky( ) )
+        return;
+
+    float mip = max( geometryProps.mip + gMipBias, 0.0 ) * gUseMipmapping;
+    uint feedback = ( gFrameIndex << 8 ) | ( 255 - uint( min( mip * MIP_FEEDBACK_MIP_SCALE, 255.0 ) ) );
+    uint materialIndex = geometryProps.GetBaseTexture( ) >> 2;
+
+    // Most threads hit a material which already got this or a finer mip, skip the atomic for them
+    if( gInOut_MipFeedback[ materialIndex ] < feedback )
+        InterlockedMax( gInOut_MipFeedback[ materialIndex ], feedback );
+}
 
 // SPP - must be POW of 2!
 // Virtual 32 spp tuned for REBLUR / RELAX purposes (actually, 1 spp but distributed in time)
@@ -40,7 +68,7 @@ float2 GetBlueNoise( bool isCheckerboard, uint seed, Texture2D<uint3> texScrambl
     // Source code and textures can be found here:
     //     https://belcour.github.io/blog/research/publication/2019/06/17/sampling-bluenoise.html (but 2D only)
 
-    uint2 pixelPos = DispatchRaysIndex( ).xy;
+    uint2 pixelPos = DispatchRaysIndex( ).xy + uint2( 0, gBandOrigin );
 
     // Sample index
     uint frameIndex = isCheckerboard ? ( gFrameIndex >> 1 ) : gFrameIndex;
@@ -119,7 +147,7 @@ float4 CastSoftShadowRay( GeometryProps geometryProps, MaterialProps materialPro
     bool isOpaqueRayNeeded = STL::Color::Luminance( materialProps.Lsum ) != 0.0 && !materialProps.isEmissive && gDisableShadowsAndEnableImportanceSampling == 0; // also skips INF rays
 
     // Sample sun disk
-    float2 rnd = gBlueNoise ? GetBlueNoise( false, 0, gIn_Scrambling_Ranking_1spp, 0, 1, 1 ) : STL::Rng::GetFloat2( );
+    float2 rnd = USE_BLUE_NOISE ? GetBlueNoise( false, 0, gIn_Scrambling_Ranking_1spp, 0, 1, 1 ) : STL::Rng::GetFloat2( );
     rnd = STL::ImportanceSampling::Cosine::GetRay( rnd ).xy;
     rnd *= gTanSunAngularRadius;
 
@@ -231,10 +259,75 @@ float4 GetRadianceFromPreviousFrame( GeometryProps geometryProps, MaterialProps
     return prevLsum;
 }
 
+// Emissive triangles: [ 0 ] - header, [ 1; 1 + 3N ) - camera relative vertices, [ 1 + 3N; 1 + 4N ) - alias table
+uint GetLightTriangleNum( )
+{ return asuint( gIn_LightData[ 0 ].x ); }
+
+// Picks an emissive triangle proportionally to its power ( alias method ) and a uniformly distributed point on it. Returns a payload as if the point was hit by a ray
+UnpackedPayload SampleLight( float3 origin, float4 rnd, float2 mipAndCone, out float3 direction, out float pdf )
+{
+    uint lightTriangleNum = GetLightTriangleNum( );
+    uint aliasTableOffset = 1 + lightTriangleNum * 3;
+
+    uint index = min( uint( rnd.x * lightTriangleNum ), lightTriangleNum - 1 );
+    float4 alias = gIn_LightData[ aliasTableOffset + index ];
+    index = rnd.y < alias.x ? index : asuint( alias.y );
+
+    float trianglePdf = gIn_LightData[ aliasTableOffset + index ].z;
+    float4 v0 = gIn_LightData[ 1 + index * 3 ];
+    float4 v1 = gIn_LightData[ 1 + index * 3 + 1 ];
+    float4 v2 = gIn_LightData[ 1 + index * 3 + 2 ];
+
+    float2 barycentrics = rnd.z + rnd.w > 1.0 ? 1.0 - rnd.zw : rnd.zw;
+    float3 X = v0.xyz + ( v1.xyz - v0.xyz ) * barycentrics.x + ( v2.xyz - v0.xyz ) * barycentrics.y;
+    float3 Ng = cross( v1.xyz - v0.xyz, v2.xyz - v0.xyz ); // length = 2 * area
+
+    float3 toLight = X - origin;
+    float distSq = dot( toLight, toLight );
+    float dist = sqrt( distSq );
+    direction = toLight / dist;
+
+    // Area to solid angle
+    float projectedArea = 0.5 * abs( dot( Ng, direction ) );
+    pdf = trianglePdf * distSq / max( projectedArea, 1e-12 );
+
+    // Emission doesn't depend on the facing, front face is good enough
+    return UnpackPayload( dist, asuint( v0.w ), asuint( v1.w ), false, barycentrics, mipAndCone );
+}
+
+uint GetSampleNum( uint2 pixelPos )
+{
+#if( RPP == 1 )
+    return 1;
+#else
+    return gAdaptiveSampling ? gIn_SampleNum[ pixelPos / SAMPLE_BUDGET_TILE_SIZE ] : gSampleNum;
+#endif
+}
+
+uint GetOctant( float3 v )
+{ return uint( v.x < 0.0 ) | ( uint( v.y < 0.0 ) << 1 ) | ( uint( v.z < 0.0 ) << 2 ); }
+
+void WriteRayRecord( uint2 pixelPos, uint key )
+{
+    gInOut_RayRecords[ RAY_KEYS_OFFSET + pixelPos.y * uint( gRectSize.x ) + pixelPos.x ] = key;
+    InterlockedAdd( gInOut_RayRecords[ key ], 1 );
+}
+
 [shader( "raygeneration" )]
 void ENTRYPOINT( )
 {
-    uint2 pixelPos = DispatchRaysIndex( ).xy;
+#if( RAY_SORTING == 2 )
+    // A ray per pixel in the order of keys, the primary hit is retraced (cheaper than storing it)
+    uint rayIndex = DispatchRaysIndex( ).x;
+    uint pixelIndex = gInOut_RayRecords[ RAY_SORTED_OFFSET + rayIndex ];
+    uint2 pixelPos = uint2( pixelIndex % uint( gRectSize.x ), pixelIndex / uint( gRectSize.x ) );
+
+    // Bins are consumed by now, clear them for the next frame
+    if( rayIndex < 2 * RAY_BIN_NUM )
+        gInOut_RayRecords[ rayIndex ] = 0;
+#else
+    uint2 pixelPos = DispatchRaysIndex( ).xy + uint2( 0, gBandOrigin ); // "--multiGpu": the band of this GPU
+#endif
     float2 pixelUv = float2( pixelPos + 0.5 ) * gInvRectSize;
 
     STL::Rng::Initialize( pixelPos, gFrameIndex );
@@ -275,6 +368,7 @@ void ENTRYPOINT( )
         UnpackedPayload unpackedPayload = UnpackPayload( payload, mipAndCone );
         geometryProps0 = GetGeometryProps( unpackedPayload, rayDesc.Origin, rayDesc.Direction, gPrimaryFullBrdf == 0 );
         materialProps0 = GetMaterialProps( geometryProps0, rayDesc.Direction, gPrimaryFullBrdf == 0 );
+        RecordMipFeedback( geometryProps0, gPrimaryFullBrdf == 0 );
 
         // Debug
         if( gOnScreen == SHOW_WORLD_UNITS )
@@ -297,6 +391,7 @@ void ENTRYPOINT( )
         }
     }
 
+#if( RAY_SORTING != 2 )
     // G-buffer
     gOut_ObjectMotion[ pixelPos ] = geometryProps0.motion * STL::Math::LinearStep( 0.0, 0.0000005, abs( geometryProps0.motion ) ); // fix imprecision problems
     gOut_ViewZ[ pixelPos ] = geometryProps0.viewZ;
@@ -304,8 +399,8 @@ void ENTRYPOINT( )
     gOut_Normal_Roughness[ pixelPos ] = geometryProps0.IsSky( ) ? SKY_MARK : PackNormalAndRoughness( materialProps0.N, materialProps0.roughness );
     gOut_BaseColor_Metalness[ pixelPos ] = float4( STL::Color::LinearToSrgb( materialProps0.baseColor ), materialProps0.metalness );
 
-    // Transparent lighting
-    if( gTransparent != 0.0 )
+    // Transparent lighting (the scene has transparent objects)
+#if( TRANSPARENCY == 1 )
     {
         RayDesc rayDesc;
         rayDesc.Origin = rayOrigin0;
@@ -375,11 +470,19 @@ void ENTRYPOINT( )
 
         gOut_TransparentLighting[ pixelPos ] = transparentLayer;
     }
+#endif
+#endif
 
     // Early out
     if( geometryProps0.IsSky( ) )
     {
+    #if( RAY_SORTING == 1 )
+        WriteRayRecord( pixelPos, RAY_BIN_NUM - 1 );
+    #endif
+
+    #if( RAY_SORTING != 2 )
         gOut_ShadowData[ pixelPos ] = SIGMA_INF_SHADOW;
+    #endif
 
         #if( CHECKERBOARD != 0 )
             pixelPos.x >>= 1;
@@ -390,6 +493,7 @@ void ENTRYPOINT( )
         return;
     }
 
+#if( RAY_SORTING != 2 )
     // Sun shadow
     float4 shadowData0 = CastSoftShadowRay( geometryProps0, materialProps0 );
 
@@ -398,6 +502,17 @@ void ENTRYPOINT( )
 
     gOut_ShadowData[ pixelPos ] = shadowData;
     gOut_Shadow_Translucency[ pixelPos ] = shadowTranslucency;
+#endif
+
+#if( RAY_SORTING == 1 )
+    // Secondary rays of pixels with similar diffuse and specular directions and lobe widths get traced together
+    float3 reflectedDirection = reflect( rayDirection0, materialProps0.N );
+    uint isRough = materialProps0.roughness > RAY_SORT_ROUGHNESS_THRESHOLD ? 1 : 0;
+    uint key = GetOctant( materialProps0.N ) | ( GetOctant( reflectedDirection ) << 3 ) | ( isRough << 6 );
+    WriteRayRecord( pixelPos, key );
+
+    return;
+#endif
 
     // Secondary rays
     float4 diffIndirect = 0;
@@ -413,7 +528,7 @@ void ENTRYPOINT( )
     float trimmingFactor = NRD_GetTrimmingFactor( materialProps0.roughness, gTrimmingParams );
 
 #if( CHECKERBOARD == 0 )
-    uint N = gSampleNum << 1;
+    uint N = GetSampleNum( pixelPos ) << 1;
     for( uint i = 0; i < N; i++ )
     {
         bool isDiffuse = ( i & 0x1 ) == 0;
@@ -435,7 +550,7 @@ void ENTRYPOINT( )
     #endif
         {
             // Low descrepancy sampling is your friend in the "Low Rpp World"
-            float2 rnd = ( gBlueNoise && tryNum == 0 ) ? GetBlueNoise( isCheckerboard, 0, gIn_Scrambling_Ranking_32spp, 0, 32, 1 ) : STL::Rng::GetFloat2( );
+            float2 rnd = ( USE_BLUE_NOISE && tryNum == 0 ) ? GetBlueNoise( isCheckerboard, 0, gIn_Scrambling_Ranking_32spp, 0, 32, 1 ) : STL::Rng::GetFloat2( );
 
             if( isDiffuse )
             {
@@ -499,6 +614,7 @@ void ENTRYPOINT( )
             UnpackedPayload unpackedPayload = UnpackPayload( payload, mipAndCone );
             geometryProps1 = GetGeometryProps( unpackedPayload, rayDesc.Origin, rayDesc.Direction, gIndirectFullBrdf == 0 );
             materialProps1 = GetMaterialProps( geometryProps1, rayDesc.Direction, gIndirectFullBrdf == 0 );
+            RecordMipFeedback( geometryProps1, gIndirectFullBrdf == 0 );
         }
 
         float3 Clight1 = materialProps1.Lsum;
@@ -591,90 +707,47 @@ void ENTRYPOINT( )
         // Apply throughput1
         Clight1 *= throughput1;
 
-        #if( USE_IMPORTANCE_SAMPLING > 1 )
-            if( gDisableShadowsAndEnableImportanceSampling != 0 )
+        #if( USE_IMPORTANCE_SAMPLING > 1 && EMISSION == 1 )
+            if( gDisableShadowsAndEnableImportanceSampling != 0 && GetLightTriangleNum( ) != 0 )
             {
-                Payload payload = (Payload)0;
-
-                RayDesc rayDesc;
-                rayDesc.Origin = geometryProps0.GetXWithOffset();
-                rayDesc.Direction = rayDirection1;
-                rayDesc.TMin = 0.0;
-                rayDesc.TMax = INF;
-
                 float2 mipAndCone = GetConeAngle( geometryProps0.mip + 1.0, isDiffuse ? 1.0 : materialProps0.roughness );
-
-                throughput1 = 0.0;
-                tryNum = 0;
+                float3 origin = geometryProps0.GetXWithOffset();
 
                 // Sample emissive surfaces
-                while( tryNum < IMPORTANCE_SAMPLE_NUM && throughput1 == 0.0 )
+                float3 lightDirection;
+                float lightPdf;
+                UnpackedPayload unpackedPayload = SampleLight( origin, STL::Rng::GetFloat4( ), mipAndCone, lightDirection, lightPdf );
+
+                // BRDF sampled rays are normalized by "pdf" and "throughput1", evaluate the same terms in the light direction
+                float NoL = saturate( dot( materialProps0.N, lightDirection ) );
+                float lightThroughput;
+                if( isDiffuse )
+                    lightThroughput = STL::ImportanceSampling::Cosine::GetPDF( NoL );
+                else
                 {
-                    float2 rnd = STL::Rng::GetFloat4( ).xy;
-
-                    if( isDiffuse )
-                    {
-                        float3 rayLocal = STL::ImportanceSampling::Cosine::GetRay( rnd );
-                        rayDirection1 = STL::Geometry::RotateVectorInverse( mLocalBasis, rayLocal );
-
-                        // No PDF and NoL for diffuse because it gets canceled out by STL::ImportanceSampling::Cosine::GetPDF
-                        throughput1 = 1.0;
-
-                        pdf = STL::ImportanceSampling::Cosine::GetPDF( saturate( dot( materialProps0.N, rayDirection1 ) ) );
-                    }
-                    else
-                    {
-                        float3 Hlocal = STL::ImportanceSampling::VNDF::GetRay( rnd, materialProps0.roughness, Vlocal, trimmingFactor );
-                        float3 H = STL::Geometry::RotateVectorInverse( mLocalBasis, Hlocal );
-                        rayDirection1 = reflect( rayDirection0, H );
-
-                        // FIX for non-parallaxed normal mapping - normal maps can easily force rays to go under the surface, it should be avoided for specular rays
-                        float f = 1.0 - STL::Math::SmoothStep( 0.0, 0.3, materialProps0.roughness );
-                        f *= saturate( -dot( rayDirection1, geometryProps0.N ) );
-                        rayDirection1 += 2.0 * geometryProps0.N * f;
-
-                        // It's a part of VNDF sampling - see http://jcgt.org/published/0007/04/01/paper.pdf (paragraph "Usage in Monte Carlo renderer")
-                        float NoL = saturate( dot( materialProps0.N, rayDirection1 ) );
-                        throughput1 = STL::BRDF::GeometryTerm_Smith( materialProps0.roughness, NoL );
-
-                        pdf = STL::ImportanceSampling::VNDF::GetPDF( abs( dot( materialProps0.N, -rayDirection0 ) ), saturate( dot( materialProps0.N, H ) ), materialProps0.roughness );
-                    }
-
-                    // But we don't want to cast rays inside the surface
-                    float NoL = saturate( dot( geometryProps0.N, rayDirection1 ) );
-                    throughput1 *= STL::Math::LinearStep( 0.0, 0.001, NoL );
-
-                    // Emissive surfaces importance sampling
-                    rayDesc.Direction = rayDirection1;
-
-                    payload = InitPayload( mipAndCone );
-                    {
-                        const uint rayFlags = RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH;
-                        const uint instanceInclusionMask = throughput1 != 0.0 ? FLAGS_ONLY_EMISSION : 0;
-                        const uint rayContributionToHitGroupIndex = 0;
-                        const uint multiplierForGeometryContributionToHitGroupIndex = 0;
-                        const uint missShaderIndex = 0;
-
-                        TraceRay( gLightTlas, rayFlags, instanceInclusionMask, rayContributionToHitGroupIndex, multiplierForGeometryContributionToHitGroupIndex, missShaderIndex, rayDesc, payload );
-                    }
-
-                    throughput1 *= float( payload.tmin != INF );
-                    tryNum++;
+                    float3 H = normalize( lightDirection - rayDirection0 );
+                    lightThroughput = STL::ImportanceSampling::VNDF::GetPDF( abs( dot( materialProps0.N, -rayDirection0 ) ), saturate( dot( materialProps0.N, H ) ), materialProps0.roughness );
+                    lightThroughput *= STL::BRDF::GeometryTerm_Smith( materialProps0.roughness, NoL );
                 }
 
-                throughput1 /= float( tryNum );
+                // But we don't want to cast rays inside the surface
+                lightThroughput *= STL::Math::LinearStep( 0.0, 0.001, saturate( dot( geometryProps0.N, lightDirection ) ) );
+                lightThroughput /= lightPdf;
 
-                // Visibility
-                UnpackedPayload unpackedPayload = UnpackPayload( payload, mipAndCone );
-                geometryProps1 = GetGeometryProps( unpackedPayload, rayDesc.Origin, rayDesc.Direction, gIndirectFullBrdf == 0 );
-                materialProps1 = GetMaterialProps( geometryProps1, rayDesc.Direction, gIndirectFullBrdf == 0 );
+                GeometryProps geometryPropsL = GetGeometryProps( unpackedPayload, origin, lightDirection, gIndirectFullBrdf == 0 );
+                MaterialProps materialPropsL = GetMaterialProps( geometryPropsL, lightDirection, gIndirectFullBrdf == 0 );
 
-                rayDesc.TMax = geometryProps1.tmin;
+                // Visibility
+                RayDesc rayDesc;
+                rayDesc.Origin = origin;
+                rayDesc.Direction = lightDirection;
+                rayDesc.TMin = 0.0;
+                rayDesc.TMax = unpackedPayload.tmin * 0.999;
 
-                payload = InitPayload( mipAndCone );
+                Payload payload = InitPayload( mipAndCone );
                 {
                     const uint rayFlags = RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH;
-                    const uint instanceInclusionMask = throughput1 != 0.0 ? FLAGS_DEFAULT : 0;
+                    const uint instanceInclusionMask = lightThroughput != 0.0 ? FLAGS_DEFAULT : 0;
                     const uint rayContributionToHitGroupIndex = 0;
                     const uint multiplierForGeometryContributionToHitGroupIndex = 0;
                     const uint missShaderIndex = 0;
@@ -682,7 +755,7 @@ void ENTRYPOINT( )
                     TraceRay( gWorldTlas, rayFlags, instanceInclusionMask, rayContributionToHitGroupIndex, multiplierForGeometryContributionToHitGroupIndex, missShaderIndex, rayDesc, payload );
                 }
 
-                Clight1 += materialProps1.Lsum * throughput1 * float( payload.tmin == INF );
+                Clight1 += materialPropsL.Lsum * lightThroughput * float( payload.tmin == INF );
 
                 // TODO: should I do it? This part is direct lighting only but the previous is most likely something else...
                 // TODO: Direct lighting from emissives should be disabled for the previous ray
@@ -778,22 +851,28 @@ void ENTRYPOINT( )
     // Indirect lighting output
 #if( CHECKERBOARD == 0 )
     gOut_Diff[ pixelPos ] = diffIndirect;
-    gOut_DiffDirectionPdf[ pixelPos ] = diffDirectionPdf;
-
     gOut_Spec[ pixelPos ] = specIndirect;
-    gOut_SpecDirectionPdf[ pixelPos ] = specDirectionPdf;
+
+    #if( DIRECTION_PDF == 1 )
+        gOut_DiffDirectionPdf[ pixelPos ] = diffDirectionPdf;
+        gOut_SpecDirectionPdf[ pixelPos ] = specDirectionPdf;
+    #endif
 #else
     pixelPos.x >>= 1;
 
     if( isDiffuse )
     {
         gOut_Diff[ pixelPos ] = diffIndirect;
-        gOut_DiffDirectionPdf[ pixelPos ] = diffDirectionPdf;
+        #if( DIRECTION_PDF == 1 )
+            gOut_DiffDirectionPdf[ pixelPos ] = diffDirectionPdf;
+        #endif
     }
     else
     {
         gOut_Spec[ pixelPos ] = specIndirect;
-        gOut_SpecDirectionPdf[ pixelPos ] = specDirectionPdf;
+        #if( DIRECTION_PDF == 1 )
+            gOut_SpecDirectionPdf[ pixelPos ] = specDirectionPdf;
+        #endif
     }
 #endif
 }
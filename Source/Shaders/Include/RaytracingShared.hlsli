@@ -9,10 +9,12 @@ license agreement from NVIDIA CORPORATION is strictly prohibited.
 */
 
 NRI_RESOURCE( RaytracingAccelerationStructure, gWorldTlas, t, 0, 2 );
-NRI_RESOURCE( RaytracingAccelerationStructure, gLightTlas, t, 1, 2 );
+NRI_RESOURCE( Buffer<float4>, gIn_LightData, t, 1, 2 );
 NRI_RESOURCE( Buffer<uint4>, gIn_PrimitiveData, t, 2, 2 );
 NRI_RESOURCE( Buffer<float4>, gIn_InstanceData, t, 3, 2 );
-NRI_RESOURCE( Texture2D<float4>, gIn_Textures[], t, 4, 2 );
+NRI_RESOURCE( Buffer<uint>, gIn_Indices, t, 4, 2 );
+NRI_RESOURCE( Buffer<uint4>, gIn_VertexData, t, 5, 2 );
+NRI_RESOURCE( Texture2D<float4>, gIn_Textures[], t, 6, 2 );
 
 //====================================================================================================================================
 
@@ -25,6 +27,8 @@ NRI_RESOURCE( Texture2D<float4>, gIn_Textures[], t, 4, 2 );
 #define FLAG_EMISSION                   0x04
 #define FLAG_FORCED_EMISSION            0x08
 
+#define MATERIAL_INDEX_BITS             24 // the rest holds the finest mip resident in all material textures (texture streaming)
+
 // Local flags
 #define FLAG_BACKFACE                   0x10
 #define FLAG_UNUSED1                    0x20
@@ -37,6 +41,11 @@ NRI_RESOURCE( Texture2D<float4>, gIn_Textures[], t, 4, 2 );
 #define FLAGS_IGNORE_TRANSPARENT        ( FLAG_OPAQUE_OR_ALPHA_OPAQUE | FLAG_EMISSION | FLAG_FORCED_EMISSION )
 #define FLAGS_DEFAULT                   FLAGS_IGNORE_TRANSPARENT
 
+// Raygen permutation, always on in other shaders
+#ifndef EMISSION
+    #define EMISSION                    1
+#endif
+
 struct IntersectionAttributes
 {
     float2 barycentrics;
@@ -131,6 +140,13 @@ UnpackedPayload UnpackPayload( Payload p, float2 mipAndCone )
 
 //====================================================================================================================================
 
+float3 DecodeUnitVectorUnorm16( uint p )
+{
+    float2 f = float2( p & 0xFFFF, p >> 16 ) / 65535.0;
+
+    return STL::Packing::DecodeUnitVector( f );
+}
+
 struct GeometryProps
 {
     float3 motion;
@@ -167,7 +183,10 @@ struct GeometryProps
     { return ( flags & ( FLAG_BACKFACE << 24 ) ) != 0; }
 
     uint GetBaseTexture()
-    { return textureOffset << 2; } // 4 textures per object
+    { return ( textureOffset & ( ( 1 << MATERIAL_INDEX_BITS ) - 1 ) ) << 2; } // 4 textures per object
+
+    float GetMinMip()
+    { return float( textureOffset >> MATERIAL_INDEX_BITS ); }
 
     float3 GetForcedEmissionColor()
     { return ( textureOffset & 0x1 ) ? float3( 1, 0, 0 ) : float3( 0, 1, 0 ); }
@@ -195,7 +214,7 @@ GeometryProps GetGeometryProps( UnpackedPayload unpackedPayload, float3 rayOrigi
     {
         // Instance
         uint instanceDataOffset = unpackedPayload.GetInstanceId();
-        instanceDataOffset *= 6;
+        instanceDataOffset = gInstanceDataOffset + instanceDataOffset * 6;
 
         float4 instanceData0 = gIn_InstanceData[ instanceDataOffset ];
         float4 instanceData1 = gIn_InstanceData[ instanceDataOffset + 1 ];
@@ -214,41 +233,99 @@ GeometryProps GetGeometryProps( UnpackedPayload unpackedPayload, float3 rayOrigi
         // Primitive data
         uint primitiveIndex = unpackedPayload.primitiveId;
         primitiveIndex += asuint( instanceData0.w );
-        primitiveIndex *= 4;
-
-        uint4 primitiveData0 = gIn_PrimitiveData[ primitiveIndex ];
-        uint4 primitiveData1 = gIn_PrimitiveData[ primitiveIndex + 1 ];
-        uint4 primitiveData2 = gIn_PrimitiveData[ primitiveIndex + 2 ];
-        uint4 primitiveData3 = gIn_PrimitiveData[ primitiveIndex + 3 ];
-
-        float2 uv0 = STL::Packing::UintToRg16f( primitiveData0.x );
-        float2 uv1 = STL::Packing::UintToRg16f( primitiveData0.y );
-        float2 uv2 = STL::Packing::UintToRg16f( primitiveData0.z );
-        float2 nfx_nfy = STL::Packing::UintToRg16f( primitiveData0.w );
-
-        float2 nfz_worldToUvUnits = STL::Packing::UintToRg16f( primitiveData1.x );
-        float2 n0x_n0y = STL::Packing::UintToRg16f( primitiveData1.y );
-        float2 n0z_n1x = STL::Packing::UintToRg16f( primitiveData1.z );
-        float2 n1y_n1z = STL::Packing::UintToRg16f( primitiveData1.w );
-
-        float2 n2x_n2y = STL::Packing::UintToRg16f( primitiveData2.x );
-        float2 n2z_t0x = STL::Packing::UintToRg16f( primitiveData2.y );
-        float2 t0y_t0z = STL::Packing::UintToRg16f( primitiveData2.z );
-        float2 t1x_t1y = STL::Packing::UintToRg16f( primitiveData2.w );
-
-        float2 t1z_t2x = STL::Packing::UintToRg16f( primitiveData3.x );
-        float2 t2y_t2z = STL::Packing::UintToRg16f( primitiveData3.y );
-        float2 b0s_b1s = STL::Packing::UintToRg16f( primitiveData3.z );
-        float2 b2s_curvature = STL::Packing::UintToRg16f( primitiveData3.w );
-
-        if( useSimplifiedModel || USE_SIMPLIFIED_BRDF_MODEL )
+
+        bool isSimplified = useSimplifiedModel || USE_SIMPLIFIED_BRDF_MODEL;
+
+        float2 uv0 = 0, uv1 = 0, uv2 = 0;
+        float3 nf, n0 = 0, n1 = 0, n2 = 0;
+        float4 t0 = 0, t1 = 0, t2 = 0;
+        float worldToUvUnits;
+
+        [branch]
+        if( gCompactPrimitiveData )
+        {
+            // Face normal and "worldToUvUnits" per triangle, 2 triangles per element
+            uint4 primitiveData = gIn_PrimitiveData[ primitiveIndex >> 1 ];
+            uint2 triangleData = ( primitiveIndex & 1 ) ? primitiveData.zw : primitiveData.xy;
+
+            nf = DecodeUnitVectorUnorm16( triangleData.x );
+            worldToUvUnits = asfloat( triangleData.y );
+
+            // Vertex attributes are not needed by the simplified model
+            [branch]
+            if( !isSimplified )
+            {
+                uint3 indices;
+                indices.x = gIn_Indices[ primitiveIndex * 3 ];
+                indices.y = gIn_Indices[ primitiveIndex * 3 + 1 ];
+                indices.z = gIn_Indices[ primitiveIndex * 3 + 2 ];
+
+                uint4 vertexData0 = gIn_VertexData[ indices.x ];
+                uint4 vertexData1 = gIn_VertexData[ indices.y ];
+                uint4 vertexData2 = gIn_VertexData[ indices.z ];
+
+                uv0 = STL::Packing::UintToRg16f( vertexData0.x );
+                uv1 = STL::Packing::UintToRg16f( vertexData1.x );
+                uv2 = STL::Packing::UintToRg16f( vertexData2.x );
+
+                n0 = DecodeUnitVectorUnorm16( vertexData0.y );
+                n1 = DecodeUnitVectorUnorm16( vertexData1.y );
+                n2 = DecodeUnitVectorUnorm16( vertexData2.y );
+
+                t0 = float4( DecodeUnitVectorUnorm16( vertexData0.z ), asfloat( vertexData0.w ) );
+                t1 = float4( DecodeUnitVectorUnorm16( vertexData1.z ), asfloat( vertexData1.w ) );
+                t2 = float4( DecodeUnitVectorUnorm16( vertexData2.z ), asfloat( vertexData2.w ) );
+            }
+        }
+        else
+        {
+            primitiveIndex *= 4;
+
+            uint4 primitiveData0 = gIn_PrimitiveData[ primitiveIndex ];
+            uint4 primitiveData1 = gIn_PrimitiveData[ primitiveIndex + 1 ];
+            uint4 primitiveData2 = gIn_PrimitiveData[ primitiveIndex + 2 ];
+            uint4 primitiveData3 = gIn_PrimitiveData[ primitiveIndex + 3 ];
+
+            uv0 = STL::Packing::UintToRg16f( primitiveData0.x );
+            uv1 = STL::Packing::UintToRg16f( primitiveData0.y );
+            uv2 = STL::Packing::UintToRg16f( primitiveData0.z );
+            float2 nfx_nfy = STL::Packing::UintToRg16f( primitiveData0.w );
+
+            float2 nfz_worldToUvUnits = STL::Packing::UintToRg16f( primitiveData1.x );
+            float2 n0x_n0y = STL::Packing::UintToRg16f( primitiveData1.y );
+            float2 n0z_n1x = STL::Packing::UintToRg16f( primitiveData1.z );
+            float2 n1y_n1z = STL::Packing::UintToRg16f( primitiveData1.w );
+
+            float2 n2x_n2y = STL::Packing::UintToRg16f( primitiveData2.x );
+            float2 n2z_t0x = STL::Packing::UintToRg16f( primitiveData2.y );
+            float2 t0y_t0z = STL::Packing::UintToRg16f( primitiveData2.z );
+            float2 t1x_t1y = STL::Packing::UintToRg16f( primitiveData2.w );
+
+            float2 t1z_t2x = STL::Packing::UintToRg16f( primitiveData3.x );
+            float2 t2y_t2z = STL::Packing::UintToRg16f( primitiveData3.y );
+            float2 b0s_b1s = STL::Packing::UintToRg16f( primitiveData3.z );
+            float2 b2s_curvature = STL::Packing::UintToRg16f( primitiveData3.w );
+
+            nf = float3( nfx_nfy, nfz_worldToUvUnits.x );
+            worldToUvUnits = nfz_worldToUvUnits.y;
+
+            n0 = float3( n0x_n0y, n0z_n1x.x );
+            n1 = float3( n0z_n1x.y, n1y_n1z );
+            n2 = float3( n2x_n2y, n2z_t0x.x );
+
+            t0 = float4( n2z_t0x.y, t0y_t0z, b0s_b1s.x );
+            t1 = float4( t1x_t1y, t1z_t2x.x, b0s_b1s.y );
+            t2 = float4( t1z_t2x.y, t2y_t2z, b2s_curvature.x );
+        }
+
+        if( isSimplified )
         {
             // Material & flags
             props.textureOffset = asuint( instanceData2.w );
             props.flags = unpackedPayload.GetFlags();
 
             // Normal
-            float3 N = float3( nfx_nfy, nfz_worldToUvUnits.x );
+            float3 N = nf;
             N = STL::Geometry::RotateVector( mObjectToWorld, N );
             N = normalize( N );
             props.N = unpackedPayload.IsBackFace() ? -N : N;
@@ -265,20 +342,12 @@ GeometryProps GetGeometryProps( UnpackedPayload unpackedPayload, float3 rayOrigi
             props.uv = barycentrics.x * uv0 + barycentrics.y * uv1 + barycentrics.z * uv2;
 
             // Normal
-            float3 n0 = float3( n0x_n0y, n0z_n1x.x );
-            float3 n1 = float3( n0z_n1x.y, n1y_n1z );
-            float3 n2 = float3( n2x_n2y, n2z_t0x.x );
-
             float3 N = barycentrics.x * n0 + barycentrics.y * n1 + barycentrics.z * n2;
             N = STL::Geometry::RotateVector( mObjectToWorld, N );
             N = normalize( N );
             props.N = unpackedPayload.IsBackFace() ? -N : N;
 
             // Tangent
-            float4 t0 = float4( n2z_t0x.y, t0y_t0z, b0s_b1s.x );
-            float4 t1 = float4( t1x_t1y, t1z_t2x.x, b0s_b1s.y );
-            float4 t2 = float4( t1z_t2x.y, t2y_t2z, b2s_curvature.x );
-
             float4 T = barycentrics.x * t0 + barycentrics.y * t1 + barycentrics.z * t2;
             T.xyz = STL::Geometry::RotateVector( mObjectToWorld, T.xyz );
             T.xyz = normalize( T.xyz );
@@ -298,7 +367,7 @@ GeometryProps GetGeometryProps( UnpackedPayload unpackedPayload, float3 rayOrigi
                 float a = unpackedPayload.tmin;
                 a *= unpackedPayload.mipAndCone.y;
                 a *= STL::Math::PositiveRcp( NoR );
-                a *= nfz_worldToUvUnits.y * invObjectScale;
+                a *= worldToUvUnits * invObjectScale;
 
                 float mip = log2( a );
             #else
@@ -322,7 +391,7 @@ GeometryProps GetGeometryProps( UnpackedPayload unpackedPayload, float3 rayOrigi
                 float3 dy = rayDirectionOffsetY * ky - rayDirection;
 
                 // Transforming from "world" to "uv" space
-                float k = nfz_worldToUvUnits.y * unpackedPayload.tmin * invObjectScale;
+                float k = worldToUvUnits * unpackedPayload.tmin * invObjectScale;
                 float kSq = k * k;
                 float duvdxMulTexSizeSq = dot( dx, dx ) * kSq;
                 float duvdyMulTexSizeSq = dot( dy, dy ) * kSq;
@@ -380,7 +449,7 @@ Returns:
     .z - for sharp sampling
         Negative MIP bias is applied (can be more negative...)
 */
-float3 GetRealMip( uint textureIndex, float mip )
+float3 GetRealMip( uint textureIndex, float mip, float minMip )
 {
     float w, h;
     gIn_Textures[ textureIndex ].GetDimensions( w, h ); // TODO: if I only had it as a constant...
@@ -394,7 +463,10 @@ float3 GetRealMip( uint textureIndex, float mip )
     mips.y = realMip + gMipBias * 0.5;
     mips.z = realMip + gMipBias;
 
-    return max( mips, 0.0 ) * gUseMipmapping;
+    mips = max( mips, 0.0 ) * gUseMipmapping;
+
+    // Finer mips are not streamed in yet
+    return max( mips, minMip );
 }
 
 MaterialProps GetMaterialProps( GeometryProps geometryProps, float3 rayDirection, bool useSimplifiedModel = false  )
@@ -439,7 +511,7 @@ MaterialProps GetMaterialProps( GeometryProps geometryProps, float3 rayDirection
     else
     {
         uint baseTexture = geometryProps.GetBaseTexture();
-        float3 mips = GetRealMip( baseTexture, geometryProps.mip );
+        float3 mips = GetRealMip( baseTexture, geometryProps.mip, geometryProps.GetMinMip() );
 
         // Base color
         float4 color = gIn_Textures[ baseTexture ].SampleLevel( gLinearMipmapLinearSampler, geometryProps.uv, mips.z );
@@ -513,7 +585,11 @@ MaterialProps GetMaterialProps( GeometryProps geometryProps, float3 rayDirection
     }
 
     // Output
-    emissive *= gEmissionIntensity * float( geometryProps.IsEmissive() );
+    #if( EMISSION == 1 )
+        emissive *= gEmissionIntensity * float( geometryProps.IsEmissive() );
+    #else
+        emissive = 0.0;
+    #endif
 
     MaterialProps props = ( MaterialProps )0;
     props.N = N;
@@ -69,6 +69,11 @@ NRI_RESOURCE( cbuffer, globalConstants, b, 0, 0 )
     uint gBlueNoise;
     uint gSampleNum;
     uint gOcclusionOnly;
+    uint gInstanceDataOffset;
+    uint gAdaptiveSampling;
+    uint gMipFeedback;
+    uint gCompactPrimitiveData;
+    uint gBandOrigin;
 };
 
 NRI_RESOURCE( SamplerState, gLinearMipmapLinearSampler, s, 1, 0 );
@@ -113,6 +118,29 @@ NRI_RESOURCE( SamplerState, gLinearSampler, s, 3, 0 );
 
 #define SKY_MARK                            0.0
 
+// Ray sorting ("--sortRays"), "gInOut_RayRecords" layout (in uints): [0; BIN_NUM) - bin sizes, [BIN_NUM; 2 * BIN_NUM) - bin cursors, then a key per pixel, then pixel indices sorted by key
+#define RAY_BIN_NUM                         ( 128 + 1 ) // octants of N and the reflected direction x 2 material classes (glossy and rough), + sky
+#define RAY_SORT_ROUGHNESS_THRESHOLD        0.5 // rough lobes scatter secondary rays far from the reflected direction
+#define RAY_SORT_GROUP_SIZE                 256 // must be >= RAY_BIN_NUM
+#define RAY_KEYS_OFFSET                     ( 2 * RAY_BIN_NUM )
+#define RAY_SORTED_OFFSET                   ( RAY_KEYS_OFFSET + uint( gRectSize.x ) * uint( gRectSize.y ) )
+
+// Adaptive sampling ("--adaptiveSampling"), "gOut_SampleSum" holds the number of distributed samples (read back in debug builds to check the budget)
+#define SAMPLE_BUDGET_TILE_SIZE             16
+#define SAMPLE_BUDGET_NOISE_MAX             4.0 // relative, clamps fireflies
+#define SAMPLE_BUDGET_MAX_SCALE             4 // a tile gets at most 4x "gSampleNum" rays per pixel...
+#define SAMPLE_BUDGET_SAMPLE_NUM_MAX        16 // ... but not more than this
+
+// Texture residency ("--textureResidency"), "gInOut_MipFeedback" holds a uint per material: the frame index in the upper 24 bits, the inverted finest requested mip in fixed point in the lower 8 bits
+#define MIP_FEEDBACK_MIP_SCALE              16.0
+
+// Quality harness ("--quality"), "Buffer::QualityReference" holds a half4 per output pixel packed into 2 uints, "Buffer::QualityMetrics" holds 4 uints per tile:
+// the sum of squared errors and the sum of SSIM of blocks (as floats), then pixel and block counts
+#define QUALITY_TILE_SIZE                   16
+#define QUALITY_BLOCK_SIZE                  8 // SSIM window
+#define QUALITY_SSIM_C1                     ( 0.01 * 0.01 )
+#define QUALITY_SSIM_C2                     ( 0.03 * 0.03 )
+
 // Settings
 #define USE_SQRT_ROUGHNESS                  0
 #define USE_OCT_PACKED_NORMALS              0
@@ -131,7 +159,6 @@ NRI_RESOURCE( SamplerState, gLinearSampler, s, 3, 0 );
 #define MAX_MIP_LEVEL                       11.0
 #define EMISSION_TEXTURE_MIP_BIAS           5.0
 #define ZERO_TROUGHPUT_SAMPLE_NUM           16
-#define IMPORTANCE_SAMPLE_NUM               16
 #define GLASS_TINT                          float3( 0.9, 0.9, 1.0 )
 
 //=============================================================================================
@@ -22,7 +22,7 @@ void Main_rahit( inout Payload payload, IntersectionAttributes intersectionAttri
     GeometryProps geometryProps = GetGeometryProps( unpackedPayload, WorldRayOrigin( ), WorldRayDirection( ) );
 
     uint baseTexture = geometryProps.GetBaseTexture();
-    float3 mips = GetRealMip( baseTexture, geometryProps.mip );
+    float3 mips = GetRealMip( baseTexture, geometryProps.mip, geometryProps.GetMinMip() );
     float alpha = gIn_Textures[ baseTexture ].SampleLevel( gLinearMipmapLinearSampler, geometryProps.uv, mips.x ).w;
 
     if( alpha < 0.5 )
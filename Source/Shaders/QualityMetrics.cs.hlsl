@@ -0,0 +1,108 @@
+/*
+Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+
+NVIDIA CORPORATION and its licensors retain all intellectual property
+and proprietary rights in and to this software, related documentation
+and any modifications thereto. Any use, reproduction, disclosure or
+distribution of this software and related documentation without an express
+license agreement from NVIDIA CORPORATION is strictly prohibited.
+*/
+
+#include "Shared.hlsli"
+
+NRI_RESOURCE( Texture2D<float4>, gIn_Image, t, 0, 1 );
+
+NRI_RESOURCE( RWBuffer<uint>, gIn_Reference, u, 1, 1 );
+NRI_RESOURCE( RWBuffer<uint>, gOut_Metrics, u, 2, 1 );
+
+#define THREAD_NUM ( QUALITY_TILE_SIZE * QUALITY_TILE_SIZE )
+#define BLOCK_THREAD_NUM ( QUALITY_BLOCK_SIZE * QUALITY_BLOCK_SIZE )
+#define BLOCKS_PER_ROW ( QUALITY_TILE_SIZE / QUALITY_BLOCK_SIZE )
+
+groupshared float4 s_Moments[ THREAD_NUM ]; // x, y, x^2, y^2 (luminance)
+groupshared float3 s_Covariance_Error_Num[ THREAD_NUM ]; // x * y, squared error, pixel count
+
+// Squared error per pixel (for PSNR) and SSIM of luminance over non-overlapping blocks, summed per tile. The CPU does the rest
+[numthreads( QUALITY_TILE_SIZE, QUALITY_TILE_SIZE, 1 )]
+void main( uint2 pixelPos : SV_DispatchThreadId, uint2 threadPos : SV_GroupThreadId, uint2 tilePos : SV_GroupId )
+{
+    float4 moments = 0;
+    float3 covariance_error_num = 0;
+
+    if( all( pixelPos < uint2( gOutputSize ) ) )
+    {
+        uint index = ( pixelPos.y * uint( gOutputSize.x ) + pixelPos.x ) * 2;
+        uint2 packed = uint2( gIn_Reference[ index ], gIn_Reference[ index + 1 ] );
+        float3 reference = float3( f16tof32( packed.x ), f16tof32( packed.x >> 16 ), f16tof32( packed.y ) );
+        float3 color = saturate( gIn_Image[ pixelPos ].xyz );
+
+        float3 delta = color - reference;
+        float x = STL::Color::Luminance( color );
+        float y = STL::Color::Luminance( reference );
+
+        moments = float4( x, y, x * x, y * y );
+        covariance_error_num = float3( x * y, dot( delta, delta ) / 3.0, 1.0 );
+    }
+
+    // Threads of a block are contiguous
+    uint2 blockPos = threadPos / QUALITY_BLOCK_SIZE;
+    uint2 blockThreadPos = threadPos % QUALITY_BLOCK_SIZE;
+    uint blockThreadIndex = blockThreadPos.y * QUALITY_BLOCK_SIZE + blockThreadPos.x;
+    uint threadIndex = ( blockPos.y * BLOCKS_PER_ROW + blockPos.x ) * BLOCK_THREAD_NUM + blockThreadIndex;
+
+    s_Moments[ threadIndex ] = moments;
+    s_Covariance_Error_Num[ threadIndex ] = covariance_error_num;
+    GroupMemoryBarrierWithGroupSync( );
+
+    [unroll]
+    for( uint stride = BLOCK_THREAD_NUM / 2; stride > 0; stride >>= 1 )
+    {
+        if( blockThreadIndex < stride )
+        {
+            s_Moments[ threadIndex ] += s_Moments[ threadIndex + stride ];
+            s_Covariance_Error_Num[ threadIndex ] += s_Covariance_Error_Num[ threadIndex + stride ];
+        }
+
+        GroupMemoryBarrierWithGroupSync( );
+    }
+
+    if( threadIndex == 0 )
+    {
+        float errorSum = 0;
+        float ssimSum = 0;
+        float pixelNum = 0;
+        float blockNum = 0;
+
+        [unroll]
+        for( uint i = 0; i < BLOCKS_PER_ROW * BLOCKS_PER_ROW; i++ )
+        {
+            float4 m = s_Moments[ i * BLOCK_THREAD_NUM ];
+            float3 c = s_Covariance_Error_Num[ i * BLOCK_THREAD_NUM ];
+
+            errorSum += c.y;
+            pixelNum += c.z;
+
+            // Blocks clipped by the screen border are skipped if too small to have meaningful statistics
+            if( c.z >= BLOCK_THREAD_NUM / 4 )
+            {
+                float invNum = 1.0 / c.z;
+                float2 mean = m.xy * invNum;
+                float2 variance = max( m.zw * invNum - mean * mean, 0.0 );
+                float covariance = c.x * invNum - mean.x * mean.y;
+
+                float ssim = ( 2.0 * mean.x * mean.y + QUALITY_SSIM_C1 ) * ( 2.0 * covariance + QUALITY_SSIM_C2 );
+                ssim /= ( mean.x * mean.x + mean.y * mean.y + QUALITY_SSIM_C1 ) * ( variance.x + variance.y + QUALITY_SSIM_C2 );
+
+                ssimSum += ssim;
+                blockNum += 1.0;
+            }
+        }
+
+        uint tileIndex = ( tilePos.y * ( ( uint( gOutputSize.x ) + QUALITY_TILE_SIZE - 1 ) / QUALITY_TILE_SIZE ) + tilePos.x ) * 4;
+
+        gOut_Metrics[ tileIndex ] = asuint( errorSum );
+        gOut_Metrics[ tileIndex + 1 ] = asuint( ssimSum );
+        gOut_Metrics[ tileIndex + 2 ] = uint( pixelNum );
+        gOut_Metrics[ tileIndex + 3 ] = uint( blockNum );
+    }
+}
@@ -0,0 +1,29 @@
+/*
+Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+
+NVIDIA CORPORATION and its licensors retain all intellectual property
+and proprietary rights in and to this software, related documentation
+and any modifications thereto. Any use, reproduction, disclosure or
+distribution of this software and related documentation without an express
+license agreement from NVIDIA CORPORATION is strictly prohibited.
+*/
+
+#include "Shared.hlsli"
+
+NRI_RESOURCE( Texture2D<float4>, gIn_Image, t, 0, 1 );
+
+NRI_RESOURCE( RWBuffer<uint>, gOut_Reference, u, 1, 1 );
+
+// The final image (display referred) gets stored as half4, i.e. the layout of the cache file
+[numthreads( QUALITY_TILE_SIZE, QUALITY_TILE_SIZE, 1 )]
+void main( uint2 pixelPos : SV_DispatchThreadId )
+{
+    if( any( pixelPos >= uint2( gOutputSize ) ) )
+        return;
+
+    float3 color = saturate( gIn_Image[ pixelPos ].xyz );
+    uint index = ( pixelPos.y * uint( gOutputSize.x ) + pixelPos.x ) * 2;
+
+    gOut_Reference[ index ] = f32tof16( color.x ) | ( f32tof16( color.y ) << 16 );
+    gOut_Reference[ index + 1 ] = f32tof16( color.z ) | ( f32tof16( 1.0 ) << 16 );
+}
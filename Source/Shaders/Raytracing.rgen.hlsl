@@ -0,0 +1,20 @@
+/*
+Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+
+NVIDIA CORPORATION and its licensors retain all intellectual property
+and proprietary rights in and to this software, related documentation
+and any modifications thereto. Any use, reproduction, disclosure or
+distribution of this software and related documentation without an express
+license agreement from NVIDIA CORPORATION is strictly prohibited.
+*/
+
+// Compiled only as permutations (see "add_hlsl_permutation" calls in "CMakeLists.txt"), which turn settings into compile time constants:
+//  RPP                     - 0 = 0.5 rpp (checkerboard), 1 = 1 rpp, 2 = "gSampleNum" rpp (2+)
+//  SECOND_BOUNCE_SPECULAR  - 2nd bounce is specular
+//  EMISSION                - emissive surfaces and importance sampling of emissive triangles
+//  TRANSPARENCY            - the scene has transparent objects
+//  DIRECTION_PDF           - direction / PDF outputs (0 for "--compactResources")
+//  RAY_SORTING             - 0 = off, 1 = primary rays ("RaytracingPrimary<EMISSION><TRANSPARENCY>_rgen"), 2 = secondary rays ("RaytracingSecondary<SECOND_BOUNCE_SPECULAR><EMISSION>_rgen")
+//  ENTRYPOINT              - "Raytracing<RPP><SECOND_BOUNCE_SPECULAR><EMISSION><TRANSPARENCY>_rgen" if "RAY_SORTING = 0"
+
+#include "Raytracing.hlsli"
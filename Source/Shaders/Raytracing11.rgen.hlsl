@@ -1,15 +0,0 @@
-/*
-Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
-
-NVIDIA CORPORATION and its licensors retain all intellectual property
-and proprietary rights in and to this software, related documentation
-and any modifications thereto. Any use, reproduction, disclosure or
-distribution of this software and related documentation without an express
-license agreement from NVIDIA CORPORATION is strictly prohibited.
-*/
-
-#define CHECKERBOARD 1
-#define SECOND_BOUNCE_SPECULAR 1
-#define ENTRYPOINT Raytracing11_rgen
-
-#include "Raytracing.hlsli"
@@ -0,0 +1,79 @@
+/*
+Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+
+NVIDIA CORPORATION and its licensors retain all intellectual property
+and proprietary rights in and to this software, related documentation
+and any modifications thereto. Any use, reproduction, disclosure or
+distribution of this software and related documentation without an express
+license agreement from NVIDIA CORPORATION is strictly prohibited.
+*/
+
+#include "Shared.hlsli"
+
+NRI_RESOURCE( Texture2D<float4>, gIn_Normal_Roughness, t, 0, 1 );
+NRI_RESOURCE( Texture2D<float4>, gIn_Diff, t, 1, 1 );
+NRI_RESOURCE( Texture2D<float4>, gIn_Spec, t, 2, 1 );
+NRI_RESOURCE( Texture2D<float4>, gIn_DenoisedDiff, t, 3, 1 );
+NRI_RESOURCE( Texture2D<float4>, gIn_DenoisedSpec, t, 4, 1 );
+
+NRI_RESOURCE( RWTexture2D<float>, gOut_TileNoise, u, 5, 1 );
+
+#define THREAD_NUM ( SAMPLE_BUDGET_TILE_SIZE * SAMPLE_BUDGET_TILE_SIZE )
+
+groupshared float2 s_Noise_Weight[ THREAD_NUM ];
+
+float GetLuminance( float4 data )
+{
+    [flatten]
+    if( gOcclusionOnly )
+        data = data.xxxx;
+
+    // Back-end unpacking inverts front-end packing of the noisy input too
+    data = gDenoiserType != REBLUR ? RELAX_BackEnd_UnpackRadiance( data ) : REBLUR_BackEnd_UnpackRadiance( data );
+
+    return STL::Color::Luminance( data.xyz );
+}
+
+float GetRelativeNoise( float4 noisy, float4 denoised )
+{
+    float a = GetLuminance( noisy );
+    float b = GetLuminance( denoised );
+
+    return abs( a - b ) / ( b + 1e-6 );
+}
+
+// Noise of the noisy input relative to the denoised output, averaged over a tile (sky is excluded)
+[numthreads( SAMPLE_BUDGET_TILE_SIZE, SAMPLE_BUDGET_TILE_SIZE, 1 )]
+void main( uint2 pixelPos : SV_DispatchThreadId, uint2 tilePos : SV_GroupId, uint threadIndex : SV_GroupIndex )
+{
+    float2 noise_weight = 0;
+
+    float4 normalAndRoughness = gIn_Normal_Roughness[ pixelPos ];
+    if( all( pixelPos < uint2( gRectSize ) ) && dot( normalAndRoughness.xyz, normalAndRoughness.xyz ) != SKY_MARK )
+    {
+        noise_weight.x = GetRelativeNoise( gIn_Diff[ pixelPos ], gIn_DenoisedDiff[ pixelPos ] );
+        noise_weight.x += GetRelativeNoise( gIn_Spec[ pixelPos ], gIn_DenoisedSpec[ pixelPos ] );
+        noise_weight.x = min( noise_weight.x, SAMPLE_BUDGET_NOISE_MAX );
+        noise_weight.y = 1.0;
+    }
+
+    s_Noise_Weight[ threadIndex ] = noise_weight;
+    GroupMemoryBarrierWithGroupSync( );
+
+    [unroll]
+    for( uint stride = THREAD_NUM / 2; stride > 0; stride >>= 1 )
+    {
+        if( threadIndex < stride )
+            s_Noise_Weight[ threadIndex ] += s_Noise_Weight[ threadIndex + stride ];
+
+        GroupMemoryBarrierWithGroupSync( );
+    }
+
+    if( threadIndex == 0 )
+    {
+        noise_weight = s_Noise_Weight[ 0 ];
+        float tileNoise = noise_weight.y != 0.0 ? noise_weight.x / noise_weight.y : 0.0;
+
+        gOut_TileNoise[ tilePos ] = tileNoise;
+    }
+}
@@ -0,0 +1,284 @@
+/*
+Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+
+NVIDIA CORPORATION and its licensors retain all intellectual property
+and proprietary rights in and to this software, related documentation
+and any modifications thereto. Any use, reproduction, disclosure or
+distribution of this software and related documentation without an express
+license agreement from NVIDIA CORPORATION is strictly prohibited.
+*/
+
+#include "Shared.hlsli"
+
+NRI_RESOURCE( Texture2D<float>, gIn_TileNoise, t, 0, 1 );
+
+NRI_RESOURCE( RWTexture2D<uint>, gOut_SampleNum, u, 1, 1 );
+NRI_RESOURCE( RWTexture2D<float>, gInOut_DilatedNoise, u, 2, 1 );
+NRI_RESOURCE( RWBuffer<uint>, gOut_SampleSum, u, 3, 1 );
+
+// A single group, each thread owns a contiguous range of tiles (row-major) and touches only their dilated noise after the dilation
+#define THREAD_NUM                  1024
+#define SCALE_SEARCH_ITERATIONS     16
+#define REMAINDER_SEARCH_ITERATIONS 12
+#define NOISE_MIN                   0.001 // relative to the mean, keeps the budget reachable if most tiles have no noise
+
+groupshared float s_FloatSum[ THREAD_NUM ];
+groupshared uint s_UintSum[ THREAD_NUM ];
+
+float GroupSum( float x, uint threadIndex )
+{
+    s_FloatSum[ threadIndex ] = x;
+    GroupMemoryBarrierWithGroupSync( );
+
+    [unroll]
+    for( uint stride = THREAD_NUM / 2; stride > 0; stride >>= 1 )
+    {
+        if( threadIndex < stride )
+            s_FloatSum[ threadIndex ] += s_FloatSum[ threadIndex + stride ];
+
+        GroupMemoryBarrierWithGroupSync( );
+    }
+
+    float sum = s_FloatSum[ 0 ];
+    GroupMemoryBarrierWithGroupSync( );
+
+    return sum;
+}
+
+uint GroupSum( uint x, uint threadIndex )
+{
+    s_UintSum[ threadIndex ] = x;
+    GroupMemoryBarrierWithGroupSync( );
+
+    [unroll]
+    for( uint stride = THREAD_NUM / 2; stride > 0; stride >>= 1 )
+    {
+        if( threadIndex < stride )
+            s_UintSum[ threadIndex ] += s_UintSum[ threadIndex + stride ];
+
+        GroupMemoryBarrierWithGroupSync( );
+    }
+
+    uint sum = s_UintSum[ 0 ];
+    GroupMemoryBarrierWithGroupSync( );
+
+    return sum;
+}
+
+// Exclusive
+uint GroupPrefixSum( uint x, uint threadIndex )
+{
+    s_UintSum[ threadIndex ] = x;
+    GroupMemoryBarrierWithGroupSync( );
+
+    [unroll]
+    for( uint offset = 1; offset < THREAD_NUM; offset <<= 1 )
+    {
+        uint y = threadIndex >= offset ? s_UintSum[ threadIndex - offset ] : 0;
+        GroupMemoryBarrierWithGroupSync( );
+
+        s_UintSum[ threadIndex ] += y;
+        GroupMemoryBarrierWithGroupSync( );
+    }
+
+    uint sum = s_UintSum[ threadIndex ] - x;
+    GroupMemoryBarrierWithGroupSync( );
+
+    return sum;
+}
+
+uint2 GetTilePos( uint tileIndex, uint2 tileNum )
+{
+    return uint2( tileIndex % tileNum.x, tileIndex / tileNum.x );
+}
+
+// Tiles of a thread and a candidate distribution: "clamp( noise * scale, 1, sampleNumMax )", then the part above 1 is multiplied by "rescale"
+struct Distribution
+{
+    uint2 tileNum;
+    uint tileBegin;
+    uint tileEnd;
+    float noiseMin;
+    float scale;
+    float rescale;
+    float sampleNumMax;
+};
+
+float GetSampleNum( Distribution d, uint tileIndex )
+{
+    float noise = max( gInOut_DilatedNoise[ GetTilePos( tileIndex, d.tileNum ) ], d.noiseMin );
+    float sampleNum = clamp( noise * d.scale, 1.0, d.sampleNumMax );
+
+    return 1.0 + ( sampleNum - 1.0 ) * d.rescale;
+}
+
+// Tiles at the maximum can't get more
+uint GetSampleNumFloor( Distribution d, uint tileIndex, out float fraction, out bool isIncrementable )
+{
+    float sampleNum = GetSampleNum( d, tileIndex );
+    uint sampleNumFloor = clamp( uint( sampleNum ), 1, uint( d.sampleNumMax ) );
+
+    fraction = sampleNum - float( sampleNumFloor );
+    isIncrementable = sampleNumFloor < uint( d.sampleNumMax );
+
+    return sampleNumFloor;
+}
+
+// Dilation, the map is used a frame later
+float DilateNoise( Distribution d )
+{
+    float noiseSum = 0;
+    for( uint i = d.tileBegin; i < d.tileEnd; i++ )
+    {
+        int2 tilePos = int2( GetTilePos( i, d.tileNum ) );
+        float noise = 0;
+
+        [unroll]
+        for( int dy = -1; dy <= 1; dy++ )
+        {
+            [unroll]
+            for( int dx = -1; dx <= 1; dx++ )
+            {
+                int2 p = clamp( tilePos + int2( dx, dy ), 0, int2( d.tileNum ) - 1 );
+                noise = max( noise, gIn_TileNoise[ p ] );
+            }
+        }
+
+        gInOut_DilatedNoise[ tilePos ] = noise;
+        noiseSum += noise;
+    }
+
+    return noiseSum;
+}
+
+float SumSampleNum( Distribution d )
+{
+    float sum = 0;
+    for( uint i = d.tileBegin; i < d.tileEnd; i++ )
+        sum += GetSampleNum( d, i );
+
+    return sum;
+}
+
+uint SumSampleNumFloor( Distribution d )
+{
+    uint sum = 0;
+    for( uint i = d.tileBegin; i < d.tileEnd; i++ )
+    {
+        float fraction;
+        bool isIncrementable;
+        sum += GetSampleNumFloor( d, i, fraction, isIncrementable );
+    }
+
+    return sum;
+}
+
+// Tiles which can get more and have the fractional part in [fractionMin; fractionMax)
+uint CountFractions( Distribution d, float fractionMin, float fractionMax )
+{
+    uint count = 0;
+    for( uint i = d.tileBegin; i < d.tileEnd; i++ )
+    {
+        float fraction;
+        bool isIncrementable;
+        GetSampleNumFloor( d, i, fraction, isIncrementable );
+
+        count += ( isIncrementable && fraction >= fractionMin && fraction < fractionMax ) ? 1 : 0;
+    }
+
+    return count;
+}
+
+// Distributes exactly "gSampleNum" rays per pixel on average (i.e. "gSampleNum * tileNum" in total) proportionally to dilated tile noise, used by ray tracing of the next frame
+[numthreads( THREAD_NUM, 1, 1 )]
+void main( uint threadIndex : SV_GroupIndex )
+{
+    uint2 tileNum = ( uint2( gRectSize ) + SAMPLE_BUDGET_TILE_SIZE - 1 ) / SAMPLE_BUDGET_TILE_SIZE;
+    uint tileCount = tileNum.x * tileNum.y;
+    uint chunkSize = ( tileCount + THREAD_NUM - 1 ) / THREAD_NUM;
+    uint budget = gSampleNum * tileCount;
+
+    Distribution d;
+    d.tileNum = tileNum;
+    d.tileBegin = min( threadIndex * chunkSize, tileCount );
+    d.tileEnd = min( d.tileBegin + chunkSize, tileCount );
+    d.sampleNumMax = float( min( gSampleNum * SAMPLE_BUDGET_MAX_SCALE, SAMPLE_BUDGET_SAMPLE_NUM_MAX ) );
+    d.rescale = 1.0;
+
+    // Normalization uses the mean of dilated values, not of the source map
+    float meanNoise = GroupSum( DilateNoise( d ), threadIndex ) / float( tileCount );
+    d.noiseMin = max( meanNoise * NOISE_MIN, 1e-6 );
+
+    // Clamping moves the sum away from the budget. The scale is searched for, the sum is monotonic in it: "gSampleNum / meanNoise" is the start,
+    // zero gives the minimum of 1 per tile (not above the budget), "sampleNumMax / noiseMin" gives the maximum (not below the budget)
+    float scaleLo = 0.0;
+    float scaleHi = d.sampleNumMax / d.noiseMin;
+    d.scale = float( gSampleNum ) / max( meanNoise, d.noiseMin );
+
+    for( uint iteration = 0; iteration <= SCALE_SEARCH_ITERATIONS; iteration++ )
+    {
+        if( GroupSum( SumSampleNum( d ), threadIndex ) >= float( budget ) )
+            scaleHi = d.scale;
+        else
+            scaleLo = d.scale;
+
+        d.scale = ( scaleLo + scaleHi ) * 0.5;
+    }
+
+    // Rescale: "scaleHi" is not below the budget, the part above the minimum of 1 per tile gets scaled down to hit it (bounds are preserved)
+    d.scale = scaleHi;
+
+    float sum = GroupSum( SumSampleNum( d ), threadIndex );
+    d.rescale = sum > float( tileCount ) ? float( budget - tileCount ) / ( sum - float( tileCount ) ) : 0.0;
+
+    // Integer parts, then the remainder goes to tiles with the largest fractional parts (the largest remainder method), i.e. the total is exact
+    uint floorSum = GroupSum( SumSampleNumFloor( d ), threadIndex );
+    uint remainder = budget > floorSum ? budget - floorSum : 0;
+
+    // Threshold search: at least "remainder" tiles have the fractional part ">= fractionLo", less than "remainder" have it ">= fractionHi"
+    float fractionLo = 0.0;
+    float fractionHi = 1.0;
+
+    for( uint step = 0; step < REMAINDER_SEARCH_ITERATIONS; step++ )
+    {
+        float fraction = ( fractionLo + fractionHi ) * 0.5;
+
+        if( GroupSum( CountFractions( d, fraction, 1.0 ), threadIndex ) >= remainder )
+            fractionLo = fraction;
+        else
+            fractionHi = fraction;
+    }
+
+    // Tiles ">= fractionHi" get +1 for sure, the rest of the remainder goes to tiles in [fractionLo; fractionHi) in tile order. With no remainder
+    // "fractionHi" stays 1, i.e. nothing gets incremented
+    uint sureNum = GroupSum( CountFractions( d, fractionHi, 1.0 ), threadIndex );
+    uint candidateRemainder = remainder - min( sureNum, remainder );
+    uint candidateIndex = GroupPrefixSum( CountFractions( d, fractionLo, fractionHi ), threadIndex );
+
+    uint sampleSum = 0;
+    for( uint i = d.tileBegin; i < d.tileEnd; i++ )
+    {
+        float fraction;
+        bool isIncrementable;
+        uint sampleNum = GetSampleNumFloor( d, i, fraction, isIncrementable );
+
+        if( isIncrementable )
+        {
+            if( fraction >= fractionHi )
+                sampleNum++;
+            else if( fraction >= fractionLo )
+            {
+                sampleNum += candidateIndex < candidateRemainder ? 1 : 0;
+                candidateIndex++;
+            }
+        }
+
+        gOut_SampleNum[ GetTilePos( i, tileNum ) ] = sampleNum;
+        sampleSum += sampleNum;
+    }
+
+    // Read back and checked against the budget on the CPU
+    sampleSum = GroupSum( sampleSum, threadIndex );
+    if( threadIndex == 0 )
+        gOut_SampleSum[ 0 ] = sampleSum;
+}
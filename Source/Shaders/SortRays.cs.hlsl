@@ -0,0 +1,51 @@
+/*
+Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+
+NVIDIA CORPORATION and its licensors retain all intellectual property
+and proprietary rights in and to this software, related documentation
+and any modifications thereto. Any use, reproduction, disclosure or
+distribution of this software and related documentation without an express
+license agreement from NVIDIA CORPORATION is strictly prohibited.
+*/
+
+#include "Shared.hlsli"
+
+NRI_RESOURCE( RWBuffer<uint>, gInOut_RayRecords, u, 0, 1 );
+
+groupshared uint s_BinOffsets[ RAY_SORT_GROUP_SIZE ];
+
+// Counting sort: bin sizes come from the primary rays, each group redoes the prefix sum (cheaper than a separate pass), pixels get scattered into their bins
+[numthreads( RAY_SORT_GROUP_SIZE, 1, 1 )]
+void main( uint pixelIndex : SV_DispatchThreadId, uint threadIndex : SV_GroupIndex )
+{
+    uint binSize = threadIndex < RAY_BIN_NUM ? gInOut_RayRecords[ threadIndex ] : 0;
+    s_BinOffsets[ threadIndex ] = binSize;
+    GroupMemoryBarrierWithGroupSync( );
+
+    [unroll]
+    for( uint offset = 1; offset < RAY_SORT_GROUP_SIZE; offset <<= 1 )
+    {
+        uint sum = threadIndex >= offset ? s_BinOffsets[ threadIndex - offset ] : 0;
+        GroupMemoryBarrierWithGroupSync( );
+
+        s_BinOffsets[ threadIndex ] += sum;
+        GroupMemoryBarrierWithGroupSync( );
+    }
+
+    // Inclusive to exclusive
+    uint binOffset = s_BinOffsets[ threadIndex ] - binSize;
+    GroupMemoryBarrierWithGroupSync( );
+
+    s_BinOffsets[ threadIndex ] = binOffset;
+    GroupMemoryBarrierWithGroupSync( );
+
+    if( pixelIndex >= uint( gRectSize.x ) * uint( gRectSize.y ) )
+        return;
+
+    uint key = gInOut_RayRecords[ RAY_KEYS_OFFSET + pixelIndex ];
+
+    uint slot;
+    InterlockedAdd( gInOut_RayRecords[ RAY_BIN_NUM + key ], 1, slot );
+
+    gInOut_RayRecords[ RAY_SORTED_OFFSET + s_BinOffsets[ key ] + slot ] = pixelIndex;
+}